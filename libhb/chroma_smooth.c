@@ -61,6 +61,9 @@ static int chroma_smooth_work(hb_filter_object_t *filter,
 static int chroma_smooth_work_thread(hb_filter_object_t *filter,
                                      hb_buffer_t ** buf_in,
                                      hb_buffer_t ** buf_out, int thread);
+static int chroma_smooth_work_stripe(hb_filter_object_t *filter,
+                                     hb_buffer_t *in, hb_buffer_t *out,
+                                     int plane, int y0, int y1, int thread);
 
 static void chroma_smooth_close(hb_filter_object_t *filter);
 
@@ -78,6 +81,7 @@ hb_filter_object_t hb_filter_chroma_smooth =
     .init_thread       = chroma_smooth_init_thread,
     .work              = chroma_smooth_work,
     .work_thread       = chroma_smooth_work_thread,
+    .work_stripe       = chroma_smooth_work_stripe,
     .close             = chroma_smooth_close,
     .settings_template = chroma_smooth_template,
 };
@@ -88,6 +92,8 @@ static void name##_##nbits(const uint8_t *frame_src,
                                  uint8_t *frame_dst,                                                        \
                            const int width,                                                                 \
                            const int height,                                                                \
+                           const int y0,                                                                    \
+                           const int y1,                                                                    \
                            int stride_src,                                                                  \
                            int stride_dst,                                                                  \
                            chroma_smooth_plane_context_t * ctx,                                             \
@@ -99,7 +105,7 @@ static void name##_##nbits(const uint8_t *frame_src,
              Tmp2;                                                                                          \
     const uint##nbits##_t *src  = (const uint##nbits##_t *)frame_src;                                       \
     uint##nbits##_t       *dst  = (uint##nbits##_t *)frame_dst;                                             \
-    const uint##nbits##_t *src2 = (const uint##nbits##_t *)frame_src;                                       \
+    const uint##nbits##_t *src2;                                                                            \
     int32_t res;                                                                                            \
     int x, y, z;                                                                                            \
     const int amount        = ctx->amount;                                                                  \
@@ -111,20 +117,22 @@ static void name##_##nbits(const uint8_t *frame_src,
                                                                                                             \
     if (!amount)                                                                                            \
     {                                                                                                       \
-        if (src != dst)                                                                                     \
+        if (frame_src != frame_dst)                                                                         \
         {                                                                                                   \
+            const uint8_t *srcy = frame_src + y0 * stride_src;                                              \
+            uint8_t       *dsty = frame_dst + y0 * stride_dst;                                              \
             if (stride_src == stride_dst)                                                                   \
             {                                                                                               \
-                memcpy(dst, src, stride_dst * height);                                                      \
+                memcpy(dsty, srcy, stride_dst * (y1 - y0));                                                 \
             }                                                                                               \
             else                                                                                            \
             {                                                                                               \
                 const int size = stride_src < stride_dst ? ABS(stride_src) : stride_dst;                    \
-                for (int yy = 0; yy < height; yy++)                                                         \
+                for (int yy = y0; yy < y1; yy++)                                                            \
                 {                                                                                           \
-                    memcpy(dst, src, size);                                                                 \
-                    dst += stride_dst;                                                                      \
-                    src += stride_src;                                                                      \
+                    memcpy(dsty, srcy, size);                                                               \
+                    dsty += stride_dst;                                                                     \
+                    srcy += stride_src;                                                                     \
                 }                                                                                           \
             }                                                                                               \
         }                                                                                                   \
@@ -132,20 +140,24 @@ static void name##_##nbits(const uint8_t *frame_src,
         return;                                                                                             \
     }                                                                                                       \
                                                                                                             \
-    for (y = 0; y < 2 * steps; y++)                                                                         \
+    /* Rows y0 to y1 of a plane can be filtered in several calls, the */                                    \
+    /* column sums in SC carry over from one call to the next. */                                           \
+    if (y0 == 0)                                                                                            \
     {                                                                                                       \
-        memset(SC[y], 0, sizeof(SC[y][0]) * (width + 2 * steps));                                           \
+        for (y = 0; y < 2 * steps; y++)                                                                     \
+        {                                                                                                   \
+            memset(SC[y], 0, sizeof(SC[y][0]) * (width + 2 * steps));                                       \
+        }                                                                                                   \
     }                                                                                                       \
                                                                                                             \
     stride_src /= ctx->bps;                                                                                 \
     stride_dst /= ctx->bps;                                                                                 \
                                                                                                             \
-    for (y = -steps; y < height + steps; y++)                                                               \
+    /* Output row y - steps is complete once input row y is summed, */                                      \
+    /* rows outside of the plane repeat the edge rows. */                                                   \
+    for (y = y0 == 0 ? -steps : y0 + steps; y < y1 + steps; y++)                                            \
     {                                                                                                       \
-        if (y < height)                                                                                     \
-        {                                                                                                   \
-            src2 = src;                                                                                     \
-        }                                                                                                   \
+        src2 = src + (y < 0 ? 0 : y < height ? y : height - 1) * stride_src;                                \
                                                                                                             \
         memset(SR, 0, sizeof(SR[0]) * (2 * steps));                                                         \
                                                                                                             \
@@ -167,19 +179,13 @@ static void name##_##nbits(const uint8_t *frame_src,
                                                                                                             \
             if (x >= steps && y >= steps)                                                                   \
             {                                                                                               \
-                const uint##nbits##_t *srx = src - steps * stride_src + x - steps;                          \
-                uint##nbits##_t       *dsx = dst - steps * stride_dst + x - steps;                          \
+                const uint##nbits##_t *srx = src + (y - steps) * stride_src + x - steps;                    \
+                uint##nbits##_t       *dsx = dst + (y - steps) * stride_dst + x - steps;                    \
                                                                                                             \
                 res = (int32_t)*srx - ((((int32_t)*srx -                                                    \
                       (int32_t)((Tmp1 + halfscale) >> scalebits)) * amount) >> 16);                         \
                 *dsx = res > max_value ? max_value : res < min_value ? min_value : (uint##nbits##_t)res;    \
             }                                                                                               \
-        }                                                                                                   \
-                                                                                                            \
-        if (y >= 0)                                                                                         \
-        {                                                                                                   \
-            dst += stride_dst;                                                                              \
-            src += stride_src;                                                                              \
         }                                                                                                   \
     }                                                                                                       \
 }                                                                                                           \
@@ -283,6 +289,7 @@ static int chroma_smooth_init(hb_filter_object_t *filter,
             ctx->scalebits = 0;
             ctx->halfscale = 0;
         }
+        filter->stripe_halo[c] = ctx->steps;
     }
 
     if (chroma_smooth_init_thread(filter, 1) < 0)
@@ -404,6 +411,7 @@ static int chroma_smooth_work_thread(hb_filter_object_t *filter,
                       out->plane[c].data,
                       in->plane[c].width,
                       in->plane[c].height,
+                      0, in->plane[c].height,
                       in->plane[c].stride,
                       out->plane[c].stride,
                       ctx, tctx);
@@ -415,6 +423,26 @@ static int chroma_smooth_work_thread(hb_filter_object_t *filter,
     return HB_FILTER_OK;
 }
 
+static int chroma_smooth_work_stripe(hb_filter_object_t *filter,
+                                     hb_buffer_t *in, hb_buffer_t *out,
+                                     int plane, int y0, int y1, int thread)
+{
+    hb_filter_private_t *pv = filter->private_data;
+    chroma_smooth_plane_context_t  * ctx  = &pv->plane_ctx[plane];
+    chroma_smooth_thread_context_t * tctx = &pv->thread_ctx[thread][plane];
+
+    chroma_smooth(in->plane[plane].data,
+                  out->plane[plane].data,
+                  in->plane[plane].width,
+                  in->plane[plane].height,
+                  y0, y1,
+                  in->plane[plane].stride,
+                  out->plane[plane].stride,
+                  ctx, tctx);
+
+    return HB_FILTER_OK;
+}
+
 static int chroma_smooth_work(hb_filter_object_t *filter,
                               hb_buffer_t ** buf_in,
                               hb_buffer_t ** buf_out)
@@ -30,6 +30,7 @@ Original "Faster" settings:
 
 #include "handbrake/handbrake.h"
 #include "handbrake/taskset.h"
+#include "handbrake/comb_detect.h"
 
 #if defined(__aarch64__)
 #include <arm_neon.h>
@@ -101,6 +102,8 @@ struct hb_filter_private_s
                                   int segment_start, int segment_stop);
     void (*apply_mask)(hb_filter_private_t *pv, hb_buffer_t *b);
 
+    CombDetectFunctions functions;
+
     hb_buffer_list_t   out_list;
 
     // Filter statistics
@@ -240,7 +243,13 @@ static void check_filtered_combing_mask(hb_filter_private_t *pv, int segment, in
         {
             int block_score = 0;
 
-            for (int block_y = 0; block_y < block_height; block_y++)
+            if (pv->functions.block_score != NULL)
+            {
+                block_score = pv->functions.block_score(
+                                &pv->mask_filtered->plane[0].data[y * stride + x],
+                                stride, block_width, block_height);
+            }
+            else for (int block_y = 0; block_y < block_height; block_y++)
             {
                 const int my = y + block_y;
                 const uint8_t *mask_p = &pv->mask_filtered->plane[0].data[my * stride + x];
@@ -403,7 +412,14 @@ static void check_combing_mask(hb_filter_private_t *pv, int segment, int start,
         {
             int block_score = 0;
 
-            for (int block_y = 0; block_y < block_height; block_y++)
+            if (x > 0 && pv->functions.block_score_adjacent != NULL)
+            {
+                // Only the first block touches a side
+                block_score = pv->functions.block_score_adjacent(
+                                &pv->mask->plane[0].data[y * stride + x],
+                                stride, block_width, block_height);
+            }
+            else for (int block_y = 0; block_y < block_height; block_y++)
             {
                 const int mask_y = y + block_y;
                 const uint8_t *mask_p = &pv->mask->plane[0].data[mask_y * stride + x];
@@ -599,7 +615,12 @@ static void mask_dilate_work(void *thread_args_v)
 
     for (int yy = start; yy < stop; yy++)
     {
-        for (int xx = 1; xx < width - 1; xx++)
+        int xx = 1;
+        if (pv->functions.mask_dilate_line != NULL)
+        {
+            xx = pv->functions.mask_dilate_line(dst, curp, cur, curn, width);
+        }
+        for (; xx < width - 1; xx++)
         {
             if (cur[xx])
             {
@@ -769,7 +790,12 @@ static void mask_erode_work(void *thread_args_v)
 
     for (int yy = start; yy < stop; yy++)
     {
-        for (int xx = 1; xx < width - 1; xx++)
+        int xx = 1;
+        if (pv->functions.mask_erode_line != NULL)
+        {
+            xx = pv->functions.mask_erode_line(dst, curp, cur, curn, width);
+        }
+        for (; xx < width - 1; xx++)
         {
             if (cur[xx] == 0)
             {
@@ -943,7 +969,13 @@ static void mask_filter_work(void *thread_args_v)
 
     for (int yy = start; yy < stop; yy++)
     {
-        for (int xx = 1; xx < width - 1; xx++)
+        int xx = 1;
+        if (pv->functions.mask_filter_line != NULL)
+        {
+            xx = pv->functions.mask_filter_line(dst, curp, cur, curn, width,
+                                                pv->filter_mode == FILTER_CLASSIC);
+        }
+        for (; xx < width - 1; xx++)
         {
             const int h_count = cur[xx-1] & cur[xx] & cur[xx+1];
             const int v_count = curp[xx] & cur[xx] & curn[xx];
@@ -1180,6 +1212,10 @@ static int comb_detect_init(hb_filter_object_t *filter,
     memset(pv->mask_filtered->data, 0, pv->mask_filtered->size);
     memset(pv->mask_temp->data, 0, pv->mask_temp->size);
 
+#if defined(ARCH_X86)
+    comb_detect_init_x86(&pv->functions);
+#endif
+
     // Set the functions for the current bit depth
     switch (pv->depth)
     {
@@ -0,0 +1,294 @@
+/* comb_detect_x86.c
+
+   Copyright (c) 2003-2024 HandBrake Team
+   This file is part of the HandBrake source code
+   Homepage: <http://handbrake.fr/>.
+   It may be used under the terms of the GNU General Public License v2.
+   For full terms see the file COPYING file or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+#include "handbrake/handbrake.h"     // needed for ARCH_X86
+
+#if defined(ARCH_X86)
+
+#include <immintrin.h>
+
+#include "libavutil/cpu.h"
+#include "handbrake/comb_detect.h"
+
+static inline int load_u32(const void *p)
+{
+    int32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+#define BIT_DEPTH 8
+#include "templates/comb_detect_x86_template.c"
+#undef BIT_DEPTH
+
+#define BIT_DEPTH 16
+#include "templates/comb_detect_x86_template.c"
+#undef BIT_DEPTH
+
+/***********************************************************************
+ * Mask filters, masks hold 0 or 1 (128 where a box was drawn)
+ **********************************************************************/
+__attribute__((target("sse4.1")))
+static int mask_filter_line_sse41(uint8_t *dst, const uint8_t *curp,
+                                  const uint8_t *cur, const uint8_t *curn,
+                                  int width, int classic)
+{
+    int xx;
+    for (xx = 1; xx + 17 <= width; xx += 16)
+    {
+        const __m128i c = _mm_loadu_si128((const __m128i *)&cur[xx]);
+        __m128i h = _mm_and_si128(
+                        _mm_and_si128(_mm_loadu_si128((const __m128i *)&cur[xx - 1]), c),
+                        _mm_loadu_si128((const __m128i *)&cur[xx + 1]));
+        if (!classic)
+        {
+            h = _mm_and_si128(h, _mm_and_si128(
+                        _mm_loadu_si128((const __m128i *)&curp[xx]),
+                        _mm_loadu_si128((const __m128i *)&curn[xx])));
+        }
+        _mm_storeu_si128((__m128i *)&dst[xx], h);
+    }
+    return xx;
+}
+
+// Saturated, the sums are only compared with small thresholds
+#define NEIGHBOURS_X16(curp, cur, curn, xx)                                 \
+    _mm_adds_epu8(                                                          \
+        _mm_adds_epu8(                                                      \
+            _mm_adds_epu8(_mm_loadu_si128((const __m128i *)&curp[xx - 1]),  \
+                          _mm_loadu_si128((const __m128i *)&curp[xx])),     \
+            _mm_adds_epu8(_mm_loadu_si128((const __m128i *)&curp[xx + 1]),  \
+                          _mm_loadu_si128((const __m128i *)&cur[xx - 1]))), \
+        _mm_adds_epu8(                                                      \
+            _mm_adds_epu8(_mm_loadu_si128((const __m128i *)&cur[xx + 1]),   \
+                          _mm_loadu_si128((const __m128i *)&curn[xx - 1])), \
+            _mm_adds_epu8(_mm_loadu_si128((const __m128i *)&curn[xx]),      \
+                          _mm_loadu_si128((const __m128i *)&curn[xx + 1]))))
+
+__attribute__((target("sse4.1")))
+static int mask_erode_line_sse41(uint8_t *dst, const uint8_t *curp,
+                                 const uint8_t *cur, const uint8_t *curn,
+                                 int width)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one  = _mm_set1_epi8(1);
+    const __m128i two  = _mm_set1_epi8(2);
+
+    int xx;
+    for (xx = 1; xx + 17 <= width; xx += 16)
+    {
+        const __m128i sum  = NEIGHBOURS_X16(curp, cur, curn, xx);
+        const __m128i ge   = _mm_cmpeq_epi8(_mm_max_epu8(sum, two), sum);
+        const __m128i zero_c = _mm_cmpeq_epi8(
+                        _mm_loadu_si128((const __m128i *)&cur[xx]), zero);
+
+        _mm_storeu_si128((__m128i *)&dst[xx],
+                         _mm_andnot_si128(zero_c, _mm_and_si128(ge, one)));
+    }
+    return xx;
+}
+
+__attribute__((target("sse4.1")))
+static int mask_dilate_line_sse41(uint8_t *dst, const uint8_t *curp,
+                                  const uint8_t *cur, const uint8_t *curn,
+                                  int width)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one  = _mm_set1_epi8(1);
+    const __m128i four = _mm_set1_epi8(4);
+
+    int xx;
+    for (xx = 1; xx + 17 <= width; xx += 16)
+    {
+        const __m128i sum  = NEIGHBOURS_X16(curp, cur, curn, xx);
+        const __m128i ge   = _mm_cmpeq_epi8(_mm_max_epu8(sum, four), sum);
+        const __m128i zero_c = _mm_cmpeq_epi8(
+                        _mm_loadu_si128((const __m128i *)&cur[xx]), zero);
+
+        _mm_storeu_si128((__m128i *)&dst[xx],
+                         _mm_andnot_si128(_mm_andnot_si128(ge, zero_c), one));
+    }
+    return xx;
+}
+
+__attribute__((target("avx2")))
+static int mask_filter_line_avx2(uint8_t *dst, const uint8_t *curp,
+                                 const uint8_t *cur, const uint8_t *curn,
+                                 int width, int classic)
+{
+    int xx;
+    for (xx = 1; xx + 33 <= width; xx += 32)
+    {
+        const __m256i c = _mm256_loadu_si256((const __m256i *)&cur[xx]);
+        __m256i h = _mm256_and_si256(
+                        _mm256_and_si256(_mm256_loadu_si256((const __m256i *)&cur[xx - 1]), c),
+                        _mm256_loadu_si256((const __m256i *)&cur[xx + 1]));
+        if (!classic)
+        {
+            h = _mm256_and_si256(h, _mm256_and_si256(
+                        _mm256_loadu_si256((const __m256i *)&curp[xx]),
+                        _mm256_loadu_si256((const __m256i *)&curn[xx])));
+        }
+        _mm256_storeu_si256((__m256i *)&dst[xx], h);
+    }
+    return xx;
+}
+
+#define NEIGHBOURS_X32(curp, cur, curn, xx)                                        \
+    _mm256_adds_epu8(                                                              \
+        _mm256_adds_epu8(                                                          \
+            _mm256_adds_epu8(_mm256_loadu_si256((const __m256i *)&curp[xx - 1]),   \
+                             _mm256_loadu_si256((const __m256i *)&curp[xx])),      \
+            _mm256_adds_epu8(_mm256_loadu_si256((const __m256i *)&curp[xx + 1]),   \
+                             _mm256_loadu_si256((const __m256i *)&cur[xx - 1]))),  \
+        _mm256_adds_epu8(                                                          \
+            _mm256_adds_epu8(_mm256_loadu_si256((const __m256i *)&cur[xx + 1]),    \
+                             _mm256_loadu_si256((const __m256i *)&curn[xx - 1])),  \
+            _mm256_adds_epu8(_mm256_loadu_si256((const __m256i *)&curn[xx]),       \
+                             _mm256_loadu_si256((const __m256i *)&curn[xx + 1]))))
+
+__attribute__((target("avx2")))
+static int mask_erode_line_avx2(uint8_t *dst, const uint8_t *curp,
+                                const uint8_t *cur, const uint8_t *curn,
+                                int width)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one  = _mm256_set1_epi8(1);
+    const __m256i two  = _mm256_set1_epi8(2);
+
+    int xx;
+    for (xx = 1; xx + 33 <= width; xx += 32)
+    {
+        const __m256i sum  = NEIGHBOURS_X32(curp, cur, curn, xx);
+        const __m256i ge   = _mm256_cmpeq_epi8(_mm256_max_epu8(sum, two), sum);
+        const __m256i zero_c = _mm256_cmpeq_epi8(
+                        _mm256_loadu_si256((const __m256i *)&cur[xx]), zero);
+
+        _mm256_storeu_si256((__m256i *)&dst[xx],
+                            _mm256_andnot_si256(zero_c, _mm256_and_si256(ge, one)));
+    }
+    return xx;
+}
+
+__attribute__((target("avx2")))
+static int mask_dilate_line_avx2(uint8_t *dst, const uint8_t *curp,
+                                 const uint8_t *cur, const uint8_t *curn,
+                                 int width)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one  = _mm256_set1_epi8(1);
+    const __m256i four = _mm256_set1_epi8(4);
+
+    int xx;
+    for (xx = 1; xx + 33 <= width; xx += 32)
+    {
+        const __m256i sum  = NEIGHBOURS_X32(curp, cur, curn, xx);
+        const __m256i ge   = _mm256_cmpeq_epi8(_mm256_max_epu8(sum, four), sum);
+        const __m256i zero_c = _mm256_cmpeq_epi8(
+                        _mm256_loadu_si256((const __m256i *)&cur[xx]), zero);
+
+        _mm256_storeu_si256((__m256i *)&dst[xx],
+                            _mm256_andnot_si256(_mm256_andnot_si256(ge, zero_c), one));
+    }
+    return xx;
+}
+
+/***********************************************************************
+ * Block scores, blocks are usually 16 pixels wide
+ **********************************************************************/
+__attribute__((target("sse4.1")))
+static int block_score_sse41(const uint8_t *mask, int stride,
+                             int block_width, int block_height)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i       sum  = _mm_setzero_si128();
+    int           score = 0;
+
+    for (int block_y = 0; block_y < block_height; block_y++)
+    {
+        const uint8_t *mask_p = &mask[block_y * stride];
+        int block_x = 0;
+
+        for (; block_x + 16 <= block_width; block_x += 16)
+        {
+            sum = _mm_add_epi64(sum, _mm_sad_epu8(
+                    _mm_loadu_si128((const __m128i *)&mask_p[block_x]), zero));
+        }
+        for (; block_x < block_width; block_x++)
+        {
+            score += mask_p[block_x];
+        }
+    }
+    return score + _mm_cvtsi128_si32(sum) +
+                   _mm_cvtsi128_si32(_mm_unpackhi_epi64(sum, sum));
+}
+
+__attribute__((target("sse4.1")))
+static int block_score_adjacent_sse41(const uint8_t *mask, int stride,
+                                      int block_width, int block_height)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i       sum  = _mm_setzero_si128();
+    int           score = 0;
+
+    for (int block_y = 0; block_y < block_height; block_y++)
+    {
+        const uint8_t *mask_p = &mask[block_y * stride];
+        int block_x = 0;
+
+        for (; block_x + 16 <= block_width; block_x += 16)
+        {
+            const __m128i m = _mm_and_si128(
+                _mm_and_si128(_mm_loadu_si128((const __m128i *)&mask_p[block_x - 1]),
+                              _mm_loadu_si128((const __m128i *)&mask_p[block_x])),
+                _mm_loadu_si128((const __m128i *)&mask_p[block_x + 1]));
+            sum = _mm_add_epi64(sum, _mm_sad_epu8(m, zero));
+        }
+        for (; block_x < block_width; block_x++)
+        {
+            score += mask_p[block_x - 1] & mask_p[block_x] & mask_p[block_x + 1];
+        }
+    }
+    return score + _mm_cvtsi128_si32(sum) +
+                   _mm_cvtsi128_si32(_mm_unpackhi_epi64(sum, sum));
+}
+
+void comb_detect_init_x86(CombDetectFunctions *functions)
+{
+    int flags = av_get_cpu_flags();
+
+    if (flags & AV_CPU_FLAG_AVX2)
+    {
+        functions->detect_combed_line[0]       = detect_combed_line_avx2_8;
+        functions->detect_combed_line[1]       = detect_combed_line_avx2_16;
+        functions->detect_gamma_combed_line[0] = detect_gamma_combed_line_avx2_8;
+        functions->detect_gamma_combed_line[1] = detect_gamma_combed_line_avx2_16;
+        functions->mask_filter_line            = mask_filter_line_avx2;
+        functions->mask_erode_line             = mask_erode_line_avx2;
+        functions->mask_dilate_line            = mask_dilate_line_avx2;
+        functions->block_score                 = block_score_sse41;
+        functions->block_score_adjacent        = block_score_adjacent_sse41;
+        hb_log("Comb detect using AVX2 optimizations");
+    }
+    else if (flags & AV_CPU_FLAG_SSE4)
+    {
+        functions->detect_combed_line[0]       = detect_combed_line_sse41_8;
+        functions->detect_combed_line[1]       = detect_combed_line_sse41_16;
+        functions->detect_gamma_combed_line[0] = detect_gamma_combed_line_sse41_8;
+        functions->detect_gamma_combed_line[1] = detect_gamma_combed_line_sse41_16;
+        functions->mask_filter_line            = mask_filter_line_sse41;
+        functions->mask_erode_line             = mask_erode_line_sse41;
+        functions->mask_dilate_line            = mask_dilate_line_sse41;
+        functions->block_score                 = block_score_sse41;
+        functions->block_score_adjacent        = block_score_adjacent_sse41;
+        hb_log("Comb detect using SSE4.1 optimizations");
+    }
+}
+
+#endif // ARCH_X86
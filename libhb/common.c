@@ -4818,6 +4818,10 @@ hb_filter_object_t * hb_filter_get( int filter_id )
             filter = &hb_filter_mt_frame;
             break;
 
+        case HB_FILTER_FUSED:
+            filter = &hb_filter_fused;
+            break;
+
 #if defined(__APPLE__)
         case HB_FILTER_PRE_VT:
             filter = &hb_filter_prefilter_vt;
@@ -4878,6 +4882,7 @@ hb_filter_object_t * hb_filter_init( int filter_id )
         case HB_FILTER_UNSHARP:
         case HB_FILTER_LAPSHARP:
         case HB_FILTER_CHROMA_SMOOTH:
+        case HB_FILTER_FUSED:
         {
             hb_filter_object_t * wrapper;
 
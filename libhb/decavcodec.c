@@ -1372,6 +1372,42 @@ static hb_buffer_t *copy_frame( hb_work_private_t *pv )
     return out;
 }
 
+// Planar format of the previews of a source, with the chroma subsampling
+// and the bit depth of the source
+static enum AVPixelFormat preview_pix_fmt(int pix_fmt)
+{
+    static const enum AVPixelFormat pix_fmts[4][3] =
+    {
+        // 4:2:0                4:2:2                4:4:4
+        { AV_PIX_FMT_YUV420P,   AV_PIX_FMT_YUV422P,   AV_PIX_FMT_YUV444P   },
+        { AV_PIX_FMT_YUV420P10, AV_PIX_FMT_YUV422P10, AV_PIX_FMT_YUV444P10 },
+        { AV_PIX_FMT_YUV420P12, AV_PIX_FMT_YUV422P12, AV_PIX_FMT_YUV444P12 },
+        { AV_PIX_FMT_YUV420P12, AV_PIX_FMT_YUV422P12, AV_PIX_FMT_YUV444P16 },
+    };
+    const AVPixFmtDescriptor * desc = av_pix_fmt_desc_get(pix_fmt);
+    int depth, chroma;
+
+    if (desc == NULL || (desc->flags & AV_PIX_FMT_FLAG_HWACCEL))
+    {
+        return AV_PIX_FMT_YUV420P;
+    }
+    depth = desc->comp[0].depth;
+    depth = depth <= 8 ? 0 : depth <= 10 ? 1 : depth <= 12 ? 2 : 3;
+    if (desc->log2_chroma_w == 0 && desc->log2_chroma_h == 0)
+    {
+        chroma = 2;
+    }
+    else if (desc->log2_chroma_w == 1 && desc->log2_chroma_h == 0)
+    {
+        chroma = 1;
+    }
+    else
+    {
+        chroma = 0;
+    }
+    return pix_fmts[depth][chroma];
+}
+
 int reinit_video_filters(hb_work_private_t * pv)
 {
     int                orig_width;
@@ -1384,12 +1420,12 @@ int reinit_video_filters(hb_work_private_t * pv)
 
     if (!pv->job)
     {
-        // HandBrake's preview pipeline uses yuv420 color.  This means all
-        // dimensions must be even.  So we must adjust the dimensions
-        // of incoming video if not even.
+        // HandBrake's preview pipeline uses planar yuv color with the
+        // bit depth of the source, 4:2:0 needs even dimensions.  So we
+        // must adjust the dimensions of incoming video if not even.
         orig_width = pv->context->width & ~1;
         orig_height = pv->context->height & ~1;
-        pix_fmt = AV_PIX_FMT_YUV420P;
+        pix_fmt = preview_pix_fmt(pv->frame->format);
         color_range = AVCOL_RANGE_MPEG;
     }
     else
@@ -1820,6 +1856,13 @@ static int decodeFrame( hb_work_private_t * pv, packet_info_t * packet_info )
 }
 
 
+// Scan previews in fast mode only need keyframes, at reduced quality
+static void set_fast_decode( AVCodecContext * context )
+{
+    context->skip_frame       = AVDISCARD_NONKEY;
+    context->skip_loop_filter = AVDISCARD_ALL;
+}
+
 static int decavcodecvInit( hb_work_object_t * w, hb_job_t * job )
 {
 
@@ -1891,7 +1934,7 @@ static int decavcodecvInit( hb_work_object_t * w, hb_job_t * job )
 
     if( pv->job && pv->job->title && !pv->job->title->has_resolution_change )
     {
-        pv->threads = HB_FFMPEG_THREADS_AUTO;
+        pv->threads = hb_job_avcodec_threads(pv->job);
     }
 
 #if HB_PROJECT_FEATURE_QSV
@@ -1971,6 +2014,10 @@ static int decavcodecvInit( hb_work_object_t * w, hb_job_t * job )
         }
 #endif
 
+        if (w->fast_decode)
+        {
+            set_fast_decode(pv->context);
+        }
         if ( hb_avcodec_open( pv->context, pv->codec, &av_opts, pv->threads ) )
         {
             av_dict_free( &av_opts );
@@ -2172,6 +2219,11 @@ static int decodePacket( hb_work_object_t * w )
             av_dict_set( &av_opts, "flags", "output_corrupt", 0 );
         }
 
+        if (w->fast_decode)
+        {
+            set_fast_decode(pv->context);
+        }
+
         // disable threaded decoding for scan, can cause crashes
         if ( hb_avcodec_open( pv->context, pv->codec, &av_opts, pv->threads ) )
         {
@@ -826,7 +826,7 @@ int encavcodecInit( hb_work_object_t * w, hb_job_t * job )
         free(filename);
     }
 
-    if (hb_avcodec_open(context, codec, &av_opts, HB_FFMPEG_THREADS_AUTO))
+    if (hb_avcodec_open(context, codec, &av_opts, hb_job_avcodec_threads(job)))
     {
         hb_log( "encavcodecInit: avcodec_open failed" );
         ret = 1;
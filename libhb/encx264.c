@@ -391,6 +391,13 @@ int encx264Init( hb_work_object_t * w, hb_job_t * job )
     param.i_keyint_max = 10 * param.i_keyint_min;
     param.i_log_level  = X264_LOG_INFO;
 
+    /* Jobs running concurrently split the processors,
+     * x264's automatic thread count is 1.5 per processor */
+    if (job->cpu_share > 0)
+    {
+        param.i_threads = hb_job_cpu_count(job) * 3 / 2;
+    }
+
     /* set up the VUI color model & gamma */
     param.vui.i_colorprim = hb_output_color_prim(job);
     param.vui.i_transfer  = hb_output_color_transfer(job);
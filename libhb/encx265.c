@@ -189,6 +189,17 @@ int encx265Init(hb_work_object_t *w, hb_job_t *job)
                                  0.5;
     param->keyframeMax = param->keyframeMin * 10;
 
+    /* Jobs running concurrently split the processors */
+    if (job->cpu_share > 0)
+    {
+        char pools[16];
+        snprintf(pools, sizeof(pools), "%d", hb_job_cpu_count(job));
+        if (param_parse(pv, param, "pools", pools))
+        {
+            goto fail;
+        }
+    }
+
     /*
      * Video Signal Type (color description only).
      *
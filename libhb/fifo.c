@@ -21,6 +21,8 @@
 #include "platform/macosx/vt_common.h"
 #endif
 
+#include <pthread.h>
+
 #ifndef SYS_DARWIN
 #if defined( SYS_FREEBSD ) || defined( SYS_NETBSD ) || defined( SYS_OPENBSD )
 #include <stdlib.h>
@@ -29,7 +31,6 @@
 #endif
 #endif
 
-#define FIFO_TIMEOUT 200
 //#define HB_FIFO_DEBUG 1
 // defining HB_BUFFER_DEBUG and HB_NO_BUFFER_POOL allows tracking
 // buffer memory leaks using valgrind.  The source of the leak
@@ -50,6 +51,8 @@ struct hb_fifo_s
     hb_cond_t    * cond_empty;
     int            wait_empty;
     hb_cond_t    * cond_alert_full;
+    // Set by hb_fifo_interrupt(), waits return immediately once set
+    int            interrupted;
     uint32_t       capacity;
     uint32_t       thresh;
     uint32_t       size;
@@ -57,12 +60,58 @@ struct hb_fifo_s
     hb_buffer_t  * first;
     hb_buffer_t  * last;
 
+    // Adaptive capacity, see hb_fifo_set_adaptive(). Protected by lock.
+    hb_fifo_budget_t * budget;
+    uint32_t       min_capacity;
+    uint32_t       max_capacity;
+    uint32_t       init_capacity;
+    uint32_t       init_thresh;
+    uint32_t       empty_waits;  // consumer waits since the last window
+
+    // Lock-free single producer / single consumer mode.
+    // See hb_fifo_init_spsc() for the rules that apply to these fifos.
+    int            spsc;
+    hb_buffer_t ** ring;
+    uint32_t       ring_mask;
+    // Buffers that did not fit in the ring. Protected by lock.
+    hb_buffer_t  * spill_first;
+    hb_buffer_t  * spill_last;
+    uint32_t       spill_count;
+    uint8_t        pad_producer[64];
+    // Producer owned
+    uint32_t       tail;
+    uint32_t       head_cache;
+    int64_t        bytes_in;
+    uint8_t        pad_consumer[64];
+    // Consumer owned
+    uint32_t       head;
+    uint32_t       tail_cache;
+    int64_t        bytes_out;
+    hb_buffer_t  * stash_first;
+    hb_buffer_t  * stash_last;
+    uint32_t       stash_count;
+    // Adaptive capacity statistics, consumer owned in both modes
+    uint32_t       window_gets;
+    uint32_t       window_min;
+    uint8_t        pad_end[64];
+
 #if defined(HB_FIFO_DEBUG)
     // Fifo list for debugging
     hb_fifo_t    * next;
 #endif
 };
 
+// Memory budget shared by the adaptive fifos of a job
+struct hb_fifo_budget_s
+{
+    hb_lock_t    * lock;
+    int64_t        limit;
+    hb_list_t    * fifos;
+    int64_t        peak;
+    int            grown;
+    int            shrunk;
+};
+
 #if defined(HB_FIFO_DEBUG)
 static hb_fifo_t fifo_list =
 {
@@ -83,6 +132,10 @@ static hb_fifo_t fifo_list =
  * A pool of 16 elements will avoid 94% of the malloc/free calls without wasting
  * too much memory. */
 #define BUFFER_POOL_MAX_ELEMENTS 32
+/* buffers allocated by threads bound to a NUMA node (see
+ * hb_thread_set_domain()) are recycled through pools of that node, so
+ * that a job placed on a node keeps using node local memory. */
+#define BUFFER_POOL_NODES 8
 
 struct hb_buffer_pools_s
 {
@@ -90,6 +143,8 @@ struct hb_buffer_pools_s
     hb_lock_t *lock;
 #if !defined(HB_NO_BUFFER_POOL)
     hb_fifo_t *pool[MAX_BUFFER_POOLS];
+    int        node_count;  // 0 when there is a single NUMA node
+    hb_fifo_t *node_pool[BUFFER_POOL_NODES][MAX_BUFFER_POOLS];
 #endif
 #if defined(HB_BUFFER_DEBUG)
     hb_list_t *alloc_list;
@@ -97,6 +152,46 @@ struct hb_buffer_pools_s
 } buffers;
 
 
+/* Per thread magazines
+ *
+ * Every thread keeps a small stack of free buffers for each of the smaller
+ * pool sizes in front of the shared pools.  Buffers are taken from and
+ * returned to the magazine without locking, the shared pool is only locked
+ * to refill an empty magazine or to flush a full one, and then a batch of
+ * buffers is moved at once.  Audio and subtitle buffers are small and are
+ * allocated and freed at a high rate, which makes the pool locks a point
+ * of contention when several jobs run in the same process.
+ *
+ * Magazines are flushed back to the shared pools when their thread exits
+ * and by hb_buffer_pool_free() for the calling thread.  Pool sizes for
+ * which less than MAGAZINE_MIN buffers fit in MAGAZINE_BYTES, i.e. video
+ * frames, bypass the magazines.
+ */
+#define MAGAZINE_BYTES   (512 * 1024)   // bytes cached per pool and thread
+#define MAGAZINE_MAX     16             // buffers cached per pool and thread
+#define MAGAZINE_MIN     2
+#define MAGAZINE_PUBLISH 1024           // operations between stats updates
+
+typedef struct
+{
+    hb_fifo_t   * pool;     // pool the cached buffers belong to
+    hb_buffer_t * first;
+    int           count;
+} hb_magazine_t;
+
+typedef struct
+{
+    hb_magazine_t          mag[MAX_BUFFER_POOLS];
+    // Not yet added to pool_stats
+    hb_buffer_pool_stats_t stats;
+    int                    pending;
+} hb_magazines_t;
+
+static __thread hb_magazines_t * magazines;
+static pthread_key_t             magazines_key;
+static pthread_once_t            magazines_once = PTHREAD_ONCE_INIT;
+static hb_buffer_pool_stats_t    pool_stats;
+
 #if defined(HB_BUFFER_DEBUG)
 static int hb_fifo_contains( hb_fifo_t *f, hb_buffer_t *b );
 #endif
@@ -134,6 +229,29 @@ void hb_buffer_pool_init( void )
         buffers.pool[i] = hb_fifo_init(BUFFER_POOL_MAX_ELEMENTS, 1);
         buffers.pool[i]->buffer_size = 1 << i;
     }
+
+    if (hb_get_numa_node_count() > 1)
+    {
+        int n;
+
+        buffers.node_count = MIN(hb_get_numa_node_count(), BUFFER_POOL_NODES);
+        for (n = 0; n < buffers.node_count; n++)
+        {
+            hb_fifo_t **pool = buffers.node_pool[n];
+
+            pool[BUFFER_POOL_FIRST] = hb_fifo_init(BUFFER_POOL_MAX_ELEMENTS*10, 1);
+            pool[BUFFER_POOL_FIRST]->buffer_size = 1 << 10;
+            for ( i = 1; i < BUFFER_POOL_FIRST; ++i )
+            {
+                pool[i] = pool[BUFFER_POOL_FIRST];
+            }
+            for ( i = BUFFER_POOL_FIRST + 1; i <= BUFFER_POOL_LAST; ++i )
+            {
+                pool[i] = hb_fifo_init(BUFFER_POOL_MAX_ELEMENTS, 1);
+                pool[i]->buffer_size = 1 << i;
+            }
+        }
+    }
 #endif
 }
 
@@ -222,6 +340,12 @@ void fifo_list_validate( void )
     buffer_pools_validate();
     while ( next )
     {
+        if ( next->spsc )
+        {
+            // Lock-free fifos do not keep a linked list of buffers
+            next = next->next;
+            continue;
+        }
         count = 0;
         hb_lock( next->lock );
         b = next->first;
@@ -280,10 +404,14 @@ void fifo_list_validate( void )
 #endif
 #endif
 
+static void magazines_flush( void );
+
 void hb_buffer_pool_free( void )
 {
     int i;
-    int64_t freed = 0;
+    int64_t freed = 0, allocated;
+
+    magazines_flush();
 
     hb_lock(buffers.lock);
 
@@ -299,24 +427,29 @@ void hb_buffer_pool_free( void )
 
 #if !defined(HB_NO_BUFFER_POOL)
     hb_buffer_t * b;
-    int           count;
-    for( i = BUFFER_POOL_FIRST; i <= BUFFER_POOL_LAST; ++i)
+    int           count, n;
+    for (n = -1; n < buffers.node_count; n++)
     {
-        count = 0;
-        while( ( b = hb_fifo_get(buffers.pool[i]) ) )
+        hb_fifo_t **pool = n < 0 ? buffers.pool : buffers.node_pool[n];
+
+        for( i = BUFFER_POOL_FIRST; i <= BUFFER_POOL_LAST; ++i)
         {
-            if( b->data )
+            count = 0;
+            while( ( b = hb_fifo_get(pool[i]) ) )
             {
-                freed += b->alloc;
-                av_free(b->data);
+                if( b->data )
+                {
+                    freed += b->alloc;
+                    av_free(b->data);
+                }
+                free( b );
+                count++;
+            }
+            if ( count )
+            {
+                hb_deep_log( 2, "Freed %d buffers of size %d", count,
+                        pool[i]->buffer_size);
             }
-            free( b );
-            count++;
-        }
-        if ( count )
-        {
-            hb_deep_log( 2, "Freed %d buffers of size %d", count,
-                    buffers.pool[i]->buffer_size);
         }
     }
 #endif
@@ -332,18 +465,20 @@ void hb_buffer_pool_free( void )
     }
 #endif
 
+    allocated = __atomic_exchange_n(&buffers.allocated, 0, __ATOMIC_RELAXED);
     hb_deep_log( 2, "Allocated %"PRId64" bytes of buffers on this pass and Freed %"PRId64" bytes, "
-           "%"PRId64" bytes leaked", buffers.allocated, freed, buffers.allocated - freed);
-    buffers.allocated = 0;
+           "%"PRId64" bytes leaked", allocated, freed, allocated - freed);
     hb_unlock(buffers.lock);
 }
 
-static hb_fifo_t *size_to_pool( int size )
+// Returns the index of the pool that serves 'size', or -1 if
+// allocations of that size do not use a pool
+static int size_to_class( int size )
 {
 #if !defined(HB_NO_BUFFER_POOL)
     if (size == 0)
     {
-        return buffers.pool[0];
+        return 0;
     }
 
     int i;
@@ -351,11 +486,397 @@ static hb_fifo_t *size_to_pool( int size )
     {
         if ( size <= (1 << i) )
         {
-            return buffers.pool[i];
+            return i;
         }
     }
 #endif
+    return -1;
+}
+
+static hb_fifo_t *class_to_pool( int cls, int node )
+{
+#if !defined(HB_NO_BUFFER_POOL)
+    if (cls < 0)
+    {
+        return NULL;
+    }
+    if (cls > 0 && node >= 0 && node < buffers.node_count)
+    {
+        return buffers.node_pool[node][cls];
+    }
+    return buffers.pool[cls];
+#else
     return NULL;
+#endif
+}
+
+static hb_fifo_t *size_to_pool( int size, int node )
+{
+    return class_to_pool(size_to_class(size), node);
+}
+
+// Frees a buffer that is not going back to a pool
+static void buffer_free( hb_buffer_t * b )
+{
+    if (b->data && b->storage_type == STANDARD)
+    {
+        av_free(b->data);
+        __atomic_sub_fetch(&buffers.allocated, b->alloc, __ATOMIC_RELAXED);
+    }
+    free( b );
+}
+
+// Takes up to 'count' buffers from a pool with a single lock acquisition
+static hb_buffer_t * pool_get_batch( hb_fifo_t * f, int count, int * got )
+{
+    hb_buffer_t * first, * last = NULL;
+    int           n;
+
+    hb_lock( f->lock );
+    first = f->first;
+    for (n = 0; n < count && n < f->size; n++)
+    {
+        last = last == NULL ? first : last->next;
+    }
+    if (n > 0)
+    {
+        f->first   = last->next;
+        last->next = NULL;
+        f->size   -= n;
+    }
+    else
+    {
+        first = NULL;
+    }
+    hb_unlock( f->lock );
+
+    *got = n;
+    return first;
+}
+
+// Prepends up to 'count' buffers of the list to a pool with a single
+// lock acquisition.  Returns the buffers that did not fit.
+static hb_buffer_t * pool_put_batch( hb_fifo_t * f, hb_buffer_t * first,
+                                     int count )
+{
+    hb_buffer_t * last = NULL, * rest;
+    int           n;
+
+    hb_lock( f->lock );
+    for (n = 0; n < count && f->size + n < f->capacity; n++)
+    {
+        last = last == NULL ? first : last->next;
+    }
+    if (n > 0)
+    {
+        rest       = last->next;
+        last->next = f->size > 0 ? f->first : NULL;
+        if (f->size == 0)
+        {
+            f->last = last;
+        }
+        f->first = first;
+        f->size += n;
+    }
+    else
+    {
+        rest = first;
+    }
+    hb_unlock( f->lock );
+
+    return rest;
+}
+
+static int magazine_capacity( int cls )
+{
+    int capacity;
+
+    if (cls == 0)
+    {
+        return MAGAZINE_MAX;
+    }
+    capacity = MIN(MAGAZINE_BYTES >> cls, MAGAZINE_MAX);
+
+    return capacity >= MAGAZINE_MIN ? capacity : 0;
+}
+
+static void magazines_publish( hb_magazines_t * m )
+{
+    __atomic_add_fetch(&pool_stats.allocs, m->stats.allocs, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&pool_stats.alloc_hits, m->stats.alloc_hits,
+                       __ATOMIC_RELAXED);
+    __atomic_add_fetch(&pool_stats.frees, m->stats.frees, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&pool_stats.free_hits, m->stats.free_hits,
+                       __ATOMIC_RELAXED);
+    __atomic_add_fetch(&pool_stats.lock_count, m->stats.lock_count,
+                       __ATOMIC_RELAXED);
+    memset(&m->stats, 0, sizeof(m->stats));
+    m->pending = 0;
+}
+
+static void magazines_account( hb_magazines_t * m )
+{
+    if (++m->pending >= MAGAZINE_PUBLISH)
+    {
+        magazines_publish(m);
+    }
+}
+
+// Returns all but the 'keep' most recently freed buffers of a magazine
+// to its pool.  Buffers that do not fit in the pool are freed.
+static void magazine_flush( hb_magazines_t * m, hb_magazine_t * mag, int keep )
+{
+    hb_buffer_t * b, * rest;
+    int           n;
+
+    if (mag->count <= keep)
+    {
+        return;
+    }
+    if (keep == 0)
+    {
+        rest       = mag->first;
+        mag->first = NULL;
+    }
+    else
+    {
+        for (b = mag->first, n = 1; n < keep; n++)
+        {
+            b = b->next;
+        }
+        rest    = b->next;
+        b->next = NULL;
+    }
+    rest = pool_put_batch(mag->pool, rest, mag->count - keep);
+    mag->count = keep;
+    m->stats.lock_count++;
+
+    while (rest != NULL)
+    {
+        b       = rest;
+        rest    = b->next;
+        b->next = NULL;
+        buffer_free(b);
+    }
+}
+
+static void magazines_destroy( void * data )
+{
+    hb_magazines_t * m = data;
+    int              i;
+
+    for (i = 0; i < MAX_BUFFER_POOLS; i++)
+    {
+        magazine_flush(m, &m->mag[i], 0);
+    }
+    magazines_publish(m);
+    if (magazines == m)
+    {
+        magazines = NULL;
+    }
+    free(m);
+}
+
+static void magazines_key_init( void )
+{
+    pthread_key_create(&magazines_key, magazines_destroy);
+}
+
+static hb_magazines_t * magazines_get( void )
+{
+    if (magazines == NULL)
+    {
+        pthread_once(&magazines_once, magazines_key_init);
+        magazines = calloc(1, sizeof(hb_magazines_t));
+        if (magazines != NULL)
+        {
+            pthread_setspecific(magazines_key, magazines);
+        }
+    }
+    return magazines;
+}
+
+// Empties the magazines of the calling thread
+static void magazines_flush( void )
+{
+    hb_magazines_t * m = magazines;
+    int              i;
+
+    if (m == NULL)
+    {
+        return;
+    }
+    for (i = 0; i < MAX_BUFFER_POOLS; i++)
+    {
+        magazine_flush(m, &m->mag[i], 0);
+    }
+    magazines_publish(m);
+}
+
+#if defined(HB_BUFFER_DEBUG)
+static int magazine_contains( hb_buffer_t * b )
+{
+    hb_magazines_t * m = magazines;
+    hb_buffer_t    * tmp;
+    int              i;
+
+    for (i = 0; m != NULL && i < MAX_BUFFER_POOLS; i++)
+    {
+        for (tmp = m->mag[i].first; tmp != NULL; tmp = tmp->next)
+        {
+            if (tmp == b)
+            {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+#endif
+
+// Takes a free buffer of pool 'cls', NULL if there is none
+static hb_buffer_t * pool_get( int cls, hb_fifo_t * pool )
+{
+    hb_magazines_t * m = magazines_get();
+    hb_magazine_t  * mag;
+    hb_buffer_t    * b;
+    int              capacity = magazine_capacity(cls);
+
+    if (m == NULL)
+    {
+        return hb_fifo_get(pool);
+    }
+    m->stats.allocs++;
+    if (capacity == 0)
+    {
+        m->stats.lock_count++;
+        b = hb_fifo_get(pool);
+        magazines_account(m);
+        return b;
+    }
+
+    mag = &m->mag[cls];
+    if (mag->pool != pool)
+    {
+        // The thread moved to another NUMA node
+        if (mag->pool != NULL)
+        {
+            magazine_flush(m, mag, 0);
+        }
+        mag->pool = pool;
+    }
+    if (mag->count > 0)
+    {
+        m->stats.alloc_hits++;
+    }
+    else
+    {
+        mag->first = pool_get_batch(pool, (capacity + 1) / 2, &mag->count);
+        m->stats.lock_count++;
+    }
+
+    b = mag->first;
+    if (b != NULL)
+    {
+        mag->first = b->next;
+        b->next    = NULL;
+        mag->count--;
+    }
+    magazines_account(m);
+    return b;
+}
+
+// Returns a buffer to pool 'cls'.  Returns 0 if the pool is full
+// and the buffer must be freed by the caller.
+static int pool_put( int cls, hb_fifo_t * pool, hb_buffer_t * b )
+{
+    hb_magazines_t * m = magazines_get();
+    hb_magazine_t  * mag;
+    int              capacity = magazine_capacity(cls);
+
+    if (m != NULL)
+    {
+        m->stats.frees++;
+        magazines_account(m);
+    }
+    if (m == NULL || capacity == 0)
+    {
+        if (m != NULL)
+        {
+            m->stats.lock_count += 2;
+        }
+        if (hb_fifo_is_full(pool))
+        {
+            return 0;
+        }
+        hb_fifo_push_head(pool, b);
+        return 1;
+    }
+
+    mag = &m->mag[cls];
+    if (mag->pool != pool)
+    {
+        if (mag->pool != NULL)
+        {
+            magazine_flush(m, mag, 0);
+        }
+        mag->pool = pool;
+    }
+    if (mag->count >= capacity)
+    {
+        magazine_flush(m, mag, capacity / 2);
+    }
+    else
+    {
+        m->stats.free_hits++;
+    }
+    b->next    = mag->first;
+    mag->first = b;
+    mag->count++;
+
+    return 1;
+}
+
+void hb_buffer_pool_get_stats( hb_buffer_pool_stats_t * stats )
+{
+    if (magazines != NULL)
+    {
+        magazines_publish(magazines);
+    }
+    stats->allocs     = __atomic_load_n(&pool_stats.allocs, __ATOMIC_RELAXED);
+    stats->alloc_hits = __atomic_load_n(&pool_stats.alloc_hits,
+                                        __ATOMIC_RELAXED);
+    stats->frees      = __atomic_load_n(&pool_stats.frees, __ATOMIC_RELAXED);
+    stats->free_hits  = __atomic_load_n(&pool_stats.free_hits,
+                                        __ATOMIC_RELAXED);
+    stats->lock_count = __atomic_load_n(&pool_stats.lock_count,
+                                        __ATOMIC_RELAXED);
+}
+
+void hb_buffer_pool_log_stats( const char * prefix,
+                               const hb_buffer_pool_stats_t * since )
+{
+    hb_buffer_pool_stats_t stats;
+
+    hb_buffer_pool_get_stats(&stats);
+    if (since != NULL)
+    {
+        stats.allocs     -= since->allocs;
+        stats.alloc_hits -= since->alloc_hits;
+        stats.frees      -= since->frees;
+        stats.free_hits  -= since->free_hits;
+        stats.lock_count -= since->lock_count;
+    }
+    if (stats.allocs == 0 && stats.frees == 0)
+    {
+        return;
+    }
+    hb_log("%s: buffer pools %"PRIu64" allocations (%.1f%% thread cached), "
+           "%"PRIu64" frees (%.1f%% thread cached), %"PRIu64" lock "
+           "acquisitions", prefix,
+           stats.allocs, stats.allocs ? 100. * stats.alloc_hits / stats.allocs : 0.,
+           stats.frees, stats.frees ? 100. * stats.free_hits / stats.frees : 0.,
+           stats.lock_count);
 }
 
 hb_buffer_t * hb_buffer_init_internal( int size )
@@ -367,11 +888,13 @@ hb_buffer_t * hb_buffer_init_internal( int size )
     // sometimes we feed data to these libraries starting from arbitrary
     // points within the buffer.
     int alloc = size ? size + AV_INPUT_BUFFER_PADDING_SIZE : 0;
-    hb_fifo_t *buffer_pool = size_to_pool( alloc );
+    int node = hb_thread_get_node();
+    int cls = size_to_class( alloc );
+    hb_fifo_t *buffer_pool = class_to_pool( cls, node );
 
     if( buffer_pool )
     {
-        b = hb_fifo_get( buffer_pool );
+        b = pool_get( cls, buffer_pool );
 
         if( b )
         {
@@ -383,6 +906,7 @@ hb_buffer_t * hb_buffer_init_internal( int size )
 
             memset( b, 0, sizeof(hb_buffer_t) );
             b->alloc          = buffer_pool->buffer_size;
+            b->node           = node;
             b->size           = size;
             if (size)
             {
@@ -414,6 +938,7 @@ hb_buffer_t * hb_buffer_init_internal( int size )
 
     b->size  = size;
     b->alloc  = buffer_pool ? buffer_pool->buffer_size : alloc;
+    b->node  = node;
 
     if (size)
     {
@@ -427,9 +952,7 @@ hb_buffer_t * hb_buffer_init_internal( int size )
 #if defined(HB_BUFFER_DEBUG)
         memset(b->data, 0, b->size);
 #endif
-        hb_lock(buffers.lock);
-        buffers.allocated += b->alloc;
-        hb_unlock(buffers.lock);
+        __atomic_add_fetch(&buffers.allocated, b->alloc, __ATOMIC_RELAXED);
     }
     b->s.start        = AV_NOPTS_VALUE;
     b->s.stop         = AV_NOPTS_VALUE;
@@ -465,8 +988,10 @@ void hb_buffer_realloc( hb_buffer_t * b, int size )
     if ( size > b->alloc || b->data == NULL )
     {
         uint8_t   * tmp;
-        uint32_t    orig = b->data != NULL ? b->alloc : 0;
-        hb_fifo_t * buffer_pool = size_to_pool(size);
+        uint32_t    orig = b->data != NULL && b->frame_class == NULL ?
+                           b->alloc : 0;
+        int         node = hb_thread_get_node();
+        hb_fifo_t * buffer_pool = size_to_pool(size, node);
 
         if (buffer_pool != NULL)
         {
@@ -480,14 +1005,20 @@ void hb_buffer_realloc( hb_buffer_t * b, int size )
         if (b->data != NULL)
         {
             memcpy(tmp, b->data, b->alloc);
-            av_free(b->data);
+            if (b->frame_class != NULL)
+            {
+                hb_frame_pool_put(b);
+            }
+            else
+            {
+                av_free(b->data);
+            }
         }
         b->data  = tmp;
         b->alloc = size;
+        b->node  = node;
 
-        hb_lock(buffers.lock);
-        buffers.allocated += size - orig;
-        hb_unlock(buffers.lock);
+        __atomic_add_fetch(&buffers.allocated, size - orig, __ATOMIC_RELAXED);
     }
 }
 
@@ -830,7 +1361,11 @@ hb_buffer_t * hb_frame_buffer_init( int pix_fmt, int width, int height )
         }
     }
 
-    buf = hb_buffer_init_internal(size);
+    buf = hb_frame_pool_get(pix_fmt, width, height, size);
+    if (buf == NULL)
+    {
+        buf = hb_buffer_init_internal(size);
+    }
 
     if( buf == NULL )
         return NULL;
@@ -900,26 +1435,35 @@ static void name##_##nbits(uint8_t *data, int width, int height, int stride) \
 DEF_MIRROR_STRIDE_FUNC(mirror_stride, 16)
 DEF_MIRROR_STRIDE_FUNC(mirror_stride, 8)
 
-void hb_frame_buffer_mirror_stride(hb_buffer_t * buf)
+// Mirror the stride padding of rows y0 to y1 of one plane
+void hb_frame_buffer_mirror_stride_rows(hb_buffer_t * buf, int pp,
+                                        int y0, int y1)
 {
     const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(buf->f.fmt);
     int   depth = desc->comp[0].depth > 8 ? 2 : 1;
+    uint8_t * data = buf->plane[pp].data + y0 * buf->plane[pp].stride;
+
+    switch (depth)
+    {
+        case 8:
+            mirror_stride_8(data, buf->plane[pp].width,
+                            y1 - y0, buf->plane[pp].stride);
+            break;
+        default:
+            mirror_stride_16(data, buf->plane[pp].width,
+                             y1 - y0, buf->plane[pp].stride);
+            break;
+    }
+}
 
+void hb_frame_buffer_mirror_stride(hb_buffer_t * buf)
+{
     for (int pp = 0; pp <= buf->f.max_plane; pp++)
     {
         if (buf->plane[pp].data != NULL)
         {
-            switch (depth)
-            {
-                case 8:
-                    mirror_stride_8(buf->plane[pp].data, buf->plane[pp].width,
-                                    buf->plane[pp].height, buf->plane[pp].stride);
-                    break;
-                default:
-                    mirror_stride_16(buf->plane[pp].data, buf->plane[pp].width,
-                                     buf->plane[pp].height, buf->plane[pp].stride);
-                    break;
-            }
+            hb_frame_buffer_mirror_stride_rows(buf, pp, 0,
+                                               buf->plane[pp].height);
         }
     }
 }
@@ -954,7 +1498,10 @@ void hb_video_buffer_realloc( hb_buffer_t * buf, int width, int height )
         }
     }
 
-    hb_buffer_realloc(buf, size );
+    if (!hb_frame_pool_realloc(buf, width, height, size))
+    {
+        hb_buffer_realloc(buf, size);
+    }
 
     buf->f.width = width;
     buf->f.height = height;
@@ -964,19 +1511,23 @@ void hb_video_buffer_realloc( hb_buffer_t * buf, int width, int height )
 }
 
 // this routine 'moves' data from src to dst by interchanging 'data',
-// 'size' & 'alloc' between them and copying the rest of the fields
-// from src to dst.
+// 'size', 'alloc', 'node' & 'frame_class' between them and copying the
+// rest of the fields from src to dst.
 void hb_buffer_swap_copy( hb_buffer_t *src, hb_buffer_t *dst )
 {
-    uint8_t *data  = dst->data;
-    int      size  = dst->size;
-    int      alloc = dst->alloc;
+    uint8_t          *data        = dst->data;
+    int               size        = dst->size;
+    int               alloc       = dst->alloc;
+    int               node        = dst->node;
+    hb_frame_class_t *frame_class = dst->frame_class;
 
     *dst = *src;
 
-    src->data  = data;
-    src->size  = size;
-    src->alloc = alloc;
+    src->data        = data;
+    src->size        = size;
+    src->alloc       = alloc;
+    src->node        = node;
+    src->frame_class = frame_class;
 }
 
 #if HB_PROJECT_FEATURE_QSV
@@ -1044,7 +1595,6 @@ void hb_buffer_close( hb_buffer_t ** _b )
     while( b )
     {
         hb_buffer_t * next = b->next;
-        hb_fifo_t *buffer_pool = size_to_pool( b->alloc );
 
         b->next = NULL;
 
@@ -1059,29 +1609,34 @@ void hb_buffer_close( hb_buffer_t ** _b )
 #endif
         free_buffer_resources(b);
 
-        if (buffer_pool && !hb_fifo_is_full(buffer_pool))
+        // Frame pool data goes back to its class, and the
+        // buffer itself to the pool of empty buffers
+        if (b->frame_class != NULL)
+        {
+            hb_frame_pool_put(b);
+        }
+
+        int cls = size_to_class( b->alloc );
+        hb_fifo_t *buffer_pool = class_to_pool( cls, b->node );
+
+        if (buffer_pool)
         {
 #if defined(HB_BUFFER_DEBUG)
-            if (hb_fifo_contains(buffer_pool, b))
+            if (hb_fifo_contains(buffer_pool, b) || magazine_contains(b))
             {
                 hb_error("hb_buffer_close: buffer %p already freed", b);
                 assert(0);
             }
 #endif
-            hb_fifo_push_head( buffer_pool, b );
-            b = next;
-            continue;
+            if (pool_put(cls, buffer_pool, b))
+            {
+                b = next;
+                continue;
+            }
         }
         // either the pool is full or this size doesn't use a pool
         // free the buf
-        if (b->data && b->storage_type == STANDARD)
-        {
-            av_free(b->data);
-            hb_lock(buffers.lock);
-            buffers.allocated -= b->alloc;
-            hb_unlock(buffers.lock);
-        }
-        free( b );
+        buffer_free(b);
         b = next;
     }
 
@@ -1215,6 +1770,612 @@ hb_fifo_t * hb_fifo_init( int capacity, int thresh )
     return f;
 }
 
+/*
+ * Lock-free single producer / single consumer fifo.
+ *
+ * Pipeline links that have exactly one thread pushing and exactly one
+ * thread pulling (e.g. between two consecutive filters) do not need the
+ * fifo lock on the fast path.  Buffers are stored in a power of 2 ring
+ * of pointers, the producer owns 'tail' and the consumer owns 'head'.
+ *
+ * Rules:
+ *   - push, push_wait and full_wait may only be called by the producer.
+ *   - get, get_wait, see, see_wait, see2, push_head and flush may only be
+ *     called by the consumer.
+ *   - size, size_bytes, is_full and percent_full may be called by anyone.
+ *
+ * Like the locked fifo, capacity is a soft limit enforced by full_wait.
+ * The ring is sized with enough slack for the buffer chains that filters
+ * and encoders emit.  If a chain still doesn't fit, the excess goes to a
+ * lock protected spill list that the consumer collects once the ring is
+ * empty, so push never blocks and ordering is preserved.
+ *
+ * The lock and condition variables are only used to sleep and wake up.
+ */
+#define FIFO_SPSC_MIN_RING 32
+
+hb_fifo_t * hb_fifo_init_spsc( int capacity, int thresh )
+{
+    hb_fifo_t * f = hb_fifo_init( capacity, thresh );
+    uint32_t    ring_size = FIFO_SPSC_MIN_RING;
+
+    while ( ring_size < (uint32_t)capacity * 4 )
+    {
+        ring_size <<= 1;
+    }
+    f->ring = calloc( ring_size, sizeof( hb_buffer_t * ) );
+    if ( f->ring == NULL )
+    {
+        // Fall back to a regular locked fifo
+        return f;
+    }
+    f->ring_mask = ring_size - 1;
+    f->spsc      = 1;
+
+    return f;
+}
+
+// The capacity of adaptive fifos changes at run time, readers that
+// don't hold the lock must load it atomically
+static inline uint32_t fifo_capacity( hb_fifo_t * f )
+{
+    return __atomic_load_n( &f->capacity, __ATOMIC_RELAXED );
+}
+
+static inline uint32_t fifo_thresh( hb_fifo_t * f )
+{
+    return __atomic_load_n( &f->thresh, __ATOMIC_RELAXED );
+}
+
+static void fifo_adapt_full( hb_fifo_t * f );
+static void fifo_adapt_get( hb_fifo_t * f, uint32_t size );
+
+static inline uint32_t spsc_size( hb_fifo_t * f )
+{
+    // Load head before tail so that tail - head can never underflow
+    uint32_t head = __atomic_load_n( &f->head, __ATOMIC_ACQUIRE );
+    uint32_t tail = __atomic_load_n( &f->tail, __ATOMIC_ACQUIRE );
+
+    return tail - head +
+           __atomic_load_n( &f->spill_count, __ATOMIC_ACQUIRE ) +
+           __atomic_load_n( &f->stash_count, __ATOMIC_RELAXED );
+}
+
+static int spsc_size_bytes( hb_fifo_t * f )
+{
+    int64_t out = __atomic_load_n( &f->bytes_out, __ATOMIC_ACQUIRE );
+    int64_t in  = __atomic_load_n( &f->bytes_in,  __ATOMIC_ACQUIRE );
+
+    return in > out ? in - out : 0;
+}
+
+// Wake up the consumer if it is sleeping in get_wait or see_wait.
+static void spsc_wake_consumer( hb_fifo_t * f )
+{
+    // Pairs with the fence in spsc_wait_empty. Either the consumer sees
+    // the new tail, or we see its wait_empty flag.
+    __atomic_thread_fence( __ATOMIC_SEQ_CST );
+    if ( __atomic_load_n( &f->wait_empty, __ATOMIC_RELAXED ) )
+    {
+        hb_lock( f->lock );
+        if ( f->wait_empty )
+        {
+            f->wait_empty = 0;
+            hb_cond_broadcast( f->cond_empty );
+        }
+        hb_unlock( f->lock );
+    }
+}
+
+// Wake up the producer if it is sleeping in full_wait or push_wait.
+static void spsc_wake_producer( hb_fifo_t * f )
+{
+    __atomic_thread_fence( __ATOMIC_SEQ_CST );
+    if ( __atomic_load_n( &f->wait_full, __ATOMIC_RELAXED ) &&
+         spsc_size( f ) <= fifo_capacity( f ) - fifo_thresh( f ) )
+    {
+        hb_lock( f->lock );
+        if ( f->wait_full )
+        {
+            f->wait_full = 0;
+            hb_cond_broadcast( f->cond_full );
+        }
+        hb_unlock( f->lock );
+    }
+}
+
+static void spsc_wait_empty( hb_fifo_t * f )
+{
+    hb_lock( f->lock );
+    f->empty_waits++;
+    while ( !f->interrupted )
+    {
+        __atomic_store_n( &f->wait_empty, 1, __ATOMIC_SEQ_CST );
+        __atomic_thread_fence( __ATOMIC_SEQ_CST );
+        if ( spsc_size( f ) >= 1 )
+        {
+            break;
+        }
+        hb_cond_wait( f->cond_empty, f->lock );
+    }
+    f->wait_empty = 0;
+    hb_unlock( f->lock );
+}
+
+static void spsc_wait_full( hb_fifo_t * f, int alert )
+{
+    hb_lock( f->lock );
+    while ( !f->interrupted )
+    {
+        __atomic_store_n( &f->wait_full, 1, __ATOMIC_SEQ_CST );
+        __atomic_thread_fence( __ATOMIC_SEQ_CST );
+        if ( spsc_size( f ) < fifo_capacity( f ) )
+        {
+            break;
+        }
+        if ( alert && f->cond_alert_full != NULL )
+        {
+            hb_cond_broadcast( f->cond_alert_full );
+        }
+        hb_cond_wait( f->cond_full, f->lock );
+    }
+    f->wait_full = 0;
+    hb_unlock( f->lock );
+}
+
+// Producer side, store one buffer in the ring. Returns 0 if the ring is full.
+static inline int spsc_ring_put( hb_fifo_t * f, hb_buffer_t * b )
+{
+    uint32_t tail = f->tail;
+
+    if ( tail - f->head_cache > f->ring_mask )
+    {
+        f->head_cache = __atomic_load_n( &f->head, __ATOMIC_ACQUIRE );
+        if ( tail - f->head_cache > f->ring_mask )
+        {
+            return 0;
+        }
+    }
+    f->ring[tail & f->ring_mask] = b;
+    __atomic_store_n( &f->tail, tail + 1, __ATOMIC_RELEASE );
+
+    return 1;
+}
+
+static void spsc_spill( hb_fifo_t * f, hb_buffer_t * b )
+{
+    hb_lock( f->lock );
+    // The consumer may have collected the spill list since we last
+    // looked. In that case the ring was empty at that point and new
+    // buffers can go back to the ring without reordering.
+    if ( f->spill_count == 0 && spsc_ring_put( f, b ) )
+    {
+        hb_unlock( f->lock );
+        return;
+    }
+    if ( f->spill_first == NULL )
+    {
+        f->spill_first = b;
+    }
+    else
+    {
+        f->spill_last->next = b;
+    }
+    f->spill_last = b;
+    __atomic_store_n( &f->spill_count, f->spill_count + 1, __ATOMIC_RELEASE );
+    hb_unlock( f->lock );
+}
+
+static void spsc_push( hb_fifo_t * f, hb_buffer_t * b )
+{
+    if ( f->cond_alert_full != NULL && spsc_size( f ) >= fifo_capacity( f ) )
+    {
+        hb_cond_broadcast( f->cond_alert_full );
+    }
+    while ( b )
+    {
+        hb_buffer_t * next = b->next;
+
+        b->next = NULL;
+        // Account bytes before publishing so that size_bytes never
+        // goes negative
+        __atomic_store_n( &f->bytes_in, f->bytes_in + b->size,
+                          __ATOMIC_RELEASE );
+        if ( __atomic_load_n( &f->spill_count, __ATOMIC_ACQUIRE ) != 0 ||
+             !spsc_ring_put( f, b ) )
+        {
+            spsc_spill( f, b );
+        }
+        b = next;
+    }
+    spsc_wake_consumer( f );
+}
+
+// Consumer side, move the spill list to the stash. Only valid when
+// the ring is empty.
+static void spsc_collect_spill( hb_fifo_t * f )
+{
+    hb_lock( f->lock );
+    if ( f->spill_first != NULL )
+    {
+        if ( f->stash_first == NULL )
+        {
+            f->stash_first = f->spill_first;
+        }
+        else
+        {
+            f->stash_last->next = f->spill_first;
+        }
+        f->stash_last = f->spill_last;
+        __atomic_store_n( &f->stash_count, f->stash_count + f->spill_count,
+                          __ATOMIC_RELAXED );
+        f->spill_first = f->spill_last = NULL;
+        __atomic_store_n( &f->spill_count, 0, __ATOMIC_RELEASE );
+    }
+    hb_unlock( f->lock );
+}
+
+// Consumer side, number of buffers available in the ring
+static inline uint32_t spsc_ring_avail( hb_fifo_t * f )
+{
+    uint32_t avail = f->tail_cache - f->head;
+
+    if ( avail == 0 )
+    {
+        f->tail_cache = __atomic_load_n( &f->tail, __ATOMIC_ACQUIRE );
+        avail = f->tail_cache - f->head;
+    }
+    return avail;
+}
+
+// Consumer side, return the buffer at position 'index' without removing it
+static hb_buffer_t * spsc_peek( hb_fifo_t * f, uint32_t index )
+{
+    hb_buffer_t * b = f->stash_first;
+    uint32_t      avail;
+
+    while ( b != NULL )
+    {
+        if ( index == 0 )
+        {
+            return b;
+        }
+        index--;
+        b = b->next;
+    }
+
+    avail = spsc_ring_avail( f );
+    if ( index >= avail )
+    {
+        // Re-read tail in case the producer has just published more
+        f->tail_cache = __atomic_load_n( &f->tail, __ATOMIC_ACQUIRE );
+        avail = f->tail_cache - f->head;
+    }
+    if ( index < avail )
+    {
+        return f->ring[(f->head + index) & f->ring_mask];
+    }
+    index -= avail;
+
+    if ( __atomic_load_n( &f->spill_count, __ATOMIC_ACQUIRE ) == 0 )
+    {
+        return NULL;
+    }
+    if ( avail == 0 )
+    {
+        spsc_collect_spill( f );
+        return spsc_peek( f, index );
+    }
+
+    // Buffers in the spill list come after everything in the ring
+    hb_lock( f->lock );
+    b = f->spill_first;
+    while ( b != NULL && index > 0 )
+    {
+        index--;
+        b = b->next;
+    }
+    hb_unlock( f->lock );
+
+    return b;
+}
+
+static hb_buffer_t * spsc_get( hb_fifo_t * f )
+{
+    hb_buffer_t * b = NULL;
+
+    if ( f->stash_first == NULL && spsc_ring_avail( f ) == 0 &&
+         __atomic_load_n( &f->spill_count, __ATOMIC_ACQUIRE ) != 0 )
+    {
+        spsc_collect_spill( f );
+    }
+
+    if ( f->stash_first != NULL )
+    {
+        b = f->stash_first;
+        f->stash_first = b->next;
+        if ( f->stash_first == NULL )
+        {
+            f->stash_last = NULL;
+        }
+        b->next = NULL;
+        __atomic_store_n( &f->stash_count, f->stash_count - 1,
+                          __ATOMIC_RELAXED );
+    }
+    else if ( spsc_ring_avail( f ) > 0 )
+    {
+        b = f->ring[f->head & f->ring_mask];
+        __atomic_store_n( &f->head, f->head + 1, __ATOMIC_RELEASE );
+    }
+
+    if ( b != NULL )
+    {
+        __atomic_store_n( &f->bytes_out, f->bytes_out + b->size,
+                          __ATOMIC_RELEASE );
+        spsc_wake_producer( f );
+        if ( f->budget != NULL )
+        {
+            fifo_adapt_get( f, spsc_size( f ) );
+        }
+    }
+
+    return b;
+}
+
+// Consumer side, return a chain of buffers to the head of the fifo
+static void spsc_push_head( hb_fifo_t * f, hb_buffer_t * b )
+{
+    hb_buffer_t * tmp = b;
+    uint32_t      count = 1;
+    int64_t       bytes = b->size;
+
+    while ( tmp->next )
+    {
+        tmp = tmp->next;
+        bytes += tmp->size;
+        count++;
+    }
+    tmp->next = f->stash_first;
+    if ( f->stash_first == NULL )
+    {
+        f->stash_last = tmp;
+    }
+    f->stash_first = b;
+    __atomic_store_n( &f->stash_count, f->stash_count + count,
+                      __ATOMIC_RELAXED );
+    __atomic_store_n( &f->bytes_out, f->bytes_out - bytes,
+                      __ATOMIC_RELEASE );
+}
+
+/*
+ * Adaptive fifo capacity.
+ *
+ * The default fifo depths are a poor fit for both very large frames
+ * (too much memory) and small ones (too little slack to absorb encoder
+ * jitter).  Fifos attached to a hb_fifo_budget_t resize themselves
+ * between min_capacity and max_capacity:
+ *
+ *   - When the producer finds the fifo full although the consumer had
+ *     to wait for input during the current window, both sides run at
+ *     the same average rate but in bursts, and a deeper fifo lets them
+ *     overlap.  The fifo grows by half if the buffers it would hold,
+ *     estimated from the average size of the queued buffers, fit in
+ *     what is left of the budget.
+ *   - When the consumer goes through a window without ever waiting and
+ *     the lower half of the fifo was never used, the producer is faster
+ *     and the extra depth only holds memory.  The fifo shrinks by a
+ *     quarter.  It also shrinks when the budget is exceeded.
+ *
+ * A window is the larger of FIFO_ADAPT_WINDOW_MIN and 4 * capacity
+ * buffers taken out of the fifo.  Memory use is measured with
+ * hb_fifo_size_bytes() over every fifo of the budget.
+ */
+#define FIFO_ADAPT_WINDOW_MIN 16
+
+hb_fifo_budget_t * hb_fifo_budget_init( int64_t limit )
+{
+    hb_fifo_budget_t * b = calloc( sizeof( hb_fifo_budget_t ), 1 );
+
+    if ( b == NULL )
+    {
+        return NULL;
+    }
+    b->lock  = hb_lock_init();
+    b->fifos = hb_list_init();
+    b->limit = limit;
+
+    return b;
+}
+
+void hb_fifo_budget_close( hb_fifo_budget_t ** _b )
+{
+    hb_fifo_budget_t * b = *_b;
+    hb_fifo_t        * f;
+
+    if ( b == NULL )
+    {
+        return;
+    }
+    // Fifos detach themselves when closed, but don't leave dangling
+    // pointers behind if the budget goes first
+    while ( ( f = hb_list_item( b->fifos, 0 ) ) != NULL )
+    {
+        hb_list_rem( b->fifos, f );
+        hb_lock( f->lock );
+        f->budget = NULL;
+        hb_unlock( f->lock );
+    }
+    hb_list_close( &b->fifos );
+    hb_lock_close( &b->lock );
+    free( b );
+    *_b = NULL;
+}
+
+int64_t hb_fifo_budget_used( hb_fifo_budget_t * b )
+{
+    int64_t used = 0;
+    int     ii;
+
+    hb_lock( b->lock );
+    for ( ii = 0; ii < hb_list_count( b->fifos ); ii++ )
+    {
+        used += hb_fifo_size_bytes( hb_list_item( b->fifos, ii ) );
+    }
+    if ( used > b->peak )
+    {
+        b->peak = used;
+    }
+    hb_unlock( b->lock );
+
+    return used;
+}
+
+void hb_fifo_budget_log( hb_fifo_budget_t * b, const char * prefix )
+{
+    if ( b == NULL )
+    {
+        return;
+    }
+    hb_fifo_budget_used( b );
+    hb_log( "%s: fifo memory budget %.1f MiB, peak use %.1f MiB, "
+            "fifos grown %d time(s), shrunk %d time(s)", prefix,
+            b->limit / 1048576., b->peak / 1048576.,
+            __atomic_load_n( &b->grown, __ATOMIC_RELAXED ),
+            __atomic_load_n( &b->shrunk, __ATOMIC_RELAXED ) );
+}
+
+// Must be called with the fifo lock held
+static void fifo_resize( hb_fifo_t * f, uint32_t capacity )
+{
+    // Keep the producer wake up point at the same fraction of
+    // the capacity
+    uint32_t thresh = (uint64_t)f->init_thresh * capacity / f->init_capacity;
+
+    thresh = MAX( 1, MIN( thresh, capacity ) );
+    __atomic_store_n( &f->thresh, thresh, __ATOMIC_RELAXED );
+    __atomic_store_n( &f->capacity, capacity, __ATOMIC_RELAXED );
+    if ( f->wait_full && f->size < capacity )
+    {
+        f->wait_full = 0;
+        hb_cond_broadcast( f->cond_full );
+    }
+}
+
+void hb_fifo_set_adaptive( hb_fifo_t * f, hb_fifo_budget_t * b,
+                           int capacity, int min_capacity, int max_capacity )
+{
+    if ( b == NULL )
+    {
+        return;
+    }
+    hb_lock( b->lock );
+    hb_list_add( b->fifos, f );
+    hb_unlock( b->lock );
+
+    hb_lock( f->lock );
+    f->budget        = b;
+    f->init_capacity = f->capacity;
+    f->init_thresh   = f->thresh;
+    f->min_capacity  = MAX( 1, min_capacity );
+    f->max_capacity  = MAX( f->min_capacity, max_capacity );
+    f->window_min    = UINT32_MAX;
+    fifo_resize( f, MAX( f->min_capacity, MIN( capacity, f->max_capacity ) ) );
+    hb_unlock( f->lock );
+}
+
+// Producer side, called without the fifo lock when the fifo is full
+static void fifo_adapt_full( hb_fifo_t * f )
+{
+    hb_fifo_budget_t * b = f->budget;
+    uint32_t           capacity, starved, grow;
+
+    hb_lock( f->lock );
+    capacity = f->capacity;
+    starved  = f->empty_waits;
+    hb_unlock( f->lock );
+
+    // A consumer that never waits is the bottleneck, a deeper fifo
+    // would only hold more buffers
+    if ( starved == 0 || capacity >= f->max_capacity )
+    {
+        return;
+    }
+    grow = MIN( MAX( capacity / 2, 1 ), f->max_capacity - capacity );
+
+    if ( b->limit > 0 )
+    {
+        int     count = hb_fifo_size( f );
+        int64_t need  = count > 0 ?
+                        (int64_t)hb_fifo_size_bytes( f ) / count * grow : 0;
+
+        if ( hb_fifo_budget_used( b ) + need > b->limit )
+        {
+            return;
+        }
+    }
+
+    hb_lock( f->lock );
+    if ( f->capacity == capacity )
+    {
+        fifo_resize( f, capacity + grow );
+        f->empty_waits = 0;
+        __atomic_add_fetch( &b->grown, 1, __ATOMIC_RELAXED );
+        hb_deep_log( 3, "fifo %p: grown to %u", (void*)f, capacity + grow );
+    }
+    hb_unlock( f->lock );
+}
+
+// Consumer side, called without the fifo lock after a buffer was taken
+// out.  'size' is the number of buffers left in the fifo.
+static void fifo_adapt_get( hb_fifo_t * f, uint32_t size )
+{
+    hb_fifo_budget_t * b = f->budget;
+    uint32_t           capacity, starved, low, shrink;
+    int64_t            used;
+    int                over;
+
+    if ( size < f->window_min )
+    {
+        f->window_min = size;
+    }
+    capacity = fifo_capacity( f );
+    if ( ++f->window_gets < MAX( FIFO_ADAPT_WINDOW_MIN, 4 * capacity ) )
+    {
+        return;
+    }
+    low = f->window_min;
+    f->window_gets = 0;
+    f->window_min  = UINT32_MAX;
+
+    hb_lock( f->lock );
+    starved = f->empty_waits;
+    f->empty_waits = 0;
+    hb_unlock( f->lock );
+
+    // Sample the use of the budget once per window, this also
+    // records the peak reported by hb_fifo_budget_log()
+    used = hb_fifo_budget_used( b );
+    if ( capacity <= f->min_capacity )
+    {
+        return;
+    }
+    over = b->limit > 0 && used > b->limit;
+    if ( !over && ( starved > 0 || low < capacity / 2 ) )
+    {
+        return;
+    }
+    shrink = MIN( MAX( capacity / 4, 1 ), capacity - f->min_capacity );
+
+    hb_lock( f->lock );
+    if ( f->capacity == capacity )
+    {
+        fifo_resize( f, capacity - shrink );
+        __atomic_add_fetch( &b->shrunk, 1, __ATOMIC_RELAXED );
+        hb_deep_log( 3, "fifo %p: shrunk to %u", (void*)f, capacity - shrink );
+    }
+    hb_unlock( f->lock );
+}
+
 void hb_fifo_register_full_cond( hb_fifo_t * f, hb_cond_t * c )
 {
     f->cond_alert_full = c;
@@ -1225,6 +2386,11 @@ int hb_fifo_size_bytes( hb_fifo_t * f )
     int ret = 0;
     hb_buffer_t * link;
 
+    if ( f->spsc )
+    {
+        return spsc_size_bytes( f );
+    }
+
     hb_lock( f->lock );
     link = f->first;
     while ( link )
@@ -1237,10 +2403,20 @@ int hb_fifo_size_bytes( hb_fifo_t * f )
     return ret;
 }
 
+int hb_fifo_capacity( hb_fifo_t * f )
+{
+    return fifo_capacity( f );
+}
+
 int hb_fifo_size( hb_fifo_t * f )
 {
     int ret;
 
+    if ( f->spsc )
+    {
+        return spsc_size( f );
+    }
+
     hb_lock( f->lock );
     ret = f->size;
     hb_unlock( f->lock );
@@ -1252,6 +2428,11 @@ int hb_fifo_is_full( hb_fifo_t * f )
 {
     int ret;
 
+    if ( f->spsc )
+    {
+        return spsc_size( f ) >= fifo_capacity( f );
+    }
+
     hb_lock( f->lock );
     ret = ( f->size >= f->capacity );
     hb_unlock( f->lock );
@@ -1263,6 +2444,12 @@ float hb_fifo_percent_full( hb_fifo_t * f )
 {
     float ret;
 
+    if ( f->spsc )
+    {
+        ret = spsc_size( f ) / fifo_capacity( f );
+        return ret;
+    }
+
     hb_lock( f->lock );
     ret = f->size / f->capacity;
     hb_unlock( f->lock );
@@ -1275,29 +2462,51 @@ float hb_fifo_percent_full( hb_fifo_t * f )
 hb_buffer_t * hb_fifo_get_wait( hb_fifo_t * f )
 {
     hb_buffer_t * b;
+    uint32_t      size;
+
+    if ( f->spsc )
+    {
+        b = spsc_get( f );
+        if ( b == NULL )
+        {
+            spsc_wait_empty( f );
+            b = spsc_get( f );
+        }
+        return b;
+    }
 
     hb_lock( f->lock );
     if( f->size < 1 )
+    {
+        f->empty_waits++;
+    }
+    while( f->size < 1 && !f->interrupted )
     {
         f->wait_empty = 1;
-        hb_cond_timedwait( f->cond_empty, f->lock, FIFO_TIMEOUT );
-        if( f->size < 1 )
-        {
-            hb_unlock( f->lock );
-            return NULL;
-        }
+        hb_cond_wait( f->cond_empty, f->lock );
+    }
+    if( f->size < 1 )
+    {
+        hb_unlock( f->lock );
+        return NULL;
     }
     b         = f->first;
     f->first  = b->next;
     b->next   = NULL;
     f->size  -= 1;
-    if( f->wait_full && f->size == f->capacity - f->thresh )
+    size      = f->size;
+    if( f->wait_full && f->size <= f->capacity - f->thresh )
     {
         f->wait_full = 0;
-        hb_cond_signal( f->cond_full );
+        hb_cond_broadcast( f->cond_full );
     }
     hb_unlock( f->lock );
 
+    if ( f->budget != NULL )
+    {
+        fifo_adapt_get( f, size );
+    }
+
     return b;
 }
 
@@ -1305,6 +2514,12 @@ hb_buffer_t * hb_fifo_get_wait( hb_fifo_t * f )
 hb_buffer_t * hb_fifo_get( hb_fifo_t * f )
 {
     hb_buffer_t * b;
+    uint32_t      size;
+
+    if ( f->spsc )
+    {
+        return spsc_get( f );
+    }
 
     hb_lock( f->lock );
     if( f->size < 1 )
@@ -1316,13 +2531,19 @@ hb_buffer_t * hb_fifo_get( hb_fifo_t * f )
     f->first  = b->next;
     b->next   = NULL;
     f->size  -= 1;
-    if( f->wait_full && f->size == f->capacity - f->thresh )
+    size      = f->size;
+    if( f->wait_full && f->size <= f->capacity - f->thresh )
     {
         f->wait_full = 0;
-        hb_cond_signal( f->cond_full );
+        hb_cond_broadcast( f->cond_full );
     }
     hb_unlock( f->lock );
 
+    if ( f->budget != NULL )
+    {
+        fifo_adapt_get( f, size );
+    }
+
     return b;
 }
 
@@ -1330,16 +2551,31 @@ hb_buffer_t * hb_fifo_see_wait( hb_fifo_t * f )
 {
     hb_buffer_t * b;
 
+    if ( f->spsc )
+    {
+        b = spsc_peek( f, 0 );
+        if ( b == NULL )
+        {
+            spsc_wait_empty( f );
+            b = spsc_peek( f, 0 );
+        }
+        return b;
+    }
+
     hb_lock( f->lock );
     if( f->size < 1 )
+    {
+        f->empty_waits++;
+    }
+    while( f->size < 1 && !f->interrupted )
     {
         f->wait_empty = 1;
-        hb_cond_timedwait( f->cond_empty, f->lock, FIFO_TIMEOUT );
-        if( f->size < 1 )
-        {
-            hb_unlock( f->lock );
-            return NULL;
-        }
+        hb_cond_wait( f->cond_empty, f->lock );
+    }
+    if( f->size < 1 )
+    {
+        hb_unlock( f->lock );
+        return NULL;
     }
     b = f->first;
     hb_unlock( f->lock );
@@ -1353,6 +2589,11 @@ hb_buffer_t * hb_fifo_see( hb_fifo_t * f )
 {
     hb_buffer_t * b;
 
+    if ( f->spsc )
+    {
+        return spsc_peek( f, 0 );
+    }
+
     hb_lock( f->lock );
     if( f->size < 1 )
     {
@@ -1369,6 +2610,11 @@ hb_buffer_t * hb_fifo_see2( hb_fifo_t * f )
 {
     hb_buffer_t * b;
 
+    if ( f->spsc )
+    {
+        return spsc_peek( f, 1 );
+    }
+
     hb_lock( f->lock );
     if( f->size < 2 )
     {
@@ -1381,17 +2627,35 @@ hb_buffer_t * hb_fifo_see2( hb_fifo_t * f )
     return b;
 }
 
-// Waits until the specified FIFO is no longer full or until FIFO_TIMEOUT milliseconds have elapsed.
+// Waits until the specified FIFO is no longer full or until the FIFO is
+// interrupted (see hb_fifo_interrupt).
 // Returns whether the FIFO is non-full upon return.
 int hb_fifo_full_wait( hb_fifo_t * f )
 {
     int result;
 
+    if ( f->spsc )
+    {
+        if ( spsc_size( f ) >= fifo_capacity( f ) )
+        {
+            if ( f->budget != NULL )
+            {
+                fifo_adapt_full( f );
+            }
+            spsc_wait_full( f, 0 );
+        }
+        return spsc_size( f ) < fifo_capacity( f );
+    }
+
+    if ( f->budget != NULL && hb_fifo_is_full( f ) )
+    {
+        fifo_adapt_full( f );
+    }
     hb_lock( f->lock );
-    if( f->size >= f->capacity )
+    while( f->size >= f->capacity && !f->interrupted )
     {
         f->wait_full = 1;
-        hb_cond_timedwait( f->cond_full, f->lock, FIFO_TIMEOUT );
+        hb_cond_wait( f->cond_full, f->lock );
     }
     result = ( f->size < f->capacity );
     hb_unlock( f->lock );
@@ -1407,13 +2671,31 @@ void hb_fifo_push_wait( hb_fifo_t * f, hb_buffer_t * b )
         return;
     }
 
+    if ( f->spsc )
+    {
+        if ( spsc_size( f ) >= fifo_capacity( f ) )
+        {
+            if ( f->budget != NULL )
+            {
+                fifo_adapt_full( f );
+            }
+            spsc_wait_full( f, 1 );
+        }
+        spsc_push( f, b );
+        return;
+    }
+
+    if ( f->budget != NULL && hb_fifo_is_full( f ) )
+    {
+        fifo_adapt_full( f );
+    }
     hb_lock( f->lock );
-    if( f->size >= f->capacity )
+    while( f->size >= f->capacity && !f->interrupted )
     {
         f->wait_full = 1;
         if (f->cond_alert_full != NULL)
             hb_cond_broadcast( f->cond_alert_full );
-        hb_cond_timedwait( f->cond_full, f->lock, FIFO_TIMEOUT );
+        hb_cond_wait( f->cond_full, f->lock );
     }
     if( f->size > 0 )
     {
@@ -1433,7 +2715,7 @@ void hb_fifo_push_wait( hb_fifo_t * f, hb_buffer_t * b )
     if( f->wait_empty && f->size >= 1 )
     {
         f->wait_empty = 0;
-        hb_cond_signal( f->cond_empty );
+        hb_cond_broadcast( f->cond_empty );
     }
     hb_unlock( f->lock );
 }
@@ -1446,6 +2728,12 @@ void hb_fifo_push( hb_fifo_t * f, hb_buffer_t * b )
         return;
     }
 
+    if ( f->spsc )
+    {
+        spsc_push( f, b );
+        return;
+    }
+
     hb_lock( f->lock );
     if (f->size >= f->capacity &&
         f->cond_alert_full != NULL)
@@ -1470,7 +2758,7 @@ void hb_fifo_push( hb_fifo_t * f, hb_buffer_t * b )
     if( f->wait_empty && f->size >= 1 )
     {
         f->wait_empty = 0;
-        hb_cond_signal( f->cond_empty );
+        hb_cond_broadcast( f->cond_empty );
     }
     hb_unlock( f->lock );
 }
@@ -1486,6 +2774,12 @@ void hb_fifo_push_head( hb_fifo_t * f, hb_buffer_t * b )
         return;
     }
 
+    if ( f->spsc )
+    {
+        spsc_push_head( f, b );
+        return;
+    }
+
     hb_lock( f->lock );
     if (f->size >= f->capacity &&
         f->cond_alert_full != NULL)
@@ -1526,6 +2820,14 @@ void hb_fifo_close( hb_fifo_t ** _f )
     if ( f == NULL )
         return;
 
+    if ( f->budget != NULL )
+    {
+        hb_lock( f->budget->lock );
+        hb_list_rem( f->budget->fifos, f );
+        hb_unlock( f->budget->lock );
+        f->budget = NULL;
+    }
+
     hb_deep_log( 2, "fifo_close: trashing %d buffer(s)", hb_fifo_size( f ) );
     while( ( b = hb_fifo_get( f ) ) )
     {
@@ -1535,6 +2837,7 @@ void hb_fifo_close( hb_fifo_t ** _f )
     hb_lock_close( &f->lock );
     hb_cond_close( &f->cond_empty );
     hb_cond_close( &f->cond_full );
+    free( f->ring );
 
 #if defined(HB_FIFO_DEBUG)
     // Remove the fifo from the global fifo list
@@ -1555,12 +2858,31 @@ void hb_fifo_flush( hb_fifo_t * f )
         hb_buffer_close( &b );
     }
     hb_lock( f->lock );
-    hb_cond_signal( f->cond_empty );
-    hb_cond_signal( f->cond_full );
+    hb_cond_broadcast( f->cond_empty );
+    hb_cond_broadcast( f->cond_full );
     hb_unlock( f->lock );
 
 }
 
+// Wakes up every thread waiting on this fifo and makes all subsequent
+// waits return immediately.  Used to release pipeline threads when a job
+// is done or stopped, since waits do not time out.
+void hb_fifo_interrupt( hb_fifo_t * f )
+{
+    if ( f == NULL )
+    {
+        return;
+    }
+
+    hb_lock( f->lock );
+    f->interrupted = 1;
+    f->wait_empty  = 0;
+    f->wait_full   = 0;
+    hb_cond_broadcast( f->cond_empty );
+    hb_cond_broadcast( f->cond_full );
+    hb_unlock( f->lock );
+}
+
 #if defined(HB_BUFFER_DEBUG)
 static int hb_fifo_contains( hb_fifo_t *f, hb_buffer_t *b )
 {
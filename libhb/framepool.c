@@ -0,0 +1,506 @@
+/* framepool.c
+
+   Copyright (c) 2003-2024 HandBrake Team
+   This file is part of the HandBrake source code
+   Homepage: <http://handbrake.fr/>.
+   It may be used under the terms of the GNU General Public License v2.
+   For full terms see the file COPYING file or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/* Frame buffer pool
+ *
+ * The power of two buffer pools of fifo.c waste up to half of the memory
+ * of a video frame, and frames larger than the largest pool go through
+ * malloc and free on every frame.  Uncompressed frames are instead
+ * recycled through classes keyed by pixel format, dimensions, stride
+ * alignment and NUMA node, every frame of a class having the same size.
+ *
+ * Frame data is 64 byte aligned, and since plane strides are multiples
+ * of HB_IMAGE_STRIDE_ALIGN so is every plane.  On Linux, frames of a huge
+ * page or more are mapped on a huge page boundary, with explicit huge
+ * pages when a job asks for them and some are reserved, transparent huge
+ * pages otherwise.
+ *
+ * The pool is active while at least one job holds it, see
+ * hb_frame_pool_acquire().  Jobs hold it across all of their passes, so
+ * that the frames of a pass are reused by the next one.  Idle frames are
+ * kept up to the sum of the limits of the running jobs, frames of the
+ * least recently used classes are freed first.
+ */
+
+#include "libavcodec/avcodec.h"
+
+#include "handbrake/handbrake.h"
+
+#if defined(SYS_LINUX)
+#include <sys/mman.h>
+#endif
+#if defined(SYS_MINGW)
+#include <malloc.h>
+#endif
+
+#define FRAME_POOL_ALIGN        64
+#define FRAME_POOL_HUGE_PAGE    (2 << 20)
+#define FRAME_POOL_PAGE         4096
+#define FRAME_POOL_DEFAULT      (256 << 20)
+#define FRAME_POOL_CLASSES      32
+
+struct hb_frame_class_s
+{
+    int        pix_fmt;
+    int        width;
+    int        height;
+    int        align;
+    int        node;
+
+    int        alloc;       // bytes of every frame of the class
+    size_t     map_size;    // mapped bytes per frame, 0 if not mapped
+    int        hugetlb;     // mapped with explicit huge pages
+
+    uint8_t ** idle;        // idle frames, most recently used last
+    int        idle_count;
+    int        idle_size;
+    int        outstanding; // frames attached to buffers
+    uint64_t   last_use;
+};
+
+static struct
+{
+    hb_lock_t        * lock;
+    int                users;
+    int64_t            limit;
+    int64_t            idle_bytes;
+    int                hugetlb_users;
+    int                hugetlb_failed;
+    uint64_t           clock;
+
+    hb_frame_class_t * classes[FRAME_POOL_CLASSES];
+    int                class_count;
+
+    uint64_t           hits;
+    uint64_t           allocs;
+    uint64_t           evictions;
+} frame_pool;
+
+void hb_frame_pool_init( void )
+{
+    if (frame_pool.lock == NULL)
+    {
+        frame_pool.lock = hb_lock_init();
+    }
+}
+
+static uint8_t * frame_alloc( hb_frame_class_t * class )
+{
+    void * data = NULL;
+
+#if defined(SYS_LINUX)
+    if (class->map_size > 0)
+    {
+        uint8_t   * map;
+        size_t      len, head, tail;
+        uintptr_t   start;
+
+        if (class->hugetlb)
+        {
+            data = mmap(NULL, class->map_size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            return data != MAP_FAILED ? data : NULL;
+        }
+
+        // Map one huge page more than needed and trim the mapping so
+        // that it starts on a huge page boundary
+        len = class->map_size + FRAME_POOL_HUGE_PAGE;
+        map = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (map == MAP_FAILED)
+        {
+            return NULL;
+        }
+        start = ((uintptr_t)map + FRAME_POOL_HUGE_PAGE - 1) &
+                ~(uintptr_t)(FRAME_POOL_HUGE_PAGE - 1);
+        head  = start - (uintptr_t)map;
+        tail  = len - head - class->map_size;
+        if (head > 0)
+        {
+            munmap(map, head);
+        }
+        if (tail > 0)
+        {
+            munmap((uint8_t *)start + class->map_size, tail);
+        }
+        madvise((void *)start, class->map_size, MADV_HUGEPAGE);
+
+        return (uint8_t *)start;
+    }
+#endif
+
+#if defined(SYS_MINGW)
+    data = _aligned_malloc(class->alloc, FRAME_POOL_ALIGN);
+#else
+    if (posix_memalign(&data, FRAME_POOL_ALIGN, class->alloc) != 0)
+    {
+        data = NULL;
+    }
+#endif
+    return data;
+}
+
+static void frame_free( hb_frame_class_t * class, uint8_t * data )
+{
+#if defined(SYS_LINUX)
+    if (class->map_size > 0)
+    {
+        munmap(data, class->map_size);
+        return;
+    }
+#endif
+#if defined(SYS_MINGW)
+    _aligned_free(data);
+#else
+    free(data);
+#endif
+}
+
+// Frees the least recently used idle frame.  Called with the lock held.
+// Returns 0 if there is no idle frame.
+static int frame_pool_evict( void )
+{
+    hb_frame_class_t * lru = NULL;
+    int                ii;
+
+    for (ii = 0; ii < frame_pool.class_count; ii++)
+    {
+        hb_frame_class_t * class = frame_pool.classes[ii];
+
+        if (class->idle_count > 0 &&
+            (lru == NULL || class->last_use < lru->last_use))
+        {
+            lru = class;
+        }
+    }
+    if (lru == NULL)
+    {
+        return 0;
+    }
+
+    // The bottom of the idle stack is the coldest frame
+    frame_free(lru, lru->idle[0]);
+    lru->idle_count--;
+    memmove(lru->idle, lru->idle + 1, lru->idle_count * sizeof(uint8_t *));
+    frame_pool.idle_bytes -= lru->alloc;
+    frame_pool.evictions++;
+
+    return 1;
+}
+
+// Removes classes that have no frames left.  Called with the lock held.
+static void frame_pool_compact( void )
+{
+    int ii = 0;
+
+    while (ii < frame_pool.class_count)
+    {
+        hb_frame_class_t * class = frame_pool.classes[ii];
+
+        if (class->idle_count == 0 && class->outstanding == 0)
+        {
+            free(class->idle);
+            free(class);
+            frame_pool.classes[ii] =
+                frame_pool.classes[--frame_pool.class_count];
+            continue;
+        }
+        ii++;
+    }
+}
+
+static hb_frame_class_t * frame_class_get( int pix_fmt, int width,
+                                           int height, int size )
+{
+    hb_frame_class_t * class;
+    int                node = hb_thread_get_node();
+    int                ii;
+
+    for (ii = 0; ii < frame_pool.class_count; ii++)
+    {
+        class = frame_pool.classes[ii];
+        if (class->pix_fmt == pix_fmt && class->width == width &&
+            class->height == height && class->node == node &&
+            class->align == HB_IMAGE_STRIDE_ALIGN)
+        {
+            return class;
+        }
+    }
+
+    if (frame_pool.class_count >= FRAME_POOL_CLASSES)
+    {
+        frame_pool_compact();
+    }
+    while (frame_pool.class_count >= FRAME_POOL_CLASSES &&
+           frame_pool_evict())
+    {
+        frame_pool_compact();
+    }
+    if (frame_pool.class_count >= FRAME_POOL_CLASSES)
+    {
+        return NULL;
+    }
+
+    class = calloc(1, sizeof(hb_frame_class_t));
+    if (class == NULL)
+    {
+        return NULL;
+    }
+    class->pix_fmt = pix_fmt;
+    class->width   = width;
+    class->height  = height;
+    class->align   = HB_IMAGE_STRIDE_ALIGN;
+    class->node    = node;
+    // Some libraries read past the end of the data, see
+    // hb_buffer_init_internal()
+    class->alloc   = size + AV_INPUT_BUFFER_PADDING_SIZE;
+#if defined(SYS_LINUX)
+    if (class->alloc >= FRAME_POOL_HUGE_PAGE)
+    {
+        if (frame_pool.hugetlb_users > 0 && !frame_pool.hugetlb_failed)
+        {
+            class->hugetlb  = 1;
+            class->map_size = MULTIPLE_MOD_UP((size_t)class->alloc,
+                                              FRAME_POOL_HUGE_PAGE);
+        }
+        else
+        {
+            class->map_size = MULTIPLE_MOD_UP((size_t)class->alloc,
+                                              FRAME_POOL_PAGE);
+        }
+    }
+#endif
+    frame_pool.classes[frame_pool.class_count++] = class;
+
+    return class;
+}
+
+// Takes frame data for the given geometry, NULL if the pool is not active
+static uint8_t * frame_pool_take( int pix_fmt, int width, int height,
+                                  int size, hb_frame_class_t ** out )
+{
+    hb_frame_class_t * class;
+    uint8_t          * data = NULL;
+
+    if (!__atomic_load_n(&frame_pool.users, __ATOMIC_RELAXED))
+    {
+        return NULL;
+    }
+
+    hb_lock(frame_pool.lock);
+    if (frame_pool.users == 0 || frame_pool.limit <= 0 ||
+        (class = frame_class_get(pix_fmt, width, height, size)) == NULL)
+    {
+        hb_unlock(frame_pool.lock);
+        return NULL;
+    }
+    class->last_use = ++frame_pool.clock;
+    class->outstanding++;
+    if (class->idle_count > 0)
+    {
+        data = class->idle[--class->idle_count];
+        frame_pool.idle_bytes -= class->alloc;
+        frame_pool.hits++;
+    }
+    hb_unlock(frame_pool.lock);
+
+    if (data == NULL)
+    {
+        // Mapping a large frame takes a while, don't hold the lock
+        data = frame_alloc(class);
+
+        hb_lock(frame_pool.lock);
+        if (data == NULL)
+        {
+            if (class->hugetlb && !frame_pool.hugetlb_failed)
+            {
+                // New classes use transparent huge pages instead
+                hb_log("frame pool: no explicit huge pages available");
+                frame_pool.hugetlb_failed = 1;
+            }
+            class->outstanding--;
+            frame_pool_compact();
+        }
+        else
+        {
+            frame_pool.allocs++;
+        }
+        hb_unlock(frame_pool.lock);
+    }
+
+    *out = class;
+    return data;
+}
+
+hb_buffer_t * hb_frame_pool_get( int pix_fmt, int width, int height, int size )
+{
+    hb_frame_class_t * class;
+    hb_buffer_t      * buf;
+    uint8_t          * data;
+
+    data = frame_pool_take(pix_fmt, width, height, size, &class);
+    if (data == NULL)
+    {
+        return NULL;
+    }
+    buf = hb_buffer_wrapper_init();
+    if (buf == NULL)
+    {
+        hb_lock(frame_pool.lock);
+        class->outstanding--;
+        frame_free(class, data);
+        hb_unlock(frame_pool.lock);
+        return NULL;
+    }
+    buf->data        = data;
+    buf->size        = size;
+    buf->alloc       = class->alloc;
+    buf->node        = class->node;
+    buf->frame_class = class;
+
+    return buf;
+}
+
+int hb_frame_pool_realloc( hb_buffer_t * buf, int width, int height, int size )
+{
+    hb_frame_class_t * class = buf->frame_class;
+    uint8_t          * data;
+
+    if (buf->storage_type != STANDARD ||
+        (buf->data != NULL && class == NULL))
+    {
+        return 0;
+    }
+    if (class != NULL && class->pix_fmt == buf->f.fmt &&
+        class->width == width && class->height == height)
+    {
+        return 1;
+    }
+
+    data = frame_pool_take(buf->f.fmt, width, height, size, &class);
+    if (data == NULL)
+    {
+        return 0;
+    }
+    if (buf->data != NULL)
+    {
+        memcpy(data, buf->data, MIN(buf->size, size));
+        hb_frame_pool_put(buf);
+    }
+    buf->data        = data;
+    buf->alloc       = class->alloc;
+    buf->node        = class->node;
+    buf->frame_class = class;
+
+    return 1;
+}
+
+void hb_frame_pool_put( hb_buffer_t * buf )
+{
+    hb_frame_class_t * class = buf->frame_class;
+    uint8_t          * data  = buf->data;
+    int                keep;
+
+    buf->data        = NULL;
+    buf->alloc       = 0;
+    buf->frame_class = NULL;
+    if (class == NULL || data == NULL)
+    {
+        return;
+    }
+
+    hb_lock(frame_pool.lock);
+    class->outstanding--;
+    keep = frame_pool.users > 0 && frame_pool.limit >= class->alloc;
+    while (keep && frame_pool.idle_bytes + class->alloc > frame_pool.limit)
+    {
+        if (!frame_pool_evict())
+        {
+            keep = 0;
+        }
+    }
+    if (keep && class->idle_count == class->idle_size)
+    {
+        int        idle_size = class->idle_size ? class->idle_size * 2 : 8;
+        uint8_t ** idle = realloc(class->idle, idle_size * sizeof(uint8_t *));
+
+        if (idle != NULL)
+        {
+            class->idle      = idle;
+            class->idle_size = idle_size;
+        }
+        else
+        {
+            keep = 0;
+        }
+    }
+    if (keep)
+    {
+        class->idle[class->idle_count++] = data;
+        frame_pool.idle_bytes += class->alloc;
+    }
+    else
+    {
+        frame_free(class, data);
+        if (frame_pool.users == 0 && class->outstanding == 0)
+        {
+            frame_pool_compact();
+        }
+    }
+    hb_unlock(frame_pool.lock);
+}
+
+void hb_frame_pool_acquire( int64_t limit, int hugetlb )
+{
+    if (limit < 0)
+    {
+        return;
+    }
+    hb_lock(frame_pool.lock);
+    frame_pool.users++;
+    frame_pool.limit += limit > 0 ? limit : FRAME_POOL_DEFAULT;
+    frame_pool.hugetlb_users += !!hugetlb;
+    hb_unlock(frame_pool.lock);
+}
+
+void hb_frame_pool_release( int64_t limit, int hugetlb )
+{
+    if (limit < 0)
+    {
+        return;
+    }
+    hb_lock(frame_pool.lock);
+    frame_pool.users--;
+    frame_pool.limit -= limit > 0 ? limit : FRAME_POOL_DEFAULT;
+    frame_pool.hugetlb_users -= !!hugetlb;
+    if (frame_pool.users == 0)
+    {
+        frame_pool.limit = 0;
+        frame_pool.hugetlb_failed = 0;
+    }
+    while (frame_pool.idle_bytes > frame_pool.limit && frame_pool_evict())
+    {
+    }
+    frame_pool_compact();
+    hb_unlock(frame_pool.lock);
+}
+
+void hb_frame_pool_log( const char * prefix )
+{
+    hb_lock(frame_pool.lock);
+    if (frame_pool.hits + frame_pool.allocs > 0)
+    {
+        hb_log("%s: frame pool %d classes, %"PRIu64" frames reused, "
+               "%"PRIu64" allocated, %"PRIu64" evicted, %.1f MiB idle",
+               prefix, frame_pool.class_count, frame_pool.hits,
+               frame_pool.allocs, frame_pool.evictions,
+               frame_pool.idle_bytes / 1048576.);
+    }
+    hb_unlock(frame_pool.lock);
+}
@@ -0,0 +1,307 @@
+/* fused_filter.c
+
+   Copyright (c) 2003-2024 HandBrake Team
+   This file is part of the HandBrake source code
+   Homepage: <http://handbrake.fr/>.
+   It may be used under the terms of the GNU General Public License v2.
+   For full terms see the file COPYING file or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/* This is a pseudo-filter that runs a chain of adjacent spatial filters
+ * over horizontal stripes of each frame. A stripe goes through every
+ * filter of the chain while it is still in cache, instead of every
+ * filter making its own pass over the whole frame.
+ *
+ * Filters take part by implementing work_stripe() and by setting
+ * stripe_halo[] during init. For each frame and plane, work_stripe()
+ * is called with consecutive row ranges [y0, y1) from the top of the
+ * plane to the bottom, and input rows [0, min(height, y1 + halo))
+ * are final when it is called. A filter may carry state from one
+ * stripe to the next in its per thread context.
+ *
+ * The stages are chained through their sub_filter pointers. The fused
+ * filter itself is wrapped by mt_frame, so frames are still processed
+ * in parallel, and the result is identical to running the stages one
+ * after the other. */
+
+#include "handbrake/handbrake.h"
+
+#define FUSED_STAGES_MAX      8
+
+// A stripe of every stage buffer should fit in L2
+#define FUSED_STRIPE_BYTES    (256 * 1024)
+#define FUSED_STRIPE_ROWS_MIN 16
+
+struct hb_filter_private_s
+{
+    hb_filter_object_t * stages[FUSED_STAGES_MAX];
+    int                  stage_count;
+
+    hb_filter_init_t     output;
+};
+
+static int fused_init(hb_filter_object_t *filter, hb_filter_init_t *init);
+static int fused_init_thread(hb_filter_object_t *filter, int threads);
+static int fused_work(hb_filter_object_t *filter,
+                      hb_buffer_t **buf_in,
+                      hb_buffer_t **buf_out);
+static int fused_work_thread(hb_filter_object_t *filter,
+                             hb_buffer_t **buf_in,
+                             hb_buffer_t **buf_out, int thread);
+static void fused_close(hb_filter_object_t *filter);
+static hb_filter_info_t * fused_info(hb_filter_object_t *filter);
+
+static const char fused_template[] = "";
+
+hb_filter_object_t hb_filter_fused =
+{
+    .id                = HB_FILTER_FUSED,
+    .enforce_order     = 0,
+    .name              = "Fused filter chain",
+    .settings          = NULL,
+    .init              = fused_init,
+    .init_thread       = fused_init_thread,
+    .work              = fused_work,
+    .work_thread       = fused_work_thread,
+    .close             = fused_close,
+    .info              = fused_info,
+    .settings_template = fused_template,
+};
+
+static int can_fuse(hb_filter_object_t *filter)
+{
+    // Only filters that are wrapped by mt_frame are candidates,
+    // anything else keeps its own thread
+    return !filter->skip && filter->sub_filter != NULL &&
+           filter->sub_filter->work_stripe != NULL &&
+           filter->sub_filter->sub_filter == NULL;
+}
+
+/*
+ * Replace runs of adjacent filters that support stripe processing
+ * with a single fused filter.  Must be called before the filters
+ * are initialized.
+ */
+void hb_filter_fuse(hb_list_t *list)
+{
+    int ii, jj, count;
+
+    for (ii = 0; ii < hb_list_count(list); ii++)
+    {
+        count = 0;
+        while (ii + count < hb_list_count(list) && count < FUSED_STAGES_MAX &&
+               can_fuse(hb_list_item(list, ii + count)))
+        {
+            count++;
+        }
+        if (count < 2)
+        {
+            continue;
+        }
+
+        hb_filter_object_t *wrapper = hb_filter_init(HB_FILTER_FUSED);
+        hb_filter_object_t *fused   = wrapper->sub_filter;
+        hb_filter_object_t *last    = fused;
+
+        // Move the wrapped filters into the fused chain and
+        // drop their mt_frame wrappers
+        for (jj = 0; jj < count; jj++)
+        {
+            hb_filter_object_t *filter = hb_list_item(list, ii);
+
+            hb_list_rem(list, filter);
+            last->sub_filter   = filter->sub_filter;
+            filter->sub_filter = NULL;
+            last               = last->sub_filter;
+            hb_filter_close(&filter);
+        }
+        wrapper->info = fused_info;
+        hb_list_insert(list, ii, wrapper);
+    }
+}
+
+static int fused_init(hb_filter_object_t *filter, hb_filter_init_t *init)
+{
+    filter->private_data = calloc(sizeof(struct hb_filter_private_s), 1);
+    if (filter->private_data == NULL)
+    {
+        hb_error("fused: calloc failed");
+        return -1;
+    }
+    hb_filter_private_t *pv = filter->private_data;
+    hb_filter_object_t  *stage;
+
+    for (stage = filter->sub_filter; stage != NULL; stage = stage->sub_filter)
+    {
+        pv->stages[pv->stage_count++] = stage;
+        if (stage->init != NULL && stage->init(stage, init))
+        {
+            hb_error("fused: failure to initialise filter '%s'", stage->name);
+            return -1;
+        }
+    }
+    pv->output = *init;
+
+    return 0;
+}
+
+static int fused_init_thread(hb_filter_object_t *filter, int threads)
+{
+    hb_filter_private_t *pv = filter->private_data;
+
+    for (int ii = 0; ii < pv->stage_count; ii++)
+    {
+        hb_filter_object_t *stage = pv->stages[ii];
+        if (stage->init_thread != NULL &&
+            stage->init_thread(stage, threads) < 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void fused_close(hb_filter_object_t *filter)
+{
+    hb_filter_private_t *pv = filter->private_data;
+
+    if (pv == NULL)
+    {
+        return;
+    }
+
+    for (int ii = 0; ii < pv->stage_count; ii++)
+    {
+        hb_filter_object_t *stage = pv->stages[ii];
+        stage->close(stage);
+    }
+    free(pv);
+    filter->private_data = NULL;
+}
+
+static hb_filter_info_t * fused_info(hb_filter_object_t *filter)
+{
+    hb_filter_object_t *stage;
+    hb_filter_info_t   *info;
+    char               *desc = NULL;
+
+    // Also called on the mt_frame wrapper
+    if (filter->sub_filter != NULL && filter->sub_filter->id == HB_FILTER_FUSED)
+    {
+        filter = filter->sub_filter;
+    }
+
+    for (stage = filter->sub_filter; stage != NULL; stage = stage->sub_filter)
+    {
+        char *settings = hb_filter_settings_string(stage->id, stage->settings);
+        char *tmp = hb_strdup_printf("%s%s%s (%s)", desc ? desc : "",
+                                     desc ? "\n" : "", stage->name,
+                                     settings ? settings : "");
+        free(settings);
+        free(desc);
+        desc = tmp;
+    }
+
+    info = calloc(1, sizeof(hb_filter_info_t));
+    if (info == NULL)
+    {
+        free(desc);
+        return NULL;
+    }
+    info->human_readable_desc = desc;
+
+    return info;
+}
+
+static int fused_work_thread(hb_filter_object_t *filter,
+                             hb_buffer_t **buf_in,
+                             hb_buffer_t **buf_out, int thread)
+{
+    hb_filter_private_t *pv = filter->private_data;
+    hb_buffer_t *in = *buf_in;
+    hb_buffer_t *buf[FUSED_STAGES_MAX + 1];
+    int          done[FUSED_STAGES_MAX];
+    int          count = pv->stage_count;
+    int          ii, c;
+
+    if (in->s.flags & HB_BUF_FLAG_EOF)
+    {
+        *buf_out = in;
+        *buf_in = NULL;
+        return HB_FILTER_DONE;
+    }
+
+    buf[0] = in;
+    for (ii = 1; ii <= count; ii++)
+    {
+        buf[ii] = hb_frame_buffer_init(pv->output.pix_fmt,
+                                       in->f.width, in->f.height);
+    }
+
+    for (c = 0; c < 3; c++)
+    {
+        const int height = in->plane[c].height;
+        int       rows;
+
+        rows = FUSED_STRIPE_BYTES / (in->plane[c].stride * (count + 1));
+        if (rows < FUSED_STRIPE_ROWS_MIN)
+        {
+            rows = FUSED_STRIPE_ROWS_MIN;
+        }
+
+        memset(done, 0, sizeof(done));
+        while (done[count - 1] < height)
+        {
+            // The first stage advances one stripe, each following stage
+            // catches up to the rows its input has made final
+            for (ii = 0; ii < count; ii++)
+            {
+                hb_filter_object_t *stage = pv->stages[ii];
+                int                 end;
+
+                if (ii == 0)
+                {
+                    end = MIN(done[0] + rows, height);
+                }
+                else if (done[ii - 1] >= height)
+                {
+                    end = height;
+                }
+                else
+                {
+                    end = done[ii - 1] - stage->stripe_halo[c];
+                }
+                if (end > done[ii])
+                {
+                    stage->work_stripe(stage, buf[ii], buf[ii + 1],
+                                       c, done[ii], end, thread);
+                    done[ii] = end;
+                }
+            }
+        }
+    }
+
+    for (ii = 1; ii < count; ii++)
+    {
+        hb_buffer_close(&buf[ii]);
+    }
+
+    hb_buffer_t *out = buf[count];
+    out->f.color_prim      = pv->output.color_prim;
+    out->f.color_transfer  = pv->output.color_transfer;
+    out->f.color_matrix    = pv->output.color_matrix;
+    out->f.color_range     = pv->output.color_range;
+    out->f.chroma_location = pv->output.chroma_location;
+
+    hb_buffer_copy_props(out, in);
+    *buf_out = out;
+
+    return HB_FILTER_OK;
+}
+
+static int fused_work(hb_filter_object_t *filter,
+                      hb_buffer_t **buf_in,
+                      hb_buffer_t **buf_out)
+{
+    return fused_work_thread(filter, buf_in, buf_out, 0);
+}
@@ -0,0 +1,69 @@
+/* comb_detect.h
+
+   Copyright (c) 2003-2024 HandBrake Team
+   This file is part of the HandBrake source code
+   Homepage: <http://handbrake.fr/>.
+   It may be used under the terms of the GNU General Public License v2.
+   For full terms see the file COPYING file or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+#ifndef HANDBRAKE_COMB_DETECT_H
+#define HANDBRAKE_COMB_DETECT_H
+
+typedef struct
+{
+    int          spatial_metric;
+    int          motion_threshold;
+    int          spatial_threshold;
+    int          spatial_threshold_squared;
+    int          spatial_threshold6;
+    int          comb32detect_min;
+    int          comb32detect_max;
+    float        gamma_motion_threshold;
+    float        gamma_spatial_threshold;
+    float        gamma_spatial_threshold6;
+    const float *gamma_lut;
+    int          force_exaustive_check;
+} CombDetectThresholds;
+
+/*
+ * Optional kernels, NULL when there is no optimized version.
+ * The line kernels return the position they stopped at,
+ * the rest of the line is done by the scalar code.
+ */
+typedef struct
+{
+    // Mark the combed pixels of a line of luma, strides are in pixels
+    int  (*detect_combed_line[2])(const CombDetectThresholds *t,
+                                  const void *prev, const void *cur,
+                                  const void *next, uint8_t *mask,
+                                  int width, int stride_prev,
+                                  int stride_cur, int stride_next);
+    int  (*detect_gamma_combed_line[2])(const CombDetectThresholds *t,
+                                        const void *prev, const void *cur,
+                                        const void *next, uint8_t *mask,
+                                        int width, int stride_prev,
+                                        int stride_cur, int stride_next);
+
+    // Mask lines, from 'xx' = 1 to 'width' - 1 like the scalar loops
+    int  (*mask_filter_line)(uint8_t *dst, const uint8_t *curp,
+                             const uint8_t *cur, const uint8_t *curn,
+                             int width, int classic);
+    int  (*mask_erode_line)(uint8_t *dst, const uint8_t *curp,
+                            const uint8_t *cur, const uint8_t *curn,
+                            int width);
+    int  (*mask_dilate_line)(uint8_t *dst, const uint8_t *curp,
+                             const uint8_t *cur, const uint8_t *curn,
+                             int width);
+
+    // Sum of a block of the mask, and the same counting only the pixels
+    // whose left and right neighbours are also set (block not at x = 0)
+    int  (*block_score)(const uint8_t *mask, int stride,
+                        int block_width, int block_height);
+    int  (*block_score_adjacent)(const uint8_t *mask, int stride,
+                                 int block_width, int block_height);
+} CombDetectFunctions;
+
+void comb_detect_init_x86(CombDetectFunctions *functions);
+
+#endif // HANDBRAKE_COMB_DETECT_H
@@ -568,6 +568,7 @@ struct hb_job_s
     // Video filters
     int             grayscale;      // Black and white encoding
     hb_list_t     * list_filter;
+    int             filter_fusion;  // Run adjacent filters stripe by stripe
 
     PRIVATE int             crop[4];
     PRIVATE int             width;
@@ -834,6 +835,31 @@ struct hb_job_s
     int hw_decode;
     int keep_duplicate_titles;
 
+    // Memory budget for the frames queued between pipeline stages, in
+    // bytes.  When set, fifo depths adapt to the job within the budget.
+    // 0 keeps the fixed default depths.
+    int64_t         fifo_memory_budget;
+
+    // Collect per stage pipeline counters, see telemetry.h
+    int             pipeline_telemetry;
+
+    // Bind the pipeline threads to one L3 cache or NUMA node domain
+    // when the job fits in one, see hb_cpu_domain_acquire()
+    int             cpu_placement;
+
+    // Bytes of idle frames kept for reuse by the frame pool between the
+    // frames and passes of the job.  0 selects the default, -1 disables
+    // the frame pool.  See framepool.c
+    int64_t         frame_pool_limit;
+    // Back large frames with explicit (reserved) huge pages instead of
+    // transparent huge pages (Linux only)
+    int             huge_pages;
+
+    // Bytes of source data the reader keeps read ahead of the demuxer
+    // on a separate I/O thread.  0 selects the default, -1 reads on the
+    // reader thread.  See reader.c
+    int64_t         read_ahead_limit;
+
 #ifdef __LIBHB__
     /* Internal data */
     hb_handle_t   * h;
@@ -843,6 +869,10 @@ struct hb_job_s
 
     uint64_t        st_paused;
 
+    hb_interjob_t * interjob;     /* NULL when the handle's is used */
+    int             cpu_share;    /* logical processors, 0 for all */
+    int             cpu_domain;   /* placement domain, -1 for none */
+
     int             init_delay;
     hb_data_t     * extradata;
 
@@ -851,6 +881,8 @@ struct hb_job_s
     hb_fifo_t     * fifo_sync;    /* Raw pictures, framerate corrected */
     hb_fifo_t     * fifo_render;  /* Raw pictures, scaled */
     hb_fifo_t     * fifo_mpeg4;   /* MPEG-4 video ES */
+    hb_fifo_budget_t * fifo_budget;
+    hb_telemetry_t   * telemetry;
 
     hb_list_t     * list_work;
 
@@ -1263,6 +1295,10 @@ struct hb_title_s
 #define         HBTF_NO_IDR (1 << 0)
 #define         HBTF_SCAN_COMPLETE (1 << 1)
 #define         HBTF_RAW_VIDEO (1 << 2)
+                // set if the previews were decoded in fast scan mode
+#define         HBTF_FAST_SCAN (1 << 3)
+                // set if a full scan may find different video properties
+#define         HBTF_LOW_CONFIDENCE (1 << 4)
 };
 
 // Update win/CS/HandBrake.Interop/HandBrakeInterop/HbLib/hb_state_s.cs when changing this struct
@@ -1400,10 +1436,12 @@ struct hb_work_object_s
     int                 codec_param;
     void              * hw_device_ctx;
     hb_title_t        * title;
+    int                 fast_decode;    /* scan: keyframes only, no deblocking */
 
     hb_work_object_t  * next;
 
     hb_handle_t       * h;
+    hb_stage_stats_t  * stats;
 #endif
 };
 
@@ -1481,6 +1519,9 @@ struct hb_filter_object_s
                                         hb_buffer_t **, hb_buffer_t ** );
     int                (* work_thread)( hb_filter_object_t *,
                                         hb_buffer_t **, hb_buffer_t **, int );
+    int                (* work_stripe)( hb_filter_object_t *,
+                                        hb_buffer_t *, hb_buffer_t *,
+                                        int, int, int, int );
     void               (* close)      ( hb_filter_object_t * );
     hb_filter_info_t * (* info)       ( hb_filter_object_t * );
 
@@ -1503,6 +1544,13 @@ struct hb_filter_object_s
     int64_t               chapter_time;
 
     hb_filter_object_t  * sub_filter;
+
+    // Filters that implement work_stripe set the number of input rows
+    // below an output row that they read, per plane.
+    // See fused_filter.c
+    int                   stripe_halo[3];
+
+    hb_stage_stats_t    * stats;
 #endif
 };
 
@@ -1567,7 +1615,9 @@ enum
 
     HB_FILTER_LAST,
     // wrapper filter for frame based multi-threading of simple filters
-    HB_FILTER_MT_FRAME
+    HB_FILTER_MT_FRAME,
+    // wrapper filter for stripe based processing of adjacent filters
+    HB_FILTER_FUSED
 };
 
 hb_filter_object_t * hb_filter_get( int filter_id );
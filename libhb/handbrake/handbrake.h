@@ -29,6 +29,8 @@ extern "C" {
 #define HB_DEBUG_ALL  1
 #define HB_PREVIEW_FORMAT_YUV 0
 #define HB_PREVIEW_FORMAT_JPG 1
+// Decoded frame kept in memory, in its own pixel format and bit depth
+#define HB_PREVIEW_FORMAT_RAW 2
 void          hb_register( hb_work_object_t * );
 void          hb_register_logger( void (*log_cb)(const char* message) );
 hb_handle_t * hb_init( int verbose );
@@ -41,6 +43,13 @@ int           hb_get_build( hb_handle_t * );
 
 char *        hb_dvd_name( char * path );
 void          hb_dvd_set_dvdnav( int enable );
+void          hb_stream_index_enable( int enable );
+void          hb_scan_set_file_threads( int count );
+void          hb_scan_set_fast( int enable );
+void          hb_scan_cache_enable( int enable );
+void          hb_scan_set_preview_threads( int count );
+void          hb_preview_store_set_budget( int64_t bytes );
+void          hb_preview_cache_set_budget( int64_t bytes );
 
 /* hb_scan()
    Scan the specified paths. Can be a DVD device, a VIDEO_TS folder or
@@ -78,6 +87,11 @@ hb_buffer_t * hb_read_preview( hb_handle_t * h, hb_title_t *title,
 
 hb_image_t  * hb_get_preview3(hb_handle_t * h, int picture,
                               hb_dict_t * job_dict);
+/* hb_preview_prerender()
+   Renders the previews of a job in the background, so that the following
+   hb_get_preview3() calls find their filter stages in the preview cache. */
+void          hb_preview_prerender(hb_handle_t * h, hb_dict_t * job_dict);
+void          hb_preview_prerender_stop(hb_handle_t * h);
 void          hb_rotate_geometry( hb_geometry_crop_t * geo,
                                   hb_geometry_crop_t * result,
                                   int angle, int hflip);
@@ -105,12 +119,14 @@ void          hb_start( hb_handle_t * );
 void          hb_pause( hb_handle_t * );
 void          hb_resume( hb_handle_t * );
 void          hb_stop( hb_handle_t * );
+void          hb_set_max_concurrent_jobs( hb_handle_t *, int );
+int           hb_get_max_concurrent_jobs( hb_handle_t * );
 
 void          hb_system_sleep_allow(hb_handle_t*);
 void          hb_system_sleep_prevent(hb_handle_t*);
 
 /* Persistent data between jobs. */
-typedef struct hb_interjob_s
+struct hb_interjob_s
 {
     int     sequence_id;     /* job->sequence_id                   */
     int     frame_count;     /* number of frames counted by sync   */
@@ -122,7 +138,7 @@ typedef struct hb_interjob_s
 
     void *context;
     int   context_size;
-} hb_interjob_t;
+};
 
 hb_interjob_t * hb_interjob_get( hb_handle_t * );
 
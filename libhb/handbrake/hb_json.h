@@ -17,6 +17,7 @@ extern "C" {
 #include "handbrake/common.h"
 
 hb_dict_t  * hb_state_to_dict( hb_state_t * state);
+hb_dict_t  * hb_handle_state_to_dict(hb_handle_t * h, hb_state_t * state);
 hb_dict_t  * hb_job_to_dict( const hb_job_t * job );
 hb_dict_t  * hb_title_to_dict( hb_handle_t *h, int title_index );
 hb_dict_t  * hb_title_set_to_dict( const hb_title_set_t * title_set );
@@ -45,6 +45,11 @@ typedef struct hb_motion_metric_object_s  hb_motion_metric_object_t;
 typedef struct hb_buffer_settings_s hb_buffer_settings_t;
 typedef struct hb_image_format_s hb_image_format_t;
 typedef struct hb_fifo_s hb_fifo_t;
+typedef struct hb_fifo_budget_s hb_fifo_budget_t;
+typedef struct hb_frame_class_s hb_frame_class_t;
+typedef struct hb_stage_stats_s hb_stage_stats_t;
+typedef struct hb_telemetry_s hb_telemetry_t;
+typedef struct hb_interjob_s hb_interjob_t;
 typedef struct hb_lock_s hb_lock_t;
 typedef struct hb_mastering_display_metadata_s hb_mastering_display_metadata_t;
 typedef struct hb_content_light_metadata_s hb_content_light_metadata_t;
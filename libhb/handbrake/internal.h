@@ -46,6 +46,22 @@ void         hb_title_close( hb_title_t ** );
 int  hb_get_pid( hb_handle_t * );
 void hb_set_state( hb_handle_t *, hb_state_t * );
 void hb_set_work_error( hb_handle_t * h, hb_error_code err );
+void hb_work_signal( hb_handle_t * h );
+uint64_t hb_work_event_count( hb_handle_t * h );
+void hb_work_wait( hb_handle_t * h, uint64_t seen );
+void hb_scan_wait( hb_handle_t * h );
+void hb_running_job_add( hb_handle_t * h, int sequence_id );
+void hb_running_job_set_pass( hb_handle_t * h, hb_job_t * job );
+void hb_running_job_remove( hb_handle_t * h, int sequence_id );
+void hb_running_job_pool_free( hb_handle_t * h );
+void hb_set_job_state( hb_job_t * job, hb_state_t * s );
+void hb_get_job_state( hb_job_t * job, hb_state_t * s );
+void hb_set_job_telemetry( hb_job_t * job, hb_telemetry_t * telemetry );
+hb_dict_t * hb_get_telemetry_dict( hb_handle_t * h );
+hb_value_array_t * hb_get_running_jobs_dict( hb_handle_t * h );
+hb_interjob_t * hb_job_interjob_get( hb_job_t * job );
+int hb_job_cpu_count( hb_job_t * job );
+int hb_job_avcodec_threads( hb_job_t * job );
 void hb_job_setup_passes(hb_handle_t *h, hb_job_t *job, hb_list_t *list_pass);
 
 /***********************************************************************
@@ -136,6 +152,8 @@ struct hb_buffer_s
 {
     int           size;     // size of this packet
     int           alloc;    // used internally by the packet allocator (hb_buffer_init)
+    int           node;     // NUMA node of the data, -1 if unknown (ditto)
+    hb_frame_class_t * frame_class; // frame pool class of the data (ditto)
     uint8_t *     data;     // packet data
     int           offset;   // used internally by packet lists (hb_list_t)
 
@@ -178,12 +196,42 @@ struct hb_buffer_s
 void hb_buffer_pool_init( void );
 void hb_buffer_pool_free( void );
 
+// Buffer pool activity.  Buffers of the smaller pool sizes go through
+// per thread magazines, hits are served without taking a pool lock.
+typedef struct
+{
+    uint64_t allocs;
+    uint64_t alloc_hits;
+    uint64_t frees;
+    uint64_t free_hits;
+    uint64_t lock_count;    // pool lock acquisitions
+} hb_buffer_pool_stats_t;
+
+void hb_buffer_pool_get_stats( hb_buffer_pool_stats_t * stats );
+// Logs pool activity since 'since' was sampled, or since
+// startup if 'since' is NULL
+void hb_buffer_pool_log_stats( const char * prefix,
+                               const hb_buffer_pool_stats_t * since );
+
+// Frame buffer pool, see framepool.c.  A limit of 0 selects the
+// default, a negative limit leaves the pool alone.
+void          hb_frame_pool_init( void );
+void          hb_frame_pool_acquire( int64_t limit, int hugetlb );
+void          hb_frame_pool_release( int64_t limit, int hugetlb );
+hb_buffer_t * hb_frame_pool_get( int pix_fmt, int width, int height, int size );
+int           hb_frame_pool_realloc( hb_buffer_t * buf, int width, int height,
+                                     int size );
+void          hb_frame_pool_put( hb_buffer_t * buf );
+void          hb_frame_pool_log( const char * prefix );
+
 hb_buffer_t * hb_buffer_wrapper_init();
 hb_buffer_t * hb_buffer_init( int size );
 hb_buffer_t * hb_buffer_eof_init( void );
 hb_buffer_t * hb_frame_buffer_init( int pix_fmt, int w, int h);
 void          hb_frame_buffer_blank_stride(hb_buffer_t * buf);
 void          hb_frame_buffer_mirror_stride(hb_buffer_t * buf);
+void          hb_frame_buffer_mirror_stride_rows(hb_buffer_t * buf, int plane,
+                                                 int y0, int y1);
 void          hb_buffer_init_planes( hb_buffer_t * b );
 void          hb_buffer_realloc( hb_buffer_t *, int size );
 void          hb_video_buffer_realloc( hb_buffer_t * b, int w, int h );
@@ -210,8 +258,10 @@ void          hb_buffer_copy_props(hb_buffer_t *dst, const hb_buffer_t *src);
 int           hb_buffer_is_writable(const hb_buffer_t *buf);
 
 hb_fifo_t   * hb_fifo_init( int capacity, int thresh );
+hb_fifo_t   * hb_fifo_init_spsc( int capacity, int thresh );
 void          hb_fifo_register_full_cond( hb_fifo_t * f, hb_cond_t * c );
 int           hb_fifo_size( hb_fifo_t * );
+int           hb_fifo_capacity( hb_fifo_t * );
 int           hb_fifo_size_bytes( hb_fifo_t * );
 int           hb_fifo_is_full( hb_fifo_t * );
 float         hb_fifo_percent_full( hb_fifo_t * f );
@@ -226,6 +276,17 @@ int           hb_fifo_full_wait( hb_fifo_t * f );
 void          hb_fifo_push_head( hb_fifo_t *, hb_buffer_t * );
 void          hb_fifo_close( hb_fifo_t ** );
 void          hb_fifo_flush( hb_fifo_t * f );
+void          hb_fifo_interrupt( hb_fifo_t * f );
+
+hb_fifo_budget_t * hb_fifo_budget_init( int64_t limit );
+void          hb_fifo_budget_close( hb_fifo_budget_t ** );
+int64_t       hb_fifo_budget_used( hb_fifo_budget_t * );
+void          hb_fifo_budget_log( hb_fifo_budget_t *, const char * prefix );
+void          hb_fifo_set_adaptive( hb_fifo_t * f, hb_fifo_budget_t * b,
+                                    int capacity, int min_capacity,
+                                    int max_capacity );
+
+#define HB_IMAGE_STRIDE_ALIGN 64
 
 static inline int hb_image_stride( int pix_fmt, int width, int plane )
 {
@@ -233,7 +294,7 @@ static inline int hb_image_stride( int pix_fmt, int width, int plane )
 
     // Make buffer SIMD friendly.
     // Zscale requires stride aligned to 64 bytes
-    linesize = MULTIPLE_MOD_UP(linesize, 64);
+    linesize = MULTIPLE_MOD_UP(linesize, HB_IMAGE_STRIDE_ALIGN);
     return linesize;
 }
 
@@ -272,8 +333,8 @@ hb_thread_t * hb_scan_init( hb_handle_t *, volatile int * die,
                             int store_previews, uint64_t min_duration,
                             int crop_auto_switch_threshold, int crop_median_threshold,
                             hb_list_t * exclude_extensions, int hw_decode, int keep_duplicate_titles);
-hb_thread_t * hb_work_init( hb_list_t * jobs,
-                            volatile int * die, hb_error_code * error, hb_job_t ** job );
+hb_thread_t * hb_work_init( hb_handle_t * h, hb_list_t * jobs,
+                            volatile int * die, hb_error_code * error );
 void ReadLoop( void * _w );
 void hb_work_loop( void * );
 hb_work_object_t * hb_muxer_init( hb_job_t * );
@@ -362,7 +423,7 @@ void		 hb_stream_close( hb_stream_t ** );
 hb_title_t * hb_stream_title_scan( hb_stream_t *, hb_title_t *);
 hb_buffer_t * hb_stream_read( hb_stream_t * );
 int          hb_stream_seek( hb_stream_t *, float );
-int          hb_stream_seek_ts( hb_stream_t * stream, int64_t ts );
+int64_t      hb_stream_seek_ts( hb_stream_t * stream, int64_t ts );
 int          hb_stream_seek_chapter( hb_stream_t *, int );
 int          hb_stream_chapter( hb_stream_t * );
 
@@ -444,6 +505,9 @@ extern hb_filter_object_t hb_filter_lapsharp;
 extern hb_filter_object_t hb_filter_unsharp;
 extern hb_filter_object_t hb_filter_avfilter;
 extern hb_filter_object_t hb_filter_mt_frame;
+extern hb_filter_object_t hb_filter_fused;
+
+void hb_filter_fuse(hb_list_t *list);
 extern hb_filter_object_t hb_filter_colorspace;
 extern hb_filter_object_t hb_filter_format;
 
@@ -11,6 +11,12 @@
 #ifndef HANDBRAKE_NLMEANS_H
 #define HANDBRAKE_NLMEANS_H
 
+struct PixelSum
+{
+    float weight_sum;
+    float pixel_sum;
+};
+
 typedef struct
 {
     void (*build_integral)(uint32_t *integral,
@@ -26,8 +32,22 @@ typedef struct
                            int    dx,
                            int    dy,
                            int    n);
+    // Add the weighted compare pixels of a displacement to the sums
+    void (*accumulate)(struct PixelSum *tmp_data,
+                 const uint32_t *integral,
+                       int       integral_stride,
+                 const void     *compare,
+                       int       bw,
+                       int       dst_w,
+                       int       dst_h,
+                       int       dx,
+                       int       dy,
+                       int       n,
+                 const float    *exptable,
+                 const float     weight_fact_table,
+                 const int       diff_max);
 } NLMeansFunctions;
 
-void nlmeans_init_x86(NLMeansFunctions *functions);
+void nlmeans_init_x86(NLMeansFunctions *functions, int depth);
 
 #endif // HANDBRAKE_NLMEANS_H
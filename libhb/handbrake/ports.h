@@ -86,6 +86,15 @@ int         hb_get_cpu_platform(void);
 const char* hb_get_cpu_name(void);
 const char* hb_get_cpu_platform_name(void);
 
+/* Placement domains: logical processors that share a L3 cache or a
+   NUMA node (Linux only). See hb_thread_set_domain() */
+int         hb_get_numa_node_count(void);
+int         hb_cpu_domain_acquire(int cpu_count);
+void        hb_cpu_domain_release(int domain);
+const char* hb_cpu_domain_name(int domain);
+int         hb_cpu_domain_cpu_count(int domain);
+int         hb_cpu_domain_node(int domain);
+
 /************************************************************************
  * Utils
  ***********************************************************************/
@@ -145,9 +154,13 @@ int hb_dvd_region(const char *device, int *region_mask);
 
 #if defined( SYS_DARWIN )
 int macOS_get_user_config_directory( char path[512] );
+int macOS_get_user_cache_directory( char path[512] );
 #endif
 void hb_get_user_config_directory( char path[512] );
 void hb_get_user_config_filename( char name[1024], char *fmt, ... );
+void hb_get_user_cache_directory( char path[512] );
+int  hb_get_user_cache_filename( char name[1024], const char *subdir,
+                                 char *fmt, ... );
 /************************************************************************
  * Threads
  ***********************************************************************/
@@ -177,6 +190,8 @@ hb_thread_t * hb_thread_init( const char * name, thread_func_t *function,
                               void * arg, int priority );
 void          hb_thread_close( hb_thread_t ** );
 int           hb_thread_has_exited( hb_thread_t * );
+void          hb_thread_set_domain( int domain );
+int           hb_thread_get_node( void );
 
 void          hb_yield(void);
 
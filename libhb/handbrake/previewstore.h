@@ -0,0 +1,55 @@
+/* previewstore.h
+
+   Copyright (c) 2003-2024 HandBrake Team
+   This file is part of the HandBrake source code
+   Homepage: <http://handbrake.fr/>.
+   It may be used under the terms of the GNU General Public License v2.
+   For full terms see the file COPYING file or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+#ifndef HANDBRAKE_PREVIEWSTORE_H
+#define HANDBRAKE_PREVIEWSTORE_H
+
+#include "handbrake/handbrake.h"
+
+/*
+ * Preview images of the scanned titles of a handle.
+ *
+ * The decoded frames are kept as they are, in their pixel format and
+ * bit depth, so that previews are filtered without a JPEG round trip.
+ * When the frames take more memory than the budget set with
+ * hb_preview_store_set_budget(), the least recently used ones are
+ * written to the temporary directory and read again when needed.
+ */
+typedef struct hb_preview_store_s hb_preview_store_t;
+
+hb_preview_store_t * hb_preview_store_init( int instance_id );
+void                 hb_preview_store_close( hb_preview_store_t ** _store );
+
+// The store keeps a copy of 'buf'
+int           hb_preview_store_put( hb_preview_store_t * store, int title,
+                                    int preview, const hb_buffer_t * buf );
+// Returns a copy of the preview, NULL if there is none
+hb_buffer_t * hb_preview_store_get( hb_preview_store_t * store, int title,
+                                    int preview );
+void          hb_preview_store_clear( hb_preview_store_t * store );
+
+// Filtered previews, 'key' describes the filters that were applied.
+// Bounded by hb_preview_cache_set_budget().
+hb_buffer_t * hb_preview_store_get_stage( hb_preview_store_t * store,
+                                          int title, int preview,
+                                          const char * key );
+void          hb_preview_store_put_stage( hb_preview_store_t * store,
+                                          int title, int preview,
+                                          const char * key,
+                                          const hb_buffer_t * buf );
+
+// Raw frame files, used to spill the store and by the scan cache
+int           hb_preview_write_file( const hb_buffer_t * buf,
+                                     const char * filename );
+hb_buffer_t * hb_preview_read_file( const char * filename );
+
+// 8 bit 4:2:0 copy of a preview, for the JPEG and YUV preview files
+hb_buffer_t * hb_preview_to_yuv420p( const hb_buffer_t * buf );
+
+#endif // HANDBRAKE_PREVIEWSTORE_H
@@ -0,0 +1,39 @@
+/* scancache.h
+
+   Copyright (c) 2003-2024 HandBrake Team
+   This file is part of the HandBrake source code
+   Homepage: <http://handbrake.fr/>.
+   It may be used under the terms of the GNU General Public License v2.
+   For full terms see the file COPYING file or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+#ifndef HANDBRAKE_SCANCACHE_H
+#define HANDBRAKE_SCANCACHE_H
+
+#include "handbrake/handbrake.h"
+
+/*
+ * Scan results of file sources.
+ *
+ * Decoding the previews of a title is the slow part of a scan.  What
+ * it finds out (video geometry, frame rate, color, crop, interlacing,
+ * audio track details, closed captions and optionally the preview
+ * images) is saved in the user cache directory.  It is used again
+ * when the same file is scanned with the same settings by the same
+ * version of libhb.
+ *
+ * Files are recognized by their path, size, modification time and a
+ * hash of their first and last blocks.
+ */
+int  hb_scan_cache_enabled( void );
+
+// 'settings' describes the scan settings that change the results.
+// Returns 1 and updates 'title' if the cache has its results.
+int  hb_scan_cache_load( hb_handle_t *h, hb_title_t *title,
+                         const char *settings, int preview_count,
+                         int store_previews );
+void hb_scan_cache_save( hb_handle_t *h, hb_title_t *title,
+                         const char *settings, int preview_count,
+                         int store_previews );
+
+#endif // HANDBRAKE_SCANCACHE_H
@@ -0,0 +1,51 @@
+/* startcode.h
+
+   Copyright (c) 2003-2024 HandBrake Team
+   This file is part of the HandBrake source code
+   Homepage: <http://handbrake.fr/>.
+   It may be used under the terms of the GNU General Public License v2.
+   For full terms see the file COPYING file or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+#ifndef HANDBRAKE_STARTCODE_H
+#define HANDBRAKE_STARTCODE_H
+
+#include <stdint.h>
+
+/*
+ * Byte pattern scanners for the demuxers.
+ *
+ * MPEG start codes, Annex B NAL unit boundaries and TS sync bytes are
+ * searched 16 or 32 bytes at a time with SSE2 or AVX2 (with NEON through
+ * sse2neon on arm64).  The scalar versions are used on other systems and
+ * for the tail of the buffers.  hb_startcode_init() selects the fastest
+ * version for the cpu flags of av_get_cpu_flags(); the scalar versions
+ * are used until it is called.
+ */
+void hb_startcode_init( void );
+
+/*
+ * Returns the first p in [buf, end) such that p[0] == 0, p[1] == 0 and
+ * (p[2] & mask) == value, and at least one byte follows p[2]
+ * (p + 3 < end).  NULL if there is none.
+ */
+const uint8_t * hb_find_start_code_prefix( const uint8_t *buf,
+                                           const uint8_t *end,
+                                           uint8_t mask, uint8_t value );
+
+// First 00 00 01 start code prefix followed by at least one byte
+static inline const uint8_t * hb_find_start_code( const uint8_t *buf,
+                                                  const uint8_t *end )
+{
+    return hb_find_start_code_prefix(buf, end, 0xff, 0x01);
+}
+
+/*
+ * Returns the first offset in [0, len) at which 'count' consecutive TS
+ * packets of 'psize' bytes start with a sync byte and a legal adaptation
+ * field control, -1 if there is none.  The buffer must hold
+ * len + (count - 1) * psize + 3 bytes.
+ */
+int hb_find_ts_sync( const uint8_t *buf, int len, int psize, int count );
+
+#endif // HANDBRAKE_STARTCODE_H
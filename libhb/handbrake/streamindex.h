@@ -0,0 +1,62 @@
+/* streamindex.h
+
+   Copyright (c) 2003-2024 HandBrake Team
+   This file is part of the HandBrake source code
+   Homepage: <http://handbrake.fr/>.
+   It may be used under the terms of the GNU General Public License v2.
+   For full terms see the file COPYING file or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+#ifndef HANDBRAKE_STREAMINDEX_H
+#define HANDBRAKE_STREAMINDEX_H
+
+#include <stdint.h>
+
+/*
+ * Video keyframe index of a transport or program stream.
+ *
+ * The index maps the time of the video frames to the file offset
+ * where the demuxer has to start reading to get them.  Times are in
+ * 90kHz ticks from the first video frame of the file, with the PTS
+ * discontinuities of spliced broadcast recordings removed, so they
+ * are on the same time line as title->duration.
+ *
+ * The index is built by reading the whole file once, then saved in
+ * the user cache directory together with the path, size and
+ * modification time of the file it was built from.
+ */
+typedef struct hb_stream_index_s hb_stream_index_t;
+
+typedef struct
+{
+    int64_t time;       // 90kHz, from the first video frame
+    int64_t pts;        // PTS of the frame in the stream
+    int64_t pos;        // file offset to start reading at
+    int     keyframe;
+} hb_stream_index_entry_t;
+
+int                 hb_stream_index_enabled( void );
+
+hb_stream_index_t * hb_stream_index_init( void );
+void                hb_stream_index_add( hb_stream_index_t *index,
+                                         int64_t pts, int64_t pos,
+                                         int keyframe );
+void                hb_stream_index_close( hb_stream_index_t **index );
+
+// Load the index of 'path' from the cache, NULL if it is missing
+// or was built from a different version of the file
+hb_stream_index_t * hb_stream_index_load( const char *path );
+int                 hb_stream_index_save( hb_stream_index_t *index,
+                                          const char *path );
+
+int64_t             hb_stream_index_duration( hb_stream_index_t *index );
+int                 hb_stream_index_keyframes( hb_stream_index_t *index );
+
+// Last keyframe at or before 'time', the first keyframe if there is
+// none.  Frames that are not keyframes are used if the stream has no
+// keyframes that we can recognize.  NULL if the index is empty.
+const hb_stream_index_entry_t *
+                    hb_stream_index_lookup( hb_stream_index_t *index,
+                                            int64_t time );
+
+#endif // HANDBRAKE_STREAMINDEX_H
@@ -10,26 +10,22 @@
 #ifndef HANDBRAKE_TASKSET_H
 #define HANDBRAKE_TASKSET_H
 
-#define TASKSET_POSIX_COMPLIANT 1
+#include "handbrake/threadpool.h"
 
-typedef struct hb_tasket_thread_t {
-    hb_thread_t      * thread;
-    hb_lock_t        * lock;
-    hb_cond_t        * begin_cond;
-    hb_cond_t        * complete_cond;
-    int                begin;
-    int                complete;
-    int                stop;
-} taskset_thread_t;
+#define TASKSET_POSIX_COMPLIANT 1
 
+/*
+ * A taskset runs 'thread_count' segments of work in parallel on the
+ * shared thread pool each time taskset_cycle() is called.
+ */
 typedef struct hb_taskset_s {
     int                thread_count;
     thread_func_t    * work_func;
     int                arg_size;
     const char       * task_descr;
     uint8_t          * task_threads_args;
-    int                task_thread_started;
-    taskset_thread_t * task_threads;
+    hb_task_t        * tasks;
+    hb_task_group_t    group;
 } taskset_t;
 
 typedef struct hb_taskset_thread_arg_s {
@@ -0,0 +1,80 @@
+/* telemetry.h
+
+   Copyright (c) 2003-2024 HandBrake Team
+   This file is part of the HandBrake source code
+   Homepage: <http://handbrake.fr/>.
+   It may be used under the terms of the GNU General Public License v2.
+   For full terms see the file COPYING file or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+#ifndef HANDBRAKE_TELEMETRY_H
+#define HANDBRAKE_TELEMETRY_H
+
+#include "handbrake/ports.h"
+
+/*
+ * Per stage pipeline counters.
+ *
+ * When job->pipeline_telemetry is set, every work object and filter of
+ * the job gets a hb_stage_stats_t that hb_work_loop() and filter_loop()
+ * update as buffers go through the stage.  The counters tell whether a
+ * job is decoder, filter or encoder bound: a bottleneck stage is busy
+ * most of the time, the stages before it are blocked on a full output
+ * and the stages after it wait on an empty input.
+ *
+ * Stages that are not instrumented have a NULL stats pointer, so the
+ * cost of the feature when disabled is one test per loop iteration.
+ */
+
+// Input fifo occupancy when a buffer is requested:
+// empty, up to 25%, 50%, 75% and above 75% of the fifo capacity
+#define HB_STAGE_OCCUPANCY_BINS 5
+
+struct hb_stage_stats_s
+{
+    char         name[64];
+    const char * type;          // "work" or "filter"
+
+    // Only written by the thread running the stage
+    uint64_t     frames_in;
+    uint64_t     frames_out;
+    uint64_t     busy_us;       // time spent in the work function
+    uint64_t     wait_in_us;    // time blocked on an empty input fifo
+    uint64_t     wait_out_us;   // time blocked on a full output fifo
+    uint64_t     occupancy[HB_STAGE_OCCUPANCY_BINS];
+    uint64_t     start_us;
+    uint64_t     stop_us;
+};
+
+hb_telemetry_t   * hb_telemetry_init( void );
+void               hb_telemetry_close( hb_telemetry_t ** );
+hb_stage_stats_t * hb_telemetry_add_stage( hb_telemetry_t *,
+                                           const char * type,
+                                           const char * name );
+hb_dict_t        * hb_telemetry_to_dict( hb_telemetry_t * );
+void               hb_telemetry_log( hb_telemetry_t *, const char * prefix );
+
+// Called by the stage thread
+void hb_stage_stats_start( hb_stage_stats_t * );
+void hb_stage_stats_stop( hb_stage_stats_t * );
+void hb_stage_stats_occupancy( hb_stage_stats_t *, hb_fifo_t * fifo_in );
+void hb_stage_stats_output( hb_stage_stats_t *, const hb_buffer_t * out );
+
+static inline void hb_stage_stats_add( uint64_t * counter, uint64_t value )
+{
+    // Single writer, the atomic store only keeps readers from
+    // seeing torn values
+    __atomic_store_n(counter, *counter + value, __ATOMIC_RELAXED);
+}
+
+// Returns the time elapsed since *t and moves *t to now
+static inline uint64_t hb_stage_stats_lap( uint64_t * t )
+{
+    uint64_t now = hb_get_time_us();
+    uint64_t lap = now - *t;
+
+    *t = now;
+    return lap;
+}
+
+#endif /* HANDBRAKE_TELEMETRY_H */
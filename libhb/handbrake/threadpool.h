@@ -0,0 +1,74 @@
+/* threadpool.h
+
+   Copyright (c) 2003-2024 HandBrake Team
+   This file is part of the HandBrake source code
+   Homepage: <http://handbrake.fr/>.
+   It may be used under the terms of the GNU General Public License v2.
+   For full terms see the file COPYING file or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+#ifndef HANDBRAKE_THREADPOOL_H
+#define HANDBRAKE_THREADPOOL_H
+
+/*
+ * Process wide work-stealing thread pool.
+ *
+ * All libhb fork/join parallelism (tasksets, frame threading) runs on
+ * a single set of worker threads sized to the machine, so that running
+ * several filters, or several jobs, does not multiply the number of
+ * threads competing for the CPU.
+ *
+ * Tasks are grouped in a hb_task_group_t.  hb_task_group_wait() blocks
+ * until every task of the group has completed, and the waiting thread
+ * runs queued tasks itself while it waits, so groups can be nested
+ * (a task may submit and wait for another group).
+ *
+ * Tasks must not block waiting for another task of the same group
+ * to make progress, there may be fewer workers than tasks.
+ */
+
+typedef struct hb_task_group_s hb_task_group_t;
+typedef struct hb_task_s       hb_task_t;
+
+struct hb_task_s
+{
+    thread_func_t   * func;
+    void            * arg;
+    hb_task_group_t * group;
+    hb_task_t       * next;
+};
+
+struct hb_task_group_s
+{
+    volatile int      pending;
+    hb_lock_t       * lock;
+    hb_cond_t       * cond;
+};
+
+typedef struct
+{
+    int      worker_count;
+    uint64_t tasks_run;      // tasks executed by the pool workers
+    uint64_t tasks_helped;   // tasks executed by threads waiting on a group
+    uint64_t tasks_stolen;   // tasks a worker took from another worker
+    uint64_t busy_us;        // time spent running tasks, all workers
+    uint64_t uptime_us;      // time since the workers were started
+} hb_threadpool_stats_t;
+
+void hb_threadpool_init( void );
+void hb_threadpool_close( void );
+int  hb_threadpool_worker_count( void );
+void hb_threadpool_get_stats( hb_threadpool_stats_t * stats );
+// Logs pool activity since 'since' was sampled, or since the
+// workers started if 'since' is NULL
+void hb_threadpool_log_stats( const char * prefix,
+                              const hb_threadpool_stats_t * since );
+
+int  hb_task_group_init( hb_task_group_t * group );
+void hb_task_group_close( hb_task_group_t * group );
+// 'task' must stay valid until the group has been waited on
+void hb_task_group_submit( hb_task_group_t * group, hb_task_t * task,
+                           thread_func_t * func, void * arg );
+void hb_task_group_wait( hb_task_group_t * group );
+
+#endif /* HANDBRAKE_THREADPOOL_H */
@@ -11,6 +11,10 @@
 #include "handbrake/hbffmpeg.h"
 #include "handbrake/hbavfilter.h"
 #include "handbrake/encx264.h"
+#include "handbrake/threadpool.h"
+#include "handbrake/telemetry.h"
+#include "handbrake/startcode.h"
+#include "handbrake/previewstore.h"
 #include "libavfilter/avfilter.h"
 #include <stdio.h>
 #include <unistd.h>
@@ -51,8 +55,19 @@ struct hb_handle_s
     hb_error_code  work_error;
     hb_thread_t  * work_thread;
 
+    int            max_concurrent_jobs;
+
+    /* Lets the work thread sleep until a work object finishes
+       or the job is stopped. See hb_work_signal() */
+    hb_lock_t    * work_lock;
+    hb_cond_t    * work_cond;
+    uint64_t       work_event;
+
     hb_lock_t    * state_lock;
     hb_state_t     state;
+    /* Job sequences being worked on, protected by state_lock.
+       The state of the first one is also reported in state. */
+    hb_list_t    * running_jobs;
 
     int            paused;
     hb_lock_t    * pause_lock;
@@ -68,8 +83,24 @@ struct hb_handle_s
 
     // power management opaque pointer
     void         * system_sleep_opaque;
+
+    // Scan previews, see hb_save_preview()
+    hb_preview_store_t * preview_store;
+
+    // Background rendering of previews, see hb_preview_prerender()
+    struct hb_prerender_s * prerender;
+    hb_thread_t  * prerender_thread;
 };
 
+/* State of a job sequence being worked on, see hb_running_job_add() */
+typedef struct
+{
+    int              sequence_id;
+    hb_job_t       * job;       // current pass, NULL until the first one
+    hb_state_t       state;
+    hb_telemetry_t * telemetry;
+} hb_running_job_t;
+
 hb_work_object_t * hb_objects = NULL;
 int hb_instance_counter = 0;
 int disable_hardware = 0;
@@ -215,12 +246,20 @@ hb_handle_t * hb_init( int verbose )
 
     h->state_lock  = hb_lock_init();
     h->state.state = HB_STATE_IDLE;
+    h->running_jobs = hb_list_init();
+
+    h->max_concurrent_jobs = 1;
 
     h->pause_lock = hb_lock_init();
     h->pause_date = -1;
 
+    h->work_lock = hb_lock_init();
+    h->work_cond = hb_cond_init();
+
     h->interjob = calloc( sizeof( hb_interjob_t ), 1 );
 
+    h->preview_store = hb_preview_store_init( h->id );
+
     /* Start library thread */
     hb_log( "hb_init: starting libhb thread" );
     h->die         = 0;
@@ -317,6 +356,8 @@ void hb_remove_previews( hb_handle_t * h )
     DIR           * dir;
     struct dirent * entry;
 
+    hb_preview_store_clear( h->preview_store );
+
     dirname = hb_get_temporary_directory();
     dir = opendir( dirname );
     if (dir == NULL)
@@ -420,6 +461,7 @@ void hb_scan( hb_handle_t * h, hb_list_t * paths, int title_index,
     h->scan_die = 0;
 
     /* Clean up from previous scan */
+    hb_preview_prerender_stop( h );
     hb_remove_previews( h );
     while( ( title = hb_list_item( h->title_set.list_title, 0 ) ) )
     {
@@ -467,6 +509,20 @@ void hb_force_rescan( hb_handle_t * h )
     h->title_set.path = NULL;
 }
 
+/**
+ * Blocks until the scan started by hb_scan() is finished.
+ * Unlike polling for HB_STATE_SCANDONE, this also works while the state
+ * is updated by jobs that are running at the same time.
+ * @param h Handle to hb_handle_t
+ */
+void hb_scan_wait( hb_handle_t * h )
+{
+    while (__atomic_load_n(&h->scan_thread, __ATOMIC_ACQUIRE) != NULL)
+    {
+        hb_snooze(50);
+    }
+}
+
 /**
  * Returns the list of titles found.
  * @param h Handle to hb_handle_t
@@ -491,6 +547,11 @@ int hb_save_preview( hb_handle_t * h, int title, int preview, hb_buffer_t *buf,
     const int format_chars = 4;
     char      format_string[format_chars];
 
+    if (format == HB_PREVIEW_FORMAT_RAW)
+    {
+        return hb_preview_store_put(h->preview_store, title, preview, buf);
+    }
+
     switch (format)
     {
         case HB_PREVIEW_FORMAT_YUV:
@@ -520,6 +581,15 @@ int hb_save_preview( hb_handle_t * h, int title, int preview, hb_buffer_t *buf,
         return -1;
     }
 
+    // The preview files are 8 bit 4:2:0
+    hb_buffer_t * yuv420p = hb_preview_to_yuv420p(buf);
+    if (yuv420p == NULL)
+    {
+        hb_error("hb_save_preview: Failed to convert preview %d", preview);
+        goto done;
+    }
+    buf = yuv420p;
+
     if (format == HB_PREVIEW_FORMAT_YUV)
     {
         int pp, hh;
@@ -599,6 +669,7 @@ int hb_save_preview( hb_handle_t * h, int title, int preview, hb_buffer_t *buf,
     }
 
 done:
+    hb_buffer_close(&yuv420p);
     free(filename);
     fclose(file);
 
@@ -614,6 +685,11 @@ hb_buffer_t * hb_read_preview(hb_handle_t * h, hb_title_t *title, int preview, i
     const int format_chars = 4;
     char      format_string[format_chars];
 
+    if (format == HB_PREVIEW_FORMAT_RAW)
+    {
+        return hb_preview_store_get(h->preview_store, title->index, preview);
+    }
+
     hb_buffer_t * buf;
     buf = hb_frame_buffer_init(AV_PIX_FMT_YUV420P,
                                title->geometry.width, title->geometry.height);
@@ -775,7 +851,9 @@ hb_image_t * hb_get_preview3(hb_handle_t * h, int picture,
 {
     hb_job_t    * job;
     hb_title_t  * title = NULL;
-    hb_buffer_t * in = NULL, * out;
+    hb_buffer_t * in = NULL, * out = NULL;
+    char       ** keys = NULL;
+    int           start = 0;
 
     job = hb_dict_to_job(h, job_dict);
     if (job == NULL)
@@ -785,9 +863,10 @@ hb_image_t * hb_get_preview3(hb_handle_t * h, int picture,
     }
     title = job->title;
 
-    in = hb_read_preview( h, title, picture, HB_PREVIEW_FORMAT_JPG );
+    in = hb_read_preview( h, title, picture, HB_PREVIEW_FORMAT_RAW );
     if (in == NULL)
     {
+        hb_error("hb_get_preview3: preview %d not available", picture);
         goto fail;
     }
 
@@ -800,15 +879,17 @@ hb_image_t * hb_get_preview3(hb_handle_t * h, int picture,
     init.time_base.num = 1;
     init.time_base.den = 90000;
     init.job = job;
-    init.pix_fmt = AV_PIX_FMT_YUV420P;
+    init.pix_fmt = in->f.fmt;
     init.hw_pix_fmt = AV_PIX_FMT_NONE;
-    init.color_range = AVCOL_RANGE_MPEG;
+    init.color_range = in->f.color_range;
 
     init.color_prim = title->color_prim;
     init.color_transfer = title->color_transfer;
     init.color_matrix = title->color_matrix;
     init.chroma_location = title->chroma_location;
     init.geometry = title->geometry;
+    init.geometry.width = in->f.width;
+    init.geometry.height = in->f.height;
     memset(init.crop, 0, sizeof(int[4]));
     init.vrate = job->vrate;
     init.cfr = 0;
@@ -942,11 +1023,52 @@ hb_image_t * hb_get_preview3(hb_handle_t * h, int picture,
         ii++;
     }
 
+    // The output of each filter is cached under a key made of the
+    // settings of the filters up to it.  Resume from the last stage
+    // whose output is known, so that changing the settings of a filter
+    // only runs it and the filters after it.
+    int count = hb_list_count(list_filter);
+
+    keys = calloc(count + 1, sizeof(char*));
+    keys[0] = hb_strdup_printf("%d:%d", par.num, par.den);
+    for (ii = 0; ii < count; ii++)
+    {
+        filter = hb_list_item(list_filter, ii);
+        if (filter->skip)
+        {
+            keys[ii + 1] = strdup(keys[ii]);
+            continue;
+        }
+        char * settings = hb_value_get_json(filter->settings);
+        keys[ii + 1] = hb_strdup_printf("%s|%d:%s", keys[ii], filter->id,
+                                        settings != NULL ? settings : "");
+        free(settings);
+    }
+    for (ii = count; ii > 0; ii--)
+    {
+        hb_buffer_t * cached;
+
+        filter = hb_list_item(list_filter, ii - 1);
+        if (filter->skip)
+        {
+            continue;
+        }
+        cached = hb_preview_store_get_stage(h->preview_store, title->index,
+                                            picture, keys[ii]);
+        if (cached != NULL)
+        {
+            hb_buffer_close(&in);
+            in = cached;
+            start = ii;
+            break;
+        }
+    }
+
     // Set up filter fifos
     hb_fifo_t *fifo_in, * fifo_first, * fifo_last;
 
     fifo_last = fifo_in = fifo_first = hb_fifo_init(2, 2);
-    for( ii = 0; ii < hb_list_count( list_filter ); ii++)
+    for (ii = start; ii < count; ii++)
     {
         filter = hb_list_item(list_filter, ii);
         if (!filter->skip)
@@ -961,17 +1083,29 @@ hb_image_t * hb_get_preview3(hb_handle_t * h, int picture,
     hb_fifo_push(fifo_first, in);
     hb_fifo_push(fifo_first, hb_buffer_eof_init());
 
-    // Process the preview frame through all filters
-    for( ii = 0; ii < hb_list_count( list_filter ); ii++)
+    // Process the preview frame through the remaining filters
+    for (ii = start; ii < count; ii++)
     {
         filter = hb_list_item(list_filter, ii);
         if (!filter->skip)
         {
+            hb_buffer_t * stage;
+
             process_filter(filter);
+            stage = hb_fifo_see(filter->fifo_out);
+            if (stage != NULL && !(stage->s.flags & HB_BUF_FLAG_EOF))
+            {
+                hb_preview_store_put_stage(h->preview_store, title->index,
+                                           picture, keys[ii + 1], stage);
+            }
         }
     }
     // Retrieve the filtered preview frame
     out = hb_fifo_get(fifo_last);
+    if (out != NULL && (out->s.flags & HB_BUF_FLAG_EOF))
+    {
+        hb_buffer_close(&out);
+    }
 
     // Close filters
     for (ii = 0; ii < hb_list_count(list_filter); ii++)
@@ -987,6 +1121,11 @@ hb_image_t * hb_get_preview3(hb_handle_t * h, int picture,
         filter = hb_list_item(list_filter, ii);
         hb_fifo_close(&filter->fifo_out);
     }
+    for (ii = 0; ii <= count; ii++)
+    {
+        free(keys[ii]);
+    }
+    free(keys);
 
     if (out == NULL)
     {
@@ -1029,6 +1168,82 @@ fail:
     return image;
 }
 
+struct hb_prerender_s
+{
+    hb_handle_t  * h;
+    hb_dict_t    * job_dict;
+    volatile int   die;
+};
+
+static void prerender_func( void * _p )
+{
+    struct hb_prerender_s * p = _p;
+    hb_job_t              * job;
+    int                     ii, count;
+
+    job = hb_dict_to_job(p->h, p->job_dict);
+    if (job == NULL)
+    {
+        return;
+    }
+    count = job->title->preview_count;
+    hb_job_close(&job);
+
+    for (ii = 0; ii < count && !p->die; ii++)
+    {
+        hb_image_t * image = hb_get_preview3(p->h, ii, p->job_dict);
+        hb_image_close(&image);
+    }
+}
+
+/**
+ * Renders all the previews of a job in a background thread.
+ * The filter stages are kept in the preview cache, so that the
+ * hb_get_preview3() calls of a frontend that steps through the previews
+ * with the same settings only convert the cached frames.
+ * A running prerender is stopped first.
+ * @param h Handle to hb_handle_t
+ * @param job_dict The job settings, as given to hb_get_preview3()
+ */
+void hb_preview_prerender( hb_handle_t * h, hb_dict_t * job_dict )
+{
+    struct hb_prerender_s * p;
+
+    hb_preview_prerender_stop(h);
+
+    p = calloc(1, sizeof(struct hb_prerender_s));
+    if (p == NULL)
+    {
+        return;
+    }
+    p->h        = h;
+    p->job_dict = hb_value_dup(job_dict);
+
+    h->prerender        = p;
+    h->prerender_thread = hb_thread_init("preview_prerender", prerender_func,
+                                         p, HB_LOW_PRIORITY);
+}
+
+/**
+ * Stops the background rendering started by hb_preview_prerender()
+ * and waits for it to finish.
+ * @param h Handle to hb_handle_t
+ */
+void hb_preview_prerender_stop( hb_handle_t * h )
+{
+    struct hb_prerender_s * p = h->prerender;
+
+    if (p == NULL)
+    {
+        return;
+    }
+    p->die = 1;
+    hb_thread_close(&h->prerender_thread);
+    hb_value_free(&p->job_dict);
+    free(p);
+    h->prerender = NULL;
+}
+
  /**
  * Analyzes a frame to detect interlacing artifacts
  * and returns true if interlacing (combing) is found.
@@ -1061,12 +1276,16 @@ int hb_detect_comb( hb_buffer_t * buf, int color_equal, int color_diff, int thre
         threshold = prog_threshold;
     }
 
+    /* Previews may have more than 8 bits, compare the 8 most significant */
+    int shift = MAX( hb_get_bit_depth( buf->f.fmt ) - 8, 0 );
+
     /* One pas for Y, one pass for Cb, one pass for Cr */
     for( k = 0; k <= buf->f.max_plane; k++ )
     {
         uint8_t * data = buf->plane[k].data;
+        uint16_t * data16 = (uint16_t *)buf->plane[k].data;
         int width = buf->plane[k].width;
-        int stride = buf->plane[k].stride;
+        int stride = shift ? buf->plane[k].stride / 2 : buf->plane[k].stride;
         int height = buf->plane[k].height;
 
         for( j = 0; j < width; ++j )
@@ -1076,10 +1295,20 @@ int hb_detect_comb( hb_buffer_t * buf, int color_equal, int color_diff, int thre
             for( n = 0; n < ( height - 4 ); n = n + 2 )
             {
                 /* Look at groups of 4 sequential horizontal lines */
-                s1 = ( ( data )[ off + j              ] & 0xff );
-                s2 = ( ( data )[ off + j +     stride ] & 0xff );
-                s3 = ( ( data )[ off + j + 2 * stride ] & 0xff );
-                s4 = ( ( data )[ off + j + 3 * stride ] & 0xff );
+                if ( shift )
+                {
+                    s1 = data16[ off + j              ] >> shift;
+                    s2 = data16[ off + j +     stride ] >> shift;
+                    s3 = data16[ off + j + 2 * stride ] >> shift;
+                    s4 = data16[ off + j + 3 * stride ] >> shift;
+                }
+                else
+                {
+                    s1 = ( ( data )[ off + j              ] & 0xff );
+                    s2 = ( ( data )[ off + j +     stride ] & 0xff );
+                    s3 = ( ( data )[ off + j + 2 * stride ] & 0xff );
+                    s4 = ( ( data )[ off + j + 3 * stride ] & 0xff );
+                }
 
                 /* Note if the 1st and 2nd lines are more different in
                    color than the 1st and 3rd lines are similar in color.*/
@@ -1106,7 +1335,7 @@ int hb_detect_comb( hb_buffer_t * buf, int color_equal, int color_diff, int thre
     }
 
 
-    /* HandBrake previews are all yuv420, so weight the average percentage of all 3 planes accordingly. */
+    /* Weight the average percentage of all 3 planes as for yuv420, the usual preview format. */
     int average_cc = ( 2 * cc[0] + ( cc[1] / 2 ) + ( cc[2] / 2 ) ) / 3;
 
     /* Now see if that average percentage of combed pixels surpasses the threshold percentage given by the user.*/
@@ -1971,7 +2200,24 @@ void hb_start( hb_handle_t * h )
     h->pause_duration = 0;
     h->work_die       = 0;
     h->work_error     = HB_ERROR_NONE;
-    h->work_thread    = hb_work_init( h->jobs, &h->work_die, &h->work_error, &h->current_job );
+    h->work_thread    = hb_work_init( h, h->jobs, &h->work_die, &h->work_error );
+}
+
+/**
+ * Sets how many queued jobs are worked on at the same time.
+ * Each running job has its own pipeline and gets an equal share of the
+ * logical processors. Takes effect on the next hb_start().
+ * @param h Handle to hb_handle_t.
+ * @param count Number of jobs, 1 (the default) processes the queue in order.
+ */
+void hb_set_max_concurrent_jobs( hb_handle_t * h, int count )
+{
+    h->max_concurrent_jobs = MAX(1, MIN(count, hb_get_cpu_count()));
+}
+
+int hb_get_max_concurrent_jobs( hb_handle_t * h )
+{
+    return h->max_concurrent_jobs;
 }
 
 /**
@@ -1989,6 +2235,11 @@ void hb_pause( hb_handle_t * h )
 
         hb_lock( h->state_lock );
         h->state.state = HB_STATE_PAUSED;
+        for (int ii = 0; ii < hb_list_count(h->running_jobs); ii++)
+        {
+            hb_running_job_t * r = hb_list_item(h->running_jobs, ii);
+            r->state.state = HB_STATE_PAUSED;
+        }
         hb_unlock( h->state_lock );
     }
 }
@@ -2006,9 +2257,19 @@ void hb_resume( hb_handle_t * h )
             // Calculate paused time for current job sequence
             h->pause_duration    += hb_get_date() - h->pause_date;
 
-            // Calculate paused time for current job pass
-            // Required to calculate accurate ETA for pass
-            h->current_job->st_paused += hb_get_date() - h->pause_date;
+            // Calculate paused time for the current pass of every
+            // running job. Required to calculate accurate ETA for pass
+            hb_lock( h->state_lock );
+            for (int ii = 0; ii < hb_list_count(h->running_jobs); ii++)
+            {
+                hb_running_job_t * r = hb_list_item(h->running_jobs, ii);
+                if (r->job != NULL)
+                {
+                    r->job->st_paused += hb_get_date() - h->pause_date;
+                }
+                r->state.param.working.paused = h->pause_duration;
+            }
+            hb_unlock( h->state_lock );
             h->pause_date              = -1;
             h->state.param.working.paused = h->pause_duration;
         }
@@ -2026,9 +2287,57 @@ void hb_stop( hb_handle_t * h )
 {
     h->work_error = HB_ERROR_CANCELED;
     h->work_die   = 1;
+    hb_work_signal( h );
     hb_resume( h );
 }
 
+/**
+ * Wakes up the work threads.
+ * Called when a work object exits or the job is stopped, so that the
+ * work threads can react without polling.
+ * @param h Handle to hb_handle_t.
+ */
+void hb_work_signal( hb_handle_t * h )
+{
+    hb_lock( h->work_lock );
+    h->work_event++;
+    hb_cond_broadcast( h->work_cond );
+    hb_unlock( h->work_lock );
+}
+
+/**
+ * Returns the number of hb_work_signal() calls so far.
+ * @param h Handle to hb_handle_t.
+ */
+uint64_t hb_work_event_count( hb_handle_t * h )
+{
+    uint64_t count;
+
+    hb_lock( h->work_lock );
+    count = h->work_event;
+    hb_unlock( h->work_lock );
+
+    return count;
+}
+
+/**
+ * Blocks until hb_work_signal() is called.
+ * Several threads may wait at the same time, so callers read
+ * hb_work_event_count() before checking the condition they are
+ * waiting for, and pass it here.
+ * @param h Handle to hb_handle_t.
+ * @param seen Value of hb_work_event_count() read before the check.
+ */
+void hb_work_wait( hb_handle_t * h, uint64_t seen )
+{
+    hb_lock( h->work_lock );
+    while( h->work_event == seen )
+    {
+        hb_cond_wait( h->work_cond, h->work_lock );
+    }
+    hb_unlock( h->work_lock );
+}
+
 /**
  * Stops the conversion process.
  * @param h Handle to hb_handle_t.
@@ -2076,6 +2385,7 @@ void hb_close( hb_handle_t ** _h )
     h->die = 1;
 
     hb_thread_close( &h->main_thread );
+    hb_preview_prerender_stop( h );
 
     while( ( title = hb_list_item( h->title_set.list_title, 0 ) ) )
     {
@@ -2087,13 +2397,18 @@ void hb_close( hb_handle_t ** _h )
     h->title_set.path = NULL;
 
     hb_list_close( &h->jobs );
+    hb_list_close( &h->running_jobs );
     hb_lock_close( &h->state_lock );
     hb_lock_close( &h->pause_lock );
+    hb_lock_close( &h->work_lock );
+    hb_cond_close( &h->work_cond );
 
     hb_system_sleep_opaque_close(&h->system_sleep_opaque);
 
     free( h->interjob );
 
+    hb_preview_store_close( &h->preview_store );
+
     free( h );
     *_h = NULL;
 }
@@ -2157,11 +2472,18 @@ int hb_global_init()
 
     hb_x264_global_init();
     hb_common_global_init(disable_hardware);
+    hb_startcode_init();
 
     /*
      * Initialise buffer pool
      */
     hb_buffer_pool_init();
+    hb_frame_pool_init();
+
+    /*
+     * Initialise the shared thread pool, workers start on first use
+     */
+    hb_threadpool_init();
 
     // Initialize the builtin presets hb_dict_t
     hb_presets_builtin_init();
@@ -2179,6 +2501,7 @@ void hb_global_close()
     struct dirent * entry;
 
     hb_presets_free();
+    hb_threadpool_close();
 
     /* Find and remove temp folder */
     dirname = hb_get_temporary_directory();
@@ -2355,6 +2678,239 @@ void hb_set_state( hb_handle_t * h, hb_state_t * s )
     hb_unlock( h->pause_lock );
 }
 
+static hb_running_job_t * find_running_job( hb_handle_t * h, int sequence_id )
+{
+    for (int ii = 0; ii < hb_list_count(h->running_jobs); ii++)
+    {
+        hb_running_job_t * r = hb_list_item(h->running_jobs, ii);
+        if (r->sequence_id == sequence_id)
+        {
+            return r;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Registers a job sequence that starts being worked on.
+ * Each running job sequence has its own state, see hb_set_job_state().
+ * The first one registered is also the one hb_get_state() reports.
+ * @param h Handle to hb_handle_t
+ * @param sequence_id Sequence of the job
+ */
+void hb_running_job_add( hb_handle_t * h, int sequence_id )
+{
+    hb_running_job_t * r = calloc(1, sizeof(hb_running_job_t));
+
+    if (r == NULL)
+    {
+        return;
+    }
+    r->sequence_id       = sequence_id;
+    r->state.state       = HB_STATE_WORKING;
+    r->state.sequence_id = sequence_id;
+
+    hb_lock( h->state_lock );
+    hb_list_add(h->running_jobs, r);
+    hb_unlock( h->state_lock );
+}
+
+/**
+ * Sets the pass of a running job sequence that is being worked on.
+ * @param h Handle to hb_handle_t
+ * @param job The pass
+ */
+void hb_running_job_set_pass( hb_handle_t * h, hb_job_t * job )
+{
+    hb_running_job_t * r;
+
+    hb_lock( h->state_lock );
+    r = find_running_job(h, job->sequence_id);
+    if (r != NULL)
+    {
+        r->job = job;
+    }
+    if (r == NULL || r == hb_list_item(h->running_jobs, 0))
+    {
+        h->current_job = job;
+    }
+    hb_unlock( h->state_lock );
+}
+
+/**
+ * Unregisters a job sequence when its last pass is done.
+ * The passes of the job must still be valid when this is called.
+ * @param h Handle to hb_handle_t
+ * @param sequence_id Sequence of the job
+ */
+void hb_running_job_remove( hb_handle_t * h, int sequence_id )
+{
+    hb_running_job_t * r, * first;
+
+    hb_lock( h->state_lock );
+    r = find_running_job(h, sequence_id);
+    if (r != NULL)
+    {
+        int primary = r == hb_list_item(h->running_jobs, 0);
+
+        hb_list_rem(h->running_jobs, r);
+        free(r);
+
+        if (primary)
+        {
+            // The next running job is now the one hb_get_state() reports
+            first = hb_list_item(h->running_jobs, 0);
+            h->current_job = first != NULL ? first->job : NULL;
+            if (first != NULL)
+            {
+                memcpy(&h->state, &first->state, sizeof(hb_state_t));
+            }
+        }
+    }
+    hb_unlock( h->state_lock );
+}
+
+/**
+ * Frees the buffers kept in the buffer pools, unless other job
+ * sequences are running.  The pools and their allocation counters
+ * are shared by all running jobs, so they are left alone until the
+ * last running job is done with them.
+ * @param h Handle to hb_handle_t
+ */
+void hb_running_job_pool_free( hb_handle_t * h )
+{
+    // Holding the state lock keeps another job from registering
+    // and allocating while the pools are drained
+    hb_lock( h->state_lock );
+    if (hb_list_count(h->running_jobs) <= 1)
+    {
+        hb_buffer_pool_free();
+    }
+    hb_unlock( h->state_lock );
+}
+
+/**
+ * Sets the state of a running job.
+ * Like hb_set_state(), blocks while the handle is paused.
+ * @param job Handle to hb_job_t
+ * @param s Handle to new hb_state_t
+ */
+void hb_set_job_state( hb_job_t * job, hb_state_t * s )
+{
+    hb_handle_t      * h = job->h;
+    hb_running_job_t * r;
+
+    hb_lock( h->pause_lock );
+    hb_lock( h->state_lock );
+    r = find_running_job(h, job->sequence_id);
+    if (r != NULL)
+    {
+        memcpy(&r->state, s, sizeof(hb_state_t));
+        if (s->state == HB_STATE_WORKING || s->state == HB_STATE_SEARCHING)
+        {
+            r->state.sequence_id = job->sequence_id;
+        }
+    }
+    if (r == NULL || r == hb_list_item(h->running_jobs, 0))
+    {
+        memcpy(&h->state, s, sizeof(hb_state_t));
+        if (s->state == HB_STATE_WORKING || s->state == HB_STATE_SEARCHING)
+        {
+            h->state.sequence_id = job->sequence_id;
+        }
+    }
+    hb_unlock( h->state_lock );
+    hb_unlock( h->pause_lock );
+}
+
+/**
+ * Returns the state of a running job.
+ * @param job Handle to hb_job_t
+ * @param s Handle to hb_state_t which to copy the state data.
+ */
+void hb_get_job_state( hb_job_t * job, hb_state_t * s )
+{
+    hb_handle_t      * h = job->h;
+    hb_running_job_t * r;
+
+    hb_lock( h->state_lock );
+    r = find_running_job(h, job->sequence_id);
+    memcpy(s, r != NULL ? &r->state : &h->state, sizeof(hb_state_t));
+    hb_unlock( h->state_lock );
+}
+
+/**
+ * Publishes the pipeline counters of a running job in the json state.
+ * @param job Handle to hb_job_t
+ * @param telemetry Counters of the job, NULL when the job is done
+ */
+void hb_set_job_telemetry( hb_job_t * job, hb_telemetry_t * telemetry )
+{
+    hb_handle_t      * h = job->h;
+    hb_running_job_t * r;
+
+    hb_lock( h->state_lock );
+    r = find_running_job(h, job->sequence_id);
+    if (r != NULL)
+    {
+        r->telemetry = telemetry;
+    }
+    hb_unlock( h->state_lock );
+}
+
+/**
+ * Returns the pipeline counters of the job hb_get_state() reports,
+ * NULL if it doesn't collect them.
+ */
+hb_dict_t * hb_get_telemetry_dict( hb_handle_t * h )
+{
+    hb_running_job_t * r;
+    hb_dict_t        * dict = NULL;
+
+    hb_lock( h->state_lock );
+    r = hb_list_item(h->running_jobs, 0);
+    if (r != NULL)
+    {
+        dict = hb_telemetry_to_dict(r->telemetry);
+    }
+    hb_unlock( h->state_lock );
+
+    return dict;
+}
+
+/**
+ * Returns the state of every running job, in the layout of
+ * hb_handle_state_to_dict() plus the SequenceID of the job.
+ */
+hb_value_array_t * hb_get_running_jobs_dict( hb_handle_t * h )
+{
+    hb_value_array_t * array = hb_value_array_init();
+
+    hb_lock( h->state_lock );
+    for (int ii = 0; ii < hb_list_count(h->running_jobs); ii++)
+    {
+        hb_running_job_t * r = hb_list_item(h->running_jobs, ii);
+        hb_dict_t        * dict = hb_state_to_dict(&r->state);
+
+        if (dict == NULL)
+        {
+            continue;
+        }
+        hb_dict_set(dict, "SequenceID", hb_value_int(r->sequence_id));
+        if (r->telemetry != NULL &&
+            (r->state.state == HB_STATE_WORKING ||
+             r->state.state == HB_STATE_PAUSED))
+        {
+            hb_dict_set(hb_dict_get(dict, "Working"), "Pipeline",
+                        hb_telemetry_to_dict(r->telemetry));
+        }
+        hb_value_array_append(array, dict);
+    }
+    hb_unlock( h->state_lock );
+
+    return array;
+}
+
 void hb_set_work_error( hb_handle_t * h, hb_error_code err )
 {
     h->work_error = err;
@@ -2376,6 +2932,40 @@ hb_interjob_t * hb_interjob_get( hb_handle_t * h )
     return h->interjob;
 }
 
+/* Persistent data between the passes of a job. Jobs that run
+ * concurrently each have their own, see hb_set_max_concurrent_jobs() */
+hb_interjob_t * hb_job_interjob_get( hb_job_t * job )
+{
+    return job->interjob != NULL ? job->interjob : job->h->interjob;
+}
+
+/**
+ * Returns the number of logical processors a job may keep busy.
+ * All of them unless the job shares the machine with other running jobs.
+ */
+int hb_job_cpu_count( hb_job_t * job )
+{
+    int count = hb_get_cpu_count();
+
+    if (job != NULL && job->cpu_share > 0 && job->cpu_share < count)
+    {
+        return job->cpu_share;
+    }
+    return count;
+}
+
+/**
+ * Returns the thread count to pass to hb_avcodec_open() for a job.
+ */
+int hb_job_avcodec_threads( hb_job_t * job )
+{
+    if (job == NULL || job->cpu_share <= 0)
+    {
+        return HB_FFMPEG_THREADS_AUTO;
+    }
+    return hb_job_cpu_count(job) / 2 + 1;
+}
+
 int is_hardware_disabled(void)
 {
     return disable_hardware;
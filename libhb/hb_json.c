@@ -122,6 +122,33 @@ hb_dict_t* hb_state_to_dict( hb_state_t * state)
     return dict;
 }
 
+/**
+ * Same as hb_state_to_dict(), and adds the per stage pipeline counters
+ * of the running job when the job collects them (Pipeline.Telemetry).
+ * When jobs run concurrently, "Jobs" lists the state of each of them.
+ * @param h - Pointer to the hb_handle_t the state was read from
+ * @param state - State returned by hb_get_state()
+ */
+hb_dict_t * hb_handle_state_to_dict(hb_handle_t * h, hb_state_t * state)
+{
+    hb_dict_t *dict = hb_state_to_dict(state);
+
+    if (dict != NULL &&
+        (state->state == HB_STATE_WORKING || state->state == HB_STATE_PAUSED))
+    {
+        hb_dict_t *pipeline = hb_get_telemetry_dict(h);
+        if (pipeline != NULL)
+        {
+            hb_dict_set(hb_dict_get(dict, "Working"), "Pipeline", pipeline);
+        }
+    }
+    if (dict != NULL && hb_get_max_concurrent_jobs(h) > 1)
+    {
+        hb_dict_set(dict, "Jobs", hb_get_running_jobs_dict(h));
+    }
+    return dict;
+}
+
 hb_dict_t * hb_version_dict()
 {
     hb_dict_t * dict;
@@ -159,7 +186,7 @@ char* hb_get_state_json( hb_handle_t * h )
     hb_state_t state;
 
     hb_get_state(h, &state);
-    hb_dict_t *dict = hb_state_to_dict(&state);
+    hb_dict_t *dict = hb_handle_state_to_dict(h, &state);
 
     char *json_state = hb_value_get_json(dict);
     hb_value_free(&dict);
@@ -308,6 +335,12 @@ static hb_dict_t* hb_title_to_dict_internal( hb_title_t *title )
 
     free(chroma_subsampling);
 
+    // Previews decoded in fast mode, LowConfidence tells when a full
+    // scan may find a different frame rate or interlacing
+    hb_dict_set_bool(dict, "FastScan", !!(title->flags & HBTF_FAST_SCAN));
+    hb_dict_set_bool(dict, "LowConfidence",
+                     !!(title->flags & HBTF_LOW_CONFIDENCE));
+
     // Mastering Display Color Volume metadata
     hb_dict_t *mastering_dict;
     if (title->mastering.has_primaries || title->mastering.has_luminance)
@@ -607,8 +640,11 @@ hb_dict_t* hb_job_to_dict( const hb_job_t * job )
     "s:{s:{s:o, s:o, s:o, s:o}, s:[]},"
     // Metadata
     "s:o,"
-    // Filters {FilterList []}
-    "s:{s:[]}"
+    // Filters {FilterList [], Fusion}
+    "s:{s:[], s:o},"
+    // Pipeline {FifoMemoryBudget, Telemetry, CpuPlacement, FramePoolLimit,
+    //           HugePages, ReadAhead}
+    "s:{s:o, s:o, s:o, s:o, s:o, s:o}"
     "}",
         "SequenceID",           hb_value_int(job->sequence_id),
         "Destination",
@@ -646,7 +682,15 @@ hb_dict_t* hb_job_to_dict( const hb_job_t * job )
             "SubtitleList",
         "Metadata",             hb_value_dup(job->metadata->dict),
         "Filters",
-            "FilterList"
+            "FilterList",
+            "Fusion",           hb_value_bool(job->filter_fusion),
+        "Pipeline",
+            "FifoMemoryBudget", hb_value_int(job->fifo_memory_budget),
+            "Telemetry",        hb_value_bool(job->pipeline_telemetry),
+            "CpuPlacement",     hb_value_bool(job->cpu_placement),
+            "FramePoolLimit",   hb_value_int(job->frame_pool_limit),
+            "HugePages",        hb_value_bool(job->huge_pages),
+            "ReadAhead",        hb_value_int(job->read_ahead_limit)
     );
     if (dict == NULL)
     {
@@ -1041,13 +1085,7 @@ void hb_json_job_scan( hb_handle_t * h, const char * json_job )
     hb_list_close(&file_paths);
 
     // Wait for scan to complete
-    hb_state_t state;
-    hb_get_state2(h, &state);
-    while (state.state == HB_STATE_SCANNING)
-    {
-        hb_snooze(50);
-        hb_get_state2(h, &state);
-    }
+    hb_scan_wait(h);
     hb_value_free(&dict);
 }
 
@@ -1120,6 +1158,9 @@ hb_job_t* hb_dict_to_job( hb_handle_t * h, hb_dict_t *dict )
     int                vbitrate = -1;
     double             vquality = HB_INVALID_VIDEO_QUALITY;
     int                adapter_index = -1;
+    json_int_t         fifo_memory_budget = 0;
+    json_int_t         frame_pool_limit = 0;
+    json_int_t         read_ahead_limit = 0;
     hb_dict_t        * meta_dict = NULL;
 
     result = json_unpack_ex(dict, &error, 0,
@@ -1160,8 +1201,11 @@ hb_job_t* hb_dict_to_job( hb_handle_t * h, hb_dict_t *dict )
     "s?{s?{s:b, s?b, s?b, s?b}, s?o},"
     // Metadata
     "s?o,"
-    // Filters {FilterList}
-    "s?{s?o}"
+    // Filters {FilterList, Fusion}
+    "s?{s?o, s?b},"
+    // Pipeline {FifoMemoryBudget, Telemetry, CpuPlacement, FramePoolLimit,
+    //           HugePages, ReadAhead}
+    "s?{s?I, s?b, s?b, s?I, s?b, s?I}"
     "}",
         "SequenceID",               unpack_i(&job->sequence_id),
         "Destination",
@@ -1227,13 +1271,24 @@ hb_job_t* hb_dict_to_job( hb_handle_t * h, hb_dict_t *dict )
             "SubtitleList",         unpack_o(&subtitle_list),
         "Metadata",                 unpack_o(&meta_dict),
         "Filters",
-            "FilterList",           unpack_o(&filter_list)
+            "FilterList",           unpack_o(&filter_list),
+            "Fusion",               unpack_b(&job->filter_fusion),
+        "Pipeline",
+            "FifoMemoryBudget",     unpack_I(&fifo_memory_budget),
+            "Telemetry",            unpack_b(&job->pipeline_telemetry),
+            "CpuPlacement",         unpack_b(&job->cpu_placement),
+            "FramePoolLimit",       unpack_I(&frame_pool_limit),
+            "HugePages",            unpack_b(&job->huge_pages),
+            "ReadAhead",            unpack_I(&read_ahead_limit)
     );
     if (result < 0)
     {
         hb_error("hb_dict_to_job: failed to parse dict: %s", error.text);
         goto fail;
     }
+    job->fifo_memory_budget = MAX(fifo_memory_budget, 0);
+    job->frame_pool_limit   = MAX(frame_pool_limit, -1);
+    job->read_ahead_limit   = MAX(read_ahead_limit, -1);
     if (meta_dict != NULL)
     {
         hb_value_free(&job->metadata->dict);
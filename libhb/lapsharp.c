@@ -7,7 +7,18 @@
    For full terms see the file COPYING file or visit http://www.gnu.org/licenses/gpl-2.0.html
  */
 
-#include "handbrake/handbrake.h"
+#include "handbrake/handbrake.h"     // needed for ARCH_X86
+
+#if defined(ARCH_X86)
+#include <immintrin.h>
+#include "libavutil/cpu.h"
+#define HAVE_LAPSHARP_SIMD 1
+#define LAPSHARP_TARGET_SSE41 __attribute__((target("sse4.1")))
+#elif defined(__aarch64__)
+#include "sse2neon.h"
+#define HAVE_LAPSHARP_SIMD 1
+#define LAPSHARP_TARGET_SSE41
+#endif
 
 #define LAPSHARP_STRENGTH_LUMA_DEFAULT   0.2
 #define LAPSHARP_STRENGTH_CHROMA_DEFAULT 0.2
@@ -16,14 +27,29 @@
 #define LAPSHARP_KERNEL_LUMA_DEFAULT   2
 #define LAPSHARP_KERNEL_CHROMA_DEFAULT 2
 
-typedef struct
+typedef struct lapsharp_plane_context_s lapsharp_plane_context_t;
+
+// Optimized version of the inner part of a line,
+// returns the position it stopped at
+typedef int (*lapsharp_line_t)(const void *src, void *dst, int stride,
+                               int x0, int x1,
+                               const lapsharp_plane_context_t *ctx);
+
+struct lapsharp_plane_context_s
 {
     int        bps;
     int        max_value;
 
     double strength;  // strength
     int    kernel;    // which kernel to use; kernels[kernel]
-} lapsharp_plane_context_t;
+
+    // Taps of the kernel by row and column distance from the center
+    int    radius;
+    int    taps[3][3];
+    double coef;
+
+    lapsharp_line_t line;   // NULL when there is no optimized version
+};
 
 typedef struct {
     const int   *mem;
@@ -101,6 +127,9 @@ static int hb_lapsharp_init(hb_filter_object_t *filter,
 static int hb_lapsharp_work(hb_filter_object_t *filter,
                             hb_buffer_t ** buf_in,
                             hb_buffer_t ** buf_out);
+static int hb_lapsharp_work_stripe(hb_filter_object_t *filter,
+                                   hb_buffer_t *in, hb_buffer_t *out,
+                                   int plane, int y0, int y1, int thread);
 
 static void hb_lapsharp_close(hb_filter_object_t *filter);
 
@@ -117,68 +146,27 @@ hb_filter_object_t hb_filter_lapsharp =
     .settings          = NULL,
     .init              = hb_lapsharp_init,
     .work              = hb_lapsharp_work,
+    .work_stripe       = hb_lapsharp_work_stripe,
     .close             = hb_lapsharp_close,
     .settings_template = hb_lapsharp_template,
 };
 
-#define DEF_LAPSHARP_FUNC(name, nbits, pixelbits)                                                \
-static void name##_##nbits(const uint8_t *frame_src,                                             \
-                                 uint8_t *frame_dst,                                             \
-                           const int width,                                                      \
-                           const int height,                                                     \
-                           int stride_src,                                                       \
-                           int stride_dst,                                                       \
-                           lapsharp_plane_context_t *ctx)                                        \
-{                                                                                                \
-    const kernel_t *kernel = &kernels[ctx->kernel];                                              \
-                                                                                                 \
-    const uint##nbits##_t *src = (const uint##nbits##_t *)frame_src;                             \
-    uint##nbits##_t       *dst = (uint##nbits##_t *)frame_dst;                                   \
-                                                                                                 \
-    stride_src /= ctx->bps;                                                                      \
-    stride_dst /= ctx->bps;                                                                      \
-                                                                                                 \
-    /* Sharpen using selected kernel */                                                          \
-    const int offset_min    = -((kernel->size - 1) / 2);                                         \
-    const int offset_max    =   (kernel->size + 1) / 2;                                          \
-    const int stride_border =   (stride_src - width) / 2;                                        \
-    const int max_value     = ctx->max_value;                                                    \
-                                                                                                 \
-    int##pixelbits##_t pixel;                                                                    \
-                                                                                                 \
-    for (int y = 0; y < height; y++)                                                             \
-    {                                                                                            \
-        for (int x = 0; x < width; x++)                                                          \
-        {                                                                                        \
-            if ((y < offset_max) ||                                                              \
-                (y > height - offset_max) ||                                                     \
-                (x < stride_border + offset_max) ||                                              \
-                (x > width + stride_border - offset_max))                                        \
-            {                                                                                    \
-                *(dst + stride_dst*y + x) = *(src + stride_src*y + x);                           \
-                continue;                                                                        \
-            }                                                                                    \
-                                                                                                 \
-            pixel = 0;                                                                           \
-            for (int k = offset_min; k < offset_max; k++)                                        \
-            {                                                                                    \
-                for (int j = offset_min; j < offset_max; j++)                                    \
-                {                                                                                \
-                    pixel += kernel->mem[((j - offset_min) * kernel->size) +                     \
-                             k - offset_min] * *(src + stride_src*(y + j) + (x + k));            \
-                }                                                                                \
-            }                                                                                    \
-            pixel = (int##pixelbits##_t)(((pixel * kernel->coef) - *(src + stride_src*y + x)) *  \
-                        ctx->strength) + *(src + stride_src*y + x);                              \
-            pixel = pixel < 0 ? 0 : pixel;                                                       \
-            pixel = pixel > max_value ? max_value : pixel;                                       \
-            *(dst + stride_dst*y + x) = (uint##nbits##_t)(pixel);                                \
-        }                                                                                        \
-    }                                                                                            \
-}                                                                                                \
-
-DEF_LAPSHARP_FUNC(lapsharp, 16, 32)
-DEF_LAPSHARP_FUNC(lapsharp, 8, 16)
+#if defined(HAVE_LAPSHARP_SIMD)
+static inline int load_u32(const void *p)
+{
+    int32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+#endif
+
+#define BIT_DEPTH 8
+#include "templates/lapsharp_template.c"
+#undef BIT_DEPTH
+
+#define BIT_DEPTH 16
+#include "templates/lapsharp_template.c"
+#undef BIT_DEPTH
 
 #define hb_lapsharp(...)                               \
     switch (pv->depth)                                 \
@@ -188,6 +176,27 @@ DEF_LAPSHARP_FUNC(lapsharp, 8, 16)
     }                                                  \
 
 
+static lapsharp_line_t lapsharp_line_func(int depth)
+{
+#if defined(ARCH_X86)
+    int flags = av_get_cpu_flags();
+
+    if (flags & AV_CPU_FLAG_AVX2)
+    {
+        return depth > 8 ? lapsharp_line_avx2_16 : lapsharp_line_avx2_8;
+    }
+    if (flags & AV_CPU_FLAG_SSE4)
+    {
+        return depth > 8 ? lapsharp_line_sse41_16 : lapsharp_line_sse41_8;
+    }
+    return NULL;
+#elif defined(HAVE_LAPSHARP_SIMD)
+    return depth > 8 ? lapsharp_line_sse41_16 : lapsharp_line_sse41_8;
+#else
+    return NULL;
+#endif
+}
+
 static int hb_lapsharp_init(hb_filter_object_t *filter,
                             hb_filter_init_t   *init)
 {
@@ -296,6 +305,22 @@ static int hb_lapsharp_init(hb_filter_object_t *filter,
         {
             ctx->kernel = c ? LAPSHARP_KERNEL_CHROMA_DEFAULT : LAPSHARP_KERNEL_LUMA_DEFAULT;
         }
+
+        const kernel_t *kernel = &kernels[ctx->kernel];
+
+        ctx->radius = kernel->size / 2;
+        ctx->coef   = kernel->coef;
+        for (int j = 0; j <= ctx->radius; j++)
+        {
+            for (int k = 0; k <= ctx->radius; k++)
+            {
+                ctx->taps[j][k] = kernel->mem[(ctx->radius + j) * kernel->size +
+                                              ctx->radius + k];
+            }
+        }
+        ctx->line = lapsharp_line_func(pv->depth);
+
+        filter->stripe_halo[c] = ctx->radius;
     }
     pv->output = *init;
 
@@ -345,6 +370,7 @@ static int hb_lapsharp_work(hb_filter_object_t *filter,
                     out->plane[c].data,
                     in->plane[c].width,
                     in->plane[c].height,
+                    0, in->plane[c].height,
                     in->plane[c].stride,
                     out->plane[c].stride,
                     ctx);
@@ -355,3 +381,35 @@ static int hb_lapsharp_work(hb_filter_object_t *filter,
 
     return HB_FILTER_OK;
 }
+
+static int hb_lapsharp_work_stripe(hb_filter_object_t *filter,
+                                   hb_buffer_t *in, hb_buffer_t *out,
+                                   int plane, int y0, int y1, int thread)
+{
+    hb_filter_private_t *pv = filter->private_data;
+    lapsharp_plane_context_t * ctx = &pv->plane_ctx[plane];
+    const int height = in->plane[plane].height;
+    const int halo   = filter->stripe_halo[plane];
+
+    // The kernel reads into the stride padding, so mirror the input rows
+    // this stripe reads. Mirroring a row also reads the start of the next
+    // row, which may not be final yet, so the last row mirrored here is
+    // mirrored again with the next stripe.
+    int m0 = y0 == 0 ? 0 : MIN(y0 + halo - 1, height);
+    int m1 = MIN(y1 + halo, height);
+    if (m1 > m0)
+    {
+        hb_frame_buffer_mirror_stride_rows(in, plane, m0, m1);
+    }
+
+    hb_lapsharp(in->plane[plane].data,
+                out->plane[plane].data,
+                in->plane[plane].width,
+                height,
+                y0, y1,
+                in->plane[plane].stride,
+                out->plane[plane].stride,
+                ctx);
+
+    return HB_FILTER_OK;
+}
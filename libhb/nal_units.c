@@ -13,6 +13,7 @@
 
 #include "handbrake/common.h"
 #include "handbrake/nal_units.h"
+#include "handbrake/startcode.h"
 
 static const uint8_t hb_annexb_startcode[] = { 0x00, 0x00, 0x00, 0x01, };
 
@@ -84,26 +85,18 @@ size_t hb_nal_unit_payload_write_isomp4(uint8_t *buf,
 
 uint8_t* hb_annexb_find_next_nalu(const uint8_t *start, size_t *size)
 {
-    uint8_t *nal = NULL;
-    uint8_t *buf = (uint8_t*)start;
-    uint8_t *end = (uint8_t*)start + *size;
+    const uint8_t *nal;
+    const uint8_t *buf;
+    const uint8_t *end = start + *size;
 
     /* Look for an Annex B start code prefix (3-byte sequence == 1) */
-    while (end - buf > 3)
-    {
-        if (!buf[0] && !buf[1] && buf[2] == 1)
-        {
-            nal = (buf += 3); // NAL unit begins after start code
-            break;
-        }
-        buf++;
-    }
-
-    if (nal == NULL)
+    buf = hb_find_start_code(start, end);
+    if (buf == NULL)
     {
         *size = 0;
         return NULL;
     }
+    nal = (buf += 3); // NAL unit begins after start code
 
     /*
      * Start code prefix found, look for the next one to determine the size
@@ -112,18 +105,14 @@ uint8_t* hb_annexb_find_next_nalu(const uint8_t *start, size_t *size)
      * sequence == 0 too (start code emulation prevention will prevent such a
      * sequence from occurring outside of a start code prefix)
      */
-    while (end - buf > 3)
+    buf = hb_find_start_code_prefix(buf, end, 0xfe, 0x00);
+    if (buf != NULL)
     {
-        if (!buf[0] && !buf[1] && (!buf[2] || buf[2] == 1))
-        {
-            end = buf;
-            break;
-        }
-        buf++;
+        end = buf;
     }
 
     *size = end - nal;
-    return  nal;
+    return (uint8_t*)nal;
 }
 
 uint8_t* hb_isomp4_find_next_nalu(const uint8_t *start, size_t *size, const uint8_t nal_length_size)
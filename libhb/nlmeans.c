@@ -87,6 +87,12 @@
 #define NLMEANS_FRAMES_MAX  32
 #define NLMEANS_EXPSIZE     128
 
+// Planes are processed in tiles small enough for their pixel sums and
+// integral image to stay in cache while looping over the displacements
+#define NLMEANS_TILE_W      256
+#define NLMEANS_TILE_H      128
+#define NLMEANS_FRAME_THREADS_DEFAULT 2
+
 typedef struct
 {
     void *mem;
@@ -98,6 +104,11 @@ typedef struct
     int border;
     hb_lock_t *mutex;
     int prefiltered;
+
+    // Buffers owned by the frame slot, kept for the following frames
+    void  *mem_alloc;
+    void  *mem_pre_alloc;
+    size_t alloc_size;
 } BorderedPlane;
 
 typedef struct
@@ -109,17 +120,40 @@ typedef struct
     hb_buffer_t *buf;        // input buf sidedata
 } Frame;
 
-struct PixelSum
+typedef struct
 {
-    float weight_sum;
-    float pixel_sum;
-};
+    struct PixelSum *tmp_data;
+    uint32_t        *integral_mem;
+    int              integral_stride;
+} NLMeansScratch;
+
+typedef struct
+{
+    hb_filter_private_t *pv;
+    Frame      **frame;
+    hb_buffer_t *out;
+    int          plane;
+    int          nframes;
+    int          x;
+    int          y;
+    int          w;
+    int          h;
+} nlmeans_tile_t;
 
 typedef struct
 {
     taskset_thread_arg_t arg;
     hb_filter_private_t *pv;
     hb_buffer_t *out;
+
+    // The frame and the following ones it is compared with
+    Frame           *frames[NLMEANS_FRAMES_MAX];
+
+    // Tiles of the frame, run on the thread pool
+    hb_task_group_t  tile_group;
+    hb_task_t       *tile_tasks;
+    nlmeans_tile_t  *tiles;
+    int              tile_count;
 } nlmeans_thread_arg_t;
 
 struct hb_filter_private_s
@@ -151,30 +185,41 @@ struct hb_filter_private_s
     void (*nlmeans_prefilter)(BorderedPlane *src, const int filter_type);
     void (*nlmeans_deborder)(const BorderedPlane *src, void *in_dst,
                                 const int w, const int s, const int h);
-    void (*nlmeans_plane)(NLMeansFunctions *functions,
-                                    Frame *frame,
-                                    int prefilter,
-                                    int plane,
-                                    int nframes,
-                                    void *dst,
-                                    int dst_w,
-                                    int dst_s,
-                                    int dst_h,
-                                    double h_param,
-                                    double origin_tune,
-                                    int n,
-                                    int r,
-                              const float *exptable,
-                              const float  weight_fact_table,
-                              const int    diff_max);
-
+    void (*nlmeans_tile)(NLMeansFunctions *functions,
+                         NLMeansScratch *scratch,
+                         Frame **frame,
+                         int plane,
+                         int nframes,
+                         void *dst,
+                         int dst_s,
+                         int tile_x,
+                         int tile_y,
+                         int tile_w,
+                         int tile_h,
+                         double origin_tune,
+                         int n,
+                         int r,
+                   const float *exptable,
+                   const float  weight_fact_table,
+                   const int    diff_max);
+
+    // Ring of frame slots, max_frames + threads long, whose planes are
+    // allocated once and reused by the following frames
     Frame      *frame;
-    int         next_frame;
+    int         frame_slots;
+    int         frame_first;   // slot of the oldest buffered frame
+    int         frame_count;   // number of buffered frames
     int         max_frames;
 
     taskset_t   taskset;
     nlmeans_thread_arg_t ** thread_data;
 
+    // Tile buffers, reused by the tiles of every frame
+    hb_lock_t  *scratch_lock;
+    hb_list_t  *scratch;
+    int         integral_stride;
+    int         integral_size;
+
     hb_filter_init_t        input;
     hb_filter_init_t        output;
 };
@@ -242,24 +287,26 @@ static int nlmeans_init(hb_filter_object_t *filter,
     {
         case 8:
             functions->build_integral = build_integral_scalar_8;
+            functions->accumulate     = accumulate_scalar_8;
             pv->nlmeans_alloc         = nlmeans_alloc_8;
             pv->nlmeans_prefilter     = nlmeans_prefilter_8;
             pv->nlmeans_deborder      = nlmeans_deborder_8;
-            pv->nlmeans_plane         = nlmeans_plane_8;
-        #if defined(ARCH_X86)
-            nlmeans_init_x86(functions);
-        #endif
+            pv->nlmeans_tile          = nlmeans_tile_8;
             break;
 
         case 16:
         default:
             functions->build_integral = build_integral_scalar_16;
+            functions->accumulate     = accumulate_scalar_16;
             pv->nlmeans_alloc         = nlmeans_alloc_16;
             pv->nlmeans_prefilter     = nlmeans_prefilter_16;
             pv->nlmeans_deborder      = nlmeans_deborder_16;
-            pv->nlmeans_plane         = nlmeans_plane_16;
+            pv->nlmeans_tile          = nlmeans_tile_16;
             break;
     }
+#if defined(ARCH_X86)
+    nlmeans_init_x86(functions, pv->depth);
+#endif
 
 
     // Mark parameters unset
@@ -357,28 +404,33 @@ static int nlmeans_init(hb_filter_object_t *filter,
         exptable[NLMEANS_EXPSIZE-1] = 0;
     }
 
+    // Tile buffers, sized for the largest patch
+    int n_max = 1;
+    for (int c = 0; c < 3; c++)
+    {
+        n_max = MAX(n_max, pv->patch_size[c]);
+    }
+    pv->integral_stride = ((NLMEANS_TILE_W + n_max + 15) / 16 * 16) + 2 * 16;
+    pv->integral_size   = pv->integral_stride * (NLMEANS_TILE_H + n_max + 1);
+    pv->scratch_lock    = hb_lock_init();
+    pv->scratch         = hb_list_init();
+
     // Threads
+    // The tiles of each frame run on the thread pool, so only a few
+    // frames need to be in flight to keep it busy
     if (pv->threads < 1) {
-        pv->threads = hb_get_cpu_count();
-
-        // Reduce internal thread count where we have many logical cores
-        // Too many threads increases CPU cache pressure, reducing performance
-        if (pv->threads >= 32) {
-            pv->threads = pv->threads / 2;
-        }
-        else if (pv->threads >= 16) {
-            pv->threads = (pv->threads / 4) * 3;
-        }
+        pv->threads = MIN(hb_get_cpu_count(), NLMEANS_FRAME_THREADS_DEFAULT);
     }
-    hb_log("NLMeans using %i threads", pv->threads);
+    hb_log("NLMeans using %i frame threads", pv->threads);
 
-    pv->frame = calloc(pv->threads + pv->max_frames, sizeof(Frame));
+    pv->frame_slots = pv->threads + pv->max_frames;
+    pv->frame = calloc(pv->frame_slots, sizeof(Frame));
     if (pv->frame == NULL)
     {
         hb_error("nlmeans: calloc failed");
         goto fail;
     }
-    for (int ii = 0; ii < pv->threads + pv->max_frames; ii++)
+    for (int ii = 0; ii < pv->frame_slots; ii++)
     {
         for (int c = 0; c < 3; c++)
         {
@@ -386,10 +438,17 @@ static int nlmeans_init(hb_filter_object_t *filter,
         }
     }
 
-    pv->thread_data = malloc(pv->threads * sizeof(nlmeans_thread_arg_t*));
+    pv->thread_data = calloc(pv->threads, sizeof(nlmeans_thread_arg_t*));
+    if (pv->thread_data == NULL)
+    {
+        hb_error("nlmeans: calloc failed");
+        goto fail;
+    }
     if (taskset_init(&pv->taskset, "nlmeans_filter", pv->threads,
                      sizeof(nlmeans_thread_arg_t), nlmeans_filter_work) == 0)
     {
+        // taskset_init() frees what it allocated, don't free it again
+        memset(&pv->taskset, 0, sizeof(pv->taskset));
         hb_error("NLMeans could not initialize taskset");
         goto fail;
     }
@@ -405,18 +464,61 @@ static int nlmeans_init(hb_filter_object_t *filter,
         pv->thread_data[ii]->pv = pv;
         pv->thread_data[ii]->arg.taskset = &pv->taskset;
         pv->thread_data[ii]->arg.segment = ii;
+        if (!hb_task_group_init(&pv->thread_data[ii]->tile_group))
+        {
+            hb_error("NLMeans could not create tile group");
+            goto fail;
+        }
     }
     pv->output = *init;
 
     return 0;
 
 fail:
-    taskset_fini(&pv->taskset);
-    free(pv->thread_data);
-    free(pv);
+    nlmeans_close(filter);
     return -1;
 }
 
+static NLMeansScratch * nlmeans_scratch_get(hb_filter_private_t *pv)
+{
+    NLMeansScratch *scratch;
+
+    hb_lock(pv->scratch_lock);
+    scratch = hb_list_item(pv->scratch, 0);
+    if (scratch != NULL)
+    {
+        hb_list_rem(pv->scratch, scratch);
+    }
+    hb_unlock(pv->scratch_lock);
+
+    if (scratch == NULL)
+    {
+        scratch = calloc(1, sizeof(NLMeansScratch));
+        if (scratch == NULL)
+        {
+            return NULL;
+        }
+        scratch->tmp_data        = malloc(NLMEANS_TILE_W * NLMEANS_TILE_H * sizeof(struct PixelSum));
+        scratch->integral_mem    = calloc(pv->integral_size, sizeof(uint32_t));
+        scratch->integral_stride = pv->integral_stride;
+        if (scratch->tmp_data == NULL || scratch->integral_mem == NULL)
+        {
+            free(scratch->tmp_data);
+            free(scratch->integral_mem);
+            free(scratch);
+            return NULL;
+        }
+    }
+    return scratch;
+}
+
+static void nlmeans_scratch_put(hb_filter_private_t *pv, NLMeansScratch *scratch)
+{
+    hb_lock(pv->scratch_lock);
+    hb_list_add(pv->scratch, scratch);
+    hb_unlock(pv->scratch_lock);
+}
+
 static void nlmeans_close(hb_filter_object_t *filter)
 {
     hb_filter_private_t *pv = filter->private_data;
@@ -426,33 +528,41 @@ static void nlmeans_close(hb_filter_object_t *filter)
         return;
     }
 
-    taskset_fini(&pv->taskset);
-    for (int c = 0; c < 3; c++)
+    // The thread args are freed with the taskset. When nlmeans_init()
+    // fails, the thread args, the frames or the taskset may be missing.
+    for (int ii = 0; pv->thread_data != NULL && ii < pv->threads; ii++)
     {
-        for (int f = 0; f < pv->nframes[c]; f++)
+        if (pv->thread_data[ii] == NULL)
         {
-            if (pv->frame[f].plane[c].mem_pre != NULL &&
-                pv->frame[f].plane[c].mem_pre != pv->frame[f].plane[c].mem)
-            {
-                free(pv->frame[f].plane[c].mem_pre);
-                pv->frame[f].plane[c].mem_pre = NULL;
-            }
-            if (pv->frame[f].plane[c].mem != NULL)
-            {
-                free(pv->frame[f].plane[c].mem);
-                pv->frame[f].plane[c].mem = NULL;
-            }
-            hb_buffer_close(&pv->frame[f].buf);
+            continue;
         }
+        hb_task_group_close(&pv->thread_data[ii]->tile_group);
+        free(pv->thread_data[ii]->tile_tasks);
+        free(pv->thread_data[ii]->tiles);
     }
 
-    for (int ii = 0; ii < pv->threads + pv->max_frames; ii++)
+    taskset_fini(&pv->taskset);
+    for (int ii = 0; pv->frame != NULL && ii < pv->frame_slots; ii++)
     {
         for (int c = 0; c < 3; c++)
         {
+            free(pv->frame[ii].plane[c].mem_alloc);
+            free(pv->frame[ii].plane[c].mem_pre_alloc);
             hb_lock_close(&pv->frame[ii].plane[c].mutex);
         }
+        hb_buffer_close(&pv->frame[ii].buf);
+    }
+
+    NLMeansScratch *scratch;
+    while ((scratch = hb_list_item(pv->scratch, 0)) != NULL)
+    {
+        hb_list_rem(pv->scratch, scratch);
+        free(scratch->tmp_data);
+        free(scratch->integral_mem);
+        free(scratch);
     }
+    hb_list_close(&pv->scratch);
+    hb_lock_close(&pv->scratch_lock);
 
     free(pv->frame);
     free(pv->thread_data);
@@ -460,12 +570,59 @@ static void nlmeans_close(hb_filter_object_t *filter)
     filter->private_data = NULL;
 }
 
-static void nlmeans_filter_work(void *thread_args_v)
+static void nlmeans_tile_work(void *tile_v)
 {
-    nlmeans_thread_arg_t *thread_data = thread_args_v;
-    hb_filter_private_t *pv = thread_data->pv;
-    int segment = thread_data->arg.segment;
-    Frame *frame = &pv->frame[segment];
+    nlmeans_tile_t *tile = tile_v;
+    hb_filter_private_t *pv = tile->pv;
+    const int c = tile->plane;
+
+    NLMeansScratch *scratch = nlmeans_scratch_get(pv);
+    if (scratch == NULL)
+    {
+        hb_error("nlmeans: tile buffer allocation failed");
+        return;
+    }
+    pv->nlmeans_tile(&pv->functions,
+                     scratch,
+                     tile->frame,
+                     c,
+                     tile->nframes,
+                     tile->out->plane[c].data,
+                     tile->out->plane[c].stride / pv->bps,
+                     tile->x,
+                     tile->y,
+                     tile->w,
+                     tile->h,
+                     pv->origin_tune[c],
+                     pv->patch_size[c],
+                     pv->range[c],
+                     pv->exptable[c],
+                     pv->weight_fact_table[c],
+                     pv->diff_max[c]);
+    nlmeans_scratch_put(pv, scratch);
+}
+
+static Frame * nlmeans_frame_slot(hb_filter_private_t *pv, int index)
+{
+    return &pv->frame[(pv->frame_first + index) % pv->frame_slots];
+}
+
+/*
+ * Denoise the buffered frame 'index', the frames after it are
+ * available up to 'frame_count' in total.  The planes are split in
+ * tiles that run on the thread pool, the calling thread helps until
+ * they are all done.
+ */
+static hb_buffer_t * nlmeans_frame(hb_filter_private_t *pv,
+                                   nlmeans_thread_arg_t *thread_data,
+                                   int index, int frame_count)
+{
+    frame_count = MIN(frame_count, pv->max_frames);
+    for (int f = 0; f < frame_count; f++)
+    {
+        thread_data->frames[f] = nlmeans_frame_slot(pv, index + f);
+    }
+    Frame *frame = thread_data->frames[0];
 
     hb_buffer_t *buf;
     buf = hb_frame_buffer_init(pv->output.pix_fmt,
@@ -473,12 +630,30 @@ static void nlmeans_filter_work(void *thread_args_v)
     buf->f.color_prim      = pv->output.color_prim;
     buf->f.color_transfer  = pv->output.color_transfer;
     buf->f.color_matrix    = pv->output.color_matrix;
-    buf->f.color_range     = pv->output.color_range ;
+    buf->f.color_range     = pv->output.color_range;
     buf->f.chroma_location = pv->output.chroma_location;
 
+    int tile_count = 0;
+    for (int c = 0; c < 3; c++)
+    {
+        tile_count += ((buf->plane[c].width  + NLMEANS_TILE_W - 1) / NLMEANS_TILE_W) *
+                      ((buf->plane[c].height + NLMEANS_TILE_H - 1) / NLMEANS_TILE_H);
+    }
+    if (tile_count > thread_data->tile_count)
+    {
+        free(thread_data->tile_tasks);
+        free(thread_data->tiles);
+        thread_data->tile_tasks = calloc(tile_count, sizeof(hb_task_t));
+        thread_data->tiles      = calloc(tile_count, sizeof(nlmeans_tile_t));
+        thread_data->tile_count = tile_count;
+        if (thread_data->tile_tasks == NULL || thread_data->tiles == NULL)
+        {
+            hb_error("nlmeans: calloc failed");
+            thread_data->tile_count = 0;
+        }
+    }
 
-    NLMeansFunctions *functions = &pv->functions;
-
+    tile_count = 0;
     for (int c = 0; c < 3; c++)
     {
         if (pv->prefilter[c] & NLMEANS_PREFILTER_MODE_PASSTHRU)
@@ -489,7 +664,7 @@ static void nlmeans_filter_work(void *thread_args_v)
                                  buf->plane[c].height);
             continue;
         }
-        if (pv->strength[c] == 0)
+        if (pv->strength[c] == 0 || thread_data->tile_count == 0)
         {
             pv->nlmeans_deborder(&frame->plane[c], buf->plane[c].data,
                                  buf->plane[c].width, buf->plane[c].stride / pv->bps,
@@ -497,31 +672,55 @@ static void nlmeans_filter_work(void *thread_args_v)
             continue;
         }
 
-        // Process current plane
-        pv->nlmeans_plane(functions,
-                          frame,
-                          pv->prefilter[c],
-                          c,
-                          pv->nframes[c],
-                          buf->plane[c].data,
-                          buf->plane[c].width,
-                          buf->plane[c].stride / pv->bps,
-                          buf->plane[c].height,
-                          pv->strength[c],
-                          pv->origin_tune[c],
-                          pv->patch_size[c],
-                          pv->range[c],
-                          pv->exptable[c],
-                          pv->weight_fact_table[c],
-                          pv->diff_max[c]);
+        const int nframes = MIN(pv->nframes[c], frame_count);
+        for (int f = 0; f < nframes; f++)
+        {
+            pv->nlmeans_prefilter(&thread_data->frames[f]->plane[c], pv->prefilter[c]);
+        }
+
+        for (int y = 0; y < buf->plane[c].height; y += NLMEANS_TILE_H)
+        {
+            for (int x = 0; x < buf->plane[c].width; x += NLMEANS_TILE_W)
+            {
+                nlmeans_tile_t *tile = &thread_data->tiles[tile_count];
+
+                tile->pv      = pv;
+                tile->frame   = thread_data->frames;
+                tile->out     = buf;
+                tile->plane   = c;
+                tile->nframes = nframes;
+                tile->x       = x;
+                tile->y       = y;
+                tile->w       = MIN(NLMEANS_TILE_W, buf->plane[c].width  - x);
+                tile->h       = MIN(NLMEANS_TILE_H, buf->plane[c].height - y);
+                hb_task_group_submit(&thread_data->tile_group,
+                                     &thread_data->tile_tasks[tile_count],
+                                     nlmeans_tile_work, tile);
+                tile_count++;
+            }
+        }
     }
-    hb_buffer_copy_props(buf, pv->frame[segment].buf);
-    hb_buffer_close(&pv->frame[segment].buf);
-    thread_data->out = buf;
+    hb_task_group_wait(&thread_data->tile_group);
+
+    hb_buffer_copy_props(buf, frame->buf);
+    hb_buffer_close(&frame->buf);
+    return buf;
+}
+
+static void nlmeans_filter_work(void *thread_args_v)
+{
+    nlmeans_thread_arg_t *thread_data = thread_args_v;
+    hb_filter_private_t *pv = thread_data->pv;
+    int segment = thread_data->arg.segment;
+
+    thread_data->out = nlmeans_frame(pv, thread_data, segment,
+                                     pv->frame_count - segment);
 }
 
 static void nlmeans_add_frame(hb_filter_private_t *pv, hb_buffer_t *buf)
 {
+    Frame *frame = nlmeans_frame_slot(pv, pv->frame_count);
+
     for (int c = 0; c < 3; c++)
     {
         // Extend copy of plane with extra border and place in buffer
@@ -530,60 +729,30 @@ static void nlmeans_add_frame(hb_filter_private_t *pv, hb_buffer_t *buf)
                           buf->plane[c].width,
                           buf->plane[c].stride / pv->bps,
                           buf->plane[c].height,
-                          &pv->frame[pv->next_frame].plane[c],
+                          &frame->plane[c],
                           border);
     }
-    pv->frame[pv->next_frame].width = buf->f.width;
-    pv->frame[pv->next_frame].height = buf->f.height;
-    pv->frame[pv->next_frame].fmt = buf->f.fmt;
-    pv->frame[pv->next_frame].buf = hb_buffer_init(0);
-    hb_buffer_copy_props(pv->frame[pv->next_frame].buf, buf);
+    frame->width = buf->f.width;
+    frame->height = buf->f.height;
+    frame->fmt = buf->f.fmt;
+    frame->buf = hb_buffer_init(0);
+    hb_buffer_copy_props(frame->buf, buf);
 
-    pv->next_frame++;
+    pv->frame_count++;
 }
 
 static hb_buffer_t * nlmeans_filter(hb_filter_private_t *pv)
 {
-    if (pv->next_frame < pv->max_frames + pv->threads)
+    if (pv->frame_count < pv->max_frames + pv->threads)
     {
         return NULL;
     }
 
     taskset_cycle(&pv->taskset);
 
-    // Free buffers that are not needed for next taskset cycle
-    for (int c = 0; c < 3; c++)
-    {
-        for (int t = 0; t < pv->threads; t++)
-        {
-            // Release last frame in buffer
-            if (pv->frame[t].plane[c].mem_pre != NULL &&
-                pv->frame[t].plane[c].mem_pre != pv->frame[t].plane[c].mem)
-            {
-                free(pv->frame[t].plane[c].mem_pre);
-                pv->frame[t].plane[c].mem_pre = NULL;
-            }
-            if (pv->frame[t].plane[c].mem != NULL)
-            {
-                free(pv->frame[t].plane[c].mem);
-                pv->frame[t].plane[c].mem = NULL;
-            }
-        }
-    }
-    // Shift frames in buffer down
-    for (int f = 0; f < pv->max_frames; f++)
-    {
-        // Don't move the mutex!
-        Frame frame = pv->frame[f];
-        pv->frame[f] = pv->frame[f+pv->threads];
-        for (int c = 0; c < 3; c++)
-        {
-            pv->frame[f].plane[c].mutex = frame.plane[c].mutex;
-            pv->frame[f+pv->threads].plane[c].mem_pre = NULL;
-            pv->frame[f+pv->threads].plane[c].mem = NULL;
-        }
-    }
-    pv->next_frame -= pv->threads;
+    // The slots of the frames just done are reused by the next frames
+    pv->frame_first  = (pv->frame_first + pv->threads) % pv->frame_slots;
+    pv->frame_count -= pv->threads;
 
     // Collect results from taskset
     hb_buffer_list_t list;
@@ -600,63 +769,10 @@ static hb_buffer_t * nlmeans_filter_flush(hb_filter_private_t *pv)
     hb_buffer_list_t list;
 
     hb_buffer_list_clear(&list);
-    for (int f = 0; f < pv->next_frame; f++)
+    for (int f = 0; f < pv->frame_count; f++)
     {
-        Frame *frame = &pv->frame[f];
-        hb_buffer_t *buf;
-        buf = hb_frame_buffer_init(pv->output.pix_fmt,
-                                   frame->width, frame->height);
-        buf->f.color_prim      = pv->output.color_prim;
-        buf->f.color_transfer  = pv->output.color_transfer;
-        buf->f.color_matrix    = pv->output.color_matrix;
-        buf->f.color_range     = pv->output.color_range;
-        buf->f.chroma_location = pv->output.chroma_location;
-
-        NLMeansFunctions *functions = &pv->functions;
-
-        for (int c = 0; c < 3; c++)
-        {
-            if (pv->prefilter[c] & NLMEANS_PREFILTER_MODE_PASSTHRU)
-            {
-                pv->nlmeans_prefilter(&frame->plane[c], pv->prefilter[c]);
-                pv->nlmeans_deborder(&frame->plane[c], buf->plane[c].data,
-                                       buf->plane[c].width, buf->plane[c].stride / pv->bps,
-                                       buf->plane[c].height);
-                continue;
-            }
-            if (pv->strength[c] == 0)
-            {
-                pv->nlmeans_deborder(&frame->plane[c], buf->plane[c].data,
-                                     buf->plane[c].width, buf->plane[c].stride / pv->bps,
-                                     buf->plane[c].height);
-                continue;
-            }
-
-            int nframes = pv->next_frame - f;
-            if (pv->nframes[c] < nframes)
-            {
-                nframes = pv->nframes[c];
-            }
-            // Process current plane
-            pv->nlmeans_plane(functions,
-                              frame,
-                              pv->prefilter[c],
-                              c,
-                              nframes,
-                              buf->plane[c].data,
-                              buf->plane[c].width,
-                              buf->plane[c].stride / pv->bps,
-                              buf->plane[c].height,
-                              pv->strength[c],
-                              pv->origin_tune[c],
-                              pv->patch_size[c],
-                              pv->range[c],
-                              pv->exptable[c],
-                              pv->weight_fact_table[c],
-                              pv->diff_max[c]);
-        }
-        hb_buffer_copy_props(buf, frame->buf);
-        hb_buffer_close(&frame->buf);
+        hb_buffer_t *buf = nlmeans_frame(pv, pv->thread_data[0],
+                                         f, pv->frame_count - f);
         hb_buffer_list_append(&list, buf);
     }
     return hb_buffer_list_clear(&list);
@@ -12,11 +12,19 @@
 
 #if defined(ARCH_X86)
 
-#include <emmintrin.h>
+#include <immintrin.h>
 
 #include "libavutil/cpu.h"
 #include "handbrake/nlmeans.h"
 
+#define BIT_DEPTH 8
+#include "templates/nlmeans_x86_template.c"
+#undef BIT_DEPTH
+
+#define BIT_DEPTH 16
+#include "templates/nlmeans_x86_template.c"
+#undef BIT_DEPTH
+
 static void build_integral_sse2(uint32_t *integral,
                                 int       integral_stride,
                           const void  *in_src,
@@ -148,9 +156,25 @@ static void build_integral_sse2(uint32_t *integral,
     }
 }
 
-void nlmeans_init_x86(NLMeansFunctions *functions)
+void nlmeans_init_x86(NLMeansFunctions *functions, int depth)
 {
-    if (av_get_cpu_flags() & AV_CPU_FLAG_SSE2)
+    int flags = av_get_cpu_flags();
+
+    if (flags & AV_CPU_FLAG_AVX2)
+    {
+        if (depth > 8)
+        {
+            functions->build_integral = build_integral_avx2_16;
+            functions->accumulate     = accumulate_avx2_16;
+        }
+        else
+        {
+            functions->build_integral = build_integral_avx2_8;
+            functions->accumulate     = accumulate_avx2_8;
+        }
+        hb_log("NLMeans using AVX2 optimizations");
+    }
+    else if ((flags & AV_CPU_FLAG_SSE2) && depth == 8)
     {
         functions->build_integral = build_integral_sse2;
         hb_log("NLMeans using SSE2 optimizations");
@@ -57,3 +57,21 @@ int macOS_get_user_config_directory(char path[512])
         return 0;
     }
 }
+
+int macOS_get_user_cache_directory(char path[512])
+{
+    @autoreleasepool
+    {
+        NSURL *url = [NSFileManager.defaultManager URLsForDirectory:NSCachesDirectory
+                                                          inDomains:NSUserDomainMask].firstObject;
+
+        if (url == nil)
+        {
+            return -1;
+        }
+
+        strncpy(path, url.fileSystemRepresentation, 511);
+        path[511] = 0;
+        return 0;
+    }
+}
@@ -1465,7 +1465,7 @@ static OSStatus reuse_vtsession(hb_work_object_t *w, hb_job_t * job, hb_work_pri
 {
     OSStatus err = noErr;
 
-    hb_interjob_t *interjob = hb_interjob_get(job->h);
+    hb_interjob_t *interjob = hb_job_interjob_get(job);
     vt_interjob_t *context = interjob->context;
 
     set_cookie(w, context->format);
@@ -2054,7 +2054,7 @@ int encvt_work(hb_work_object_t *w, hb_buffer_t **buf_in, hb_buffer_t **buf_out)
             context->queue = pv->queue;
             context->format = pv->format;
 
-            hb_interjob_t *interjob = hb_interjob_get(job->h);
+            hb_interjob_t *interjob = hb_job_interjob_get(job);
             interjob->context = context;
         }
         else if (job->pass_id == HB_PASS_ENCODE_FINAL)
@@ -59,6 +59,7 @@
 #include <time.h>
 #include <sys/time.h>
 #include <ctype.h>
+#include <errno.h>
 
 #if defined( SYS_LINUX )
 #include <linux/cdrom.h>
@@ -474,6 +475,405 @@ static int init_cpu_count()
     return cpu_count;
 }
 
+/************************************************************************
+ * CPU topology
+ ************************************************************************
+ * On Linux, the logical processors the process may run on are grouped
+ * in placement domains read from sysfs: the processors sharing a L3
+ * cache, and the processors of a NUMA node when there is more than one.
+ * A job can bind its threads to one domain with hb_thread_set_domain(),
+ * so that the frames its stages exchange stay in a shared cache and in
+ * node local memory. Elsewhere there are no domains and placement is
+ * a no-op.
+ ***********************************************************************/
+#if defined(SYS_LINUX)
+#define HB_CPU_DOMAINS_MAX 256
+
+typedef struct
+{
+    cpu_set_t   cpus;
+    int         count;      // logical processors
+    int         node;       // NUMA node, -1 if unknown
+    int         cache;      // 1 for a L3 cache domain, 0 for a NUMA node
+    char        name[96];
+} hb_cpu_domain_t;
+
+static struct
+{
+    pthread_once_t    once;
+    pthread_mutex_t   mutex;
+    cpu_set_t         process;  // affinity of the process at startup
+    int               node_count;
+    int               count;
+    hb_cpu_domain_t   domain[HB_CPU_DOMAINS_MAX];
+    int               cpu_users[CPU_SETSIZE];
+} hb_cpu_topology =
+{
+    .once  = PTHREAD_ONCE_INIT,
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static __thread int hb_thread_domain = -1;
+
+static int read_sysfs_line( const char * path, char * buf, int size )
+{
+    FILE * file = fopen(path, "r");
+    int    len;
+
+    if (file == NULL)
+    {
+        return -1;
+    }
+    if (fgets(buf, size, file) == NULL)
+    {
+        fclose(file);
+        return -1;
+    }
+    fclose(file);
+
+    len = strlen(buf);
+    while (len > 0 && isspace((unsigned char)buf[len - 1]))
+    {
+        buf[--len] = 0;
+    }
+    return 0;
+}
+
+// Parses the sysfs cpu list format, e.g. "0-7,64-71"
+static void parse_cpu_list( const char * list, cpu_set_t * set )
+{
+    const char * pos = list;
+
+    CPU_ZERO(set);
+    while (*pos)
+    {
+        char * end;
+        long   first, last;
+
+        first = last = strtol(pos, &end, 10);
+        if (end == pos)
+        {
+            break;
+        }
+        if (*end == '-')
+        {
+            pos  = end + 1;
+            last = strtol(pos, &end, 10);
+        }
+        for (; first <= last && first < CPU_SETSIZE; first++)
+        {
+            CPU_SET(first, set);
+        }
+        pos = *end == ',' ? end + 1 : end;
+        if (end == pos && *pos != 0)
+        {
+            break;
+        }
+    }
+}
+
+static int cpu_node( int cpu )
+{
+    char path[128];
+    int  node;
+
+    for (node = 0; node < hb_cpu_topology.node_count; node++)
+    {
+        snprintf(path, sizeof(path),
+                 "/sys/devices/system/cpu/cpu%d/node%d", cpu, node);
+        if (access(path, F_OK) == 0)
+        {
+            return node;
+        }
+    }
+    return -1;
+}
+
+static void add_cpu_domain( const char * list, int cache, int node )
+{
+    hb_cpu_domain_t * d;
+    cpu_set_t         set;
+    int               ii;
+
+    if (hb_cpu_topology.count >= HB_CPU_DOMAINS_MAX)
+    {
+        return;
+    }
+
+    parse_cpu_list(list, &set);
+    CPU_AND(&set, &set, &hb_cpu_topology.process);
+    if (CPU_COUNT(&set) == 0)
+    {
+        return;
+    }
+    for (ii = 0; ii < hb_cpu_topology.count; ii++)
+    {
+        if (CPU_EQUAL(&set, &hb_cpu_topology.domain[ii].cpus))
+        {
+            return;
+        }
+    }
+
+    d = &hb_cpu_topology.domain[hb_cpu_topology.count++];
+    d->cpus  = set;
+    d->count = CPU_COUNT(&set);
+    d->cache = cache;
+    d->node  = node;
+    snprintf(d->name, sizeof(d->name), "%s (cpus %s)",
+             cache ? "L3 cache" : "NUMA node", list);
+}
+
+static void init_cpu_topology( void )
+{
+    char path[128], buf[1024];
+    int  cpu, index, node;
+
+    sched_getaffinity(0, sizeof(hb_cpu_topology.process),
+                      &hb_cpu_topology.process);
+
+    if (read_sysfs_line("/sys/devices/system/node/possible",
+                        buf, sizeof(buf)) == 0)
+    {
+        cpu_set_t nodes;
+        parse_cpu_list(buf, &nodes);
+        for (node = CPU_SETSIZE - 1; node >= 0; node--)
+        {
+            if (CPU_ISSET(node, &nodes))
+            {
+                hb_cpu_topology.node_count = node + 1;
+                break;
+            }
+        }
+    }
+
+    // L3 caches, shared by a core complex or by a whole package
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (!CPU_ISSET(cpu, &hb_cpu_topology.process))
+        {
+            continue;
+        }
+        for (index = 0; index < 8; index++)
+        {
+            snprintf(path, sizeof(path),
+                     "/sys/devices/system/cpu/cpu%d/cache/index%d/level",
+                     cpu, index);
+            if (read_sysfs_line(path, buf, sizeof(buf)) < 0)
+            {
+                break;
+            }
+            if (atoi(buf) != 3)
+            {
+                continue;
+            }
+            snprintf(path, sizeof(path),
+                     "/sys/devices/system/cpu/cpu%d/cache/index%d/shared_cpu_list",
+                     cpu, index);
+            if (read_sysfs_line(path, buf, sizeof(buf)) == 0)
+            {
+                add_cpu_domain(buf, 1, cpu_node(cpu));
+            }
+        }
+    }
+
+    // NUMA nodes, only useful when there are several
+    for (node = 0; hb_cpu_topology.node_count > 1 &&
+                   node < hb_cpu_topology.node_count; node++)
+    {
+        snprintf(path, sizeof(path),
+                 "/sys/devices/system/node/node%d/cpulist", node);
+        if (read_sysfs_line(path, buf, sizeof(buf)) == 0)
+        {
+            add_cpu_domain(buf, 0, node);
+        }
+    }
+}
+
+static hb_cpu_domain_t * get_cpu_domain( int domain )
+{
+    pthread_once(&hb_cpu_topology.once, init_cpu_topology);
+    if (domain < 0 || domain >= hb_cpu_topology.count)
+    {
+        return NULL;
+    }
+    return &hb_cpu_topology.domain[domain];
+}
+#endif // SYS_LINUX
+
+/*
+ * Returns the number of NUMA nodes, 1 when unknown.
+ */
+int hb_get_numa_node_count( void )
+{
+#if defined(SYS_LINUX)
+    pthread_once(&hb_cpu_topology.once, init_cpu_topology);
+    return MAX(1, hb_cpu_topology.node_count);
+#else
+    return 1;
+#endif
+}
+
+/*
+ * Reserves the placement domain for a job that keeps cpu_count logical
+ * processors busy: the smallest domain that is large enough, or the
+ * largest NUMA node when none is, since remote memory costs more than
+ * fewer processors.  Among domains of the same size, the one whose
+ * processors are the least used by other jobs wins.
+ * Returns -1 if no domain is suitable.
+ */
+int hb_cpu_domain_acquire( int cpu_count )
+{
+    int best = -1;
+
+#if defined(SYS_LINUX)
+    double best_load = 0.;
+    int    best_fits = 0;
+    int    ii, cpu;
+
+    pthread_once(&hb_cpu_topology.once, init_cpu_topology);
+    pthread_mutex_lock(&hb_cpu_topology.mutex);
+    for (ii = 0; ii < hb_cpu_topology.count; ii++)
+    {
+        hb_cpu_domain_t * d = &hb_cpu_topology.domain[ii];
+        double            load = 0.;
+        int               fits = d->count >= cpu_count;
+        int               better;
+
+        if (!fits && d->cache)
+        {
+            continue;
+        }
+        for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        {
+            if (CPU_ISSET(cpu, &d->cpus))
+            {
+                load += hb_cpu_topology.cpu_users[cpu];
+            }
+        }
+        load /= d->count;
+
+        if (best < 0 || fits != best_fits)
+        {
+            better = best < 0 || fits;
+        }
+        else if (d->count != hb_cpu_topology.domain[best].count)
+        {
+            better = fits ? d->count < hb_cpu_topology.domain[best].count :
+                            d->count > hb_cpu_topology.domain[best].count;
+        }
+        else
+        {
+            better = load < best_load;
+        }
+        if (better)
+        {
+            best      = ii;
+            best_load = load;
+            best_fits = fits;
+        }
+    }
+    if (best >= 0)
+    {
+        for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        {
+            if (CPU_ISSET(cpu, &hb_cpu_topology.domain[best].cpus))
+            {
+                hb_cpu_topology.cpu_users[cpu]++;
+            }
+        }
+    }
+    pthread_mutex_unlock(&hb_cpu_topology.mutex);
+#endif
+
+    return best;
+}
+
+void hb_cpu_domain_release( int domain )
+{
+#if defined(SYS_LINUX)
+    hb_cpu_domain_t * d = get_cpu_domain(domain);
+    int               cpu;
+
+    if (d == NULL)
+    {
+        return;
+    }
+    pthread_mutex_lock(&hb_cpu_topology.mutex);
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (CPU_ISSET(cpu, &d->cpus) && hb_cpu_topology.cpu_users[cpu] > 0)
+        {
+            hb_cpu_topology.cpu_users[cpu]--;
+        }
+    }
+    pthread_mutex_unlock(&hb_cpu_topology.mutex);
+#endif
+}
+
+const char * hb_cpu_domain_name( int domain )
+{
+#if defined(SYS_LINUX)
+    hb_cpu_domain_t * d = get_cpu_domain(domain);
+    if (d != NULL)
+    {
+        return d->name;
+    }
+#endif
+    return "all processors";
+}
+
+int hb_cpu_domain_cpu_count( int domain )
+{
+#if defined(SYS_LINUX)
+    hb_cpu_domain_t * d = get_cpu_domain(domain);
+    if (d != NULL)
+    {
+        return d->count;
+    }
+#endif
+    return hb_get_cpu_count();
+}
+
+int hb_cpu_domain_node( int domain )
+{
+#if defined(SYS_LINUX)
+    hb_cpu_domain_t * d = get_cpu_domain(domain);
+    if (d != NULL)
+    {
+        return d->node;
+    }
+#endif
+    return -1;
+}
+
+/*
+ * Binds the calling thread to a placement domain, -1 to run on every
+ * processor of the process again.  Threads started by hb_thread_init()
+ * from this thread are bound to the same domain.
+ */
+void hb_thread_set_domain( int domain )
+{
+#if defined(SYS_LINUX)
+    hb_cpu_domain_t * d = get_cpu_domain(domain);
+
+    hb_thread_domain = d != NULL ? domain : -1;
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t),
+                           d != NULL ? &d->cpus : &hb_cpu_topology.process);
+#endif
+}
+
+/*
+ * Returns the NUMA node the calling thread is bound to, -1 if none.
+ */
+int hb_thread_get_node( void )
+{
+#if defined(SYS_LINUX)
+    return hb_thread_domain >= 0 ? hb_cpu_domain_node(hb_thread_domain) : -1;
+#else
+    return -1;
+#endif
+}
+
 int hb_platform_init()
 {
     int result = 0;
@@ -597,6 +997,98 @@ void hb_get_user_config_filename( char name[1024], char *fmt, ... )
     va_end( args );
 }
 
+/************************************************************************
+ * Get the user cache directory
+ ***********************************************************************/
+void hb_get_user_cache_directory( char path[512] )
+{
+#if defined( SYS_CYGWIN ) || defined( SYS_MINGW )
+#ifndef CSIDL_FLAG_DONT_UNEXPAND
+    WCHAR wide_path[MAX_PATH];
+
+    if (SHGetFolderPathW(NULL, CSIDL_LOCAL_APPDATA, NULL, SHGFP_TYPE_CURRENT, wide_path) == S_OK &&
+        WideCharToMultiByte(CP_UTF8, 0, wide_path, -1, path, 512, NULL, NULL) != 0)
+    {
+        path[511] = 0;
+        return;
+    }
+#else
+    WCHAR *wide_path;
+
+    if (SHGetKnownFolderPath(&FOLDERID_LocalAppData, 0, NULL, &wide_path) == S_OK &&
+        WideCharToMultiByte(CP_UTF8, 0, wide_path, -1, path, 512, NULL, NULL) != 0)
+    {
+        CoTaskMemFree(wide_path);
+        path[511] = 0;
+        return;
+    }
+    else if (wide_path != NULL)
+    {
+        CoTaskMemFree(wide_path);
+    }
+#endif // !defined CSIDL_FLAG_DONT_UNEXPAND
+#elif defined( SYS_LINUX )
+    char *p;
+
+    if ((p = getenv("XDG_CACHE_HOME")) != NULL)
+    {
+        strncpy(path, p, 511);
+        path[511] = 0;
+        return;
+    }
+    else if ((p = getenv("HOME")) != NULL)
+    {
+        strncpy(path, p, 511);
+        path[511] = 0;
+        int len = strlen(path);
+        strncpy(path + len, "/.cache", 511 - len - 1);
+        path[511] = 0;
+        return;
+    }
+#elif defined( __APPLE__ )
+    if (macOS_get_user_cache_directory(path) == 0)
+    {
+        return;
+    }
+#endif
+
+    hb_error("Failed to lookup user cache directory!");
+    path[0] = 0;
+}
+
+/************************************************************************
+ * Get a filename in the HandBrake/<subdir> folder of the user cache
+ * directory.  The folders are created if they don't exist yet.
+ * Returns -1 if there is no usable cache directory.
+ ***********************************************************************/
+int hb_get_user_cache_filename( char name[1024], const char *subdir,
+                                char *fmt, ... )
+{
+    char    dir[512];
+    va_list args;
+    int     len;
+
+    hb_get_user_cache_directory( dir );
+    if (dir[0] == 0)
+    {
+        return -1;
+    }
+    hb_mkdir( dir );
+    len = snprintf( name, 1024, "%s/HandBrake", dir );
+    hb_mkdir( name );
+    len += snprintf( name + len, 1024 - len, "/%s", subdir );
+    if (len >= 1024 - 2 || (hb_mkdir( name ) != 0 && errno != EEXIST))
+    {
+        return -1;
+    }
+    name[len++] = '/';
+
+    va_start( args, fmt );
+    vsnprintf( name + len, 1024 - len, fmt, args );
+    va_end( args );
+    return 0;
+}
+
 /************************************************************************
  * Creates a uniquely-named temporary directory for this process. On
  * POSIX systems, mkdtemp(3) is used to ensure the directory name is
@@ -828,6 +1320,7 @@ struct hb_thread_s
 
     hb_lock_t     * lock;
     int             exited;
+    int             domain;
     pthread_t       thread;
 };
 
@@ -880,6 +1373,12 @@ static void attribute_align_thread hb_thread_func( void * _t )
     pthread_setname_np( t->name );
 #endif
 
+    /* Run where the thread that started this one runs */
+    if (t->domain >= 0)
+    {
+        hb_thread_set_domain(t->domain);
+    }
+
     /* Start the actual routine */
     t->function( t->arg );
 
@@ -907,6 +1406,11 @@ hb_thread_t * hb_thread_init( const char * name, void (* function)(void *),
     t->function = function;
     t->arg      = arg;
     t->priority = priority;
+#if defined(SYS_LINUX)
+    t->domain   = hb_thread_domain;
+#else
+    t->domain   = -1;
+#endif
 
     t->lock     = hb_lock_init();
 
@@ -0,0 +1,552 @@
+/* previewstore.c
+
+   Copyright (c) 2003-2024 HandBrake Team
+   This file is part of the HandBrake source code
+   Homepage: <http://handbrake.fr/>.
+   It may be used under the terms of the GNU General Public License v2.
+   For full terms see the file COPYING file or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+#include "handbrake/handbrake.h"
+#include "handbrake/hbffmpeg.h"
+#include "handbrake/previewstore.h"
+#include <errno.h>
+
+#define PREVIEW_FILE_MAGIC  "HBPRVW01"
+
+typedef struct
+{
+    int           title;
+    int           preview;
+    char        * key;          // filter stages of a rendered preview
+    hb_buffer_t * buf;          // NULL when the frame is in 'filename'
+    char        * filename;
+    int64_t       size;
+    uint64_t      used;         // last use, the oldest frames are spilled
+} preview_entry_t;
+
+struct hb_preview_store_s
+{
+    hb_lock_t   * lock;
+    int           instance_id;
+    hb_list_t   * list;
+    int64_t       memory;       // size of the frames in memory
+    hb_list_t   * stages;
+    int64_t       stage_memory;
+    uint64_t      clock;
+};
+
+// Memory used by the previews of a handle, 0 keeps them all on disk
+static int64_t preview_store_budget = 256 * 1024 * 1024;
+// Memory used by the filtered previews of a handle
+static int64_t preview_stage_budget = 256 * 1024 * 1024;
+
+void hb_preview_store_set_budget( int64_t bytes )
+{
+    preview_store_budget = bytes < 0 ? 0 : bytes;
+}
+
+void hb_preview_cache_set_budget( int64_t bytes )
+{
+    preview_stage_budget = bytes < 0 ? 0 : bytes;
+}
+
+static int plane_count( const hb_buffer_t * buf )
+{
+    return buf->f.max_plane + 1;
+}
+
+// Bytes of the visible part of a row of a plane
+static int row_size( const hb_buffer_t * buf, int plane )
+{
+    return av_image_get_linesize(buf->f.fmt, buf->f.width, plane);
+}
+
+static hb_buffer_t * copy_frame( const hb_buffer_t * src )
+{
+    hb_buffer_t * dst;
+    int           pp, yy;
+
+    dst = hb_frame_buffer_init(src->f.fmt, src->f.width, src->f.height);
+    if (dst == NULL)
+    {
+        return NULL;
+    }
+    dst->f = src->f;
+    dst->s = src->s;
+    for (pp = 0; pp < plane_count(src); pp++)
+    {
+        const uint8_t * in   = src->plane[pp].data;
+        uint8_t       * out  = dst->plane[pp].data;
+        const int       size = row_size(src, pp);
+
+        for (yy = 0; yy < dst->plane[pp].height; yy++)
+        {
+            memcpy(out, in, size);
+            in  += src->plane[pp].stride;
+            out += dst->plane[pp].stride;
+        }
+    }
+    return dst;
+}
+
+/*
+ * Preview files hold a header with the format of the frame, then the
+ * rows of each plane without their padding.
+ */
+int hb_preview_write_file( const hb_buffer_t * buf, const char * filename )
+{
+    FILE          * file;
+    const char    * fmt_name = av_get_pix_fmt_name(buf->f.fmt);
+    char            name[32];
+    int32_t         header[7];
+    int             pp, yy, err;
+
+    if (fmt_name == NULL)
+    {
+        return -1;
+    }
+    file = hb_fopen(filename, "wb");
+    if (file == NULL)
+    {
+        hb_error("hb_preview_write_file: Failed to open %s (reason: %s)",
+                 filename, strerror(errno));
+        return -1;
+    }
+
+    memset(name, 0, sizeof(name));
+    strncpy(name, fmt_name, sizeof(name) - 1);
+    header[0] = buf->f.width;
+    header[1] = buf->f.height;
+    header[2] = buf->f.color_prim;
+    header[3] = buf->f.color_transfer;
+    header[4] = buf->f.color_matrix;
+    header[5] = buf->f.color_range;
+    header[6] = buf->f.chroma_location;
+
+    err = fwrite(PREVIEW_FILE_MAGIC, 8, 1, file) != 1 ||
+          fwrite(name, sizeof(name), 1, file) != 1 ||
+          fwrite(header, sizeof(header), 1, file) != 1;
+    for (pp = 0; !err && pp < plane_count(buf); pp++)
+    {
+        const uint8_t * data = buf->plane[pp].data;
+        const int       size = row_size(buf, pp);
+
+        for (yy = 0; !err && yy < buf->plane[pp].height; yy++)
+        {
+            err = fwrite(data, size, 1, file) != 1;
+            data += buf->plane[pp].stride;
+        }
+    }
+    if (fclose(file) != 0 || err)
+    {
+        hb_error("hb_preview_write_file: Failed to write %s", filename);
+        remove(filename);
+        return -1;
+    }
+    return 0;
+}
+
+hb_buffer_t * hb_preview_read_file( const char * filename )
+{
+    FILE          * file;
+    hb_buffer_t   * buf = NULL;
+    char            magic[8];
+    char            name[32];
+    int32_t         header[7];
+    int             pix_fmt, pp, yy, err;
+
+    file = hb_fopen(filename, "rb");
+    if (file == NULL)
+    {
+        return NULL;
+    }
+    if (fread(magic, sizeof(magic), 1, file) != 1 ||
+        memcmp(magic, PREVIEW_FILE_MAGIC, sizeof(magic)) ||
+        fread(name, sizeof(name), 1, file) != 1 ||
+        fread(header, sizeof(header), 1, file) != 1)
+    {
+        goto fail;
+    }
+    name[sizeof(name) - 1] = 0;
+    pix_fmt = av_get_pix_fmt(name);
+    if (pix_fmt == AV_PIX_FMT_NONE || header[0] <= 0 || header[1] <= 0)
+    {
+        goto fail;
+    }
+    buf = hb_frame_buffer_init(pix_fmt, header[0], header[1]);
+    if (buf == NULL)
+    {
+        goto fail;
+    }
+    buf->f.color_prim      = header[2];
+    buf->f.color_transfer  = header[3];
+    buf->f.color_matrix    = header[4];
+    buf->f.color_range     = header[5];
+    buf->f.chroma_location = header[6];
+
+    err = 0;
+    for (pp = 0; !err && pp < plane_count(buf); pp++)
+    {
+        uint8_t   * data = buf->plane[pp].data;
+        const int   size = row_size(buf, pp);
+
+        for (yy = 0; !err && yy < buf->plane[pp].height; yy++)
+        {
+            err = fread(data, size, 1, file) != 1;
+            data += buf->plane[pp].stride;
+        }
+    }
+    if (err)
+    {
+        goto fail;
+    }
+    fclose(file);
+    return buf;
+
+fail:
+    hb_error("hb_preview_read_file: Invalid preview file %s", filename);
+    hb_buffer_close(&buf);
+    fclose(file);
+    return NULL;
+}
+
+hb_buffer_t * hb_preview_to_yuv420p( const hb_buffer_t * buf )
+{
+    struct SwsContext * sws;
+    hb_buffer_t       * out;
+    const uint8_t     * src_data[4] = {NULL,};
+    uint8_t           * dst_data[4] = {NULL,};
+    int                 src_stride[4] = {0,}, dst_stride[4] = {0,};
+    int                 pp;
+
+    if (buf->f.fmt == AV_PIX_FMT_YUV420P)
+    {
+        return copy_frame(buf);
+    }
+
+    out = hb_frame_buffer_init(AV_PIX_FMT_YUV420P, buf->f.width, buf->f.height);
+    if (out == NULL)
+    {
+        return NULL;
+    }
+    sws = hb_sws_get_context(buf->f.width, buf->f.height, buf->f.fmt,
+                             buf->f.color_range == AVCOL_RANGE_JPEG,
+                             out->f.width, out->f.height, AV_PIX_FMT_YUV420P, 0,
+                             SWS_LANCZOS | SWS_ACCURATE_RND,
+                             hb_sws_get_colorspace(buf->f.color_matrix));
+    if (sws == NULL)
+    {
+        hb_buffer_close(&out);
+        return NULL;
+    }
+    for (pp = 0; pp < plane_count(buf) && pp < 4; pp++)
+    {
+        src_data[pp]   = buf->plane[pp].data;
+        src_stride[pp] = buf->plane[pp].stride;
+    }
+    for (pp = 0; pp < 3; pp++)
+    {
+        dst_data[pp]   = out->plane[pp].data;
+        dst_stride[pp] = out->plane[pp].stride;
+    }
+    sws_scale(sws, src_data, src_stride, 0, buf->f.height,
+              dst_data, dst_stride);
+    sws_freeContext(sws);
+
+    out->s                 = buf->s;
+    out->f.color_prim      = buf->f.color_prim;
+    out->f.color_transfer  = buf->f.color_transfer;
+    out->f.color_matrix    = buf->f.color_matrix;
+    out->f.color_range     = AVCOL_RANGE_MPEG;
+    out->f.chroma_location = buf->f.chroma_location;
+
+    return out;
+}
+
+hb_preview_store_t * hb_preview_store_init( int instance_id )
+{
+    hb_preview_store_t * store = calloc(1, sizeof(hb_preview_store_t));
+
+    if (store == NULL)
+    {
+        return NULL;
+    }
+    store->lock        = hb_lock_init();
+    store->list        = hb_list_init();
+    store->stages      = hb_list_init();
+    store->instance_id = instance_id;
+    return store;
+}
+
+static void entry_close( int64_t * memory, preview_entry_t ** _entry )
+{
+    preview_entry_t * entry = *_entry;
+
+    if (entry->buf != NULL)
+    {
+        *memory -= entry->size;
+        hb_buffer_close(&entry->buf);
+    }
+    if (entry->filename != NULL)
+    {
+        remove(entry->filename);
+        free(entry->filename);
+    }
+    free(entry->key);
+    free(entry);
+    *_entry = NULL;
+}
+
+// Filtered versions of a preview are stale once the preview changes
+static void remove_stages( hb_preview_store_t * store, int title, int preview )
+{
+    preview_entry_t * entry;
+    int               ii;
+
+    for (ii = 0; (entry = hb_list_item(store->stages, ii)) != NULL; )
+    {
+        if (entry->title == title && entry->preview == preview)
+        {
+            hb_list_rem(store->stages, entry);
+            entry_close(&store->stage_memory, &entry);
+            continue;
+        }
+        ii++;
+    }
+}
+
+static preview_entry_t * find_entry( hb_preview_store_t * store, int title,
+                                     int preview )
+{
+    preview_entry_t * entry;
+    int               ii;
+
+    for (ii = 0; (entry = hb_list_item(store->list, ii)) != NULL; ii++)
+    {
+        if (entry->title == title && entry->preview == preview)
+        {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+// Write the least recently used frames to disk until the frames in
+// memory fit the budget
+static void spill( hb_preview_store_t * store )
+{
+    while (store->memory > preview_store_budget)
+    {
+        preview_entry_t * entry, * oldest = NULL;
+        char            * filename;
+        int               ii;
+
+        for (ii = 0; (entry = hb_list_item(store->list, ii)) != NULL; ii++)
+        {
+            if (entry->buf != NULL &&
+                (oldest == NULL || entry->used < oldest->used))
+            {
+                oldest = entry;
+            }
+        }
+        if (oldest == NULL)
+        {
+            break;
+        }
+        filename = hb_get_temporary_filename("%d_%d_%d.raw",
+                                             store->instance_id,
+                                             oldest->title, oldest->preview);
+        if (filename == NULL || hb_preview_write_file(oldest->buf, filename))
+        {
+            // Keep the frames in memory rather than losing them
+            free(filename);
+            break;
+        }
+        oldest->filename = filename;
+        store->memory   -= oldest->size;
+        hb_buffer_close(&oldest->buf);
+    }
+}
+
+int hb_preview_store_put( hb_preview_store_t * store, int title,
+                          int preview, const hb_buffer_t * buf )
+{
+    preview_entry_t * entry;
+
+    entry = calloc(1, sizeof(preview_entry_t));
+    if (entry == NULL)
+    {
+        return -1;
+    }
+    entry->title   = title;
+    entry->preview = preview;
+    entry->buf     = copy_frame(buf);
+    if (entry->buf == NULL)
+    {
+        hb_error("hb_preview_store_put: failed to copy preview %d", preview);
+        free(entry);
+        return -1;
+    }
+    entry->size = entry->buf->size;
+
+    hb_lock(store->lock);
+    preview_entry_t * old = find_entry(store, title, preview);
+    if (old != NULL)
+    {
+        hb_list_rem(store->list, old);
+        entry_close(&store->memory, &old);
+    }
+    remove_stages(store, title, preview);
+    entry->used    = ++store->clock;
+    store->memory += entry->size;
+    hb_list_add(store->list, entry);
+    spill(store);
+    hb_unlock(store->lock);
+
+    return 0;
+}
+
+hb_buffer_t * hb_preview_store_get( hb_preview_store_t * store, int title,
+                                    int preview )
+{
+    preview_entry_t * entry;
+    hb_buffer_t     * buf = NULL;
+
+    hb_lock(store->lock);
+    entry = find_entry(store, title, preview);
+    if (entry != NULL)
+    {
+        entry->used = ++store->clock;
+        if (entry->buf != NULL)
+        {
+            buf = copy_frame(entry->buf);
+        }
+        else
+        {
+            buf = hb_preview_read_file(entry->filename);
+        }
+    }
+    hb_unlock(store->lock);
+
+    return buf;
+}
+
+void hb_preview_store_clear( hb_preview_store_t * store )
+{
+    preview_entry_t * entry;
+
+    hb_lock(store->lock);
+    while ((entry = hb_list_item(store->list, 0)) != NULL)
+    {
+        hb_list_rem(store->list, entry);
+        entry_close(&store->memory, &entry);
+    }
+    while ((entry = hb_list_item(store->stages, 0)) != NULL)
+    {
+        hb_list_rem(store->stages, entry);
+        entry_close(&store->stage_memory, &entry);
+    }
+    hb_unlock(store->lock);
+}
+
+/*
+ * Outputs of the filter stages of rendered previews.  'key' describes
+ * the filters up to the stage, so that a preview is only filtered again
+ * from the first stage whose settings changed.
+ */
+hb_buffer_t * hb_preview_store_get_stage( hb_preview_store_t * store,
+                                          int title, int preview,
+                                          const char * key )
+{
+    preview_entry_t * entry;
+    hb_buffer_t     * buf = NULL;
+    int               ii;
+
+    hb_lock(store->lock);
+    for (ii = 0; (entry = hb_list_item(store->stages, ii)) != NULL; ii++)
+    {
+        if (entry->title == title && entry->preview == preview &&
+            !strcmp(entry->key, key))
+        {
+            entry->used = ++store->clock;
+            buf = copy_frame(entry->buf);
+            break;
+        }
+    }
+    hb_unlock(store->lock);
+
+    return buf;
+}
+
+void hb_preview_store_put_stage( hb_preview_store_t * store, int title,
+                                 int preview, const char * key,
+                                 const hb_buffer_t * buf )
+{
+    preview_entry_t * entry, * oldest;
+    int               ii;
+
+    if (buf->size > preview_stage_budget)
+    {
+        return;
+    }
+    entry = calloc(1, sizeof(preview_entry_t));
+    if (entry == NULL)
+    {
+        return;
+    }
+    entry->title   = title;
+    entry->preview = preview;
+    entry->key     = strdup(key);
+    entry->buf     = copy_frame(buf);
+    if (entry->key == NULL || entry->buf == NULL)
+    {
+        hb_buffer_close(&entry->buf);
+        free(entry->key);
+        free(entry);
+        return;
+    }
+    entry->size = entry->buf->size;
+
+    hb_lock(store->lock);
+    // Drop the least recently used stages
+    while (store->stage_memory + entry->size > preview_stage_budget)
+    {
+        preview_entry_t * stage;
+
+        oldest = NULL;
+        for (ii = 0; (stage = hb_list_item(store->stages, ii)) != NULL; ii++)
+        {
+            if (oldest == NULL || stage->used < oldest->used)
+            {
+                oldest = stage;
+            }
+        }
+        if (oldest == NULL)
+        {
+            break;
+        }
+        hb_list_rem(store->stages, oldest);
+        entry_close(&store->stage_memory, &oldest);
+    }
+    entry->used          = ++store->clock;
+    store->stage_memory += entry->size;
+    hb_list_add(store->stages, entry);
+    hb_unlock(store->lock);
+}
+
+void hb_preview_store_close( hb_preview_store_t ** _store )
+{
+    hb_preview_store_t * store = *_store;
+
+    if (store == NULL)
+    {
+        return;
+    }
+    hb_preview_store_clear(store);
+    hb_list_close(&store->list);
+    hb_list_close(&store->stages);
+    hb_lock_close(&store->lock);
+    free(store);
+    *_store = NULL;
+}
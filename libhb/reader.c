@@ -9,6 +9,7 @@
 
 #include "libavutil/avutil.h"
 #include "handbrake/handbrake.h"
+#include "handbrake/telemetry.h"
 
 static int  reader_init( hb_work_object_t * w, hb_job_t * job );
 static void reader_close( hb_work_object_t * w );
@@ -33,9 +34,40 @@ typedef struct
     hb_buffer_list_t list;
 } buffer_splice_list_t;
 
+/*
+ * Read-ahead
+ *
+ * The source is read on a separate I/O thread that keeps up to
+ * job->read_ahead_limit bytes queued ahead of the demuxer, so that
+ * storage stalls are absorbed by the queue instead of stalling the
+ * decoders.  All seeks (start chapter, start time, preview position)
+ * are done by hb_reader_open() before the thread is started, after
+ * that the source is only read sequentially by the I/O thread.
+ */
+#define READ_AHEAD_DEFAULT  (32 * 1024 * 1024)
+#define READ_AHEAD_MAX      (1024 * 1024 * 1024)
+
+typedef struct
+{
+    hb_thread_t    * thread;
+    hb_lock_t      * lock;
+    hb_cond_t      * cond;
+    hb_buffer_list_t list;
+    int64_t          limit;
+    int              eof;
+    int              stop;
+    int              reader_waiting;
+    int              io_waiting;
+
+    // Times the reader found the queue empty, and time it waited
+    uint64_t         underruns;
+    uint64_t         wait_us;
+} reader_read_ahead_t;
+
 struct hb_work_private_s
 {
     hb_handle_t  * h;
+    hb_work_object_t * w;
     hb_job_t     * job;
     hb_title_t   * title;
     volatile int * die;
@@ -60,6 +92,8 @@ struct hb_work_private_s
 
     buffer_splice_list_t * splice_list;
     int                    splice_list_size;
+
+    reader_read_ahead_t    read_ahead;
 };
 
 /***********************************************************************
@@ -68,6 +102,7 @@ struct hb_work_private_s
 static hb_fifo_t ** GetFifoForId( hb_work_private_t * r, int id );
 static hb_buffer_list_t * get_splice_list(hb_work_private_t * r, int id);
 static void UpdateState( hb_work_private_t  * r );
+static void read_ahead_stop( hb_work_private_t * r );
 
 /***********************************************************************
  * reader_init
@@ -166,7 +201,8 @@ static int hb_reader_open( hb_work_private_t * r )
                          (r->job->seek_points ? (r->job->seek_points + 1.0)
                                               : 11.0);
             int64_t start = r->title->duration * frac;
-            if (hb_stream_seek_ts(r->stream, start) >= 0)
+            if (r->title->type == HB_FF_STREAM_TYPE &&
+                hb_stream_seek_ts(r->stream, start) >= 0)
             {
                 // If successful, we know the video stream has been seeked
                 // to the right location. But libav does not seek all
@@ -179,12 +215,28 @@ static int hb_reader_open( hb_work_private_t * r )
             }
             else
             {
-                // hb_stream_seek_ts only works for libav streams.
-                // TS and PS streams have not index and have timestamp
-                // discontinuities, so we seek to a byte position in these.
+                // TS and PS streams have timestamp discontinuities, so
+                // we seek to a fraction of the stream.  It is a fraction
+                // of the duration if the stream has an index, and of the
+                // file size otherwise.
                 hb_stream_seek(r->stream, frac);
             }
         }
+        else if (r->job->pts_to_start && r->title->type == HB_STREAM_TYPE)
+        {
+            int64_t pos = hb_stream_seek_ts(r->stream, r->job->pts_to_start);
+            if (pos >= 0)
+            {
+                // The stream index took us to the last keyframe before
+                // pts_to_start, and we know its time.  sync.c drops the
+                // frames before pts_to_start.
+                r->duration -= pos;
+                r->job->reader_pts_offset = pos;
+            }
+            // Without an index we decode frames from the start of the
+            // stream until we find the correct time in sync.c
+            r->start_found = 1;
+        }
         else if (r->job->pts_to_start)
         {
             if (hb_stream_seek_ts( r->stream, r->job->pts_to_start ) >= 0)
@@ -198,11 +250,8 @@ static int hb_reader_open( hb_work_private_t * r )
             }
             else
             {
-                // hb_stream_seek_ts does nothing for TS streams and will
-                // return an error.
-                //
-                // So we will decode frames until we find the correct time
-                // in sync.c
+                // The seek failed, so we will decode frames until we
+                // find the correct time in sync.c
                 r->start_found = 1;
             }
         }
@@ -247,6 +296,7 @@ static int reader_init( hb_work_object_t * w, hb_job_t * job )
     w->private_data = r;
 
     r->h     = job->h;
+    r->w     = w;
     r->job   = job;
     r->title = job->title;
     r->die   = job->die;
@@ -324,6 +374,13 @@ static int reader_init( hb_work_object_t * w, hb_job_t * job )
     // fifos that will be needed (+1 for null terminator)
     r->fifos = calloc(count + 1, sizeof(hb_fifo_t*));
 
+    if (job->read_ahead_limit >= 0)
+    {
+        r->read_ahead.limit = job->read_ahead_limit > 0 ?
+                              MIN(job->read_ahead_limit, READ_AHEAD_MAX) :
+                              READ_AHEAD_DEFAULT;
+    }
+
     // The stream needs to be open before starting the reader thread
     // to prevent a race with decoders that may share information
     // with the reader. Specifically avcodec needs this.
@@ -343,6 +400,9 @@ static void reader_close( hb_work_object_t * w )
     {
         return;
     }
+    // The I/O thread must be done with the source before it is closed
+    read_ahead_stop(r);
+
     if (r->bd)
     {
         hb_bd_stop( r->bd );
@@ -409,15 +469,32 @@ static hb_buffer_t * splice_discontinuity( hb_work_private_t *r, hb_buffer_t *bu
 
 static void push_buf( hb_work_private_t *r, hb_fifo_t *fifo, hb_buffer_t *buf )
 {
+    // The reader has no input fifo and delivers its output itself,
+    // so it accounts for its output in the stage telemetry here
+    hb_stage_stats_t * stats = r->w->stats;
+    uint64_t           clock = 0;
+
+    if (stats != NULL)
+    {
+        clock = hb_get_time_us();
+    }
     while ( !*r->die && !r->job->done )
     {
         if ( hb_fifo_full_wait( fifo ) )
         {
             hb_fifo_push( fifo, buf );
             buf = NULL;
+            if (stats != NULL)
+            {
+                hb_stage_stats_add(&stats->frames_out, 1);
+            }
             break;
         }
     }
+    if (stats != NULL)
+    {
+        hb_stage_stats_add(&stats->wait_out_us, hb_stage_stats_lap(&clock));
+    }
     if ( buf )
     {
         hb_buffer_close( &buf );
@@ -449,16 +526,16 @@ static void reader_send_eof( hb_work_private_t * r )
     hb_log("reader: done. %d scr changes", r->demux.scr_changes);
 }
 
-static int reader_work( hb_work_object_t * w, hb_buffer_t ** buf_in,
-                        hb_buffer_t ** buf_out)
+/***********************************************************************
+ * reader_read
+ ***********************************************************************
+ * Reads the next block of the source, NULL at the end of the title
+ * or of the last chapter of the job.  Called by the I/O thread when
+ * read-ahead is enabled, by the reader thread otherwise.
+ **********************************************************************/
+static hb_buffer_t * reader_read( hb_work_private_t * r )
 {
-    hb_work_private_t  * r = w->private_data;
-    hb_fifo_t         ** fifos;
-    hb_buffer_t        * buf;
-    hb_buffer_list_t     list;
-    int                  ii, chapter = -1;
-
-    hb_buffer_list_clear(&list);
+    int chapter = -1;
 
     if (r->bd)
         chapter = hb_bd_chapter( r->bd );
@@ -470,45 +547,168 @@ static int reader_work( hb_work_object_t * w, hb_buffer_t ** buf_in,
     if( chapter < 0 )
     {
         hb_log( "reader: end of the title reached" );
-        reader_send_eof(r);
-        return HB_WORK_DONE;
+        return NULL;
     }
     if( chapter > r->chapter_end )
     {
         hb_log("reader: end of chapter %d (media %d) reached at media chapter %d",
                 r->job->chapter_end, r->chapter_end, chapter);
-        reader_send_eof(r);
-        return HB_WORK_DONE;
+        return NULL;
     }
 
     if (r->bd)
     {
-        if( (buf = hb_bd_read( r->bd )) == NULL )
+        return hb_bd_read( r->bd );
+    }
+    else if (r->dvd)
+    {
+        return hb_dvd_read( r->dvd );
+    }
+    else if (r->stream)
+    {
+        return hb_stream_read( r->stream );
+    }
+
+    // This should never happen
+    hb_error("Stream not initialized");
+    return NULL;
+}
+
+static void read_ahead_thread( void * data )
+{
+    hb_work_private_t   * r  = data;
+    reader_read_ahead_t * ra = &r->read_ahead;
+    hb_buffer_t         * buf;
+
+    while (1)
+    {
+        hb_lock(ra->lock);
+        while (!ra->stop && hb_buffer_list_size(&ra->list) >= ra->limit)
+        {
+            ra->io_waiting = 1;
+            hb_cond_wait(ra->cond, ra->lock);
+            ra->io_waiting = 0;
+        }
+        if (ra->stop)
+        {
+            hb_unlock(ra->lock);
+            break;
+        }
+        hb_unlock(ra->lock);
+
+        buf = reader_read(r);
+
+        hb_lock(ra->lock);
+        if (buf == NULL)
+        {
+            ra->eof = 1;
+        }
+        hb_buffer_list_append(&ra->list, buf);
+        if (ra->reader_waiting)
+        {
+            hb_cond_broadcast(ra->cond);
+        }
+        hb_unlock(ra->lock);
+
+        if (buf == NULL)
         {
-            reader_send_eof(r);
-            return HB_WORK_DONE;
+            break;
         }
     }
-    else if (r->dvd)
+}
+
+static void read_ahead_start( hb_work_private_t * r )
+{
+    reader_read_ahead_t * ra = &r->read_ahead;
+
+    ra->lock   = hb_lock_init();
+    ra->cond   = hb_cond_init();
+    // Started from the reader thread so that the I/O thread inherits
+    // its processor placement
+    ra->thread = hb_thread_init("reader I/O", read_ahead_thread, r,
+                                HB_NORMAL_PRIORITY);
+}
+
+static void read_ahead_stop( hb_work_private_t * r )
+{
+    reader_read_ahead_t * ra = &r->read_ahead;
+
+    if (ra->thread == NULL)
+    {
+        return;
+    }
+    hb_lock(ra->lock);
+    ra->stop = 1;
+    hb_cond_broadcast(ra->cond);
+    hb_unlock(ra->lock);
+    hb_thread_close(&ra->thread);
+
+    hb_log("reader: read-ahead of %"PRId64" KiB, queue ran empty %"PRIu64
+           " times for %"PRIu64" ms", ra->limit / 1024, ra->underruns,
+           ra->wait_us / 1000);
+
+    hb_buffer_list_close(&ra->list);
+    hb_cond_close(&ra->cond);
+    hb_lock_close(&ra->lock);
+}
+
+static hb_buffer_t * read_ahead_get( hb_work_private_t * r )
+{
+    reader_read_ahead_t * ra = &r->read_ahead;
+    hb_buffer_t         * buf;
+
+    hb_lock(ra->lock);
+    if (hb_buffer_list_count(&ra->list) == 0 && !ra->eof)
     {
-        if( (buf = hb_dvd_read( r->dvd )) == NULL )
+        uint64_t start = hb_get_time_us();
+
+        ra->underruns++;
+        while (hb_buffer_list_count(&ra->list) == 0 && !ra->eof)
         {
-            reader_send_eof(r);
-            return HB_WORK_DONE;
+            ra->reader_waiting = 1;
+            hb_cond_wait(ra->cond, ra->lock);
+            ra->reader_waiting = 0;
         }
+        ra->wait_us += hb_get_time_us() - start;
     }
-    else if (r->stream)
+    buf = hb_buffer_list_rem_head(&ra->list);
+    // Let the I/O thread refill a quarter of the queue at once rather
+    // than waking it for every buffer
+    if (ra->io_waiting &&
+        hb_buffer_list_size(&ra->list) <= ra->limit - ra->limit / 4)
+    {
+        hb_cond_signal(ra->cond);
+    }
+    hb_unlock(ra->lock);
+
+    return buf;
+}
+
+static int reader_work( hb_work_object_t * w, hb_buffer_t ** buf_in,
+                        hb_buffer_t ** buf_out)
+{
+    hb_work_private_t  * r = w->private_data;
+    hb_fifo_t         ** fifos;
+    hb_buffer_t        * buf;
+    hb_buffer_list_t     list;
+    int                  ii;
+
+    hb_buffer_list_clear(&list);
+
+    if (r->read_ahead.limit > 0)
     {
-        if ( (buf = hb_stream_read( r->stream )) == NULL )
+        if (r->read_ahead.thread == NULL)
         {
-            reader_send_eof(r);
-            return HB_WORK_DONE;
+            read_ahead_start(r);
         }
+        buf = read_ahead_get(r);
     }
     else
     {
-        // This should never happen
-        hb_error("Stream not initialized");
+        buf = reader_read(r);
+    }
+    if (buf == NULL)
+    {
         reader_send_eof(r);
         return HB_WORK_DONE;
     }
@@ -625,7 +825,7 @@ static void UpdateState( hb_work_private_t  * r )
         r->st_first = now;
     }
 
-    hb_get_state2(r->job->h, &state);
+    hb_get_job_state(r->job, &state);
 #define p state.param.working
     state.state = HB_STATE_WORKING;
     p.progress  = (float) r->last_pts / (float) r->duration;
@@ -658,7 +858,7 @@ static void UpdateState( hb_work_private_t  * r )
     }
 #undef p
 
-    hb_set_state( r->job->h, &state );
+    hb_set_job_state( r->job, &state );
 }
 
 /***********************************************************************
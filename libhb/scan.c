@@ -10,6 +10,9 @@
 #include "handbrake/handbrake.h"
 #include "handbrake/hbffmpeg.h"
 #include "handbrake/hwaccel.h"
+#include "handbrake/scancache.h"
+
+typedef struct hb_scan_pool_s hb_scan_pool_t;
 
 typedef struct
 {
@@ -37,22 +40,48 @@ typedef struct
     hb_list_t    * exclude_extensions;
 
     int            hw_decode;
+
+    // Batch scans scan several files at the same time, see ScanFiles()
+    hb_scan_pool_t * pool;
+    int            pool_index;      // file scanned by this worker
     
 } hb_scan_t;
 
+struct hb_scan_pool_s
+{
+    hb_lock_t    * lock;
+    int            count;           // number of files
+    int            next;            // next file to scan
+    int            done;            // files scanned
+    float        * progress;        // scan progress of each file, 0 to 1
+    float          progress_sum;
+    hb_title_t  ** titles;          // scanned titles, in file order
+};
+
 #define PREVIEW_READ_THRESH (200)
 #define AUDIO_DECODE_ERROR_LIMIT (10)
 
+// Files of a batch scanned at the same time, 0 for automatic
+static int scan_file_threads = 0;
+// Decode only the keyframes of files for the previews
+static int scan_fast = 0;
+// Threads decoding the previews of a file, 0 for automatic
+static int scan_preview_threads = 0;
+
 static void ScanFunc( void * );
-static int  DecodePreviews( hb_scan_t *, hb_title_t * title, int flush );
+static void ScanFiles( hb_scan_t * data, int count );
+static int  ScanTitle( hb_scan_t * data, hb_title_t * title );
+static int  DecodePreviews( hb_scan_t *, hb_title_t * title, int flush,
+                             int fast );
 static hb_audio_t * find_audio_for_id(hb_title_t * title, int id);
 static void LookForAudio(hb_scan_t *scan, hb_title_t *title, hb_audio_t * audio, hb_buffer_t *b);
 static int  AllAudioOK( hb_title_t * title );
 static void UpdateState1(hb_scan_t *scan, int title);
 static void UpdateState2(hb_scan_t *scan, int title);
 static void UpdateState3(hb_scan_t *scan, int preview);
+static void ScanFilesProgress(hb_scan_t *scan, float progress, int preview);
 
-static const char *aspect_to_string(hb_rational_t *dar)
+static const char *aspect_to_string(hb_rational_t *dar, char arstr[32])
 {
     double aspect = (double)dar->num / dar->den;
     switch ( (int)(aspect * 9.) )
@@ -60,11 +89,10 @@ static const char *aspect_to_string(hb_rational_t *dar)
         case 9 * 4 / 3:    return "4:3";
         case 9 * 16 / 9:   return "16:9";
     }
-    static char arstr[32];
     if (aspect >= 1)
-        snprintf(arstr, sizeof(arstr), "%.2f:1", aspect);
+        snprintf(arstr, 32, "%.2f:1", aspect);
     else
-        snprintf(arstr, sizeof(arstr), "1:%.2f", 1. / aspect );
+        snprintf(arstr, 32, "1:%.2f", 1. / aspect );
     return arstr;
 }
 
@@ -133,6 +161,7 @@ static void ScanFunc( void * _data )
     hb_title_t * title;
     int          i;
     int          feature = 0;
+    int          scanned = 0;
 
     data->bd = NULL;
     data->dvd = NULL;
@@ -208,47 +237,24 @@ static void ScanFunc( void * _data )
         }
         else
         {
-            /* Scan all titles */
-            for( i = 0; i < hb_batch_title_count( data->batch ); i++ )
+            /* Scan all titles, including their previews */
+            ScanFiles(data, hb_batch_title_count(data->batch));
+            scanned = 1;
+            if (*data->die)
             {
-                if (*data->die)
-                {
-                    goto finish;
-                }
-
-                hb_title_t * title;
-
-                UpdateState1(data, i + 1);
-                title = hb_batch_title_scan(data->batch, i + 1);
-                if ( title != NULL )
-                {
-                    hb_list_add( data->title_set->list_title, title );
-                }
+                goto finish;
             }
         }
     }
     else if (hb_list_count(data->paths) > 1) // We have many file paths to process.
     {
         // If dragging a batch of files, maybe not, but if the UI's implement a recursive folder maybe?
-        for (i = 0; i < hb_list_count( data->paths ); i++)
+        ScanFiles(data, hb_list_count(data->paths));
+        scanned = 1;
+        single_path = hb_list_item(data->paths, hb_list_count(data->paths) - 1);
+        if (*data->die)
         {
-            if (*data->die)
-            {
-                goto finish;
-            }
-
-            single_path = hb_list_item(data->paths, i);
-
-            UpdateState1(data, i + 1);
-
-            if (hb_is_valid_batch_path(single_path))
-            {
-                title = hb_batch_title_scan_single(data->h, single_path, (int)i + 1);
-                if (title != NULL)
-                {
-                    hb_list_add(data->title_set->list_title, title);
-                }
-            }
+            goto finish;
         }
     }
     else if (single_path != NULL) // Single File.
@@ -277,11 +283,8 @@ static void ScanFunc( void * _data )
         }
     }
 
-    for( i = 0; i < hb_list_count( data->title_set->list_title ); )
+    for( i = 0; !scanned && i < hb_list_count( data->title_set->list_title ); )
     {
-        int j, npreviews;
-        hb_audio_t * audio;
-
         if ( *data->die )
         {
             goto finish;
@@ -290,71 +293,12 @@ static void ScanFunc( void * _data )
 
         UpdateState2(data, i + 1);
 
-        /* Decode previews */
-        /* this will also detect more AC3 / DTS information */
-        npreviews = DecodePreviews( data, title, 1 );
-        if (npreviews < 2)
-        {
-            // Try harder to get some valid frames
-            // Allow libav to return "corrupt" frames
-            hb_log("scan: Too few previews (%d), trying harder", npreviews);
-            title->flags |= HBTF_NO_IDR;
-            npreviews = DecodePreviews( data, title, 0 );
-        }
-        if (npreviews == 0)
+        if (!ScanTitle(data, title))
         {
-            /* TODO: free things */
             hb_list_rem( data->title_set->list_title, title );
-            for( j = 0; j < hb_list_count( title->list_audio ); j++)
-            {
-                audio = hb_list_item( title->list_audio, j );
-                if ( audio->priv.scan_cache )
-                {
-                    hb_fifo_flush( audio->priv.scan_cache );
-                    hb_fifo_close( &audio->priv.scan_cache );
-                }
-            }
             hb_title_close( &title );
             continue;
         }
-        title->preview_count = npreviews;
-
-        /* Make sure we found audio rates and bitrates */
-        for( j = 0; j < hb_list_count( title->list_audio ); )
-        {
-            audio = hb_list_item( title->list_audio, j );
-            if ( audio->priv.scan_cache )
-            {
-                hb_fifo_flush( audio->priv.scan_cache );
-                hb_fifo_close( &audio->priv.scan_cache );
-            }
-            if( !audio->config.in.bitrate )
-            {
-                hb_log( "scan: removing audio 0x%x because no bitrate found",
-                        audio->id );
-                hb_list_rem( title->list_audio, audio );
-                free( audio );
-                continue;
-            }
-            j++;
-        }
-
-        // VOBSUB and PGS width and height needs to be set to the
-        // title width and height for any stream type that does
-        // not provide this information (DVDs, BDs, VOBs, and M2TSs).
-        // Title width and height don't get set until we decode
-        // previews, so we can't set subtitle width/height till
-        // we get here.
-        for (j = 0; j < hb_list_count(title->list_subtitle); j++)
-        {
-            hb_subtitle_t *subtitle = hb_list_item(title->list_subtitle, j);
-            if ((subtitle->source == VOBSUB || subtitle->source == PGSSUB) &&
-                (subtitle->width <= 0 || subtitle->height <= 0))
-            {
-                subtitle->width  = title->geometry.width;
-                subtitle->height = title->geometry.height;
-            }
-        }
         i++;
     }
 
@@ -425,6 +369,283 @@ finish:
     hb_buffer_pool_free();
 }
 
+/***********************************************************************
+ * ScanTitle
+ ***********************************************************************
+ * Decode the previews of a title and finish its audio and subtitle
+ * tracks.  Returns 0 if no preview could be decoded, the caller then
+ * discards the title.  The results for files come from the scan cache
+ * when it is enabled and has them, see scancache.h.
+ **********************************************************************/
+static int ScanTitle( hb_scan_t * data, hb_title_t * title )
+{
+    int          j, npreviews;
+    hb_audio_t * audio;
+    char         settings[128];
+    int          cache, fast;
+
+    // DVD and BD previews are few and short, they are always decoded
+    // the normal way
+    fast = scan_fast && (title->type == HB_STREAM_TYPE ||
+                         title->type == HB_FF_STREAM_TYPE);
+
+    // Only files can be recognized when they are scanned again
+    cache = hb_scan_cache_enabled() &&
+            (title->type == HB_STREAM_TYPE ||
+             title->type == HB_FF_STREAM_TYPE);
+    snprintf(settings, sizeof(settings), "crop=%d:%d hw_decode=%d fast=%d",
+             data->crop_threshold_frames, data->crop_threshold_pixels,
+             data->hw_decode, fast);
+    if (cache && hb_scan_cache_load(data->h, title, settings,
+                                    data->preview_count, data->store_previews))
+    {
+        UpdateState3(data, data->preview_count);
+        goto subtitles;
+    }
+
+    /* Decode previews */
+    /* this will also detect more AC3 / DTS information */
+    npreviews = DecodePreviews( data, title, 1, fast );
+    if (npreviews < 2 && !*data->die)
+    {
+        // Try harder to get some valid frames
+        // Allow libav to return "corrupt" frames
+        hb_log("scan: Too few previews (%d), trying harder", npreviews);
+        title->flags |= HBTF_NO_IDR;
+        title->flags &= ~(HBTF_FAST_SCAN | HBTF_LOW_CONFIDENCE);
+        npreviews = DecodePreviews( data, title, 0, 0 );
+    }
+    if (npreviews == 0)
+    {
+        /* TODO: free things */
+        for( j = 0; j < hb_list_count( title->list_audio ); j++)
+        {
+            audio = hb_list_item( title->list_audio, j );
+            if ( audio->priv.scan_cache )
+            {
+                hb_fifo_flush( audio->priv.scan_cache );
+                hb_fifo_close( &audio->priv.scan_cache );
+            }
+        }
+        return 0;
+    }
+    title->preview_count = npreviews;
+
+    /* Make sure we found audio rates and bitrates */
+    for( j = 0; j < hb_list_count( title->list_audio ); )
+    {
+        audio = hb_list_item( title->list_audio, j );
+        if ( audio->priv.scan_cache )
+        {
+            hb_fifo_flush( audio->priv.scan_cache );
+            hb_fifo_close( &audio->priv.scan_cache );
+        }
+        if( !audio->config.in.bitrate )
+        {
+            hb_log( "scan: removing audio 0x%x because no bitrate found",
+                    audio->id );
+            hb_list_rem( title->list_audio, audio );
+            free( audio );
+            continue;
+        }
+        j++;
+    }
+    if (cache && !*data->die)
+    {
+        hb_scan_cache_save(data->h, title, settings,
+                           data->preview_count, data->store_previews);
+    }
+
+subtitles:
+    // VOBSUB and PGS width and height needs to be set to the
+    // title width and height for any stream type that does
+    // not provide this information (DVDs, BDs, VOBs, and M2TSs).
+    // Title width and height don't get set until we decode
+    // previews, so we can't set subtitle width/height till
+    // we get here.
+    for (j = 0; j < hb_list_count(title->list_subtitle); j++)
+    {
+        hb_subtitle_t *subtitle = hb_list_item(title->list_subtitle, j);
+        if ((subtitle->source == VOBSUB || subtitle->source == PGSSUB) &&
+            (subtitle->width <= 0 || subtitle->height <= 0))
+        {
+            subtitle->width  = title->geometry.width;
+            subtitle->height = title->geometry.height;
+        }
+    }
+    return 1;
+}
+
+/***********************************************************************
+ * ScanFiles
+ ***********************************************************************
+ * Scan the files of a batch, or the list of paths, on a pool of
+ * threads.  Each thread takes the next file, scans its title and
+ * decodes its previews.  The titles keep the index of their file and
+ * are added to the title set in file order once all files are scanned.
+ **********************************************************************/
+static hb_title_t * ScanFile( hb_scan_t * data, int i )
+{
+    char * path;
+
+    if (data->batch)
+    {
+        return hb_batch_title_scan(data->batch, i + 1);
+    }
+    path = hb_list_item(data->paths, i);
+    if (hb_is_valid_batch_path(path))
+    {
+        return hb_batch_title_scan_single(data->h, path, i + 1);
+    }
+    return NULL;
+}
+
+static void ScanFilesFunc( void * _data )
+{
+    hb_scan_t      * data = _data;
+    hb_scan_pool_t * pool = data->pool;
+    hb_title_t     * title;
+
+    while (!*data->die)
+    {
+        hb_lock(pool->lock);
+        data->pool_index = pool->next++;
+        hb_unlock(pool->lock);
+        if (data->pool_index >= pool->count)
+        {
+            break;
+        }
+
+        UpdateState1(data, data->pool_index + 1);
+        title = ScanFile(data, data->pool_index);
+        if (title != NULL)
+        {
+            UpdateState2(data, data->pool_index + 1);
+            if (!ScanTitle(data, title))
+            {
+                hb_title_close(&title);
+            }
+        }
+        // Each file has its own slot, read after the threads are joined
+        pool->titles[data->pool_index] = title;
+
+        hb_lock(pool->lock);
+        pool->done++;
+        hb_unlock(pool->lock);
+        UpdateState3(data, data->preview_count);
+    }
+}
+
+static void ScanFiles( hb_scan_t * data, int count )
+{
+    hb_scan_pool_t   pool;
+    hb_scan_t      * workers;
+    hb_thread_t   ** threads;
+    int              ii, thread_count;
+
+    if (count <= 0)
+    {
+        return;
+    }
+
+    // Preview decoding is multi-threaded and each file has its own
+    // decoders and frames, so don't use too many.
+    thread_count = scan_file_threads;
+    if (thread_count <= 0)
+    {
+        thread_count = MIN(8, MAX(1, hb_get_cpu_count() / 2));
+    }
+    thread_count = MIN(thread_count, count);
+
+    memset(&pool, 0, sizeof(pool));
+    pool.lock     = hb_lock_init();
+    pool.count    = count;
+    pool.progress = calloc(count, sizeof(float));
+    pool.titles   = calloc(count, sizeof(hb_title_t *));
+    workers       = calloc(thread_count, sizeof(hb_scan_t));
+    threads       = calloc(thread_count, sizeof(hb_thread_t *));
+    if (pool.lock == NULL || pool.progress == NULL || pool.titles == NULL ||
+        workers == NULL || threads == NULL)
+    {
+        hb_error("scan: out of memory");
+        goto cleanup;
+    }
+
+    hb_log("scan: scanning %d files, %d at a time", count, thread_count);
+    for (ii = 0; ii < thread_count; ii++)
+    {
+        workers[ii]      = *data;
+        workers[ii].pool = &pool;
+    }
+    // The scan thread is the first worker
+    for (ii = 1; ii < thread_count; ii++)
+    {
+        threads[ii] = hb_thread_init("scan worker", ScanFilesFunc,
+                                     &workers[ii], HB_NORMAL_PRIORITY);
+    }
+    ScanFilesFunc(&workers[0]);
+    for (ii = 1; ii < thread_count; ii++)
+    {
+        if (threads[ii] != NULL)
+        {
+            hb_thread_close(&threads[ii]);
+        }
+    }
+
+    for (ii = 0; ii < count; ii++)
+    {
+        if (pool.titles[ii] != NULL)
+        {
+            hb_list_add(data->title_set->list_title, pool.titles[ii]);
+        }
+    }
+
+cleanup:
+    free(threads);
+    free(workers);
+    free(pool.titles);
+    free(pool.progress);
+    hb_lock_close(&pool.lock);
+}
+
+// Aggregated progress of the files being scanned by a pool
+static void ScanFilesProgress( hb_scan_t * scan, float progress, int preview )
+{
+    hb_scan_pool_t * pool = scan->pool;
+    hb_state_t       state;
+
+    hb_lock(pool->lock);
+    pool->progress_sum += progress - pool->progress[scan->pool_index];
+    pool->progress[scan->pool_index] = progress;
+
+    hb_get_state2(scan->h, &state);
+#define p state.param.scanning
+    state.state     = HB_STATE_SCANNING;
+    p.title_cur     = MIN(pool->done + 1, pool->count);
+    p.title_count   = pool->count;
+    p.preview_cur   = preview;
+    p.preview_count = scan->preview_count;
+    p.progress      = pool->progress_sum / pool->count;
+#undef p
+    hb_set_state(scan->h, &state);
+    hb_unlock(pool->lock);
+}
+
+void hb_scan_set_file_threads( int count )
+{
+    scan_file_threads = count;
+}
+
+void hb_scan_set_fast( int enable )
+{
+    scan_fast = !!enable;
+}
+
+void hb_scan_set_preview_threads( int count )
+{
+    scan_preview_threads = count;
+}
+
 // -----------------------------------------------
 // stuff related to cropping
 
@@ -441,17 +662,27 @@ static inline int clampBlack( int x )
     return x < 16 ? 16 : x;
 }
 
+// Previews have the bit depth of the source, the thresholds are for
+// 8 bit luma values
+static inline int luma8( const uint8_t *luma, int offset, int shift )
+{
+    if ( shift )
+        return ((const uint16_t *)luma)[offset] >> shift;
+    return luma[offset];
+}
+
 static int row_all_dark( hb_buffer_t* buf, int row )
 {
     int width = buf->plane[0].width;
     int stride = buf->plane[0].stride;
+    int shift = MAX( hb_get_bit_depth( buf->f.fmt ) - 8, 0 );
     uint8_t *luma = buf->plane[0].data + stride * row;
 
     // compute the average luma value of the row
     int i, avg = 0;
     for ( i = 0; i < width; ++i )
     {
-        avg += clampBlack( luma[i] );
+        avg += clampBlack( luma8( luma, i, shift ) );
     }
     avg /= width;
     if ( avg >= DARK )
@@ -463,7 +694,7 @@ static int row_all_dark( hb_buffer_t* buf, int row )
     // so anything less will fail to crop because of the noise).
     for ( i = 0; i < width; ++i )
     {
-        if ( absdiff( avg, clampBlack( luma[i] ) ) > 16 )
+        if ( absdiff( avg, clampBlack( luma8( luma, i, shift ) ) ) > 16 )
             return 0;
     }
     return 1;
@@ -471,15 +702,17 @@ static int row_all_dark( hb_buffer_t* buf, int row )
 
 static int column_all_dark( hb_buffer_t* buf, int top, int bottom, int col )
 {
-    int stride = buf->plane[0].stride;
+    int shift = MAX( hb_get_bit_depth( buf->f.fmt ) - 8, 0 );
+    int bps = shift ? 2 : 1;
+    int stride = buf->plane[0].stride / bps;
     int height = buf->plane[0].height - top - bottom;
-    uint8_t *luma = buf->plane[0].data + stride * top + col;
+    uint8_t *luma = buf->plane[0].data + buf->plane[0].stride * top + col * bps;
 
     // compute the average value of the column
     int i = height, avg = 0, row = 0;
     for ( ; --i >= 0; row += stride )
     {
-        avg += clampBlack( luma[row] );
+        avg += clampBlack( luma8( luma, row, shift ) );
     }
     avg /= height;
     if ( avg >= DARK )
@@ -490,7 +723,7 @@ static int column_all_dark( hb_buffer_t* buf, int top, int bottom, int col )
     i = height, row = 0;
     for ( ; --i >= 0; row += stride )
     {
-        if ( absdiff( avg, clampBlack( luma[row] ) ) > 16 )
+        if ( absdiff( avg, clampBlack( luma8( luma, row, shift ) ) ) > 16 )
             return 0;
     }
     return 1;
@@ -535,98 +768,718 @@ static void record_crop( crop_record_t *crops, int t, int b, int l, int r )
     ++crops->n;
 }
 
-static int compare_int( const void *a, const void *b )
-{
-    return *(const int *)a - *(const int *)b;
+static int compare_int( const void *a, const void *b )
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+static void sort_crops( crop_record_t *crops )
+{
+    qsort( crops->t, crops->n, sizeof(crops->t[0]), compare_int );
+    qsort( crops->b, crops->n, sizeof(crops->t[0]), compare_int );
+    qsort( crops->l, crops->n, sizeof(crops->t[0]), compare_int );
+    qsort( crops->r, crops->n, sizeof(crops->t[0]), compare_int );
+}
+
+// -----------------------------------------------
+// stuff related to title width/height/aspect info
+
+typedef struct {
+    int count;              /* number of times we've seen this info entry */
+    hb_work_info_t info;    /* copy of info entry */
+} info_list_t;
+
+static void remember_info( info_list_t *info_list, hb_work_info_t *info )
+{
+    for ( ; info_list->count; ++info_list )
+    {
+        if ( memcmp( &info_list->info, info, sizeof(*info) ) == 0 )
+        {
+            // we found a match - bump its count
+            ++info_list->count;
+            return;
+        }
+    }
+    // no match found - add new entry to list (info_list points to
+    // the first free slot). NB - we assume that info_list was allocated
+    // so that it's big enough even if there are no dups. I.e., 10 slots
+    // allocated if there are 10 previews.
+    info_list->count = 1;
+    info_list->info = *info;
+}
+
+static void most_common_info( info_list_t *info_list, hb_work_info_t *info )
+{
+    int i, biggest = 0;
+    for ( i = 1; info_list[i].count; ++i )
+    {
+        if ( info_list[i].count > info_list[biggest].count )
+            biggest = i;
+    }
+    *info = info_list[biggest].info;
+}
+
+static int has_resolution_change( info_list_t *info_list )
+{
+    int w, h, i;
+
+    if( !info_list[0].count )
+        return 0;
+    w = info_list[0].info.geometry.width;
+    h = info_list[0].info.geometry.height;
+    for ( i = 1; info_list[i].count; ++i )
+    {
+        if (w != info_list[i].info.geometry.width ||
+            h != info_list[i].info.geometry.height)
+            return 1;
+    }
+    return 0;
+}
+
+static int is_close_to( int val, int target, int thresh )
+{
+    int diff = val - target;
+    diff = diff < 0 ? -diff : diff;
+    return diff < thresh;
+}
+
+static hb_buffer_t * read_buf(hb_scan_t * data, hb_stream_t * stream)
+{
+    if (data->bd)
+    {
+        return hb_bd_read(data->bd);
+    }
+    else if (data->dvd)
+    {
+        return hb_dvd_read(data->dvd);
+    }
+    else if (stream)
+    {
+        return hb_stream_read(stream);
+    }
+
+    // This shouldn't happen
+    return NULL;
+}
+
+// Results of the preview at one position, see DecodePreview()
+#define PREVIEW_NONE    0   // no usable picture at this position
+#define PREVIEW_OK      1
+#define PREVIEW_EOF     2   // end of the source, later positions are ignored
+
+typedef struct
+{
+    int             status;
+    hb_work_info_t  info;
+    int             interlaced;
+    int             has_crop;
+    int             crop[4];            // top, bottom, left, right
+
+    // frame rate statistics of the frames decoded at this position
+    int             pulldown_count;
+    int             doubled_frame_count;
+    int             progressive_count;
+    int             vid_samples;
+} preview_result_t;
+
+typedef struct
+{
+    hb_scan_t        * data;
+    hb_title_t       * title;           // the scanned title, its audio
+                                        // tracks are probed
+    hb_title_t       * vid_title;       // title of the stream and decoder
+    int                subtitle_count;  // tracks of vid_title that are
+                                        // tracks of title
+    hb_stream_t      * stream;
+    hb_work_object_t * vid_decoder;
+    void             * hw_device_ctx;
+    int                flush;
+    int                fast;
+    int                cc_wait;
+
+    // Shared by all the workers of a title
+    hb_lock_t        * lock;            // NULL when there is one worker
+    int              * next;            // next position to decode
+    int              * done;            // positions decoded
+    int              * abort_audio;
+    preview_result_t * results;
+} preview_worker_t;
+
+static void preview_lock( preview_worker_t * w )
+{
+    if (w->lock != NULL)
+    {
+        hb_lock(w->lock);
+    }
+}
+
+static void preview_unlock( preview_worker_t * w )
+{
+    if (w->lock != NULL)
+    {
+        hb_unlock(w->lock);
+    }
+}
+
+// Audio tracks are probed by all the workers of a title
+static int preview_audio_ok( preview_worker_t * w, int check_abort )
+{
+    int ok;
+
+    preview_lock(w);
+    ok = (check_abort && *w->abort_audio) || AllAudioOK(w->title);
+    preview_unlock(w);
+    return ok;
+}
+
+static int preview_worker_init( preview_worker_t * w, int hw_decode )
+{
+    hb_scan_t  * data  = w->data;
+    hb_title_t * title = w->title;
+
+    if (w->vid_title != title)
+    {
+        // The stream and the decoder of each worker write their own
+        // state and closed captions into the title
+        hb_title_t * copy = malloc(sizeof(hb_title_t));
+        int          ii;
+
+        if (copy == NULL)
+        {
+            w->vid_title = NULL;
+            return -1;
+        }
+        preview_lock(w);
+        *copy = *title;
+        // The format context of the title's stream may be closed
+        // already, the worker's stream sets its own
+        copy->opaque_priv   = NULL;
+        copy->list_audio    = hb_list_init();
+        copy->list_subtitle = hb_list_init();
+        for (ii = 0; ii < hb_list_count(title->list_audio); ii++)
+        {
+            hb_list_add(copy->list_audio, hb_list_item(title->list_audio, ii));
+        }
+        for (ii = 0; ii < hb_list_count(title->list_subtitle); ii++)
+        {
+            hb_list_add(copy->list_subtitle,
+                        hb_list_item(title->list_subtitle, ii));
+        }
+        w->subtitle_count = hb_list_count(copy->list_subtitle);
+        preview_unlock(w);
+        w->vid_title = copy;
+    }
+
+    if (data->bd == NULL && data->dvd == NULL) // data->batch or a single file
+    {
+        w->stream = hb_stream_open(data->h, title->path, w->vid_title, 0);
+        if (w->stream == NULL)
+        {
+            hb_error("Can't open stream!");
+            return -1;
+        }
+    }
+
+    if (title->video_codec == WORK_NONE)
+    {
+        hb_error("No video decoder set!");
+        return -1;
+    }
+
+    if (hw_decode)
+    {
+        hb_hwaccel_hw_ctx_init(title->video_codec_param, hw_decode,
+                               &w->hw_device_ctx);
+    }
+
+    w->vid_decoder = hb_get_work(data->h, title->video_codec);
+    w->vid_decoder->codec_param = title->video_codec_param;
+    w->vid_decoder->hw_device_ctx = w->hw_device_ctx;
+    w->vid_decoder->title = w->vid_title;
+    w->vid_decoder->fast_decode = w->fast;
+
+    if (w->vid_decoder->init(w->vid_decoder, NULL))
+    {
+        hb_error("Decoder init failed!");
+        free(w->vid_decoder);
+        w->vid_decoder = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+static void preview_worker_close( preview_worker_t * w )
+{
+    if (w->vid_decoder != NULL)
+    {
+        w->vid_decoder->close(w->vid_decoder);
+        free(w->vid_decoder);
+        w->vid_decoder = NULL;
+    }
+    hb_hwaccel_hw_ctx_close(&w->hw_device_ctx);
+    hb_stream_close(&w->stream);
+
+    if (w->vid_title != NULL && w->vid_title != w->title)
+    {
+        hb_subtitle_t * subtitle;
+        int             ii;
+
+        // Closed captions found by this worker and not merged into the
+        // title, the other tracks belong to the title
+        for (ii = w->subtitle_count;
+             (subtitle = hb_list_item(w->vid_title->list_subtitle, ii)); ii++)
+        {
+            free(subtitle);
+        }
+        hb_list_close(&w->vid_title->list_subtitle);
+        hb_list_close(&w->vid_title->list_audio);
+        free(w->vid_title);
+    }
+    w->vid_title = NULL;
+}
+
+/***********************************************************************
+ * DecodePreview
+ ***********************************************************************
+ * Seek to preview position i, decode a picture and analyse it.  Audio
+ * packets read on the way are used to find the audio track details.
+ **********************************************************************/
+static void DecodePreview( preview_worker_t * w, int i,
+                           preview_result_t * res )
+{
+    hb_scan_t        * data        = w->data;
+    hb_title_t       * title       = w->title;
+    hb_work_object_t * vid_decoder = w->vid_decoder;
+    hb_buffer_t      * buf, * buf_es;
+    hb_buffer_list_t   list_es;
+    hb_buffer_t      * vid_buf = NULL, * last_vid_buf = NULL;
+    int                frame_wait, frames = 0, packets = 0, j;
+
+    memset(res, 0, sizeof(*res));
+    hb_buffer_list_clear(&list_es);
+
+    if (data->bd)
+    {
+        if( !hb_bd_seek( data->bd, (float) ( i + 1 ) / ( data->preview_count + 1.0 ) ) )
+        {
+            return;
+        }
+    }
+    if (data->dvd)
+    {
+        if( !hb_dvd_seek( data->dvd, (float) ( i + 1 ) / ( data->preview_count + 1.0 ) ) )
+        {
+            return;
+        }
+    }
+    else if (w->stream)
+    {
+        /* we start reading streams at zero rather than 1/11 because
+         * short streams may have only one sequence header in the entire
+         * file and we need it to decode any previews.
+         *
+         * Also, seeking to position 0 loses the palette of avi files
+         * so skip initial seek */
+        if (i != 0)
+        {
+            if (!hb_stream_seek(w->stream,
+                                (float)i / (data->preview_count + 1.0)))
+            {
+                return;
+            }
+        }
+        else
+        {
+            hb_stream_set_need_keyframe(w->stream, 1);
+        }
+    }
+
+    hb_deep_log( 2, "scan: preview %d", i + 1 );
+
+    if (w->flush && vid_decoder->flush)
+        vid_decoder->flush( vid_decoder );
+    if (title->flags & HBTF_NO_IDR)
+    {
+        if (!w->flush)
+        {
+            // If we are doing the first previews decode attempt,
+            // set this threshold high so that we get the best
+            // quality frames possible.
+            frame_wait = 100;
+        }
+        else
+        {
+            // If we failed to get enough valid frames in the first
+            // previews decode attempt, lower the threshold to improve
+            // our chances of getting something to work with.
+            frame_wait = 10;
+        }
+    }
+    else if (!w->fast)
+    {
+        // For certain mpeg-2 streams, libav is delivering a
+        // dummy first frame that is all black.  So always skip
+        // one frame
+        frame_wait = 1;
+    }
+    else
+    {
+        frame_wait = 0;
+    }
+
+    vid_decoder->frame_count = 0;
+    while (vid_decoder->frame_count < PREVIEW_READ_THRESH ||
+          (!preview_audio_ok(w, 0) && packets < 10000))
+    {
+        if ((buf = read_buf(data, w->stream)) == NULL)
+        {
+            // If we reach EOF and no audio, don't continue looking for
+            // audio
+            preview_lock(w);
+            *w->abort_audio = 1;
+            preview_unlock(w);
+            if (vid_buf != NULL || last_vid_buf != NULL)
+            {
+                break;
+            }
+            hb_log("Warning: Could not read data for preview %d, skipped",
+                   i + 1 );
+
+            // If we reach EOF and no video, don't continue looking for
+            // video
+            res->status = PREVIEW_EOF;
+            goto skip_preview;
+        }
+
+        packets++;
+        if (buf->size <= 0)
+        {
+            // Ignore "null" frames
+            hb_buffer_close(&buf);
+            continue;
+        }
+
+        (hb_demux[title->demuxer])(buf, &list_es, 0 );
+
+        while ((buf_es = hb_buffer_list_rem_head(&list_es)) != NULL)
+        {
+            if( buf_es->s.id == title->video_id && vid_buf == NULL )
+            {
+                vid_decoder->work( vid_decoder, &buf_es, &vid_buf );
+                // There are 2 conditions we decode additional
+                // video frames for during scan.
+                // 1. We did not detect IDR frames, so the initial video
+                //    frames may be corrupt.  We decode extra frames to
+                //    increase the probability of a complete preview frame
+                // 2. Some frames do not contain CC data, even though
+                //    CCs are present in the stream.  So we need to decode
+                //    additional frames to find the CCs.
+                if (vid_buf != NULL && (frame_wait || w->cc_wait || w->fast))
+                {
+                    hb_work_info_t vid_info;
+                    if (vid_decoder->info(vid_decoder, &vid_info))
+                    {
+                        if (is_close_to(vid_info.rate.den, 900900, 100) &&
+                            (vid_buf->s.flags & PIC_FLAG_REPEAT_FIRST_FIELD))
+                        {
+                            /* Potentially soft telecine material */
+                            res->pulldown_count++;
+                        }
+
+                        if (vid_buf->s.flags & PIC_FLAG_REPEAT_FRAME)
+                        {
+                            // AVCHD-Lite specifies that all streams are
+                            // 50 or 60 fps.  To produce 25 or 30 fps, camera
+                            // makers are repeating all frames.
+                            res->doubled_frame_count++;
+                        }
+
+                        if (is_close_to(vid_info.rate.den, 1126125, 100 ))
+                        {
+                            // Frame FPS is 23.976 (meaning it's
+                            // progressive), so start keeping track of
+                            // how many are reporting at that speed. When
+                            // enough show up that way, we want to make
+                            // that the overall title FPS.
+                            res->progressive_count++;
+                        }
+                        res->vid_samples++;
+                    }
+
+                    if (frames > 0 && vid_buf->s.frametype == HB_FRAME_I)
+                        frame_wait = 0;
+                    if (frame_wait || w->cc_wait)
+                    {
+                        hb_buffer_close(&last_vid_buf);
+                        last_vid_buf = vid_buf;
+                        vid_buf = NULL;
+                        if (frame_wait) frame_wait--;
+                        if (w->cc_wait) w->cc_wait--;
+                    }
+                    frames++;
+                }
+            }
+            else
+            {
+                preview_lock(w);
+                if (!AllAudioOK(title) && !*w->abort_audio)
+                {
+                    hb_audio_t * audio = find_audio_for_id(title, buf_es->s.id);
+                    if (audio != NULL && audio->priv.scan_error_count < AUDIO_DECODE_ERROR_LIMIT)
+                    {
+                        // Probe with the worker's title, its
+                        // opaque_priv is the worker's open stream
+                        LookForAudio( data, w->vid_title, audio, buf_es );
+                        buf_es = NULL;
+                    }
+                }
+                preview_unlock(w);
+            }
+            if ( buf_es )
+                hb_buffer_close( &buf_es );
+        }
+
+        if (vid_buf && preview_audio_ok(w, 1))
+            break;
+    }
+    hb_buffer_list_close(&list_es);
+
+    if (vid_buf == NULL)
+    {
+        vid_buf = last_vid_buf;
+        last_vid_buf = NULL;
+    }
+    hb_buffer_close(&last_vid_buf);
+
+    if (vid_buf == NULL)
+    {
+        hb_log( "scan: could not get a decoded picture" );
+        return;
+    }
+
+    /* Get size and rate infos */
+
+    hb_work_info_t vid_info;
+    if( !vid_decoder->info( vid_decoder, &vid_info ) )
+    {
+        /*
+         * Could not fill vid_info, don't continue and try to use vid_info
+         * in this case.
+         */
+        hb_log( "scan: could not get a video information" );
+        hb_buffer_close( &vid_buf );
+        return;
+    }
+
+    if (vid_info.geometry.width  != vid_buf->f.width ||
+        vid_info.geometry.height != vid_buf->f.height)
+    {
+        hb_log( "scan: video geometry information does not match buffer" );
+        hb_buffer_close( &vid_buf );
+        return;
+    }
+    res->info = vid_info;
+
+    /* Check preview for interlacing artifacts */
+    if( hb_detect_comb( vid_buf, 10, 30, 9, 10, 30, 9 ) )
+    {
+        hb_deep_log( 2, "Interlacing detected in preview frame %i", i+1);
+        res->interlaced = 1;
+    }
+
+    if( data->store_previews )
+    {
+        hb_save_preview( data->h, title->index, i, vid_buf, HB_PREVIEW_FORMAT_RAW );
+    }
+
+    /* Detect black borders */
+
+    int top, bottom, left, right;
+    int h4 = vid_info.geometry.height / 4, w4 = vid_info.geometry.width / 4;
+
+    // When widescreen content is matted to 16:9 or 4:3 there's sometimes
+    // a thin border on the outer edge of the matte. On TV content it can be
+    // "line 21" VBI data that's normally hidden in the overscan. For HD
+    // content it can just be a diagnostic added in post production so that
+    // the frame borders are visible. We try to ignore these borders so
+    // we can crop the matte. The border width depends on the resolution
+    // (12 pixels on 1080i looks visually the same as 4 pixels on 480i)
+    // so we allow the border to be up to 1% of the frame height.
+    const int border = vid_info.geometry.height / 100;
+
+    for ( top = border; top < h4; ++top )
+    {
+        if ( ! row_all_dark( vid_buf, top ) )
+            break;
+    }
+    if ( top <= border )
+    {
+        // we never made it past the border region - see if the rows we
+        // didn't check are dark or if we shouldn't crop at all.
+        for ( top = 0; top < border; ++top )
+        {
+            if ( ! row_all_dark( vid_buf, top ) )
+                break;
+        }
+        if ( top >= border )
+        {
+            top = 0;
+        }
+    }
+    for ( bottom = border; bottom < h4; ++bottom )
+    {
+        if ( ! row_all_dark( vid_buf, vid_info.geometry.height - 1 - bottom ) )
+            break;
+    }
+    if ( bottom <= border )
+    {
+        for ( bottom = 0; bottom < border; ++bottom )
+        {
+            if ( ! row_all_dark( vid_buf, vid_info.geometry.height - 1 - bottom ) )
+                break;
+        }
+        if ( bottom >= border )
+        {
+            bottom = 0;
+        }
+    }
+    for ( left = 0; left < w4; ++left )
+    {
+        if ( ! column_all_dark( vid_buf, top, bottom, left ) )
+            break;
+    }
+    for ( right = 0; right < w4; ++right )
+    {
+        if ( ! column_all_dark( vid_buf, top, bottom, vid_info.geometry.width - 1 - right ) )
+            break;
+    }
+
+    // only record the result if all the crops are less than a quarter of
+    // the frame otherwise we can get fooled by frames with a lot of black
+    // like titles, credits & fade-thru-black transitions.
+    if ( top < h4 && bottom < h4 && left < w4 && right < w4 )
+    {
+        res->has_crop = 1;
+        res->crop[0]  = top;
+        res->crop[1]  = bottom;
+        res->crop[2]  = left;
+        res->crop[3]  = right;
+    }
+    res->status = PREVIEW_OK;
+
+skip_preview:
+    hb_buffer_list_close(&list_es);
+
+    /* Make sure we found audio rates and bitrates */
+    preview_lock(w);
+    for( j = 0; j < hb_list_count( title->list_audio ); j++ )
+    {
+        hb_audio_t * audio = hb_list_item( title->list_audio, j );
+        if ( audio->priv.scan_cache )
+        {
+            hb_fifo_flush( audio->priv.scan_cache );
+        }
+    }
+    preview_unlock(w);
+    if (vid_buf)
+    {
+        hb_buffer_close( &vid_buf );
+    }
 }
 
-static void sort_crops( crop_record_t *crops )
+static void DecodePreviewsFunc( void * _w )
 {
-    qsort( crops->t, crops->n, sizeof(crops->t[0]), compare_int );
-    qsort( crops->b, crops->n, sizeof(crops->t[0]), compare_int );
-    qsort( crops->l, crops->n, sizeof(crops->t[0]), compare_int );
-    qsort( crops->r, crops->n, sizeof(crops->t[0]), compare_int );
-}
+    preview_worker_t * w = _w;
+    hb_scan_t        * data = w->data;
+    int                i;
 
-// -----------------------------------------------
-// stuff related to title width/height/aspect info
+    while (!*data->die)
+    {
+        preview_lock(w);
+        i = (*w->next)++;
+        preview_unlock(w);
+        if (i >= data->preview_count)
+        {
+            break;
+        }
+        if (w->lock == NULL)
+        {
+            UpdateState3(data, i + 1);
+        }
+        else
+        {
+            // Positions are independent, only the first one waits
+            // for captions
+            w->cc_wait = (i == 0 && !w->fast) ? 10 : 0;
+        }
 
-typedef struct {
-    int count;              /* number of times we've seen this info entry */
-    hb_work_info_t info;    /* copy of info entry */
-} info_list_t;
+        DecodePreview(w, i, &w->results[i]);
 
-static void remember_info( info_list_t *info_list, hb_work_info_t *info )
-{
-    for ( ; info_list->count; ++info_list )
-    {
-        if ( memcmp( &info_list->info, info, sizeof(*info) ) == 0 )
+        if (w->lock != NULL)
         {
-            // we found a match - bump its count
-            ++info_list->count;
-            return;
+            hb_lock(w->lock);
+            UpdateState3(data, ++*w->done);
+            hb_unlock(w->lock);
+        }
+        if (w->results[i].status == PREVIEW_EOF)
+        {
+            // The following positions are past the end too
+            preview_lock(w);
+            *w->next = data->preview_count;
+            preview_unlock(w);
+            break;
         }
     }
-    // no match found - add new entry to list (info_list points to
-    // the first free slot). NB - we assume that info_list was allocated
-    // so that it's big enough even if there are no dups. I.e., 10 slots
-    // allocated if there are 10 previews.
-    info_list->count = 1;
-    info_list->info = *info;
 }
 
-static void most_common_info( info_list_t *info_list, hb_work_info_t *info )
+static void DecodePreviewsThread( void * _w )
 {
-    int i, biggest = 0;
-    for ( i = 1; info_list[i].count; ++i )
+    preview_worker_t * w = _w;
+
+    if (preview_worker_init(w, 0) == 0)
     {
-        if ( info_list[i].count > info_list[biggest].count )
-            biggest = i;
+        DecodePreviewsFunc(w);
     }
-    *info = info_list[biggest].info;
 }
 
-static int has_resolution_change( info_list_t *info_list )
+static int has_cc_subtitle( hb_title_t * title )
 {
-    int w, h, i;
+    hb_subtitle_t * subtitle;
+    int             ii;
 
-    if( !info_list[0].count )
-        return 0;
-    w = info_list[0].info.geometry.width;
-    h = info_list[0].info.geometry.height;
-    for ( i = 1; info_list[i].count; ++i )
+    for (ii = 0; (subtitle = hb_list_item(title->list_subtitle, ii)); ii++)
     {
-        if (w != info_list[i].info.geometry.width ||
-            h != info_list[i].info.geometry.height)
+        if (subtitle->id == HB_SUBTITLE_EMBEDDED_CC_TAG)
+        {
             return 1;
+        }
     }
     return 0;
 }
 
-static int is_close_to( int val, int target, int thresh )
-{
-    int diff = val - target;
-    diff = diff < 0 ? -diff : diff;
-    return diff < thresh;
-}
-
-static hb_buffer_t * read_buf(hb_scan_t * data, hb_stream_t * stream)
+// Independent streams and decoders for the positions of a file
+static int preview_thread_count( hb_scan_t * data, hb_title_t * title,
+                                 int flush, int hw_decode )
 {
-    if (data->bd)
-    {
-        return hb_bd_read(data->bd);
-    }
-    else if (data->dvd)
+    int count;
+
+    // libavformat sources get the codec parameters from the container,
+    // the decoder of a TS or PS source may need the sequence header at
+    // the start of the file.  The second attempt of a scan keeps the
+    // decoder state from one preview to the next.
+    if (data->bd || data->dvd || title->type != HB_FF_STREAM_TYPE ||
+        !flush || hw_decode)
     {
-        return hb_dvd_read(data->dvd);
+        return 1;
     }
-    else if (stream)
+    count = scan_preview_threads;
+    if (count <= 0)
     {
-        return hb_stream_read(stream);
+        // The files of a batch are already scanned in parallel
+        count = data->pool != NULL ? 1 :
+                MIN(8, MAX(1, hb_get_cpu_count() / 2));
     }
-
-    // This shouldn't happen
-    return NULL;
+    return MAX(1, MIN(count, data->preview_count));
 }
 
 /***********************************************************************
@@ -635,29 +1488,36 @@ static hb_buffer_t * read_buf(hb_scan_t * data, hb_stream_t * stream)
  * Decode 10 pictures for the given title.
  * It assumes that data->reader and data->vts have successfully been
  * DVDOpen()ed and ifoOpen()ed.
+ *
+ * In fast mode the decoder outputs only keyframes and skips the loop
+ * filter, and the first keyframe after each seek is the preview.  The
+ * frame rate and interlacing are then guessed from fewer frames, the
+ * title is marked HBTF_LOW_CONFIDENCE when they may be wrong.
+ *
+ * The positions of a file are decoded on several threads, each with
+ * its own stream and decoder.  The results are merged in position
+ * order, so they don't depend on the number of threads.
  **********************************************************************/
-static int DecodePreviews( hb_scan_t * data, hb_title_t * title, int flush )
+static int DecodePreviews( hb_scan_t * data, hb_title_t * title, int flush,
+                           int fast )
 {
-    int                i, npreviews = 0, abort = 0;
-    hb_buffer_t      * buf, * buf_es;
-    hb_buffer_list_t   list_es;
+    int                i, npreviews = 0;
     int                progressive_count = 0;
     int                pulldown_count = 0;
     int                doubled_frame_count = 0;
     int                interlaced_preview_count = 0;
     int                vid_samples = 0;
-    int                frame_wait = 0;
-    int                cc_wait = 10;
-    int                frames;
-    hb_stream_t      * stream = NULL;
     info_list_t      * info_list;
     int                abort_audio = 0;
+    int                next = 0, done = 0;
+    int                thread_count;
+    preview_worker_t * workers;
+    hb_thread_t     ** threads;
+    preview_result_t * results;
 
     info_list = calloc(data->preview_count+1, sizeof(*info_list));
     crop_record_t *crops = crop_record_init( data->preview_count );
 
-    hb_buffer_list_clear(&list_es);
-
     if( data->batch )
     {
         hb_log( "scan: decoding previews for title %d (%s)", title->index, title->path );
@@ -678,28 +1538,6 @@ static int DecodePreviews( hb_scan_t * data, hb_title_t * title, int flush )
         title->angle_count = hb_dvd_angle_count( data->dvd );
         hb_log( "scan: title angle(s) %d", title->angle_count );
     }
-    else // data->batch or a single file
-    {
-        stream = hb_stream_open(data->h, title->path, title, 0);
-    }
-
-    if (data->bd == NULL && data->dvd == NULL && stream == NULL)
-    {
-        hb_error("Can't open stream!");
-        free(info_list);
-        crop_record_free(crops);
-        hb_stream_close(&stream);
-        return 0;
-    }
-
-    if (title->video_codec == WORK_NONE)
-    {
-        hb_error("No video decoder set!");
-        free(info_list);
-        crop_record_free(crops);
-        hb_stream_close(&stream);
-        return 0;
-    }
 
     int hw_decode = 0;
 
@@ -719,370 +1557,167 @@ static int DecodePreviews( hb_scan_t * data, hb_title_t * title, int flush )
         hw_decode = HB_DECODE_SUPPORT_MF;
     }
 
-    void *hw_device_ctx = NULL;
-    if (hw_decode)
-    {
-        hb_hwaccel_hw_ctx_init(title->video_codec_param, hw_decode, &hw_device_ctx);
-    }
-
-    hb_work_object_t *vid_decoder = hb_get_work(data->h, title->video_codec);
-    vid_decoder->codec_param = title->video_codec_param;
-    vid_decoder->hw_device_ctx = hw_device_ctx;
-    vid_decoder->title = title;
-
-    if (vid_decoder->init(vid_decoder, NULL))
+    thread_count = preview_thread_count(data, title, flush, hw_decode);
+    workers = calloc(thread_count, sizeof(preview_worker_t));
+    threads = calloc(thread_count, sizeof(hb_thread_t *));
+    results = calloc(data->preview_count, sizeof(preview_result_t));
+    if (info_list == NULL || workers == NULL || threads == NULL ||
+        (results == NULL && data->preview_count > 0))
     {
-        hb_error("Decoder init failed!");
+        hb_error("scan: out of memory");
         free(info_list);
         crop_record_free(crops);
-        free( vid_decoder );
-        hb_stream_close(&stream);
-        hb_hwaccel_hw_ctx_close(&hw_device_ctx);
+        free(workers);
+        free(threads);
+        free(results);
         return 0;
     }
 
-    for( i = 0; i < data->preview_count; i++ )
+    for (i = 0; i < thread_count; i++)
     {
-        int j;
-
-        UpdateState3(data, i + 1);
-
-        if ( *data->die )
-        {
-            free( info_list );
-            crop_record_free( crops );
-            vid_decoder->close( vid_decoder );
-            free( vid_decoder );
-            hb_stream_close(&stream);
-            hb_hwaccel_hw_ctx_close(&hw_device_ctx);
-            return 0;
-        }
-        if (data->bd)
-        {
-            if( !hb_bd_seek( data->bd, (float) ( i + 1 ) / ( data->preview_count + 1.0 ) ) )
-          {
-              continue;
-          }
-        }
-        if (data->dvd)
-        {
-            if( !hb_dvd_seek( data->dvd, (float) ( i + 1 ) / ( data->preview_count + 1.0 ) ) )
-          {
-              continue;
-          }
-        }
-        else if (stream)
+        preview_worker_t * w = &workers[i];
+
+        w->data        = data;
+        w->title       = title;
+        w->vid_title   = thread_count > 1 ? NULL : title;
+        w->flush       = flush;
+        w->fast        = fast;
+        w->cc_wait     = fast ? 0 : 10;
+        w->next        = &next;
+        w->done        = &done;
+        w->abort_audio = &abort_audio;
+        w->results     = results;
+    }
+    if (thread_count > 1)
+    {
+        workers[0].lock = hb_lock_init();
+        for (i = 1; i < thread_count; i++)
         {
-            /* we start reading streams at zero rather than 1/11 because
-             * short streams may have only one sequence header in the entire
-             * file and we need it to decode any previews.
-             *
-             * Also, seeking to position 0 loses the palette of avi files
-             * so skip initial seek */
-            if (i != 0)
-            {
-                if (!hb_stream_seek(stream,
-                                    (float)i / (data->preview_count + 1.0)))
-                {
-                    continue;
-                }
-            }
-            else
-            {
-                hb_stream_set_need_keyframe(stream, 1);
-            }
+            workers[i].lock = workers[0].lock;
         }
+    }
 
-        hb_deep_log( 2, "scan: preview %d", i + 1 );
-
-        if (flush && vid_decoder->flush)
-            vid_decoder->flush( vid_decoder );
-        if (title->flags & HBTF_NO_IDR)
+    if (thread_count == 1)
+    {
+        if (preview_worker_init(&workers[0], hw_decode))
         {
-            if (!flush)
-            {
-                // If we are doing the first previews decode attempt,
-                // set this threshold high so that we get the best
-                // quality frames possible.
-                frame_wait = 100;
-            }
-            else
-            {
-                // If we failed to get enough valid frames in the first
-                // previews decode attempt, lower the threshold to improve
-                // our chances of getting something to work with.
-                frame_wait = 10;
-            }
+            preview_worker_close(&workers[0]);
+            goto fail;
         }
-        else
+        DecodePreviewsFunc(&workers[0]);
+    }
+    else
+    {
+        hb_log("scan: decoding previews on %d threads", thread_count);
+        for (i = 1; i < thread_count; i++)
         {
-            // For certain mpeg-2 streams, libav is delivering a
-            // dummy first frame that is all black.  So always skip
-            // one frame
-            frame_wait = 1;
+            threads[i] = hb_thread_init("scan previews", DecodePreviewsThread,
+                                        &workers[i], HB_NORMAL_PRIORITY);
         }
-        frames = 0;
-
-        hb_buffer_t * vid_buf = NULL, * last_vid_buf = NULL;
-
-        int packets = 0;
-        vid_decoder->frame_count = 0;
-        while (vid_decoder->frame_count < PREVIEW_READ_THRESH ||
-              (!AllAudioOK(title) && packets < 10000))
+        DecodePreviewsThread(&workers[0]);
+        for (i = 1; i < thread_count; i++)
         {
-            if ((buf = read_buf(data, stream)) == NULL)
-            {
-                // If we reach EOF and no audio, don't continue looking for
-                // audio
-                abort_audio = 1;
-                if (vid_buf != NULL || last_vid_buf != NULL)
-                {
-                    break;
-                }
-                hb_log("Warning: Could not read data for preview %d, skipped",
-                       i + 1 );
-
-                // If we reach EOF and no video, don't continue looking for
-                // video
-                abort = 1;
-                goto skip_preview;
-            }
-
-            packets++;
-            if (buf->size <= 0)
-            {
-                // Ignore "null" frames
-                hb_buffer_close(&buf);
-                continue;
-            }
-
-            (hb_demux[title->demuxer])(buf, &list_es, 0 );
-
-            while ((buf_es = hb_buffer_list_rem_head(&list_es)) != NULL)
+            if (threads[i] != NULL)
             {
-                if( buf_es->s.id == title->video_id && vid_buf == NULL )
-                {
-                    vid_decoder->work( vid_decoder, &buf_es, &vid_buf );
-                    // There are 2 conditions we decode additional
-                    // video frames for during scan.
-                    // 1. We did not detect IDR frames, so the initial video
-                    //    frames may be corrupt.  We decode extra frames to
-                    //    increase the probability of a complete preview frame
-                    // 2. Some frames do not contain CC data, even though
-                    //    CCs are present in the stream.  So we need to decode
-                    //    additional frames to find the CCs.
-                    if (vid_buf != NULL && (frame_wait || cc_wait))
-                    {
-                        hb_work_info_t vid_info;
-                        if (vid_decoder->info(vid_decoder, &vid_info))
-                        {
-                            if (is_close_to(vid_info.rate.den, 900900, 100) &&
-                                (vid_buf->s.flags & PIC_FLAG_REPEAT_FIRST_FIELD))
-                            {
-                                /* Potentially soft telecine material */
-                                pulldown_count++;
-                            }
-
-                            if (vid_buf->s.flags & PIC_FLAG_REPEAT_FRAME)
-                            {
-                                // AVCHD-Lite specifies that all streams are
-                                // 50 or 60 fps.  To produce 25 or 30 fps, camera
-                                // makers are repeating all frames.
-                                doubled_frame_count++;
-                            }
-
-                            if (is_close_to(vid_info.rate.den, 1126125, 100 ))
-                            {
-                                // Frame FPS is 23.976 (meaning it's
-                                // progressive), so start keeping track of
-                                // how many are reporting at that speed. When
-                                // enough show up that way, we want to make
-                                // that the overall title FPS.
-                                progressive_count++;
-                            }
-                            vid_samples++;
-                        }
-
-                        if (frames > 0 && vid_buf->s.frametype == HB_FRAME_I)
-                            frame_wait = 0;
-                        if (frame_wait || cc_wait)
-                        {
-                            hb_buffer_close(&last_vid_buf);
-                            last_vid_buf = vid_buf;
-                            vid_buf = NULL;
-                            if (frame_wait) frame_wait--;
-                            if (cc_wait) cc_wait--;
-                        }
-                        frames++;
-                    }
-                }
-                else if (!AllAudioOK(title) && !abort_audio)
-                {
-                    hb_audio_t * audio = find_audio_for_id(title, buf_es->s.id);
-                    if (audio != NULL && audio->priv.scan_error_count < AUDIO_DECODE_ERROR_LIMIT)
-                    {
-                        LookForAudio( data, title, audio, buf_es );
-                        buf_es = NULL;
-                    }
-                }
-                if ( buf_es )
-                    hb_buffer_close( &buf_es );
+                hb_thread_close(&threads[i]);
             }
-
-            if (vid_buf && (abort_audio || AllAudioOK(title)))
-                break;
         }
-        hb_buffer_list_close(&list_es);
-
-        if (vid_buf == NULL)
-        {
-            vid_buf = last_vid_buf;
-            last_vid_buf = NULL;
-        }
-        hb_buffer_close(&last_vid_buf);
+    }
 
-        if (vid_buf == NULL)
+    if (*data->die)
+    {
+        for (i = 0; i < thread_count; i++)
         {
-            hb_log( "scan: could not get a decoded picture" );
-            continue;
+            preview_worker_close(&workers[i]);
         }
+        goto fail;
+    }
 
-        /* Get size and rate infos */
+    // Merge the results in position order
+    for (i = 0; i < data->preview_count; i++)
+    {
+        preview_result_t * res = &results[i];
 
-        hb_work_info_t vid_info;
-        if( !vid_decoder->info( vid_decoder, &vid_info ) )
+        pulldown_count      += res->pulldown_count;
+        doubled_frame_count += res->doubled_frame_count;
+        progressive_count   += res->progressive_count;
+        vid_samples         += res->vid_samples;
+        if (res->status == PREVIEW_EOF)
         {
-            /*
-             * Could not fill vid_info, don't continue and try to use vid_info
-             * in this case.
-             */
-            hb_log( "scan: could not get a video information" );
-            hb_buffer_close( &vid_buf );
-            continue;
+            break;
         }
-
-        if (vid_info.geometry.width  != vid_buf->f.width ||
-            vid_info.geometry.height != vid_buf->f.height)
+        if (res->status != PREVIEW_OK)
         {
-            hb_log( "scan: video geometry information does not match buffer" );
-            hb_buffer_close( &vid_buf );
             continue;
         }
-        remember_info( info_list, &vid_info );
-
-        /* Check preview for interlacing artifacts */
-        if( hb_detect_comb( vid_buf, 10, 30, 9, 10, 30, 9 ) )
+        remember_info(info_list, &res->info);
+        if (res->interlaced)
         {
-            hb_deep_log( 2, "Interlacing detected in preview frame %i", i+1);
             interlaced_preview_count++;
         }
-
-        if( data->store_previews )
+        if (res->has_crop)
         {
-            hb_save_preview( data->h, title->index, i, vid_buf, HB_PREVIEW_FORMAT_JPG );
+            record_crop(crops, res->crop[0], res->crop[1],
+                               res->crop[2], res->crop[3]);
         }
+        ++npreviews;
+    }
+    UpdateState3(data, i);
 
-        /* Detect black borders */
-
-        int top, bottom, left, right;
-        int h4 = vid_info.geometry.height / 4, w4 = vid_info.geometry.width / 4;
-
-        // When widescreen content is matted to 16:9 or 4:3 there's sometimes
-        // a thin border on the outer edge of the matte. On TV content it can be
-        // "line 21" VBI data that's normally hidden in the overscan. For HD
-        // content it can just be a diagnostic added in post production so that
-        // the frame borders are visible. We try to ignore these borders so
-        // we can crop the matte. The border width depends on the resolution
-        // (12 pixels on 1080i looks visually the same as 4 pixels on 480i)
-        // so we allow the border to be up to 1% of the frame height.
-        const int border = vid_info.geometry.height / 100;
+    for (i = 0; i < thread_count; i++)
+    {
+        hb_title_t    * vid_title = workers[i].vid_title;
+        hb_subtitle_t * subtitle;
+        int             ii;
 
-        for ( top = border; top < h4; ++top )
-        {
-            if ( ! row_all_dark( vid_buf, top ) )
-                break;
-        }
-        if ( top <= border )
-        {
-            // we never made it past the border region - see if the rows we
-            // didn't check are dark or if we shouldn't crop at all.
-            for ( top = 0; top < border; ++top )
-            {
-                if ( ! row_all_dark( vid_buf, top ) )
-                    break;
-            }
-            if ( top >= border )
-            {
-                top = 0;
-            }
-        }
-        for ( bottom = border; bottom < h4; ++bottom )
+        if (vid_title == NULL || vid_title == title)
         {
-            if ( ! row_all_dark( vid_buf, vid_info.geometry.height - 1 - bottom ) )
-                break;
+            continue;
         }
-        if ( bottom <= border )
+        if (title->color_prim     == HB_COLR_PRI_UNSET &&
+            title->color_transfer == HB_COLR_TRA_UNSET &&
+            title->color_matrix   == HB_COLR_MAT_UNSET)
         {
-            for ( bottom = 0; bottom < border; ++bottom )
-            {
-                if ( ! row_all_dark( vid_buf, vid_info.geometry.height - 1 - bottom ) )
-                    break;
-            }
-            if ( bottom >= border )
-            {
-                bottom = 0;
-            }
+            title->color_prim     = vid_title->color_prim;
+            title->color_transfer = vid_title->color_transfer;
+            title->color_matrix   = vid_title->color_matrix;
+            title->color_range    = vid_title->color_range;
         }
-        for ( left = 0; left < w4; ++left )
+        // Side data of the decoded frames, the first worker that found
+        // it wins
+        if (!title->mastering.has_primaries && !title->mastering.has_luminance)
         {
-            if ( ! column_all_dark( vid_buf, top, bottom, left ) )
-                break;
+            title->mastering = vid_title->mastering;
         }
-        for ( right = 0; right < w4; ++right )
+        if (title->coll.max_cll == 0 && title->coll.max_fall == 0)
         {
-            if ( ! column_all_dark( vid_buf, top, bottom, vid_info.geometry.width - 1 - right ) )
-                break;
+            title->coll = vid_title->coll;
         }
-
-        // only record the result if all the crops are less than a quarter of
-        // the frame otherwise we can get fooled by frames with a lot of black
-        // like titles, credits & fade-thru-black transitions.
-        if ( top < h4 && bottom < h4 && left < w4 && right < w4 )
+        if (title->ambient.ambient_illuminance.num == 0 &&
+            title->ambient.ambient_illuminance.den == 0)
         {
-            record_crop( crops, top, bottom, left, right );
+            title->ambient = vid_title->ambient;
         }
-        ++npreviews;
+        title->hdr_10_plus |= vid_title->hdr_10_plus;
 
-skip_preview:
-        /* Make sure we found audio rates and bitrates */
-        for( j = 0; j < hb_list_count( title->list_audio ); j++ )
-        {
-            hb_audio_t * audio = hb_list_item( title->list_audio, j );
-            if ( audio->priv.scan_cache )
-            {
-                hb_fifo_flush( audio->priv.scan_cache );
-            }
-        }
-        if (vid_buf)
+        // Keep the closed captions found by the first worker
+        ii = workers[i].subtitle_count;
+        subtitle = hb_list_item(vid_title->list_subtitle, ii);
+        if (subtitle != NULL && !has_cc_subtitle(title))
         {
-            hb_buffer_close( &vid_buf );
-        }
-        if (abort)
-        {
-            break;
+            hb_list_rem(vid_title->list_subtitle, subtitle);
+            subtitle->track = hb_list_count(title->list_subtitle);
+            hb_list_add(title->list_subtitle, subtitle);
         }
     }
-    UpdateState3(data, i);
-
-    vid_decoder->close( vid_decoder );
-    free( vid_decoder );
-
-    hb_hwaccel_hw_ctx_close(&hw_device_ctx);
-
-    if (stream != NULL)
+    for (i = 0; i < thread_count; i++)
     {
-        hb_stream_close(&stream);
+        preview_worker_close(&workers[i]);
     }
+    hb_lock_close(&workers[0].lock);
+    free(workers);
+    free(threads);
+    free(results);
 
     if ( npreviews )
     {
@@ -1338,12 +1973,13 @@ skip_preview:
             title->loose_crop[3] = EVEN( crops->r[i] );
         }
 
+        char arstr[32];
         hb_log( "scan: %d previews, %dx%d, %.3f fps, autocrop = %d/%d/%d/%d, "
                 "aspect %s, PAR %d:%d, color profile: %d-%d-%d, chroma location: %s",
                 npreviews, title->geometry.width, title->geometry.height,
                 (float)title->vrate.num / title->vrate.den,
                 title->crop[0], title->crop[1], title->crop[2], title->crop[3],
-                aspect_to_string(&title->dar),
+                aspect_to_string(&title->dar, arstr),
                 title->geometry.par.num, title->geometry.par.den,
                 title->color_prim, title->color_transfer, title->color_matrix,
                 av_chroma_location_name(title->chroma_location));
@@ -1412,18 +2048,40 @@ skip_preview:
         {
             title->detected_interlacing = 0;
         }
+
+        if (fast)
+        {
+            // Pulldown needs runs of frames, and combing is harder to
+            // see without the loop filter when only a few previews have it
+            title->flags |= HBTF_FAST_SCAN;
+            if (npreviews < data->preview_count / 2 ||
+                (is_close_to(vid_info.rate.den, 900900, 100) && vid_samples < 4) ||
+                (interlaced_preview_count > 0 &&
+                 interlaced_preview_count < npreviews / 2))
+            {
+                hb_log("scan: fast scan results are approximate, a full scan may differ");
+                title->flags |= HBTF_LOW_CONFIDENCE;
+            }
+        }
     }
     crop_record_free( crops );
     free( info_list );
 
-    hb_buffer_list_close(&list_es);
-
     if (data->bd)
       hb_bd_stop( data->bd );
     if (data->dvd)
       hb_dvd_stop( data->dvd );
 
     return npreviews;
+
+fail:
+    free(info_list);
+    crop_record_free(crops);
+    hb_lock_close(&workers[0].lock);
+    free(workers);
+    free(threads);
+    free(results);
+    return 0;
 }
 
 static hb_audio_t * find_audio_for_id(hb_title_t * title, int id)
@@ -1817,6 +2475,12 @@ static int  AllAudioOK( hb_title_t * title )
 static void UpdateState1(hb_scan_t *scan, int title)
 {
     hb_state_t state;
+
+    if (scan->pool != NULL)
+    {
+        ScanFilesProgress(scan, 0, 0);
+        return;
+    }
     
     int is_multi_file = hb_list_count(scan->paths) > 0;
 
@@ -1842,6 +2506,13 @@ static void UpdateState2(hb_scan_t *scan, int title)
 {
     hb_state_t state;
 
+    if (scan->pool != NULL)
+    {
+        // Opening and probing the file is the first half of its scan
+        ScanFilesProgress(scan, 0.5, 1);
+        return;
+    }
+
     hb_get_state2(scan->h, &state);
 #define p state.param.scanning
     /* Update the UI */
@@ -1863,6 +2534,14 @@ static void UpdateState3(hb_scan_t *scan, int preview)
 {
     hb_state_t state;
 
+    if (scan->pool != NULL)
+    {
+        ScanFilesProgress(scan,
+                          0.5 + 0.5 * (float)preview / scan->preview_count,
+                          preview);
+        return;
+    }
+
     hb_get_state2(scan->h, &state);
 #define p state.param.scanning
     p.preview_cur = preview;
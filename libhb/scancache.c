@@ -0,0 +1,585 @@
+/* scancache.c
+
+   Copyright (c) 2003-2024 HandBrake Team
+   This file is part of the HandBrake source code
+   Homepage: <http://handbrake.fr/>.
+   It may be used under the terms of the GNU General Public License v2.
+   For full terms see the file COPYING file or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+#include "handbrake/handbrake.h"
+#include "handbrake/hbffmpeg.h"
+#include "handbrake/scancache.h"
+#include "handbrake/previewstore.h"
+
+#define CACHE_DIR           "scan-cache"
+// Size of the blocks hashed at the start and the end of the file
+#define FINGERPRINT_BLOCK   (64 * 1024)
+
+static int scan_cache_enabled = 0;
+
+void hb_scan_cache_enable( int enable )
+{
+    scan_cache_enabled = !!enable;
+}
+
+int hb_scan_cache_enabled( void )
+{
+    return scan_cache_enabled;
+}
+
+static uint64_t fnv1a( uint64_t hash, const void * data, size_t size )
+{
+    const uint8_t * p = data;
+
+    while (size--)
+    {
+        hash ^= *p++;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static uint64_t path_hash( const char * path )
+{
+    return fnv1a(0xcbf29ce484222325ULL, path, strlen(path));
+}
+
+static int fingerprint( const char * path, char fp[17] )
+{
+    hb_stat_t   st;
+    FILE      * file;
+    uint8_t   * buf;
+    uint64_t    hash = 0xcbf29ce484222325ULL;
+    int64_t     size, mtime;
+    size_t      len;
+    int         ret = -1;
+
+    if (hb_stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        return -1;
+    }
+    size  = st.st_size;
+    mtime = st.st_mtime;
+    hash  = fnv1a(hash, &size, sizeof(size));
+    hash  = fnv1a(hash, &mtime, sizeof(mtime));
+
+    file = hb_fopen(path, "rb");
+    buf  = malloc(FINGERPRINT_BLOCK);
+    if (file == NULL || buf == NULL)
+    {
+        goto done;
+    }
+    len  = fread(buf, 1, FINGERPRINT_BLOCK, file);
+    hash = fnv1a(hash, buf, len);
+    if (size > 2 * FINGERPRINT_BLOCK)
+    {
+        if (fseeko(file, size - FINGERPRINT_BLOCK, SEEK_SET) != 0)
+        {
+            goto done;
+        }
+        len  = fread(buf, 1, FINGERPRINT_BLOCK, file);
+        hash = fnv1a(hash, buf, len);
+    }
+    snprintf(fp, 17, "%016"PRIx64, hash);
+    ret = 0;
+
+done:
+    free(buf);
+    if (file != NULL)
+    {
+        fclose(file);
+    }
+    return ret;
+}
+
+static hb_value_t * rational_value( hb_rational_t r )
+{
+    hb_dict_t * dict = hb_dict_init();
+
+    hb_dict_set_int(dict, "Num", r.num);
+    hb_dict_set_int(dict, "Den", r.den);
+    return dict;
+}
+
+static hb_value_t * int_array_value( const int * val, int count )
+{
+    hb_value_array_t * array = hb_value_array_init();
+    int                ii;
+
+    for (ii = 0; ii < count; ii++)
+    {
+        hb_value_array_append(array, hb_value_int(val[ii]));
+    }
+    return array;
+}
+
+static const struct
+{
+    const char    * name;
+    hb_chan_map_t * map;
+} channel_maps[] =
+{
+    { "libav",  &hb_libav_chan_map  },
+    { "liba52", &hb_liba52_chan_map },
+    { "vorbis", &hb_vorbis_chan_map },
+    { "aac",    &hb_aac_chan_map    },
+};
+
+static const char * channel_map_name( hb_chan_map_t * map )
+{
+    int ii;
+
+    for (ii = 0; ii < sizeof(channel_maps) / sizeof(channel_maps[0]); ii++)
+    {
+        if (channel_maps[ii].map == map)
+        {
+            return channel_maps[ii].name;
+        }
+    }
+    return NULL;
+}
+
+static hb_chan_map_t * channel_map_by_name( const char * name )
+{
+    int ii;
+
+    for (ii = 0; name && ii < sizeof(channel_maps) / sizeof(channel_maps[0]);
+         ii++)
+    {
+        if (!strcmp(channel_maps[ii].name, name))
+        {
+            return channel_maps[ii].map;
+        }
+    }
+    return NULL;
+}
+
+static const char * dict_string( hb_dict_t * dict, const char * key,
+                                 const char * def )
+{
+    const char * str = hb_dict_get_string(dict, key);
+    return str != NULL ? str : def;
+}
+
+static hb_audio_t * find_audio( hb_title_t * title, int id )
+{
+    hb_audio_t * audio;
+    int          ii;
+
+    for (ii = 0; (audio = hb_list_item(title->list_audio, ii)); ii++)
+    {
+        if (audio->id == id)
+        {
+            return audio;
+        }
+    }
+    return NULL;
+}
+
+static hb_subtitle_t * find_embedded_cc( hb_title_t * title )
+{
+    hb_subtitle_t * subtitle;
+    int             ii;
+
+    for (ii = 0; (subtitle = hb_list_item(title->list_subtitle, ii)); ii++)
+    {
+        if (subtitle->source == CC608SUB &&
+            subtitle->id == HB_SUBTITLE_EMBEDDED_CC_TAG)
+        {
+            return subtitle;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * The results of DecodePreviews() and LookForAudio(), see scan.c
+ */
+static hb_dict_t * title_to_dict( hb_title_t * title )
+{
+    hb_dict_t        * dict = hb_dict_init();
+    hb_value_array_t * audio_list;
+    hb_audio_t       * audio;
+    hb_subtitle_t    * subtitle;
+    int                ii;
+
+    hb_dict_set_bool(dict, "NoIDR", !!(title->flags & HBTF_NO_IDR));
+    hb_dict_set_bool(dict, "FastScan", !!(title->flags & HBTF_FAST_SCAN));
+    hb_dict_set_bool(dict, "LowConfidence",
+                     !!(title->flags & HBTF_LOW_CONFIDENCE));
+    hb_dict_set_int(dict, "PreviewCount", title->preview_count);
+    hb_dict_set_bool(dict, "ResolutionChange", title->has_resolution_change);
+    if (title->video_codec_name != NULL)
+    {
+        hb_dict_set_string(dict, "VideoCodec", title->video_codec_name);
+    }
+    hb_dict_set_int(dict, "VideoProfile", title->video_codec_profile);
+    hb_dict_set_int(dict, "VideoBitRate", title->video_bitrate);
+    hb_dict_set_int(dict, "Width", title->geometry.width);
+    hb_dict_set_int(dict, "Height", title->geometry.height);
+    hb_dict_set(dict, "PAR", rational_value(title->geometry.par));
+    hb_dict_set(dict, "DAR", rational_value(title->dar));
+    hb_dict_set(dict, "FrameRate", rational_value(title->vrate));
+    hb_dict_set_int(dict, "PixFmt", title->pix_fmt);
+    hb_dict_set_int(dict, "ColorPrimaries", title->color_prim);
+    hb_dict_set_int(dict, "ColorTransfer", title->color_transfer);
+    hb_dict_set_int(dict, "ColorMatrix", title->color_matrix);
+    hb_dict_set_int(dict, "ColorRange", title->color_range);
+    hb_dict_set_int(dict, "ChromaLocation", title->chroma_location);
+    hb_dict_set_int(dict, "DecodeSupport", title->video_decode_support);
+    hb_dict_set(dict, "Crop", int_array_value(title->crop, 4));
+    hb_dict_set(dict, "LooseCrop", int_array_value(title->loose_crop, 4));
+    hb_dict_set_bool(dict, "InterlaceDetected", title->detected_interlacing);
+
+    audio_list = hb_value_array_init();
+    for (ii = 0; (audio = hb_list_item(title->list_audio, ii)); ii++)
+    {
+        hb_dict_t  * audio_dict = hb_dict_init();
+        const char * map = channel_map_name(audio->config.in.channel_map);
+
+        hb_dict_set_int(audio_dict, "Id", audio->id);
+        hb_dict_set_int(audio_dict, "Codec", audio->config.in.codec);
+        hb_dict_set_int(audio_dict, "SampleRate", audio->config.in.samplerate);
+        hb_dict_set_int(audio_dict, "SampleBitDepth",
+                        audio->config.in.sample_bit_depth);
+        hb_dict_set_int(audio_dict, "SamplesPerFrame",
+                        audio->config.in.samples_per_frame);
+        hb_dict_set_int(audio_dict, "BitRate", audio->config.in.bitrate);
+        hb_dict_set_int(audio_dict, "MatrixEncoding",
+                        audio->config.in.matrix_encoding);
+        hb_dict_set_int(audio_dict, "ChannelLayout",
+                        audio->config.in.channel_layout);
+        if (map != NULL)
+        {
+            hb_dict_set_string(audio_dict, "ChannelMap", map);
+        }
+        hb_dict_set_int(audio_dict, "Version", audio->config.in.version);
+        hb_dict_set_int(audio_dict, "Flags", audio->config.in.flags);
+        hb_dict_set_int(audio_dict, "Mode", audio->config.in.mode);
+        hb_dict_set_string(audio_dict, "Description",
+                           audio->config.lang.description);
+        hb_value_array_append(audio_list, audio_dict);
+    }
+    hb_dict_set(dict, "AudioList", audio_list);
+
+    // Added by the video decoder when it finds captions
+    subtitle = find_embedded_cc(title);
+    if (subtitle != NULL)
+    {
+        hb_dict_t * cc_dict = hb_dict_init();
+
+        hb_dict_set_int(cc_dict, "Track", subtitle->track);
+        hb_dict_set_string(cc_dict, "Language", subtitle->lang);
+        hb_dict_set_string(cc_dict, "LanguageCode", subtitle->iso639_2);
+        hb_dict_set(dict, "ClosedCaptions", cc_dict);
+    }
+    return dict;
+}
+
+static int dict_to_title( hb_dict_t * dict, hb_title_t * title )
+{
+    hb_value_array_t * audio_list = hb_dict_get(dict, "AudioList");
+    hb_dict_t        * cc_dict    = hb_dict_get(dict, "ClosedCaptions");
+    hb_audio_t       * audio;
+    const char       * codec_name;
+    int                ii, count;
+
+    if (hb_value_type(audio_list) != HB_VALUE_TYPE_ARRAY)
+    {
+        return -1;
+    }
+    // The title comes from the same file, its audio tracks are the
+    // ones that were scanned minus those that had no usable data
+    count = hb_value_array_len(audio_list);
+    for (ii = 0; ii < count; ii++)
+    {
+        hb_dict_t * audio_dict = hb_value_array_get(audio_list, ii);
+
+        if (find_audio(title, hb_dict_get_int(audio_dict, "Id")) == NULL)
+        {
+            return -1;
+        }
+    }
+
+    if (hb_dict_get_bool(dict, "NoIDR"))
+    {
+        title->flags |= HBTF_NO_IDR;
+    }
+    if (hb_dict_get_bool(dict, "FastScan"))
+    {
+        title->flags |= HBTF_FAST_SCAN;
+    }
+    if (hb_dict_get_bool(dict, "LowConfidence"))
+    {
+        title->flags |= HBTF_LOW_CONFIDENCE;
+    }
+    title->preview_count         = hb_dict_get_int(dict, "PreviewCount");
+    title->has_resolution_change = hb_dict_get_bool(dict, "ResolutionChange");
+    codec_name = hb_dict_get_string(dict, "VideoCodec");
+    if (title->video_codec_name == NULL && codec_name != NULL)
+    {
+        title->video_codec_name = strdup(codec_name);
+    }
+    title->video_codec_profile   = hb_dict_get_int(dict, "VideoProfile");
+    title->video_bitrate         = hb_dict_get_int(dict, "VideoBitRate");
+    title->geometry.width        = hb_dict_get_int(dict, "Width");
+    title->geometry.height       = hb_dict_get_int(dict, "Height");
+    hb_dict_extract_rational(&title->geometry.par, dict, "PAR");
+    hb_dict_extract_rational(&title->dar, dict, "DAR");
+    hb_dict_extract_rational(&title->vrate, dict, "FrameRate");
+    title->pix_fmt               = hb_dict_get_int(dict, "PixFmt");
+    title->color_prim            = hb_dict_get_int(dict, "ColorPrimaries");
+    title->color_transfer        = hb_dict_get_int(dict, "ColorTransfer");
+    title->color_matrix          = hb_dict_get_int(dict, "ColorMatrix");
+    title->color_range           = hb_dict_get_int(dict, "ColorRange");
+    title->chroma_location       = hb_dict_get_int(dict, "ChromaLocation");
+    title->video_decode_support  = hb_dict_get_int(dict, "DecodeSupport");
+    hb_dict_extract_int_array(title->crop, 4, dict, "Crop");
+    hb_dict_extract_int_array(title->loose_crop, 4, dict, "LooseCrop");
+    title->detected_interlacing  = hb_dict_get_bool(dict, "InterlaceDetected");
+
+    for (ii = 0; (audio = hb_list_item(title->list_audio, ii)); )
+    {
+        hb_dict_t * audio_dict = NULL;
+        int         jj;
+
+        for (jj = 0; jj < count; jj++)
+        {
+            audio_dict = hb_value_array_get(audio_list, jj);
+            if (hb_dict_get_int(audio_dict, "Id") == audio->id)
+            {
+                break;
+            }
+        }
+        if (jj == count)
+        {
+            hb_log("scan: removing audio 0x%x, not found in cache", audio->id);
+            hb_list_rem(title->list_audio, audio);
+            free(audio);
+            continue;
+        }
+        audio->config.in.codec = hb_dict_get_int(audio_dict, "Codec");
+        audio->config.in.samplerate =
+            hb_dict_get_int(audio_dict, "SampleRate");
+        audio->config.in.sample_bit_depth =
+            hb_dict_get_int(audio_dict, "SampleBitDepth");
+        audio->config.in.samples_per_frame =
+            hb_dict_get_int(audio_dict, "SamplesPerFrame");
+        audio->config.in.bitrate = hb_dict_get_int(audio_dict, "BitRate");
+        audio->config.in.matrix_encoding =
+            hb_dict_get_int(audio_dict, "MatrixEncoding");
+        audio->config.in.channel_layout =
+            hb_dict_get_int(audio_dict, "ChannelLayout");
+        audio->config.in.channel_map =
+            channel_map_by_name(hb_dict_get_string(audio_dict, "ChannelMap"));
+        audio->config.in.version = hb_dict_get_int(audio_dict, "Version");
+        audio->config.in.flags   = hb_dict_get_int(audio_dict, "Flags");
+        audio->config.in.mode    = hb_dict_get_int(audio_dict, "Mode");
+        snprintf(audio->config.lang.description,
+                 sizeof(audio->config.lang.description), "%s",
+                 dict_string(audio_dict, "Description", ""));
+        ii++;
+    }
+
+    if (cc_dict != NULL && find_embedded_cc(title) == NULL)
+    {
+        hb_subtitle_t * subtitle = calloc(sizeof(hb_subtitle_t), 1);
+
+        // Same as the track decavcodec.c creates
+        subtitle->track        = hb_dict_get_int(cc_dict, "Track");
+        subtitle->id           = HB_SUBTITLE_EMBEDDED_CC_TAG;
+        subtitle->format       = TEXTSUB;
+        subtitle->source       = CC608SUB;
+        subtitle->config.dest  = PASSTHRUSUB;
+        subtitle->codec        = WORK_DECAVSUB;
+        subtitle->codec_param  = AV_CODEC_ID_EIA_608;
+        subtitle->attributes   = HB_SUBTITLE_ATTR_CC;
+        subtitle->timebase.num = 1;
+        subtitle->timebase.den = 90000;
+        snprintf(subtitle->lang, sizeof(subtitle->lang), "%s",
+                 dict_string(cc_dict, "Language", ""));
+        snprintf(subtitle->iso639_2, sizeof(subtitle->iso639_2), "%s",
+                 dict_string(cc_dict, "LanguageCode", "und"));
+        hb_list_add(title->list_subtitle, subtitle);
+    }
+    return 0;
+}
+
+/*
+ * Cache files are JSON, named after a hash of the source path.  The
+ * preview frames are saved next to them when the scan stores them.
+ */
+static int cache_filename( char name[1024], const char * path )
+{
+    return hb_get_user_cache_filename(name, CACHE_DIR, "%016"PRIx64".json",
+                                      path_hash(path));
+}
+
+static int preview_filename( char name[1024], const char * path, int preview )
+{
+    return hb_get_user_cache_filename(name, CACHE_DIR, "%016"PRIx64"-%d.raw",
+                                      path_hash(path), preview);
+}
+
+static int restore_previews( hb_handle_t * h, hb_title_t * title,
+                             hb_value_array_t * previews )
+{
+    int ii;
+
+    if (hb_value_type(previews) != HB_VALUE_TYPE_ARRAY)
+    {
+        return -1;
+    }
+    for (ii = 0; ii < hb_value_array_len(previews); ii++)
+    {
+        int           preview = hb_value_get_int(hb_value_array_get(previews, ii));
+        char          name[1024];
+        hb_buffer_t * buf;
+        int           err;
+
+        if (preview_filename(name, title->path, preview) != 0)
+        {
+            return -1;
+        }
+        buf = hb_preview_read_file(name);
+        if (buf == NULL)
+        {
+            return -1;
+        }
+        err = hb_save_preview(h, title->index, preview, buf,
+                              HB_PREVIEW_FORMAT_RAW);
+        hb_buffer_close(&buf);
+        if (err)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int hb_scan_cache_load( hb_handle_t * h, hb_title_t * title,
+                        const char * settings, int preview_count,
+                        int store_previews )
+{
+    hb_dict_t  * dict;
+    hb_dict_t  * title_dict;
+    char         name[1024];
+    char         fp[17];
+    const char * str;
+
+    if (!scan_cache_enabled || title->path == NULL ||
+        cache_filename(name, title->path) != 0 ||
+        fingerprint(title->path, fp) != 0)
+    {
+        return 0;
+    }
+    dict = hb_value_read_json(name);
+    if (dict == NULL)
+    {
+        return 0;
+    }
+
+    if ((str = hb_dict_get_string(dict, "Version"))  == NULL ||
+        strcmp(str, HB_PROJECT_VERSION)              ||
+        (str = hb_dict_get_string(dict, "RepoHash")) == NULL ||
+        strcmp(str, HB_PROJECT_REPO_HASH)            ||
+        (str = hb_dict_get_string(dict, "Path"))     == NULL ||
+        strcmp(str, title->path)                     ||
+        (str = hb_dict_get_string(dict, "Fingerprint")) == NULL ||
+        strcmp(str, fp)                              ||
+        (str = hb_dict_get_string(dict, "Settings")) == NULL ||
+        strcmp(str, settings)                        ||
+        hb_dict_get_int(dict, "PreviewCount") != preview_count)
+    {
+        hb_log("scan: ignoring stale scan cache %s", name);
+        goto fail;
+    }
+    title_dict = hb_dict_get(dict, "Title");
+    if (hb_value_type(title_dict) != HB_VALUE_TYPE_DICT)
+    {
+        goto fail;
+    }
+    if (store_previews &&
+        restore_previews(h, title, hb_dict_get(dict, "Previews")) != 0)
+    {
+        // Cached without the preview images, scan again to get them
+        goto fail;
+    }
+    if (dict_to_title(title_dict, title) != 0)
+    {
+        hb_log("scan: scan cache %s doesn't match the title", name);
+        goto fail;
+    }
+    hb_value_free(&dict);
+
+    hb_log("scan: using cached scan results for %s", title->path);
+    return 1;
+
+fail:
+    hb_value_free(&dict);
+    return 0;
+}
+
+void hb_scan_cache_save( hb_handle_t * h, hb_title_t * title,
+                         const char * settings, int preview_count,
+                         int store_previews )
+{
+    hb_dict_t * dict;
+    char        name[1024];
+    char        fp[17];
+
+    if (!scan_cache_enabled || title->path == NULL ||
+        cache_filename(name, title->path) != 0 ||
+        fingerprint(title->path, fp) != 0)
+    {
+        return;
+    }
+
+    dict = hb_dict_init();
+    hb_dict_set_string(dict, "Version", HB_PROJECT_VERSION);
+    hb_dict_set_string(dict, "RepoHash", HB_PROJECT_REPO_HASH);
+    hb_dict_set_string(dict, "Path", title->path);
+    hb_dict_set_string(dict, "Fingerprint", fp);
+    hb_dict_set_string(dict, "Settings", settings);
+    hb_dict_set_int(dict, "PreviewCount", preview_count);
+    hb_dict_set(dict, "Title", title_to_dict(title));
+
+    if (store_previews)
+    {
+        hb_value_array_t * previews = hb_value_array_init();
+        int                ii;
+
+        // Previews that could not be decoded have no image
+        for (ii = 0; ii < preview_count; ii++)
+        {
+            char          preview[1024];
+            hb_buffer_t * buf;
+            int           err;
+
+            if (preview_filename(preview, title->path, ii) != 0)
+            {
+                break;
+            }
+            buf = hb_read_preview(h, title, ii, HB_PREVIEW_FORMAT_RAW);
+            if (buf == NULL)
+            {
+                continue;
+            }
+            err = hb_preview_write_file(buf, preview);
+            hb_buffer_close(&buf);
+            if (!err)
+            {
+                hb_value_array_append(previews, hb_value_int(ii));
+            }
+        }
+        hb_dict_set(dict, "Previews", previews);
+    }
+
+    if (hb_value_write_json(dict, name) != 0)
+    {
+        hb_log("scan: error writing scan cache %s", name);
+        remove(name);
+    }
+    hb_value_free(&dict);
+}
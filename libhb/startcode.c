@@ -0,0 +1,241 @@
+/* startcode.c
+
+   Copyright (c) 2003-2024 HandBrake Team
+   This file is part of the HandBrake source code
+   Homepage: <http://handbrake.fr/>.
+   It may be used under the terms of the GNU General Public License v2.
+   For full terms see the file COPYING file or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+#include "handbrake/handbrake.h"     // needed for ARCH_X86
+#include "handbrake/startcode.h"
+
+#if defined(ARCH_X86)
+#include <immintrin.h>
+#include "libavutil/cpu.h"
+#define HAVE_STARTCODE_SIMD 1
+#elif defined(__aarch64__)
+#include "sse2neon.h"
+#define HAVE_STARTCODE_SIMD 1
+#endif
+
+/***********************************************************************
+ * Scalar versions
+ **********************************************************************/
+static const uint8_t * find_prefix_c( const uint8_t *p, const uint8_t *end,
+                                      uint8_t mask, uint8_t value )
+{
+    for (; end - p > 3; p++)
+    {
+        if (p[0] == 0 && p[1] == 0 && (p[2] & mask) == value)
+        {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static int check_ts_sync( const uint8_t *buf )
+{
+    // must have initial sync byte & a legal adaptation ctrl
+    return (buf[0] == 0x47) && (((buf[3] & 0x30) >> 4) > 0);
+}
+
+static int find_ts_sync_c( const uint8_t *buf, int len, int psize, int count )
+{
+    int offset, ii;
+
+    for (offset = 0; offset < len; offset++)
+    {
+        for (ii = 0; ii < count; ii++)
+        {
+            if (!check_ts_sync(&buf[offset + ii * psize]))
+            {
+                break;
+            }
+        }
+        if (ii == count)
+        {
+            return offset;
+        }
+    }
+    return -1;
+}
+
+#if defined(HAVE_STARTCODE_SIMD)
+/***********************************************************************
+ * SSE2 versions, NEON through sse2neon on arm64
+ **********************************************************************/
+static const uint8_t * find_prefix_sse2( const uint8_t *p, const uint8_t *end,
+                                         uint8_t mask, uint8_t value )
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i m    = _mm_set1_epi8(mask);
+    const __m128i v    = _mm_set1_epi8(value);
+
+    // The 16 candidates at p read p[0] to p[17], and the last one
+    // must be followed by a byte
+    while (end - p >= 16 + 3)
+    {
+        __m128i b0 = _mm_loadu_si128((const __m128i *)(p));
+        __m128i b1 = _mm_loadu_si128((const __m128i *)(p + 1));
+        __m128i b2 = _mm_loadu_si128((const __m128i *)(p + 2));
+        __m128i hit;
+        int     bits;
+
+        hit  = _mm_and_si128(_mm_cmpeq_epi8(_mm_or_si128(b0, b1), zero),
+                             _mm_cmpeq_epi8(_mm_and_si128(b2, m), v));
+        bits = _mm_movemask_epi8(hit);
+        if (bits)
+        {
+            return p + __builtin_ctz(bits);
+        }
+        p += 16;
+    }
+    return find_prefix_c(p, end, mask, value);
+}
+
+static int find_ts_sync_sse2( const uint8_t *buf, int len,
+                              int psize, int count )
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i sync = _mm_set1_epi8(0x47);
+    const __m128i afc  = _mm_set1_epi8(0x30);
+    int           offset, ii;
+
+    for (offset = 0; offset + 16 <= len; offset += 16)
+    {
+        int bits = 0xffff;
+
+        // Most offsets of a damaged stream fail on the first packet
+        for (ii = 0; ii < count && bits; ii++)
+        {
+            const uint8_t *p = buf + offset + ii * psize;
+            __m128i s = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p),
+                                       sync);
+            __m128i a = _mm_and_si128(
+                            _mm_loadu_si128((const __m128i *)(p + 3)), afc);
+
+            bits &= _mm_movemask_epi8(
+                        _mm_andnot_si128(_mm_cmpeq_epi8(a, zero), s));
+        }
+        if (bits)
+        {
+            return offset + __builtin_ctz(bits);
+        }
+    }
+    ii = find_ts_sync_c(buf + offset, len - offset, psize, count);
+    return ii < 0 ? -1 : offset + ii;
+}
+#endif // HAVE_STARTCODE_SIMD
+
+#if defined(ARCH_X86)
+/***********************************************************************
+ * AVX2 versions
+ **********************************************************************/
+__attribute__((target("avx2")))
+static const uint8_t * find_prefix_avx2( const uint8_t *p, const uint8_t *end,
+                                         uint8_t mask, uint8_t value )
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i m    = _mm256_set1_epi8(mask);
+    const __m256i v    = _mm256_set1_epi8(value);
+
+    while (end - p >= 32 + 3)
+    {
+        __m256i  b0 = _mm256_loadu_si256((const __m256i *)(p));
+        __m256i  b1 = _mm256_loadu_si256((const __m256i *)(p + 1));
+        __m256i  b2 = _mm256_loadu_si256((const __m256i *)(p + 2));
+        __m256i  hit;
+        uint32_t bits;
+
+        hit  = _mm256_and_si256(
+                    _mm256_cmpeq_epi8(_mm256_or_si256(b0, b1), zero),
+                    _mm256_cmpeq_epi8(_mm256_and_si256(b2, m), v));
+        bits = _mm256_movemask_epi8(hit);
+        if (bits)
+        {
+            return p + __builtin_ctz(bits);
+        }
+        p += 32;
+    }
+    return find_prefix_sse2(p, end, mask, value);
+}
+
+__attribute__((target("avx2")))
+static int find_ts_sync_avx2( const uint8_t *buf, int len,
+                              int psize, int count )
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i sync = _mm256_set1_epi8(0x47);
+    const __m256i afc  = _mm256_set1_epi8(0x30);
+    int           offset, ii;
+
+    for (offset = 0; offset + 32 <= len; offset += 32)
+    {
+        uint32_t bits = 0xffffffff;
+
+        for (ii = 0; ii < count && bits; ii++)
+        {
+            const uint8_t *p = buf + offset + ii * psize;
+            __m256i s = _mm256_cmpeq_epi8(
+                            _mm256_loadu_si256((const __m256i *)p), sync);
+            __m256i a = _mm256_and_si256(
+                            _mm256_loadu_si256((const __m256i *)(p + 3)), afc);
+
+            bits &= _mm256_movemask_epi8(
+                        _mm256_andnot_si256(_mm256_cmpeq_epi8(a, zero), s));
+        }
+        if (bits)
+        {
+            return offset + __builtin_ctz(bits);
+        }
+    }
+    ii = find_ts_sync_sse2(buf + offset, len - offset, psize, count);
+    return ii < 0 ? -1 : offset + ii;
+}
+#endif // ARCH_X86
+
+/***********************************************************************
+ * Dispatch
+ **********************************************************************/
+static const uint8_t * (*find_prefix)( const uint8_t *, const uint8_t *,
+                                       uint8_t, uint8_t ) = find_prefix_c;
+static int (*find_ts_sync)( const uint8_t *, int, int, int ) = find_ts_sync_c;
+
+void hb_startcode_init( void )
+{
+    // Can be called again, e.g. after av_force_cpu_flags()
+    find_prefix  = find_prefix_c;
+    find_ts_sync = find_ts_sync_c;
+
+#if defined(ARCH_X86)
+    int flags = av_get_cpu_flags();
+
+    if (flags & AV_CPU_FLAG_AVX2)
+    {
+        find_prefix  = find_prefix_avx2;
+        find_ts_sync = find_ts_sync_avx2;
+    }
+    else if (flags & AV_CPU_FLAG_SSE2)
+    {
+        find_prefix  = find_prefix_sse2;
+        find_ts_sync = find_ts_sync_sse2;
+    }
+#elif defined(HAVE_STARTCODE_SIMD)
+    find_prefix  = find_prefix_sse2;
+    find_ts_sync = find_ts_sync_sse2;
+#endif
+}
+
+const uint8_t * hb_find_start_code_prefix( const uint8_t *buf,
+                                           const uint8_t *end,
+                                           uint8_t mask, uint8_t value )
+{
+    return find_prefix(buf, end, mask, value);
+}
+
+int hb_find_ts_sync( const uint8_t *buf, int len, int psize, int count )
+{
+    return find_ts_sync(buf, len, psize, count);
+}
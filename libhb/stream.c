@@ -10,11 +10,16 @@
 #include <string.h>
 #include <ctype.h>
 #include <errno.h>
+#if defined(SYS_LINUX) || defined(SYS_FREEBSD) || defined(SYS_DARWIN)
+#include <fcntl.h>
+#endif
 
 #include "handbrake/handbrake.h"
 #include "handbrake/hbffmpeg.h"
 #include "handbrake/lang.h"
 #include "handbrake/extradata.h"
+#include "handbrake/startcode.h"
+#include "handbrake/streamindex.h"
 #include "libbluray/bluray.h"
 
 #define min(a, b) a < b ? a : b
@@ -188,7 +193,6 @@ struct hb_stream_s
         int64_t last_timestamp; // used for discontinuity detection when
                                 // there are no PCRs
 
-        uint8_t *packet;        // buffer for one TS packet
         hb_ts_stream_t *list;
         int count;
         int alloc;
@@ -215,8 +219,21 @@ struct hb_stream_s
 #define         TS_HAS_RAP  (1 << 1)    // Random Access Point bit seen
 #define         TS_HAS_RSEI (1 << 2)    // "Restart point" SEI seen
 
+    hb_stream_index_t *index;   // video keyframe index, see streamindex.h
+
     char    *path;
     FILE    *file_handle;
+
+    // Block input of transport and program streams, see stream_fill()
+    struct
+    {
+        uint8_t *buf;
+        int      start;         // start of the valid data in buf
+        int      size;          // end of the valid data in buf
+        int      pos;           // read position in buf
+        off_t    offset;        // file offset of buf[0]
+        int      error;
+    } in;
     hb_stream_type_t hb_stream_type;
     hb_title_t *title;
 
@@ -290,6 +307,264 @@ static void hb_ps_resolve_stream_types(hb_stream_t *stream);
 void hb_ts_stream_reset(hb_stream_t *stream);
 void hb_ps_stream_reset(hb_stream_t *stream);
 
+/*
+ * Block input for transport and program streams.
+ *
+ * The file is read in large blocks and TS packets and PS start codes
+ * are parsed in place, instead of one stdio call per packet or byte.
+ * Blocks are read at STREAM_BLOCK_SIZE aligned file offsets into an
+ * aligned buffer.  The unread end of the previous block (and a few
+ * bytes before it, so that short backward seeks stay in the buffer)
+ * is moved in front of the new block, so that up to STREAM_KEEP_SIZE
+ * contiguous bytes can be peeked at any position.
+ *
+ * The kernel is told that the file is read sequentially, and to read
+ * ahead the block that follows the one just read.
+ *
+ * The FILE is unbuffered and its position is always the file offset
+ * of the end of the valid data in the buffer.
+ */
+#define STREAM_BLOCK_SIZE  (1024 * 1024)
+#define STREAM_KEEP_SIZE   (64 * 1024)
+#define STREAM_KEEP_BEHIND 16
+
+static void stream_advise( hb_stream_t *stream, off_t offset, off_t len )
+{
+#if defined(SYS_LINUX) || defined(SYS_FREEBSD)
+    posix_fadvise(fileno(stream->file_handle), offset, len,
+                  POSIX_FADV_WILLNEED);
+#endif
+}
+
+static int stream_input_init( hb_stream_t *stream )
+{
+    int fd = fileno(stream->file_handle);
+
+    stream->in.buf = av_malloc(STREAM_KEEP_SIZE + STREAM_BLOCK_SIZE);
+    if (stream->in.buf == NULL)
+    {
+        return -1;
+    }
+    setvbuf(stream->file_handle, NULL, _IONBF, 0);
+#if defined(SYS_LINUX) || defined(SYS_FREEBSD)
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#elif defined(SYS_DARWIN)
+    fcntl(fd, F_RDAHEAD, 1);
+#else
+    (void)fd;
+#endif
+
+    // Empty buffer positioned at the start of the file
+    fseeko(stream->file_handle, 0, SEEK_SET);
+    stream->in.offset = -STREAM_KEEP_SIZE;
+    stream->in.start  = STREAM_KEEP_SIZE;
+    stream->in.size   = STREAM_KEEP_SIZE;
+    stream->in.pos    = STREAM_KEEP_SIZE;
+    stream->in.error  = 0;
+
+    return 0;
+}
+
+static void stream_input_close( hb_stream_t *stream )
+{
+    av_freep(&stream->in.buf);
+}
+
+// Reads the next block, returns the number of bytes read
+static size_t stream_read_block( hb_stream_t *stream )
+{
+    uint8_t * buf    = stream->in.buf;
+    int       remain = stream->in.size - stream->in.pos;
+    int       skip   = 0, behind;
+    off_t     next   = stream->in.offset + stream->in.size;
+    size_t    len;
+
+    if (remain < 0)
+    {
+        // Seek past the end of the buffer, see stream_seek()
+        skip   = -remain;
+        remain = 0;
+    }
+    behind = MIN(stream->in.pos - skip - stream->in.start, STREAM_KEEP_BEHIND);
+    behind = MIN(behind, STREAM_KEEP_SIZE - remain);
+    memmove(buf + STREAM_KEEP_SIZE - remain - behind,
+            buf + stream->in.pos - skip - behind, remain + behind);
+
+    len = fread(buf + STREAM_KEEP_SIZE, 1, STREAM_BLOCK_SIZE,
+                stream->file_handle);
+    stream->in.offset = next - STREAM_KEEP_SIZE;
+    stream->in.start  = STREAM_KEEP_SIZE - remain - behind;
+    stream->in.size   = STREAM_KEEP_SIZE + len;
+    stream->in.pos    = STREAM_KEEP_SIZE - remain + skip;
+
+    if (len < STREAM_BLOCK_SIZE)
+    {
+        int err = ferror(stream->file_handle);
+        if (err != 0 && !stream->in.error)
+        {
+            hb_error("stream: read error (%d) @ %"PRId64, err, (int64_t)next);
+            hb_set_work_error(stream->h, HB_ERROR_READ);
+        }
+        stream->in.error = err;
+        clearerr(stream->file_handle);
+    }
+    else
+    {
+        stream_advise(stream, next + STREAM_BLOCK_SIZE, STREAM_BLOCK_SIZE);
+    }
+
+    return len;
+}
+
+/*
+ * Reads blocks until at least 'need' bytes (at most STREAM_KEEP_SIZE)
+ * can be read at the read position.  Returns 0 if the end of the file
+ * is reached first.
+ */
+static int stream_fill( hb_stream_t *stream, int need )
+{
+    while (stream->in.size - stream->in.pos < need)
+    {
+        if (stream_read_block(stream) < STREAM_BLOCK_SIZE)
+        {
+            return stream->in.size - stream->in.pos >= need;
+        }
+    }
+    return 1;
+}
+
+// Returns a pointer to the next 'len' bytes, or NULL at the end of the
+// file.  The data is valid until the next call to any stream_* input
+// function.  Does not advance the read position, see stream_skip().
+static inline const uint8_t * stream_peek( hb_stream_t *stream, int len )
+{
+    if (stream->in.size - stream->in.pos < len && !stream_fill(stream, len))
+    {
+        return NULL;
+    }
+    return stream->in.buf + stream->in.pos;
+}
+
+static inline void stream_skip( hb_stream_t *stream, int len )
+{
+    stream->in.pos += len;
+}
+
+static inline int stream_getc( hb_stream_t *stream )
+{
+    if (stream->in.pos >= stream->in.size && !stream_fill(stream, 1))
+    {
+        return EOF;
+    }
+    return stream->in.buf[stream->in.pos++];
+}
+
+// Copies up to 'len' bytes, returns the number of bytes copied
+static int stream_read( hb_stream_t *stream, uint8_t *dst, int len )
+{
+    int done = 0;
+
+    while (done < len)
+    {
+        int avail = stream->in.size - stream->in.pos;
+        if (avail <= 0)
+        {
+            if (!stream_fill(stream, 1))
+            {
+                break;
+            }
+            continue;
+        }
+        avail = MIN(avail, len - done);
+        memcpy(dst + done, stream->in.buf + stream->in.pos, avail);
+        stream->in.pos += avail;
+        done           += avail;
+    }
+    return done;
+}
+
+/*
+ * Looks in the buffered data at the read position for the next start
+ * code prefix followed by a stream id in [min_id, max_id].  Returns 1
+ * and sets *len to the number of bytes before the start code if it is
+ * found.  Otherwise returns 0 and sets *len to the number of bytes that
+ * can be skipped before looking again, or EOF at the end of the file.
+ * Does not advance the read position.
+ */
+static int stream_find_start_code( hb_stream_t *stream,
+                                   int min_id, int max_id, int *len )
+{
+    const uint8_t *buf, *end, *sc;
+    int            avail = stream->in.size - stream->in.pos;
+
+    if (avail < 4)
+    {
+        stream_fill(stream, 4);
+        avail = stream->in.size - stream->in.pos;
+        if (avail <= 0)
+        {
+            *len = 0;
+            return EOF;
+        }
+    }
+    buf = stream->in.buf + stream->in.pos;
+    end = buf + avail;
+    for (sc = buf; (sc = hb_find_start_code(sc, end)) != NULL; sc++)
+    {
+        if (sc[3] >= min_id && sc[3] <= max_id)
+        {
+            *len = sc - buf;
+            return 1;
+        }
+    }
+    // Keep the last bytes, a start code may continue in the next block
+    *len = avail >= 4 ? avail - 3 : avail;
+    return 0;
+}
+
+static off_t stream_tell( hb_stream_t *stream )
+{
+    return stream->in.offset + stream->in.pos;
+}
+
+static int stream_seek( hb_stream_t *stream, off_t pos )
+{
+    off_t block;
+
+    if (pos >= stream->in.offset + stream->in.start &&
+        pos <= stream->in.offset + stream->in.size)
+    {
+        // Still buffered
+        stream->in.pos = pos - stream->in.offset;
+        return 0;
+    }
+
+    // Read from the block that contains 'pos'
+    block = pos & ~((off_t)STREAM_BLOCK_SIZE - 1);
+    if (fseeko(stream->file_handle, block, SEEK_SET) != 0)
+    {
+        return -1;
+    }
+    stream_advise(stream, block, STREAM_BLOCK_SIZE);
+    stream->in.offset = block - STREAM_KEEP_SIZE;
+    stream->in.start  = STREAM_KEEP_SIZE;
+    stream->in.size   = STREAM_KEEP_SIZE;
+    stream->in.pos    = STREAM_KEEP_SIZE + (pos - block);
+
+    return 0;
+}
+
+static off_t stream_file_size( hb_stream_t *stream )
+{
+    off_t size;
+
+    fseeko(stream->file_handle, 0, SEEK_END);
+    size = ftello(stream->file_handle);
+    fseeko(stream->file_handle, stream->in.offset + stream->in.size, SEEK_SET);
+
+    return size;
+}
+
 /*
  * logging routines.
  * these frontend hb_log because transport streams can have a lot of errors
@@ -507,43 +782,34 @@ static int check_ps_sc(const uint8_t *buf)
     return (buf[pos+0] == 0x00) && (buf[pos+1] == 0x00) && (buf[pos+2] == 0x01);
 }
 
-static int check_ts_sync(const uint8_t *buf)
-{
-    // must have initial sync byte & a legal adaptation ctrl
-    return (buf[0] == 0x47) && (((buf[3] & 0x30) >> 4) > 0);
-}
-
-static int have_ts_sync(const uint8_t *buf, int psize, int count)
-{
-    int ii;
-    for ( ii = 0; ii < count; ii++ )
-    {
-        if ( !check_ts_sync(&buf[ii*psize]) )
-            return 0;
-    }
-    return 1;
-}
-
 static int hb_stream_check_for_ts(const uint8_t *buf)
 {
     // transport streams should have a sync byte every 188 bytes.
     // search the first 8KB of buf looking for at least 8 consecutive
     // correctly located sync patterns.
-    int offset = 0;
+    static const int psizes[] = { 188, 192, 204, 208 };
     int count = 16;
+    int found = -1, found_size = 0;
+    int ii;
 
-    for ( offset = 0; offset < 8*1024-count*188; ++offset )
+    // The lowest offset wins, packet sizes are tried in order at
+    // each offset
+    for ( ii = 0; ii < sizeof(psizes) / sizeof(psizes[0]); ii++ )
     {
-        if ( have_ts_sync( &buf[offset], 188, count) )
-            return 188 | (offset << 8);
-        if ( have_ts_sync( &buf[offset], 192, count) )
-            return 192 | (offset << 8);
-        if ( have_ts_sync( &buf[offset], 204, count) )
-            return 204 | (offset << 8);
-        if ( have_ts_sync( &buf[offset], 208, count) )
-            return 208 | (offset << 8);
+        int psize = psizes[ii];
+        int len   = MIN(8*1024-count*188, 8*1024-(count-1)*psize-3);
+        int offset;
+
+        if ( found >= 0 )
+            len = MIN(len, found);
+        offset = hb_find_ts_sync(buf, len, psize, count);
+        if ( offset >= 0 )
+        {
+            found      = offset;
+            found_size = psize;
+        }
     }
-    return 0;
+    return found >= 0 ? found_size | (found << 8) : 0;
 }
 
 static int hb_stream_check_for_ps(hb_stream_t *stream)
@@ -552,7 +818,7 @@ static int hb_stream_check_for_ps(hb_stream_t *stream)
     uint8_t sc_buf[4];
     int pos = 0;
 
-    fseek(stream->file_handle, 0, SEEK_SET);
+    stream_seek(stream, 0);
 
     // program streams should start with a PACK then some other mpeg start
     // code (usually a SYS but that might be missing if we only have a clip).
@@ -560,11 +826,18 @@ static int hb_stream_check_for_ps(hb_stream_t *stream)
     {
         int offset;
 
-        if ( fread(buf, 1, sizeof(buf), stream->file_handle) != sizeof(buf) )
+        if ( stream_read(stream, buf, sizeof(buf)) != sizeof(buf) )
             return 0;
 
         for ( offset = 0; offset < 8*1024-27; ++offset )
         {
+            // Skip to the next start code prefix
+            const uint8_t *sc = hb_find_start_code(&buf[offset],
+                                                   &buf[8*1024-27+3]);
+            if ( sc == NULL )
+                break;
+            offset = sc - buf;
+
             if ( check_ps_sync( &buf[offset] ) && check_ps_sc( &buf[offset] ) )
             {
                 int pes_offset, prev, data_len;
@@ -590,23 +863,23 @@ static int hb_stream_check_for_ps(hb_stream_t *stream)
                 data_len = (b[4] << 8) + b[5];
                 if ( data_len && sid > 0xba && sid < 0xf9 )
                 {
-                    prev = ftell( stream->file_handle );
+                    prev = stream_tell( stream );
                     pos = prev - ( sizeof(buf) - offset );
                     pos += pes_offset + 6 + data_len;
-                    fseek( stream->file_handle, pos, SEEK_SET );
-                    if ( fread(sc_buf, 1, 4, stream->file_handle) != 4 )
+                    stream_seek( stream, pos );
+                    if ( stream_read(stream, sc_buf, 4) != 4 )
                         return 0;
                     if (sc_buf[0] == 0x00 && sc_buf[1] == 0x00 &&
                         sc_buf[2] == 0x01)
                     {
                         return 1;
                     }
-                    fseek( stream->file_handle, prev, SEEK_SET );
+                    stream_seek( stream, prev );
                 }
             }
         }
-        fseek( stream->file_handle, -27, SEEK_CUR );
-        pos = ftell( stream->file_handle );
+        stream_seek( stream, stream_tell( stream ) - 27 );
+        pos = stream_tell( stream );
     }
     return 0;
 }
@@ -615,7 +888,7 @@ static int hb_stream_get_type(hb_stream_t *stream)
 {
     uint8_t buf[2048*4];
 
-    if ( fread(buf, 1, sizeof(buf), stream->file_handle) == sizeof(buf) )
+    if ( stream_read(stream, buf, sizeof(buf)) == sizeof(buf) )
     {
         int psize;
         if ( ( psize = hb_stream_check_for_ts(buf) ) != 0 )
@@ -649,14 +922,9 @@ static void hb_stream_delete_dynamic( hb_stream_t *d )
         fclose( d->file_handle );
         d->file_handle = NULL;
     }
+    stream_input_close( d );
 
     int i=0;
-
-    if ( d->ts.packet )
-    {
-        free( d->ts.packet );
-        d->ts.packet = NULL;
-    }
     if ( d->ts.list )
     {
         for (i = 0; i < d->ts.count; i++)
@@ -683,6 +951,7 @@ static void hb_stream_delete_dynamic( hb_stream_t *d )
 static void hb_stream_delete( hb_stream_t *d )
 {
     hb_stream_delete_dynamic( d );
+    hb_stream_index_close( &d->index );
     free( d->ts.list );
     free( d->pes.list );
     free( d->path );
@@ -863,7 +1132,7 @@ hb_stream_open(hb_handle_t *h, const char *path, hb_title_t *title, int scan)
     d->title = title;
     d->scan = scan;
     d->path = strdup( path );
-    if (d->path != NULL )
+    if (d->path != NULL && stream_input_init( d ) == 0)
     {
         if (hb_stream_get_type( d ) != 0)
         {
@@ -871,6 +1140,10 @@ hb_stream_open(hb_handle_t *h, const char *path, hb_title_t *title, int scan)
             {
                 prune_streams( d );
             }
+            if ( hb_stream_index_enabled() )
+            {
+                d->index = hb_stream_index_load( d->path );
+            }
             // reset to beginning of file and reset some stream
             // state information
             hb_stream_seek( d, 0. );
@@ -878,6 +1151,7 @@ hb_stream_open(hb_handle_t *h, const char *path, hb_title_t *title, int scan)
         }
         fclose( d->file_handle );
         d->file_handle = NULL;
+        stream_input_close( d );
         if ( ffmpeg_open( d, title, scan ) )
         {
             return d;
@@ -887,6 +1161,7 @@ hb_stream_open(hb_handle_t *h, const char *path, hb_title_t *title, int scan)
     {
         fclose( d->file_handle );
     }
+    stream_input_close( d );
     if (d->path)
     {
         free( d->path );
@@ -960,7 +1235,6 @@ hb_stream_t * hb_bd_stream_open( hb_handle_t *h, hb_title_t *title )
     d->file_handle = NULL;
     d->title = title;
     d->path = NULL;
-    d->ts.packet = NULL;
 
     int pid = title->video_id;
     int stream_type = title->video_stream_type;
@@ -1144,31 +1418,28 @@ hb_title_t * hb_stream_title_scan(hb_stream_t *stream, hb_title_t * title)
 
 /*
  * read the next transport stream packet from 'stream'. Return NULL if
- * we hit eof & a pointer to the sync byte otherwise.
+ * we hit eof & a pointer to the sync byte otherwise.  The packet is
+ * parsed in place in the input buffer and is valid until the next read.
  */
 static const uint8_t *next_packet( hb_stream_t *stream )
 {
-    uint8_t *buf = stream->ts.packet + stream->packetsize - 188;
+    const uint8_t *buf;
 
     while ( 1 )
     {
-        if ( fread(stream->ts.packet, 1, stream->packetsize, stream->file_handle) !=
-             stream->packetsize )
+        buf = stream_peek( stream, stream->packetsize );
+        if ( buf == NULL )
         {
-            int err;
-            if ((err = ferror(stream->file_handle)) != 0)
-            {
-                hb_error("next_packet: error (%d)", err);
-                hb_set_work_error(stream->h, HB_ERROR_READ);
-            }
             return NULL;
         }
+        stream_skip( stream, stream->packetsize );
+        buf += stream->packetsize - 188;
         if (buf[0] == 0x47)
         {
             return buf;
         }
         // lost sync - back up to where we started then try to re-establish.
-        off_t pos = ftello(stream->file_handle) - stream->packetsize;
+        off_t pos = stream_tell(stream) - stream->packetsize;
         off_t pos2 = align_to_next_packet(stream);
         if ( pos2 == 0 )
         {
@@ -1185,26 +1456,15 @@ static const uint8_t *next_packet( hb_stream_t *stream )
  */
 static void skip_to_next_pack( hb_stream_t *src_stream )
 {
-    // scan forward until we find the start of the next pack
-    uint32_t strt_code = -1;
-    int c;
-
-    flockfile( src_stream->file_handle );
-    while ( ( c = getc_unlocked( src_stream->file_handle ) ) != EOF )
-    {
-        strt_code = ( strt_code << 8 ) | c;
-        if ( strt_code == 0x000001ba )
-            // we found the start of the next pack
-            break;
-    }
-    funlockfile( src_stream->file_handle );
+    // scan forward until we find the start of the next pack, the
+    // next read starts on the pack boundary.
+    int len;
 
-    // if we didn't terminate on an eof back up so the next read
-    // starts on the pack boundary.
-    if ( c != EOF )
+    while ( stream_find_start_code( src_stream, 0xba, 0xba, &len ) == 0 )
     {
-        fseeko( src_stream->file_handle, -4, SEEK_CUR );
+        stream_skip( src_stream, len );
     }
+    stream_skip( src_stream, len );
 }
 
 static void CreateDecodedNAL( uint8_t **dst, int *dst_len,
@@ -1219,22 +1479,25 @@ static void CreateDecodedNAL( uint8_t **dst, int *dst_len,
     {
         while( src < end )
         {
-            if( src < end - 3 && src[0] == 0x00 && src[1] == 0x00 &&
-                src[2] == 0x01 )
+            // Next start code (00 00 01) or emulation prevention (00 00 03)
+            const uint8_t *sc = hb_find_start_code_prefix(src, end,
+                                                          0xfd, 0x01);
+            if( sc == NULL )
             {
-                // Next start code found
+                memcpy( d, src, end - src );
+                d += end - src;
                 break;
             }
-            if( src < end - 3 && src[0] == 0x00 && src[1] == 0x00 &&
-                src[2] == 0x03 )
+            memcpy( d, src, sc - src );
+            d += sc - src;
+            if( sc[2] == 0x01 )
             {
-                *d++ = 0x00;
-                *d++ = 0x00;
-
-                src += 3;
-                continue;
+                // Next start code found
+                break;
             }
-            *d++ = *src++;
+            *d++ = 0x00;
+            *d++ = 0x00;
+            src = sc + 3;
         }
     }
     *dst_len = d - *dst;
@@ -1278,13 +1541,37 @@ static int isRecoveryPoint( const uint8_t *buf, int len )
     return recovery_frames;
 }
 
+/*
+ * Returns the index of the first byte at or after 'ii' that follows a
+ * 00 00 01 start code prefix, -1 if there is none.  The bytes before
+ * buf count as zeros.
+ */
+static int next_start_code( const uint8_t *buf, int len, int ii )
+{
+    const uint8_t *sc;
+
+    for ( ; ii < 3 && ii < len; ii++ )
+    {
+        if ( ( ii == 1 && buf[0] == 0x01 ) ||
+             ( ii == 2 && buf[0] == 0x00 && buf[1] == 0x01 ) )
+        {
+            return ii;
+        }
+    }
+    if ( ii >= len )
+    {
+        return -1;
+    }
+    sc = hb_find_start_code( buf + ii - 3, buf + len );
+    return sc != NULL ? sc - buf + 3 : -1;
+}
+
 static int isIframe( hb_stream_t *stream, const uint8_t *buf, int len )
 {
     // For mpeg2: look for a gop start or i-frame picture start
     // for h.264: look for idr nal type or a slice header for an i-frame
     // for vc1:   look for a Sequence header
     int ii;
-    uint32_t strid = 0;
 
 
     int vid = pes_index_of_video( stream );
@@ -1294,32 +1581,28 @@ static int isIframe( hb_stream_t *stream, const uint8_t *buf, int len )
          pes->codec_param == AV_CODEC_ID_MPEG2VIDEO )
     {
         // This section of the code handles MPEG-1 and MPEG-2 video streams
-        for (ii = 0; ii < len; ii++)
+        for (ii = 0; (ii = next_start_code(buf, len, ii)) >= 0; ii++)
         {
-            strid = (strid << 8) | buf[ii];
-            if ( ( strid >> 8 ) == 1 )
+            // we found a start code
+            uint8_t id = buf[ii];
+            switch ( id )
             {
-                // we found a start code
-                uint8_t id = strid;
-                switch ( id )
-                {
-                    case 0xB8: // group_start_code (GOP header)
-                    case 0xB3: // sequence_header code
-                        return 1;
+                case 0xB8: // group_start_code (GOP header)
+                case 0xB3: // sequence_header code
+                    return 1;
 
-                    case 0x00: // picture_start_code
-                        // picture_header, let's see if it's an I-frame
-                        if (ii < len - 3)
+                case 0x00: // picture_start_code
+                    // picture_header, let's see if it's an I-frame
+                    if (ii < len - 3)
+                    {
+                        // check if picture_coding_type == 1
+                        if ((buf[ii+2] & (0x7 << 3)) == (1 << 3))
                         {
-                            // check if picture_coding_type == 1
-                            if ((buf[ii+2] & (0x7 << 3)) == (1 << 3))
-                            {
-                                // found an I-frame picture
-                                return 1;
-                            }
+                            // found an I-frame picture
+                            return 1;
                         }
-                        break;
-                }
+                    }
+                    break;
             }
         }
         // didn't find an I-frame
@@ -1328,31 +1611,27 @@ static int isIframe( hb_stream_t *stream, const uint8_t *buf, int len )
     if ( pes->stream_type == 0x1b || pes->codec_param == AV_CODEC_ID_H264 )
     {
         // we have an h.264 stream
-        for (ii = 0; ii < len; ii++)
+        for (ii = 0; (ii = next_start_code(buf, len, ii)) >= 0; ii++)
         {
-            strid = (strid << 8) | buf[ii];
-            if ( ( strid >> 8 ) == 1 )
+            // we found a start code - remove the ref_idc from the nal type
+            uint8_t nal_type = buf[ii] & 0x1f;
+            if ( nal_type == 0x01 )
             {
-                // we found a start code - remove the ref_idc from the nal type
-                uint8_t nal_type = strid & 0x1f;
-                if ( nal_type == 0x01 )
-                {
-                    // Found slice and no recovery point
-                    return 0;
-                }
-                if ( nal_type == 0x05 )
-                {
-                    // h.264 IDR picture start
-                    return 1;
-                }
-                else if ( nal_type == 0x06 )
+                // Found slice and no recovery point
+                return 0;
+            }
+            if ( nal_type == 0x05 )
+            {
+                // h.264 IDR picture start
+                return 1;
+            }
+            else if ( nal_type == 0x06 )
+            {
+                int off = ii + 1;
+                int recovery_frames = isRecoveryPoint( buf+off, len-off );
+                if ( recovery_frames )
                 {
-                    int off = ii + 1;
-                    int recovery_frames = isRecoveryPoint( buf+off, len-off );
-                    if ( recovery_frames )
-                    {
-                        return recovery_frames;
-                    }
+                    return recovery_frames;
                 }
             }
         }
@@ -1362,10 +1641,9 @@ static int isIframe( hb_stream_t *stream, const uint8_t *buf, int len )
     if ( pes->stream_type == 0xea || pes->codec_param == AV_CODEC_ID_VC1 )
     {
         // we have an vc1 stream
-        for (ii = 0; ii < len; ii++)
+        for (ii = 0; (ii = next_start_code(buf, len, ii)) >= 0; ii++)
         {
-            strid = (strid << 8) | buf[ii];
-            if ( strid == 0x10f )
+            if ( buf[ii] == 0x0f )
             {
                 // the ffmpeg vc1 decoder requires a seq hdr code in the first
                 // frame.
@@ -1378,10 +1656,9 @@ static int isIframe( hb_stream_t *stream, const uint8_t *buf, int len )
     if ( pes->stream_type == 0x10 || pes->codec_param == AV_CODEC_ID_MPEG4 )
     {
         // we have an mpeg4 stream
-        for (ii = 0; ii < len-1; ii++)
+        for (ii = 0; (ii = next_start_code(buf, len-1, ii)) >= 0; ii++)
         {
-            strid = (strid << 8) | buf[ii];
-            if ( strid == 0x1b6 )
+            if ( buf[ii] == 0xb6 )
             {
                 if ((buf[ii+1] & 0xC0) == 0)
                     return 1;
@@ -1562,7 +1839,7 @@ static struct pts_pos hb_sample_pts(hb_stream_t *stream, uint64_t fpos)
     {
         const uint8_t *buf;
         int adapt_len;
-        fseeko( stream->file_handle, fpos, SEEK_SET );
+        stream_seek( stream, fpos );
         align_to_next_packet( stream );
         int pid = stream->ts.list[ts_index_of_video(stream)].pid;
         buf = hb_ts_stream_getPEStype( stream, pid, &adapt_len );
@@ -1590,7 +1867,7 @@ static struct pts_pos hb_sample_pts(hb_stream_t *stream, uint64_t fpos)
                 ++stream->has_IDRs;
             }
         }
-        pp.pos = ftello(stream->file_handle);
+        pp.pos = stream_tell(stream);
         if ( !stream->has_IDRs )
         {
             // Scan a little more to see if we will stumble upon one
@@ -1615,7 +1892,7 @@ static struct pts_pos hb_sample_pts(hb_stream_t *stream, uint64_t fpos)
 
         // round address down to nearest dvd sector start
         fpos &=~ ( HB_DVD_READ_BUFFER_SIZE - 1 );
-        fseeko( stream->file_handle, fpos, SEEK_SET );
+        stream_seek( stream, fpos );
         if ( stream->hb_stream_type == program )
         {
             skip_to_next_pack( stream );
@@ -1660,7 +1937,7 @@ static struct pts_pos hb_sample_pts(hb_stream_t *stream, uint64_t fpos)
         }
 
         pp.pts = pes_info.pts;
-        pp.pos = ftello(stream->file_handle);
+        pp.pos = stream_tell(stream);
     }
     return pp;
 }
@@ -1714,14 +1991,139 @@ static double compute_stream_rate( struct pts_pos *pp, int n )
     return rates[nrates >> 1];
 }
 
+/*
+ * Read the whole stream and index the video frames.
+ *
+ * Transport stream entries point at the TS packet that starts the PES
+ * packet of the frame.  Program stream entries point at the pack that
+ * contains the start of the PES packet.
+ */
+static hb_stream_index_t * hb_stream_index_build(hb_stream_t *stream)
+{
+    hb_stream_index_t *index = hb_stream_index_init();
+    uint64_t start = hb_get_date();
+
+    if ( index == NULL )
+    {
+        return NULL;
+    }
+    stream_seek(stream, 0);
+    if ( stream->hb_stream_type == transport )
+    {
+        const uint8_t *buf;
+        int pid = stream->ts.list[ts_index_of_video(stream)].pid;
+
+        align_to_next_packet(stream);
+        while ( ( buf = next_packet( stream ) ) != NULL )
+        {
+            int pack_pid = ( (buf[1] & 0x1f) << 8 ) | buf[2];
+            int adapt_len = 0;
+
+            if ( ( buf[1] & 0x40 ) == 0 || pack_pid != pid )
+            {
+                continue;
+            }
+            switch ( buf[3] & 0x30 )
+            {
+                case 0x00: // illegal
+                case 0x20: // fill packet
+                    continue;
+
+                case 0x30: // adaptation
+                    adapt_len = buf[4] + 1;
+                    break;
+            }
+            // PES header with a PTS
+            const uint8_t *pes = buf + 4 + adapt_len;
+            if ( adapt_len > 188 - 4 - 14 ||
+                 pes[0] != 0x00 || pes[1] != 0x00 || pes[2] != 0x01 ||
+                 ( pes[7] >> 7 ) != 1 )
+            {
+                continue;
+            }
+            hb_stream_index_add( index, pes_timestamp( pes + 9 ),
+                                 stream_tell( stream ) - stream->packetsize,
+                                 ts_isIframe( stream, buf, adapt_len ) );
+        }
+    }
+    else
+    {
+        hb_buffer_t *buf = hb_buffer_init(HB_DVD_READ_BUFFER_SIZE);
+        hb_pes_info_t pes_info;
+        off_t pack = 0;
+        int len;
+
+        buf->size = 0;
+        while ( ( len = hb_ps_read_packet( stream, buf ) ) > 0 )
+        {
+            if ( buf->data[3] == 0xba )
+            {
+                pack = stream_tell( stream ) - len;
+            }
+            else if ( hb_parse_ps( stream, buf->data, buf->size, &pes_info ) &&
+                      pes_info.pts != AV_NOPTS_VALUE )
+            {
+                int idx;
+                if ( pes_info.stream_id == 0xbd )
+                {
+                    idx = index_of_ps_stream( stream, pes_info.stream_id,
+                                              pes_info.bd_substream_id );
+                }
+                else
+                {
+                    idx = index_of_ps_stream( stream, pes_info.stream_id,
+                                              pes_info.stream_id_ext );
+                }
+                if ( idx >= 0 && stream->pes.list[idx].stream_kind == V )
+                {
+                    int key = isIframe( stream, buf->data, buf->size );
+                    hb_stream_index_add( index, pes_info.pts, pack, key );
+                }
+            }
+            buf->size = 0;
+        }
+        hb_buffer_close( &buf );
+    }
+    stream_seek(stream, 0);
+
+    hb_log( "stream index: %d keyframes, duration %"PRId64" ms, "
+            "built in %"PRIu64" ms",
+            hb_stream_index_keyframes( index ),
+            hb_stream_index_duration( index ) / 90,
+            hb_get_date() - start );
+    return index;
+}
+
 static void hb_stream_duration(hb_stream_t *stream, hb_title_t *inTitle)
 {
     struct pts_pos ptspos[NDURSAMPLES];
     struct pts_pos *pp = ptspos;
     int i;
 
-    fseeko(stream->file_handle, 0, SEEK_END);
-    uint64_t fsize = ftello(stream->file_handle);
+    // The index has the exact duration and knows all the keyframes
+    if ( stream->index == NULL && hb_stream_index_enabled() )
+    {
+        stream->index = hb_stream_index_build( stream );
+        if ( stream->index != NULL )
+        {
+            hb_stream_index_save( stream->index, stream->path );
+        }
+    }
+    if ( stream->index != NULL &&
+         hb_stream_index_duration( stream->index ) > 0 )
+    {
+        uint64_t dur = hb_stream_index_duration( stream->index );
+        stream->has_IDRs = MIN( 255,
+                                hb_stream_index_keyframes( stream->index ) );
+        inTitle->duration = dur;
+        dur /= 90000;
+        inTitle->hours    = dur / 3600;
+        inTitle->minutes  = ( dur % 3600 ) / 60;
+        inTitle->seconds  = dur % 60;
+        return;
+    }
+
+    uint64_t fsize = stream_file_size(stream);
     uint64_t fincr = fsize / NDURSAMPLES;
     uint64_t fpos = fincr / 2;
     for ( i = NDURSAMPLES; --i >= 0; fpos += fincr )
@@ -1735,7 +2137,7 @@ static void hb_stream_duration(hb_stream_t *stream, hb_title_t *inTitle)
     inTitle->minutes  = ( dur % 3600 ) / 60;
     inTitle->seconds  = dur % 60;
 
-    rewind(stream->file_handle);
+    stream_seek(stream, 0);
 }
 
 /***********************************************************************
@@ -1827,6 +2229,34 @@ int hb_stream_chapter( hb_stream_t * src_stream )
     return( src_stream->chapter );
 }
 
+/*
+ * Seek a transport or program stream to the keyframe of an index entry.
+ * The demuxer starts at a packet boundary before the keyframe.
+ */
+static int stream_seek_index( hb_stream_t *stream,
+                              const hb_stream_index_entry_t *entry )
+{
+    if ( stream_seek( stream, entry->pos ) != 0 )
+    {
+        return 0;
+    }
+    if ( stream->hb_stream_type == transport )
+    {
+        hb_ts_stream_reset( stream );
+        align_to_next_packet( stream );
+    }
+    else
+    {
+        hb_ps_stream_reset( stream );
+        skip_to_next_pack( stream );
+    }
+    if ( !stream->has_IDRs )
+    {
+        stream->need_keyframe = 0;
+    }
+    return 1;
+}
+
 /***********************************************************************
  * hb_stream_seek
  ***********************************************************************
@@ -1838,18 +2268,26 @@ int hb_stream_seek( hb_stream_t * stream, float f )
     {
         return ffmpeg_seek( stream, f );
     }
-    off_t stream_size, cur_pos, new_pos;
+    off_t stream_size, new_pos;
     double pos_ratio = f;
-    cur_pos = ftello( stream->file_handle );
-    fseeko( stream->file_handle, 0, SEEK_END );
-    stream_size = ftello( stream->file_handle );
+    const hb_stream_index_entry_t *entry;
+
+    // Seek to the keyframe at the same fraction of the duration.
+    // Position 0 is the start of the file, which has the tables
+    // that the start of the video may depend on.
+    if ( f > 0 && stream->index != NULL &&
+         ( entry = hb_stream_index_lookup( stream->index,
+                        f * hb_stream_index_duration( stream->index ) ) ) )
+    {
+        return stream_seek_index( stream, entry );
+    }
+
+    stream_size = stream_file_size( stream );
     new_pos = (off_t) ((double) (stream_size) * pos_ratio);
     new_pos &=~ (HB_DVD_READ_BUFFER_SIZE - 1);
 
-    int r = fseeko( stream->file_handle, new_pos, SEEK_SET );
-    if (r == -1)
+    if (stream_seek( stream, new_pos ) != 0)
     {
-        fseeko( stream->file_handle, cur_pos, SEEK_SET );
         return 0;
     }
 
@@ -1879,12 +2317,26 @@ int hb_stream_seek( hb_stream_t * stream, float f )
     return 1;
 }
 
-int hb_stream_seek_ts( hb_stream_t * stream, int64_t ts )
+/*
+ * Returns the time of the position seeked to, -1 if seeking by time
+ * is not supported.  Transport and program streams can only seek by
+ * time if they have an index.  Their times are from the start of the
+ * stream, without timestamp discontinuities (see streamindex.h).
+ */
+int64_t hb_stream_seek_ts( hb_stream_t * stream, int64_t ts )
 {
+    const hb_stream_index_entry_t *entry;
+
     if ( stream->hb_stream_type == ffmpeg )
     {
         return ffmpeg_seek_ts( stream, ts );
     }
+    if ( stream->index != NULL &&
+         ( entry = hb_stream_index_lookup( stream->index, ts ) ) != NULL &&
+         stream_seek_index( stream, entry ) )
+    {
+        return MAX( 0, entry->time );
+    }
     return -1;
 }
 
@@ -2304,8 +2756,6 @@ static int hb_ts_stream_init(hb_stream_t *stream)
     }
     stream->pes.count = 0;
 
-    stream->ts.packet = malloc( stream->packetsize );
-
     // Find the audio and video pids in the stream
     if (hb_ts_stream_find_pids(stream) < 0)
     {
@@ -2481,51 +2931,38 @@ static void hb_ps_stream_init(hb_stream_t *stream)
 
 static off_t align_to_next_packet(hb_stream_t *stream)
 {
-    uint8_t buf[MAX_HOLE];
+    const uint8_t *buf;
     off_t pos = 0;
-    off_t start = ftello(stream->file_handle);
+    off_t start = stream_tell(stream);
     off_t orig;
 
     if ( start >= stream->packetsize ) {
         start -= stream->packetsize;
-        fseeko(stream->file_handle, start, SEEK_SET);
+        stream_seek(stream, start);
     }
     orig = start;
 
     while (1)
     {
-        if (fread(buf, sizeof(buf), 1, stream->file_handle) == 1)
+        // Scan the input buffer in place, read errors are
+        // reported by stream_fill()
+        buf = stream_peek(stream, MAX_HOLE);
+        if (buf == NULL)
         {
-            const uint8_t *bp = buf;
-            int i;
-
-            for ( i = sizeof(buf) - 8 * stream->packetsize; --i >= 0; ++bp )
-            {
-                if ( have_ts_sync( bp, stream->packetsize, 8 ) )
-                {
-                    break;
-                }
-            }
-            if ( i >= 0 )
-            {
-                pos = ( bp - buf ) - stream->packetsize + 188;
-                break;
-            }
-            fseeko(stream->file_handle, -8 * stream->packetsize, SEEK_CUR);
-            start = ftello(stream->file_handle);
+            return 0;
         }
-        else
+
+        int off = hb_find_ts_sync(buf, MAX_HOLE - 8 * stream->packetsize,
+                                  stream->packetsize, 8);
+        if ( off >= 0 )
         {
-            int err;
-            if ((err = ferror(stream->file_handle)) != 0)
-            {
-                hb_error("align_to_next_packet: error (%d)", err);
-                hb_set_work_error(stream->h, HB_ERROR_READ);
-            }
-            return 0;
+            pos = off - stream->packetsize + 188;
+            break;
         }
+        stream_skip(stream, MAX_HOLE - 8 * stream->packetsize);
+        start = stream_tell(stream);
     }
-    fseeko(stream->file_handle, start+pos, SEEK_SET);
+    stream_seek(stream, start+pos);
     return start - orig + pos;
 }
 
@@ -3366,36 +3803,61 @@ static int hb_parse_ps(
     }
 }
 
+/*
+ * Appends the data up to the next pack or PES start code to b, the next
+ * read starts at the start code.  Returns 0 at the end of the file.
+ */
+static int ps_read_to_start_code( hb_stream_t *stream, hb_buffer_t *b,
+                                  int *pos )
+{
+    int found, len;
+
+    do
+    {
+        found = stream_find_start_code( stream, 0xb9, 0xff, &len );
+        if ( len > 0 )
+        {
+            if ( *pos + len > b->alloc )
+            {
+                // need to expand the buffer
+                hb_buffer_realloc( b, MAX( b->alloc * 2, *pos + len ) );
+            }
+            memcpy( b->data + *pos, stream_peek( stream, len ), len );
+            stream_skip( stream, len );
+            *pos += len;
+        }
+    } while ( found == 0 );
+
+    return found == 1;
+}
+
 static int hb_ps_read_packet( hb_stream_t * stream, hb_buffer_t *b )
 {
     // Appends to buffer if size != 0
-    unsigned int start_code = -1;
     int pos = b->size;
     int stream_id = -1;
-    int c;
+    int c, found, skip;
 
 #define cp (b->data)
-    flockfile( stream->file_handle );
-    while ( ( c = getc_unlocked( stream->file_handle ) ) != EOF )
+    // Find the start of the next start code
+    while ( ( found = stream_find_start_code( stream, 0x00, 0xff,
+                                              &skip ) ) == 0 )
     {
-        start_code = ( start_code << 8 ) | c;
-        if ( ( start_code >> 8 )== 0x000001 )
-            // we found the start of the next start
-            break;
+        stream_skip( stream, skip );
     }
-    if ( c == EOF )
+    if ( found == EOF )
         goto done;
+    stream_skip( stream, skip );
 
     if ( pos + 4 > b->alloc )
     {
         // need to expand the buffer
         hb_buffer_realloc( b, b->alloc * 2 );
     }
-    cp[pos++] = ( start_code >> 24 ) & 0xff;
-    cp[pos++] = ( start_code >> 16 ) & 0xff;
-    cp[pos++] = ( start_code >>  8 ) & 0xff;
-    cp[pos++] = ( start_code )       & 0xff;
-    stream_id = start_code & 0xff;
+    // The start code is buffered
+    stream_read( stream, cp+pos, 4 );
+    stream_id = cp[pos+3];
+    pos += 4;
 
     if ( stream_id == 0xba )
     {
@@ -3408,7 +3870,7 @@ static int hb_ps_read_packet( hb_stream_t * stream, hb_buffer_t *b )
         }
 
         // There are at least 8 bytes.  More if this is mpeg2 pack.
-        if (fread( cp+pos, 1, 8, stream->file_handle ) < 8)
+        if (stream_read( stream, cp+pos, 8 ) < 8)
             goto done;
 
         int mark = cp[pos] >> 4;
@@ -3417,12 +3879,12 @@ static int hb_ps_read_packet( hb_stream_t * stream, hb_buffer_t *b )
         if ( mark != 0x02 )
         {
             // mpeg-2 pack,
-            if (fread( cp+pos, 1, 2, stream->file_handle ) == 2)
+            if (stream_read( stream, cp+pos, 2 ) == 2)
             {
                 int len = cp[start+13] & 0x7;
                 pos += 2;
                 if (len > 0 &&
-                    fread( cp+pos, 1, len, stream->file_handle ) == len)
+                    stream_read( stream, cp+pos, len ) == len)
                     pos += len;
                 else
                     goto done;
@@ -3435,11 +3897,11 @@ static int hb_ps_read_packet( hb_stream_t * stream, hb_buffer_t *b )
     else if ( stream_id >= 0xbb )
     {
         int len = 0;
-        c = getc_unlocked( stream->file_handle );
+        c = stream_getc( stream );
         if ( c == EOF )
             goto done;
         len = c << 8;
-        c = getc_unlocked( stream->file_handle );
+        c = stream_getc( stream );
         if ( c == EOF )
             goto done;
         len |= c;
@@ -3455,71 +3917,26 @@ static int hb_ps_read_packet( hb_stream_t * stream, hb_buffer_t *b )
         if ( len )
         {
             // Length is non-zero, read the packet all at once
-            len = fread( cp+pos, 1, len, stream->file_handle );
+            len = stream_read( stream, cp+pos, len );
             pos += len;
         }
         else
         {
             // Length is zero, read bytes till we find a start code.
             // Only video PES packets are allowed to have zero length.
-            start_code = -1;
-            while ( ( c = getc_unlocked( stream->file_handle ) ) != EOF )
-            {
-                start_code = ( start_code << 8 ) | c;
-                if ( pos  >= b->alloc )
-                {
-                    // need to expand the buffer
-                    hb_buffer_realloc( b, b->alloc * 2 );
-                }
-                cp[pos++] = c;
-                if ( ( start_code >> 8   ) == 0x000001 &&
-                     ( start_code & 0xff ) >= 0xb9 )
-                {
-                    // we found the start of the next start
-                    break;
-                }
-            }
-            if ( c == EOF )
+            if ( !ps_read_to_start_code( stream, b, &pos ) )
                 goto done;
-            pos -= 4;
-            fseeko( stream->file_handle, -4, SEEK_CUR );
         }
     }
     else
     {
         // Unknown, find next start code
-        start_code = -1;
-        while ( ( c = getc_unlocked( stream->file_handle ) ) != EOF )
-        {
-            start_code = ( start_code << 8 ) | c;
-            if ( pos  >= b->alloc )
-            {
-                // need to expand the buffer
-                hb_buffer_realloc( b, b->alloc * 2 );
-            }
-            cp[pos++] = c;
-            if ( ( start_code >> 8 ) == 0x000001 &&
-                 ( start_code & 0xff ) >= 0xb9 )
-                // we found the start of the next start
-                break;
-        }
-        if ( c == EOF )
+        if ( !ps_read_to_start_code( stream, b, &pos ) )
             goto done;
-        pos -= 4;
-        fseeko( stream->file_handle, -4, SEEK_CUR );
     }
 
 done:
-    // Parse packet for information we might need
-    funlockfile( stream->file_handle );
-
-    int err;
-    if ((err = ferror(stream->file_handle)) != 0)
-    {
-        hb_error("hb_ps_read_packet: error (%d)", err);
-        hb_set_work_error(stream->h, HB_ERROR_READ);
-    }
-
+    // Read errors are reported by stream_fill()
     int len = pos - b->size;
     b->size = pos;
 #undef cp
@@ -3894,7 +4311,7 @@ static void hb_ps_stream_find_streams(hb_stream_t *stream)
     int ii, jj;
     hb_buffer_t *buf  = hb_buffer_init(HB_DVD_READ_BUFFER_SIZE);
 
-    fseeko( stream->file_handle, 0, SEEK_SET );
+    stream_seek( stream, 0 );
     // Scan beginning of file, then if no program stream map is found
     // seek to 20% and scan again since there's occasionally no
     // audio at the beginning (particularly for vobs).
@@ -4613,9 +5030,8 @@ static int hb_ts_stream_find_pids(hb_stream_t *stream)
     // changes PMTs (and thus video & audio PIDs) when 'programs' change. Since
     // we may have the tail of the previous program at the beginning of this
     // file, take our PMT from the middle of the file.
-    fseeko(stream->file_handle, 0, SEEK_END);
-    uint64_t fsize = ftello(stream->file_handle);
-    fseeko(stream->file_handle, fsize >> 1, SEEK_SET);
+    uint64_t fsize = stream_file_size(stream);
+    stream_seek(stream, fsize >> 1);
     align_to_next_packet(stream);
 
     // Read the Transport Stream Packets (188 bytes each) looking at first for PID 0 (the PAT PID), then decode that
@@ -0,0 +1,414 @@
+/* streamindex.c
+
+   Copyright (c) 2003-2024 HandBrake Team
+   This file is part of the HandBrake source code
+   Homepage: <http://handbrake.fr/>.
+   It may be used under the terms of the GNU General Public License v2.
+   For full terms see the file COPYING file or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+#include "handbrake/handbrake.h"
+#include "handbrake/streamindex.h"
+
+#define INDEX_MAGIC         0x49534248  // "HBSI"
+#define INDEX_VERSION       1
+#define INDEX_DIR           "stream-index"
+
+// Larger PTS jumps between two video frames are splices
+#define INDEX_DISCONTINUITY (10 * 90000)
+// Frames that are not keyframes are indexed at most once per second
+#define INDEX_INTERVAL      90000
+
+struct hb_stream_index_s
+{
+    hb_stream_index_entry_t * list;
+    int                       count;
+    int                       alloc;
+    int                       keyframes;
+
+    int64_t                   duration;
+
+    // Time line state while the index is built
+    int64_t                   last_pts;
+    int64_t                   last_time;
+    int64_t                   max_time;
+    int64_t                   frame_duration;
+};
+
+static int stream_index_enabled = 0;
+
+void hb_stream_index_enable( int enable )
+{
+    stream_index_enabled = !!enable;
+}
+
+int hb_stream_index_enabled( void )
+{
+    return stream_index_enabled;
+}
+
+hb_stream_index_t * hb_stream_index_init( void )
+{
+    hb_stream_index_t * index = calloc(1, sizeof(hb_stream_index_t));
+
+    if (index == NULL)
+    {
+        return NULL;
+    }
+    index->last_pts = AV_NOPTS_VALUE;
+    return index;
+}
+
+void hb_stream_index_close( hb_stream_index_t ** _index )
+{
+    hb_stream_index_t * index = *_index;
+
+    if (index == NULL)
+    {
+        return;
+    }
+    free(index->list);
+    free(index);
+    *_index = NULL;
+}
+
+static int index_append( hb_stream_index_t * index,
+                         const hb_stream_index_entry_t * entry )
+{
+    if (index->count == index->alloc)
+    {
+        int alloc = index->alloc ? index->alloc * 2 : 1024;
+        hb_stream_index_entry_t * list;
+
+        list = realloc(index->list, alloc * sizeof(hb_stream_index_entry_t));
+        if (list == NULL)
+        {
+            return -1;
+        }
+        index->list  = list;
+        index->alloc = alloc;
+    }
+    index->list[index->count++] = *entry;
+    if (entry->keyframe)
+    {
+        index->keyframes++;
+    }
+    return 0;
+}
+
+/*
+ * Add a video frame, in file order.
+ *
+ * The time line follows the PTS, across 33 bit wraps.  When the PTS
+ * jumps (spliced recordings) the time line continues one frame after
+ * the latest frame so far.
+ */
+void hb_stream_index_add( hb_stream_index_t * index,
+                          int64_t pts, int64_t pos, int keyframe )
+{
+    hb_stream_index_entry_t entry;
+    int64_t                 time, delta;
+
+    if (index->last_pts == AV_NOPTS_VALUE)
+    {
+        time = 0;
+    }
+    else
+    {
+        delta = pts - index->last_pts;
+        if (delta < -(1LL << 32))
+        {
+            delta += 1LL << 33;
+        }
+        else if (delta > (1LL << 32))
+        {
+            delta -= 1LL << 33;
+        }
+        if (delta > INDEX_DISCONTINUITY || delta < -INDEX_DISCONTINUITY)
+        {
+            time = index->max_time + (index->frame_duration ?
+                                      index->frame_duration : 3003);
+        }
+        else
+        {
+            time = index->last_time + delta;
+            if (delta > 0 && (index->frame_duration == 0 ||
+                              delta < index->frame_duration))
+            {
+                index->frame_duration = delta;
+            }
+        }
+    }
+    index->last_pts  = pts;
+    index->last_time = time;
+    if (time > index->max_time)
+    {
+        index->max_time = time;
+    }
+    index->duration = index->max_time + (index->frame_duration ?
+                                         index->frame_duration : 3003);
+
+    // Keep the list sorted by time for the lookups
+    if (index->count > 0)
+    {
+        int64_t last = index->list[index->count - 1].time;
+
+        if (time <= last || (!keyframe && time < last + INDEX_INTERVAL))
+        {
+            return;
+        }
+    }
+    entry.time     = time;
+    entry.pts      = pts;
+    entry.pos      = pos;
+    entry.keyframe = !!keyframe;
+    index_append(index, &entry);
+}
+
+int64_t hb_stream_index_duration( hb_stream_index_t * index )
+{
+    return index->duration;
+}
+
+int hb_stream_index_keyframes( hb_stream_index_t * index )
+{
+    return index->keyframes;
+}
+
+const hb_stream_index_entry_t *
+hb_stream_index_lookup( hb_stream_index_t * index, int64_t time )
+{
+    int lo = 0, hi = index->count - 1, ii;
+
+    if (index->count == 0)
+    {
+        return NULL;
+    }
+
+    // Last entry at or before 'time'
+    while (lo < hi)
+    {
+        int mid = (lo + hi + 1) / 2;
+        if (index->list[mid].time <= time)
+        {
+            lo = mid;
+        }
+        else
+        {
+            hi = mid - 1;
+        }
+    }
+    if (index->keyframes == 0)
+    {
+        return &index->list[lo];
+    }
+    for (ii = lo; ii >= 0; ii--)
+    {
+        if (index->list[ii].keyframe)
+        {
+            return &index->list[ii];
+        }
+    }
+    for (ii = lo + 1; ii < index->count; ii++)
+    {
+        if (index->list[ii].keyframe)
+        {
+            return &index->list[ii];
+        }
+    }
+    return &index->list[lo];
+}
+
+/*
+ * Cache files
+ *
+ * All numbers are stored little endian:
+ *   magic, version            32 bit
+ *   file size, mtime          64 bit
+ *   path length               32 bit, followed by the path
+ *   duration                  64 bit
+ *   entry count               32 bit
+ *   entries                   time, pts, pos, keyframe, 64 bit each
+ */
+static uint64_t path_hash( const char * path )
+{
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (; *path; path++)
+    {
+        hash ^= (uint8_t)*path;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static int index_filename( char name[1024], const char * path )
+{
+    return hb_get_user_cache_filename(name, INDEX_DIR, "%016"PRIx64".idx",
+                                      path_hash(path));
+}
+
+static int put_le32( FILE * file, uint32_t val )
+{
+    uint8_t b[4] = { val, val >> 8, val >> 16, val >> 24 };
+    return fwrite(b, 4, 1, file) == 1 ? 0 : -1;
+}
+
+static int put_le64( FILE * file, uint64_t val )
+{
+    if (put_le32(file, val) < 0)
+    {
+        return -1;
+    }
+    return put_le32(file, val >> 32);
+}
+
+static int get_le32( FILE * file, uint32_t * val )
+{
+    uint8_t b[4];
+
+    if (fread(b, 4, 1, file) != 1)
+    {
+        return -1;
+    }
+    *val = b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+    return 0;
+}
+
+static int get_le64( FILE * file, int64_t * val )
+{
+    uint32_t lo, hi;
+
+    if (get_le32(file, &lo) < 0 || get_le32(file, &hi) < 0)
+    {
+        return -1;
+    }
+    *val = (int64_t)(((uint64_t)hi << 32) | lo);
+    return 0;
+}
+
+hb_stream_index_t * hb_stream_index_load( const char * path )
+{
+    hb_stream_index_t * index = NULL;
+    hb_stat_t           st;
+    char                name[1024];
+    char              * stored_path = NULL;
+    FILE              * file;
+    uint32_t            magic, version, len, count, ii;
+    int64_t             size, mtime, duration;
+
+    if (hb_stat(path, &st) != 0 || index_filename(name, path) != 0)
+    {
+        return NULL;
+    }
+    file = hb_fopen(name, "rb");
+    if (file == NULL)
+    {
+        return NULL;
+    }
+
+    if (get_le32(file, &magic)   < 0 || magic   != INDEX_MAGIC   ||
+        get_le32(file, &version) < 0 || version != INDEX_VERSION ||
+        get_le64(file, &size)    < 0 || size    != st.st_size    ||
+        get_le64(file, &mtime)   < 0 || mtime   != st.st_mtime   ||
+        get_le32(file, &len)     < 0 || len     != strlen(path))
+    {
+        goto fail;
+    }
+    stored_path = malloc(len);
+    if (stored_path == NULL || fread(stored_path, 1, len, file) != len ||
+        memcmp(stored_path, path, len))
+    {
+        goto fail;
+    }
+    if (get_le64(file, &duration) < 0 || get_le32(file, &count) < 0 ||
+        count > INT_MAX / sizeof(hb_stream_index_entry_t))
+    {
+        goto fail;
+    }
+
+    index = hb_stream_index_init();
+    if (index == NULL)
+    {
+        goto fail;
+    }
+    index->duration = duration;
+    for (ii = 0; ii < count; ii++)
+    {
+        hb_stream_index_entry_t entry;
+        int64_t                 keyframe;
+
+        if (get_le64(file, &entry.time) < 0 ||
+            get_le64(file, &entry.pts)  < 0 ||
+            get_le64(file, &entry.pos)  < 0 ||
+            get_le64(file, &keyframe)   < 0)
+        {
+            goto fail;
+        }
+        entry.keyframe = keyframe != 0;
+        if (index_append(index, &entry) < 0)
+        {
+            goto fail;
+        }
+    }
+    free(stored_path);
+    fclose(file);
+
+    hb_log("stream index: %d keyframes loaded from %s",
+           index->keyframes, name);
+    return index;
+
+fail:
+    hb_log("stream index: ignoring stale or damaged %s", name);
+    hb_stream_index_close(&index);
+    free(stored_path);
+    fclose(file);
+    return NULL;
+}
+
+int hb_stream_index_save( hb_stream_index_t * index, const char * path )
+{
+    hb_stat_t  st;
+    char       name[1024];
+    FILE     * file;
+    size_t     len = strlen(path);
+    int        ii, err;
+
+    if (hb_stat(path, &st) != 0 || index_filename(name, path) != 0)
+    {
+        return -1;
+    }
+    file = hb_fopen(name, "wb");
+    if (file == NULL)
+    {
+        hb_log("stream index: can't create %s", name);
+        return -1;
+    }
+
+    err = put_le32(file, INDEX_MAGIC)   < 0 ||
+          put_le32(file, INDEX_VERSION) < 0 ||
+          put_le64(file, st.st_size)    < 0 ||
+          put_le64(file, st.st_mtime)   < 0 ||
+          put_le32(file, len)           < 0 ||
+          fwrite(path, 1, len, file) != len ||
+          put_le64(file, index->duration) < 0 ||
+          put_le32(file, index->count)  < 0;
+    for (ii = 0; ii < index->count && !err; ii++)
+    {
+        hb_stream_index_entry_t * entry = &index->list[ii];
+
+        err = put_le64(file, entry->time) < 0 ||
+              put_le64(file, entry->pts)  < 0 ||
+              put_le64(file, entry->pos)  < 0 ||
+              put_le64(file, entry->keyframe) < 0;
+    }
+    if (fclose(file) != 0 || err)
+    {
+        // A truncated index would be rejected, but don't leave it around
+        hb_log("stream index: error writing %s", name);
+        remove(name);
+        return -1;
+    }
+    return 0;
+}
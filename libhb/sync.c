@@ -2358,7 +2358,7 @@ static int syncVideoInit( hb_work_object_t * w, hb_job_t * job)
     if (job->pass_id == HB_PASS_ENCODE_FINAL)
     {
         /* We already have an accurate frame count from pass 1 */
-        hb_interjob_t * interjob = hb_interjob_get(job->h);
+        hb_interjob_t * interjob = hb_job_interjob_get(job);
         pv->common->est_frame_count = interjob->frame_count;
     }
     else
@@ -2519,7 +2519,7 @@ static void syncVideoClose( hb_work_object_t * w )
     if( job->pass_id == HB_PASS_ENCODE_ANALYSIS )
     {
         /* Preserve frame count for better accuracy in pass 2 */
-        hb_interjob_t * interjob = hb_interjob_get( job->h );
+        hb_interjob_t * interjob = hb_job_interjob_get(job);
         interjob->frame_count = pv->stream->frame_count;
     }
     sync_delta_t * delta;
@@ -3181,7 +3181,7 @@ static void UpdateState( sync_common_t * common, int frame_count )
         common->st_counts[3] = frame_count;
     }
 
-    hb_get_state2(job->h, &state);
+    hb_get_job_state(job, &state);
     state.state = HB_STATE_WORKING;
 
 #define p state.param.working
@@ -3221,7 +3221,7 @@ static void UpdateState( sync_common_t * common, int frame_count )
     }
 #undef p
 
-    hb_set_state(job->h, &state);
+    hb_set_job_state(job, &state);
 }
 
 static void UpdateSearchState( sync_common_t * common, int64_t start,
@@ -3246,7 +3246,7 @@ static void UpdateSearchState( sync_common_t * common, int64_t start,
         common->st_first = now;
     }
 
-    hb_get_state2(job->h, &state);
+    hb_get_job_state(job, &state);
     state.state = HB_STATE_SEARCHING;
 
 #define p state.param.working
@@ -3288,7 +3288,7 @@ static void UpdateSearchState( sync_common_t * common, int64_t start,
     }
 #undef p
 
-    hb_set_state(job->h, &state);
+    hb_set_job_state(job, &state);
 }
 
 static int syncSubtitleInit( hb_work_object_t * w, hb_job_t * job )
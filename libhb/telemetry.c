@@ -0,0 +1,285 @@
+/* telemetry.c
+
+   Copyright (c) 2003-2024 HandBrake Team
+   This file is part of the HandBrake source code
+   Homepage: <http://handbrake.fr/>.
+   It may be used under the terms of the GNU General Public License v2.
+   For full terms see the file COPYING file or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+#include "handbrake/handbrake.h"
+#include "handbrake/ports.h"
+#include "handbrake/telemetry.h"
+
+struct hb_telemetry_s
+{
+    hb_lock_t  * lock;
+    hb_list_t  * stages;
+};
+
+static const char * occupancy_names[HB_STAGE_OCCUPANCY_BINS] =
+{
+    "0", "25", "50", "75", "100"
+};
+
+hb_telemetry_t * hb_telemetry_init( void )
+{
+    hb_telemetry_t * t = calloc(1, sizeof(hb_telemetry_t));
+
+    if (t == NULL)
+    {
+        return NULL;
+    }
+    t->lock   = hb_lock_init();
+    t->stages = hb_list_init();
+
+    return t;
+}
+
+void hb_telemetry_close( hb_telemetry_t ** _t )
+{
+    hb_telemetry_t   * t = *_t;
+    hb_stage_stats_t * stats;
+
+    if (t == NULL)
+    {
+        return;
+    }
+    while ((stats = hb_list_item(t->stages, 0)) != NULL)
+    {
+        hb_list_rem(t->stages, stats);
+        free(stats);
+    }
+    hb_list_close(&t->stages);
+    hb_lock_close(&t->lock);
+    free(t);
+    *_t = NULL;
+}
+
+hb_stage_stats_t * hb_telemetry_add_stage( hb_telemetry_t * t,
+                                           const char * type,
+                                           const char * name )
+{
+    hb_stage_stats_t * stats;
+
+    if (t == NULL)
+    {
+        return NULL;
+    }
+    stats = calloc(1, sizeof(hb_stage_stats_t));
+    if (stats == NULL)
+    {
+        return NULL;
+    }
+    stats->type = type;
+    snprintf(stats->name, sizeof(stats->name), "%s", name ? name : "");
+
+    hb_lock(t->lock);
+    hb_list_add(t->stages, stats);
+    hb_unlock(t->lock);
+
+    return stats;
+}
+
+void hb_stage_stats_start( hb_stage_stats_t * stats )
+{
+    __atomic_store_n(&stats->start_us, hb_get_time_us(), __ATOMIC_RELAXED);
+}
+
+void hb_stage_stats_stop( hb_stage_stats_t * stats )
+{
+    __atomic_store_n(&stats->stop_us, hb_get_time_us(), __ATOMIC_RELAXED);
+}
+
+void hb_stage_stats_occupancy( hb_stage_stats_t * stats, hb_fifo_t * fifo_in )
+{
+    int size     = hb_fifo_size(fifo_in);
+    int capacity = hb_fifo_capacity(fifo_in);
+    int bin;
+
+    if (size <= 0 || capacity <= 0)
+    {
+        bin = 0;
+    }
+    else
+    {
+        bin = 1 + MIN((size * 4 - 1) / capacity, HB_STAGE_OCCUPANCY_BINS - 2);
+    }
+    hb_stage_stats_add(&stats->occupancy[bin], 1);
+}
+
+void hb_stage_stats_output( hb_stage_stats_t * stats, const hb_buffer_t * out )
+{
+    uint64_t count = 0;
+
+    for (; out != NULL; out = out->next)
+    {
+        count++;
+    }
+    hb_stage_stats_add(&stats->frames_out, count);
+}
+
+typedef struct
+{
+    uint64_t frames_in;
+    uint64_t frames_out;
+    uint64_t busy_us;
+    uint64_t wait_in_us;
+    uint64_t wait_out_us;
+    uint64_t elapsed_us;
+    uint64_t occupancy[HB_STAGE_OCCUPANCY_BINS];
+} stage_sample_t;
+
+static void stage_sample( hb_stage_stats_t * stats, stage_sample_t * s )
+{
+    uint64_t start, stop;
+    int      ii;
+
+    s->frames_in   = __atomic_load_n(&stats->frames_in, __ATOMIC_RELAXED);
+    s->frames_out  = __atomic_load_n(&stats->frames_out, __ATOMIC_RELAXED);
+    s->busy_us     = __atomic_load_n(&stats->busy_us, __ATOMIC_RELAXED);
+    s->wait_in_us  = __atomic_load_n(&stats->wait_in_us, __ATOMIC_RELAXED);
+    s->wait_out_us = __atomic_load_n(&stats->wait_out_us, __ATOMIC_RELAXED);
+    for (ii = 0; ii < HB_STAGE_OCCUPANCY_BINS; ii++)
+    {
+        s->occupancy[ii] = __atomic_load_n(&stats->occupancy[ii],
+                                           __ATOMIC_RELAXED);
+    }
+
+    start = __atomic_load_n(&stats->start_us, __ATOMIC_RELAXED);
+    stop  = __atomic_load_n(&stats->stop_us, __ATOMIC_RELAXED);
+    if (start == 0)
+    {
+        s->elapsed_us = 0;
+    }
+    else
+    {
+        s->elapsed_us = (stop ? stop : hb_get_time_us()) - start;
+    }
+}
+
+static double percent( uint64_t part, uint64_t whole )
+{
+    return whole > 0 ? 100. * part / whole : 0.;
+}
+
+// The stage that spends the largest share of its time working
+// limits the throughput of the pipeline
+static hb_stage_stats_t * find_bound( hb_telemetry_t * t )
+{
+    hb_stage_stats_t * bound = NULL;
+    double             best = 0.;
+    stage_sample_t     s;
+    int                ii;
+
+    for (ii = 0; ii < hb_list_count(t->stages); ii++)
+    {
+        hb_stage_stats_t * stats = hb_list_item(t->stages, ii);
+        double             busy;
+
+        stage_sample(stats, &s);
+        busy = percent(s.busy_us, s.elapsed_us);
+        if (busy > best)
+        {
+            best  = busy;
+            bound = stats;
+        }
+    }
+    return bound;
+}
+
+hb_dict_t * hb_telemetry_to_dict( hb_telemetry_t * t )
+{
+    hb_dict_t        * dict;
+    hb_value_array_t * stages;
+    hb_stage_stats_t * bound;
+    stage_sample_t     s;
+    int                ii, jj;
+
+    if (t == NULL)
+    {
+        return NULL;
+    }
+
+    dict   = hb_dict_init();
+    stages = hb_value_array_init();
+
+    hb_lock(t->lock);
+    for (ii = 0; ii < hb_list_count(t->stages); ii++)
+    {
+        hb_stage_stats_t * stats = hb_list_item(t->stages, ii);
+        hb_dict_t        * stage = hb_dict_init();
+        hb_dict_t        * occupancy = hb_dict_init();
+
+        stage_sample(stats, &s);
+        for (jj = 0; jj < HB_STAGE_OCCUPANCY_BINS; jj++)
+        {
+            hb_dict_set(occupancy, occupancy_names[jj],
+                        hb_value_int(s.occupancy[jj]));
+        }
+        hb_dict_set(stage, "Name",         hb_value_string(stats->name));
+        hb_dict_set(stage, "Type",         hb_value_string(stats->type));
+        hb_dict_set(stage, "FramesIn",     hb_value_int(s.frames_in));
+        hb_dict_set(stage, "FramesOut",    hb_value_int(s.frames_out));
+        hb_dict_set(stage, "ElapsedUs",    hb_value_int(s.elapsed_us));
+        hb_dict_set(stage, "BusyUs",       hb_value_int(s.busy_us));
+        hb_dict_set(stage, "WaitInputUs",  hb_value_int(s.wait_in_us));
+        hb_dict_set(stage, "WaitOutputUs", hb_value_int(s.wait_out_us));
+        hb_dict_set(stage, "InputOccupancy", occupancy);
+        hb_value_array_append(stages, stage);
+    }
+    bound = find_bound(t);
+    hb_dict_set(dict, "Bound", hb_value_string(bound ? bound->name : ""));
+    hb_unlock(t->lock);
+
+    hb_dict_set(dict, "Stages", stages);
+
+    return dict;
+}
+
+void hb_telemetry_log( hb_telemetry_t * t, const char * prefix )
+{
+    hb_stage_stats_t * bound;
+    stage_sample_t     s;
+    int                ii;
+
+    if (t == NULL)
+    {
+        return;
+    }
+
+    hb_lock(t->lock);
+    hb_log("%s: pipeline stages (busy, waiting on input, blocked on output,"
+           " input occupancy 0/25/50/75/100%%)", prefix);
+    for (ii = 0; ii < hb_list_count(t->stages); ii++)
+    {
+        hb_stage_stats_t * stats = hb_list_item(t->stages, ii);
+        uint64_t           samples = 0;
+        int                jj;
+
+        stage_sample(stats, &s);
+        for (jj = 0; jj < HB_STAGE_OCCUPANCY_BINS; jj++)
+        {
+            samples += s.occupancy[jj];
+        }
+        hb_log("%s:   %-6s %-24s in %8"PRIu64" out %8"PRIu64
+               "  busy %5.1f%%  wait in %5.1f%%  wait out %5.1f%%"
+               "  occupancy %.0f/%.0f/%.0f/%.0f/%.0f%%",
+               prefix, stats->type, stats->name, s.frames_in, s.frames_out,
+               percent(s.busy_us, s.elapsed_us),
+               percent(s.wait_in_us, s.elapsed_us),
+               percent(s.wait_out_us, s.elapsed_us),
+               percent(s.occupancy[0], samples),
+               percent(s.occupancy[1], samples),
+               percent(s.occupancy[2], samples),
+               percent(s.occupancy[3], samples),
+               percent(s.occupancy[4], samples));
+    }
+    bound = find_bound(t);
+    if (bound != NULL)
+    {
+        hb_log("%s: pipeline is bound by %s '%s'", prefix,
+               bound->type, bound->name);
+    }
+    hb_unlock(t->lock);
+}
@@ -131,6 +131,24 @@ static void FUNC(apply_mask)(hb_filter_private_t *pv, hb_buffer_t *b)
     }
 }
 
+// Thresholds for the optimized line kernels, see comb_detect.h
+static void FUNC(get_thresholds)(const hb_filter_private_t *pv,
+                                 CombDetectThresholds *t)
+{
+    t->spatial_metric            = pv->spatial_metric;
+    t->motion_threshold          = pv->motion_threshold;
+    t->spatial_threshold         = pv->spatial_threshold;
+    t->spatial_threshold_squared = pv->spatial_threshold_squared;
+    t->spatial_threshold6        = pv->spatial_threshold6;
+    t->comb32detect_min          = pv->comb32detect_min;
+    t->comb32detect_max          = pv->comb32detect_max;
+    t->gamma_motion_threshold    = pv->gamma_motion_threshold;
+    t->gamma_spatial_threshold   = pv->gamma_spatial_threshold;
+    t->gamma_spatial_threshold6  = pv->gamma_spatial_threshold6;
+    t->gamma_lut                 = pv->gamma_lut;
+    t->force_exaustive_check     = pv->force_exaustive_check;
+}
+
 static void FUNC(detect_gamma_combed_segment)(hb_filter_private_t *pv,
                                               int segment_start, int segment_stop)
 {
@@ -176,6 +194,12 @@ static void FUNC(detect_gamma_combed_segment)(hb_filter_private_t *pv,
     const int up_1_next    = -1 * stride_next;
     const int down_1_next =       stride_next;
 
+    CombDetectThresholds thresholds;
+    FUNC(get_thresholds)(pv, &thresholds);
+    int (*const line)(const CombDetectThresholds *, const void *, const void *,
+                      const void *, uint8_t *, int, int, int, int) =
+        pv->functions.detect_gamma_combed_line[BIT_DEPTH > 8];
+
     for (int y = segment_start; y < segment_stop; y++)
     {
         // We need to examine a column of 5 pixels
@@ -187,7 +211,17 @@ static void FUNC(detect_gamma_combed_segment)(hb_filter_private_t *pv,
 
         memset(mask, 0, mask_stride);
 
-        for (int x = 0; x < width; x++)
+        int x = 0;
+        if (line != NULL)
+        {
+            x = line(&thresholds, prev, cur, next, mask, width,
+                     stride_prev, stride_cur, stride_next);
+            prev += x;
+            cur  += x;
+            next += x;
+            mask += x;
+        }
+        for (; x < width; x++)
         {
             const float up_diff    = pv->gamma_lut[cur[0]] - pv->gamma_lut[cur[up_1]];
             const float down_diff  = pv->gamma_lut[cur[0]] - pv->gamma_lut[cur[down_1]];
@@ -294,6 +328,12 @@ static void FUNC(detect_combed_segment)(hb_filter_private_t *pv,
     const int up_1_next    = -1 * stride_next;
     const int down_1_next =       stride_next;
 
+    CombDetectThresholds thresholds;
+    FUNC(get_thresholds)(pv, &thresholds);
+    int (*const line)(const CombDetectThresholds *, const void *, const void *,
+                      const void *, uint8_t *, int, int, int, int) =
+        pv->functions.detect_combed_line[BIT_DEPTH > 8];
+
     for (int y = segment_start; y < segment_stop; y++)
     {
         // We need to examine a column of 5 pixels
@@ -305,7 +345,17 @@ static void FUNC(detect_combed_segment)(hb_filter_private_t *pv,
 
         memset(mask, 0, mask_stride);
 
-        for (int x = 0; x < width; x++)
+        int x = 0;
+        if (line != NULL)
+        {
+            x = line(&thresholds, prev, cur, next, mask, width,
+                     stride_prev, stride_cur, stride_next);
+            prev += x;
+            cur  += x;
+            next += x;
+            mask += x;
+        }
+        for (; x < width; x++)
         {
             const int up_diff = cur[0] - cur[up_1];
             const int down_diff = cur[0] - cur[down_1];
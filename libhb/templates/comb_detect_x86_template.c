@@ -0,0 +1,413 @@
+/* comb_detect_x86_template.c
+
+   Copyright (c) 2003-2024 HandBrake Team
+   This file is part of the HandBrake source code
+   Homepage: <http://handbrake.fr/>.
+   It may be used under the terms of the GNU General Public License v2.
+   For full terms see the file COPYING file or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+// Vector versions of the per pixel loops of comb_detect_template.c.
+// Pixels are widened to 32 bit lanes, so that the metrics are computed
+// with the same integer and float operations as the scalar code.
+
+#if BIT_DEPTH > 8
+#   define pixel  uint16_t
+#   define FUNC(name) name##_##16
+#   define LOAD_X4(p) _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i *)(p)))
+#   define LOAD_X8(p) _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(p)))
+#else
+#   define pixel  uint8_t
+#   define FUNC(name) name##_##8
+#   define LOAD_X4(p) _mm_cvtepu8_epi32(_mm_cvtsi32_si128(load_u32(p)))
+#   define LOAD_X8(p) _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(p)))
+#endif
+
+#define GAMMA_X4(lut, p) _mm_setr_ps(lut[(p)[0]], lut[(p)[1]], lut[(p)[2]], lut[(p)[3]])
+#define GAMMA_X8(lut, p) _mm256_i32gather_ps(lut, LOAD_X8(p), 4)
+
+__attribute__((target("sse4.1")))
+static int FUNC(detect_combed_line_sse41)(const CombDetectThresholds *t,
+                                          const void *in_prev,
+                                          const void *in_cur,
+                                          const void *in_next,
+                                          uint8_t *mask, int width,
+                                          int stride_prev, int stride_cur,
+                                          int stride_next)
+{
+    const pixel *prev = in_prev;
+    const pixel *cur  = in_cur;
+    const pixel *next = in_next;
+
+    const int check_motion = t->motion_threshold > 0 &&
+                             !t->force_exaustive_check;
+
+    const __m128i athresh   = _mm_set1_epi32(t->spatial_threshold);
+    const __m128i nathresh  = _mm_set1_epi32(-t->spatial_threshold);
+    const __m128i mthresh   = _mm_set1_epi32(t->motion_threshold);
+    const __m128i athresh_2 = _mm_set1_epi32(t->spatial_threshold_squared);
+    const __m128i athresh6  = _mm_set1_epi32(t->spatial_threshold6);
+    const __m128i comb_min  = _mm_set1_epi32(t->comb32detect_min);
+    const __m128i comb_max  = _mm_set1_epi32(t->comb32detect_max);
+    const __m128i one       = _mm_set1_epi8(1);
+
+    int x;
+    for (x = 0; x + 4 <= width; x += 4)
+    {
+        const __m128i c    = LOAD_X4(&cur[x]);
+        const __m128i u1   = LOAD_X4(&cur[x - stride_cur]);
+        const __m128i d1   = LOAD_X4(&cur[x + stride_cur]);
+        const __m128i up   = _mm_sub_epi32(c, u1);
+        const __m128i down = _mm_sub_epi32(c, d1);
+
+        __m128i combed = _mm_or_si128(
+            _mm_and_si128(_mm_cmpgt_epi32(up, athresh),
+                          _mm_cmpgt_epi32(down, athresh)),
+            _mm_and_si128(_mm_cmplt_epi32(up, nathresh),
+                          _mm_cmplt_epi32(down, nathresh)));
+        if (_mm_testz_si128(combed, combed))
+        {
+            // The mask line is already cleared
+            continue;
+        }
+
+        if (check_motion)
+        {
+            const __m128i p0  = LOAD_X4(&prev[x]);
+            const __m128i pu1 = LOAD_X4(&prev[x - stride_prev]);
+            const __m128i pd1 = LOAD_X4(&prev[x + stride_prev]);
+            const __m128i n0  = LOAD_X4(&next[x]);
+            const __m128i nu1 = LOAD_X4(&next[x - stride_next]);
+            const __m128i nd1 = LOAD_X4(&next[x + stride_next]);
+
+            __m128i m1 = _mm_and_si128(
+                _mm_cmpgt_epi32(_mm_abs_epi32(_mm_sub_epi32(p0, c)), mthresh),
+                _mm_and_si128(
+                    _mm_cmpgt_epi32(_mm_abs_epi32(_mm_sub_epi32(u1, nu1)), mthresh),
+                    _mm_cmpgt_epi32(_mm_abs_epi32(_mm_sub_epi32(d1, nd1)), mthresh)));
+            __m128i m2 = _mm_and_si128(
+                _mm_cmpgt_epi32(_mm_abs_epi32(_mm_sub_epi32(n0, c)), mthresh),
+                _mm_and_si128(
+                    _mm_cmpgt_epi32(_mm_abs_epi32(_mm_sub_epi32(pu1, u1)), mthresh),
+                    _mm_cmpgt_epi32(_mm_abs_epi32(_mm_sub_epi32(pd1, d1)), mthresh)));
+            combed = _mm_and_si128(combed, _mm_or_si128(m1, m2));
+        }
+
+        if (t->spatial_metric == 0)
+        {
+            const __m128i d2 = LOAD_X4(&cur[x + 2 * stride_cur]);
+
+            combed = _mm_and_si128(combed, _mm_and_si128(
+                _mm_cmplt_epi32(_mm_abs_epi32(_mm_sub_epi32(c, d2)), comb_min),
+                _mm_cmpgt_epi32(_mm_abs_epi32(down), comb_max)));
+        }
+        else if (t->spatial_metric == 1)
+        {
+            const __m128i combing = _mm_mullo_epi32(_mm_sub_epi32(u1, c),
+                                                    _mm_sub_epi32(d1, c));
+
+            combed = _mm_and_si128(combed, _mm_cmpgt_epi32(combing, athresh_2));
+        }
+        else if (t->spatial_metric == 2)
+        {
+            const __m128i u2 = LOAD_X4(&cur[x - 2 * stride_cur]);
+            const __m128i d2 = LOAD_X4(&cur[x + 2 * stride_cur]);
+            const __m128i s  = _mm_add_epi32(u1, d1);
+            const __m128i combing = _mm_abs_epi32(_mm_sub_epi32(
+                _mm_add_epi32(_mm_add_epi32(u2, _mm_slli_epi32(c, 2)), d2),
+                _mm_add_epi32(s, _mm_add_epi32(s, s))));
+
+            combed = _mm_and_si128(combed, _mm_cmpgt_epi32(combing, athresh6));
+        }
+        else
+        {
+            continue;
+        }
+
+        const __m128i w = _mm_packs_epi32(combed, combed);
+        const int32_t b = _mm_cvtsi128_si32(
+                            _mm_and_si128(_mm_packs_epi16(w, w), one));
+        memcpy(&mask[x], &b, sizeof(b));
+    }
+    return x;
+}
+
+__attribute__((target("avx2")))
+static int FUNC(detect_combed_line_avx2)(const CombDetectThresholds *t,
+                                         const void *in_prev,
+                                         const void *in_cur,
+                                         const void *in_next,
+                                         uint8_t *mask, int width,
+                                         int stride_prev, int stride_cur,
+                                         int stride_next)
+{
+    const pixel *prev = in_prev;
+    const pixel *cur  = in_cur;
+    const pixel *next = in_next;
+
+    const int check_motion = t->motion_threshold > 0 &&
+                             !t->force_exaustive_check;
+
+    const __m256i athresh   = _mm256_set1_epi32(t->spatial_threshold);
+    const __m256i nathresh  = _mm256_set1_epi32(-t->spatial_threshold);
+    const __m256i mthresh   = _mm256_set1_epi32(t->motion_threshold);
+    const __m256i athresh_2 = _mm256_set1_epi32(t->spatial_threshold_squared);
+    const __m256i athresh6  = _mm256_set1_epi32(t->spatial_threshold6);
+    const __m256i comb_min  = _mm256_set1_epi32(t->comb32detect_min);
+    const __m256i comb_max  = _mm256_set1_epi32(t->comb32detect_max);
+    const __m128i one       = _mm_set1_epi8(1);
+
+    int x;
+    for (x = 0; x + 8 <= width; x += 8)
+    {
+        const __m256i c    = LOAD_X8(&cur[x]);
+        const __m256i u1   = LOAD_X8(&cur[x - stride_cur]);
+        const __m256i d1   = LOAD_X8(&cur[x + stride_cur]);
+        const __m256i up   = _mm256_sub_epi32(c, u1);
+        const __m256i down = _mm256_sub_epi32(c, d1);
+
+        __m256i combed = _mm256_or_si256(
+            _mm256_and_si256(_mm256_cmpgt_epi32(up, athresh),
+                             _mm256_cmpgt_epi32(down, athresh)),
+            _mm256_and_si256(_mm256_cmpgt_epi32(nathresh, up),
+                             _mm256_cmpgt_epi32(nathresh, down)));
+        if (_mm256_testz_si256(combed, combed))
+        {
+            continue;
+        }
+
+        if (check_motion)
+        {
+            const __m256i p0  = LOAD_X8(&prev[x]);
+            const __m256i pu1 = LOAD_X8(&prev[x - stride_prev]);
+            const __m256i pd1 = LOAD_X8(&prev[x + stride_prev]);
+            const __m256i n0  = LOAD_X8(&next[x]);
+            const __m256i nu1 = LOAD_X8(&next[x - stride_next]);
+            const __m256i nd1 = LOAD_X8(&next[x + stride_next]);
+
+            __m256i m1 = _mm256_and_si256(
+                _mm256_cmpgt_epi32(_mm256_abs_epi32(_mm256_sub_epi32(p0, c)), mthresh),
+                _mm256_and_si256(
+                    _mm256_cmpgt_epi32(_mm256_abs_epi32(_mm256_sub_epi32(u1, nu1)), mthresh),
+                    _mm256_cmpgt_epi32(_mm256_abs_epi32(_mm256_sub_epi32(d1, nd1)), mthresh)));
+            __m256i m2 = _mm256_and_si256(
+                _mm256_cmpgt_epi32(_mm256_abs_epi32(_mm256_sub_epi32(n0, c)), mthresh),
+                _mm256_and_si256(
+                    _mm256_cmpgt_epi32(_mm256_abs_epi32(_mm256_sub_epi32(pu1, u1)), mthresh),
+                    _mm256_cmpgt_epi32(_mm256_abs_epi32(_mm256_sub_epi32(pd1, d1)), mthresh)));
+            combed = _mm256_and_si256(combed, _mm256_or_si256(m1, m2));
+        }
+
+        if (t->spatial_metric == 0)
+        {
+            const __m256i d2 = LOAD_X8(&cur[x + 2 * stride_cur]);
+
+            combed = _mm256_and_si256(combed, _mm256_and_si256(
+                _mm256_cmpgt_epi32(comb_min, _mm256_abs_epi32(_mm256_sub_epi32(c, d2))),
+                _mm256_cmpgt_epi32(_mm256_abs_epi32(down), comb_max)));
+        }
+        else if (t->spatial_metric == 1)
+        {
+            const __m256i combing = _mm256_mullo_epi32(_mm256_sub_epi32(u1, c),
+                                                       _mm256_sub_epi32(d1, c));
+
+            combed = _mm256_and_si256(combed, _mm256_cmpgt_epi32(combing, athresh_2));
+        }
+        else if (t->spatial_metric == 2)
+        {
+            const __m256i u2 = LOAD_X8(&cur[x - 2 * stride_cur]);
+            const __m256i d2 = LOAD_X8(&cur[x + 2 * stride_cur]);
+            const __m256i s  = _mm256_add_epi32(u1, d1);
+            const __m256i combing = _mm256_abs_epi32(_mm256_sub_epi32(
+                _mm256_add_epi32(_mm256_add_epi32(u2, _mm256_slli_epi32(c, 2)), d2),
+                _mm256_add_epi32(s, _mm256_add_epi32(s, s))));
+
+            combed = _mm256_and_si256(combed, _mm256_cmpgt_epi32(combing, athresh6));
+        }
+        else
+        {
+            continue;
+        }
+
+        const __m128i w = _mm_packs_epi32(_mm256_castsi256_si128(combed),
+                                          _mm256_extracti128_si256(combed, 1));
+        _mm_storel_epi64((__m128i *)&mask[x],
+                         _mm_and_si128(_mm_packs_epi16(w, w), one));
+    }
+    return x;
+}
+
+__attribute__((target("sse4.1")))
+static int FUNC(detect_gamma_combed_line_sse41)(const CombDetectThresholds *t,
+                                                const void *in_prev,
+                                                const void *in_cur,
+                                                const void *in_next,
+                                                uint8_t *mask, int width,
+                                                int stride_prev, int stride_cur,
+                                                int stride_next)
+{
+    const pixel *prev = in_prev;
+    const pixel *cur  = in_cur;
+    const pixel *next = in_next;
+    const float *lut  = t->gamma_lut;
+
+    const int check_motion = t->gamma_motion_threshold > 0 &&
+                             !t->force_exaustive_check;
+
+    const __m128 athresh  = _mm_set1_ps(t->gamma_spatial_threshold);
+    const __m128 nathresh = _mm_set1_ps(-t->gamma_spatial_threshold);
+    const __m128 mthresh  = _mm_set1_ps(t->gamma_motion_threshold);
+    const __m128 athresh6 = _mm_set1_ps(t->gamma_spatial_threshold6);
+    const __m128 sign     = _mm_set1_ps(-0.0f);
+    const __m128 three    = _mm_set1_ps(3.0f);
+    const __m128 four     = _mm_set1_ps(4.0f);
+    const __m128i one     = _mm_set1_epi8(1);
+
+    int x;
+    for (x = 0; x + 4 <= width; x += 4)
+    {
+        const __m128 c    = GAMMA_X4(lut, &cur[x]);
+        const __m128 u1   = GAMMA_X4(lut, &cur[x - stride_cur]);
+        const __m128 d1   = GAMMA_X4(lut, &cur[x + stride_cur]);
+        const __m128 up   = _mm_sub_ps(c, u1);
+        const __m128 down = _mm_sub_ps(c, d1);
+
+        __m128 combed = _mm_or_ps(
+            _mm_and_ps(_mm_cmpgt_ps(up, athresh), _mm_cmpgt_ps(down, athresh)),
+            _mm_and_ps(_mm_cmplt_ps(up, nathresh), _mm_cmplt_ps(down, nathresh)));
+        if (_mm_movemask_ps(combed) == 0)
+        {
+            continue;
+        }
+
+        if (check_motion)
+        {
+            const __m128 p0  = GAMMA_X4(lut, &prev[x]);
+            const __m128 pu1 = GAMMA_X4(lut, &prev[x - stride_prev]);
+            const __m128 pd1 = GAMMA_X4(lut, &prev[x + stride_prev]);
+            const __m128 n0  = GAMMA_X4(lut, &next[x]);
+            const __m128 nu1 = GAMMA_X4(lut, &next[x - stride_next]);
+            const __m128 nd1 = GAMMA_X4(lut, &next[x + stride_next]);
+
+            __m128 m1 = _mm_and_ps(
+                _mm_cmpgt_ps(_mm_andnot_ps(sign, _mm_sub_ps(p0, c)), mthresh),
+                _mm_and_ps(
+                    _mm_cmpgt_ps(_mm_andnot_ps(sign, _mm_sub_ps(u1, nu1)), mthresh),
+                    _mm_cmpgt_ps(_mm_andnot_ps(sign, _mm_sub_ps(d1, nd1)), mthresh)));
+            __m128 m2 = _mm_and_ps(
+                _mm_cmpgt_ps(_mm_andnot_ps(sign, _mm_sub_ps(n0, c)), mthresh),
+                _mm_and_ps(
+                    _mm_cmpgt_ps(_mm_andnot_ps(sign, _mm_sub_ps(pu1, u1)), mthresh),
+                    _mm_cmpgt_ps(_mm_andnot_ps(sign, _mm_sub_ps(pd1, d1)), mthresh)));
+            combed = _mm_and_ps(combed, _mm_or_ps(m1, m2));
+        }
+
+        // Same operation order as the scalar code, for identical rounding
+        const __m128 u2 = GAMMA_X4(lut, &cur[x - 2 * stride_cur]);
+        const __m128 d2 = GAMMA_X4(lut, &cur[x + 2 * stride_cur]);
+        const __m128 combing = _mm_andnot_ps(sign, _mm_sub_ps(
+            _mm_add_ps(_mm_add_ps(u2, _mm_mul_ps(four, c)), d2),
+            _mm_mul_ps(three, _mm_add_ps(u1, d1))));
+
+        combed = _mm_and_ps(combed, _mm_cmpgt_ps(combing, athresh6));
+
+        const __m128i w = _mm_packs_epi32(_mm_castps_si128(combed),
+                                          _mm_castps_si128(combed));
+        const int32_t b = _mm_cvtsi128_si32(
+                            _mm_and_si128(_mm_packs_epi16(w, w), one));
+        memcpy(&mask[x], &b, sizeof(b));
+    }
+    return x;
+}
+
+__attribute__((target("avx2")))
+static int FUNC(detect_gamma_combed_line_avx2)(const CombDetectThresholds *t,
+                                               const void *in_prev,
+                                               const void *in_cur,
+                                               const void *in_next,
+                                               uint8_t *mask, int width,
+                                               int stride_prev, int stride_cur,
+                                               int stride_next)
+{
+    const pixel *prev = in_prev;
+    const pixel *cur  = in_cur;
+    const pixel *next = in_next;
+    const float *lut  = t->gamma_lut;
+
+    const int check_motion = t->gamma_motion_threshold > 0 &&
+                             !t->force_exaustive_check;
+
+    const __m256 athresh  = _mm256_set1_ps(t->gamma_spatial_threshold);
+    const __m256 nathresh = _mm256_set1_ps(-t->gamma_spatial_threshold);
+    const __m256 mthresh  = _mm256_set1_ps(t->gamma_motion_threshold);
+    const __m256 athresh6 = _mm256_set1_ps(t->gamma_spatial_threshold6);
+    const __m256 sign     = _mm256_set1_ps(-0.0f);
+    const __m256 three    = _mm256_set1_ps(3.0f);
+    const __m256 four     = _mm256_set1_ps(4.0f);
+    const __m128i one     = _mm_set1_epi8(1);
+
+    int x;
+    for (x = 0; x + 8 <= width; x += 8)
+    {
+        const __m256 c    = GAMMA_X8(lut, &cur[x]);
+        const __m256 u1   = GAMMA_X8(lut, &cur[x - stride_cur]);
+        const __m256 d1   = GAMMA_X8(lut, &cur[x + stride_cur]);
+        const __m256 up   = _mm256_sub_ps(c, u1);
+        const __m256 down = _mm256_sub_ps(c, d1);
+
+        __m256 combed = _mm256_or_ps(
+            _mm256_and_ps(_mm256_cmp_ps(up, athresh, _CMP_GT_OQ),
+                          _mm256_cmp_ps(down, athresh, _CMP_GT_OQ)),
+            _mm256_and_ps(_mm256_cmp_ps(up, nathresh, _CMP_LT_OQ),
+                          _mm256_cmp_ps(down, nathresh, _CMP_LT_OQ)));
+        if (_mm256_movemask_ps(combed) == 0)
+        {
+            continue;
+        }
+
+        if (check_motion)
+        {
+            const __m256 p0  = GAMMA_X8(lut, &prev[x]);
+            const __m256 pu1 = GAMMA_X8(lut, &prev[x - stride_prev]);
+            const __m256 pd1 = GAMMA_X8(lut, &prev[x + stride_prev]);
+            const __m256 n0  = GAMMA_X8(lut, &next[x]);
+            const __m256 nu1 = GAMMA_X8(lut, &next[x - stride_next]);
+            const __m256 nd1 = GAMMA_X8(lut, &next[x + stride_next]);
+
+            __m256 m1 = _mm256_and_ps(
+                _mm256_cmp_ps(_mm256_andnot_ps(sign, _mm256_sub_ps(p0, c)), mthresh, _CMP_GT_OQ),
+                _mm256_and_ps(
+                    _mm256_cmp_ps(_mm256_andnot_ps(sign, _mm256_sub_ps(u1, nu1)), mthresh, _CMP_GT_OQ),
+                    _mm256_cmp_ps(_mm256_andnot_ps(sign, _mm256_sub_ps(d1, nd1)), mthresh, _CMP_GT_OQ)));
+            __m256 m2 = _mm256_and_ps(
+                _mm256_cmp_ps(_mm256_andnot_ps(sign, _mm256_sub_ps(n0, c)), mthresh, _CMP_GT_OQ),
+                _mm256_and_ps(
+                    _mm256_cmp_ps(_mm256_andnot_ps(sign, _mm256_sub_ps(pu1, u1)), mthresh, _CMP_GT_OQ),
+                    _mm256_cmp_ps(_mm256_andnot_ps(sign, _mm256_sub_ps(pd1, d1)), mthresh, _CMP_GT_OQ)));
+            combed = _mm256_and_ps(combed, _mm256_or_ps(m1, m2));
+        }
+
+        // Same operation order as the scalar code, for identical rounding
+        const __m256 u2 = GAMMA_X8(lut, &cur[x - 2 * stride_cur]);
+        const __m256 d2 = GAMMA_X8(lut, &cur[x + 2 * stride_cur]);
+        const __m256 combing = _mm256_andnot_ps(sign, _mm256_sub_ps(
+            _mm256_add_ps(_mm256_add_ps(u2, _mm256_mul_ps(four, c)), d2),
+            _mm256_mul_ps(three, _mm256_add_ps(u1, d1))));
+
+        combed = _mm256_and_ps(combed, _mm256_cmp_ps(combing, athresh6, _CMP_GT_OQ));
+
+        const __m256i r = _mm256_castps_si256(combed);
+        const __m128i w = _mm_packs_epi32(_mm256_castsi256_si128(r),
+                                          _mm256_extracti128_si256(r, 1));
+        _mm_storel_epi64((__m128i *)&mask[x],
+                         _mm_and_si128(_mm_packs_epi16(w, w), one));
+    }
+    return x;
+}
+
+#undef pixel
+#undef FUNC
+#undef LOAD_X4
+#undef LOAD_X8
+#undef GAMMA_X4
+#undef GAMMA_X8
@@ -0,0 +1,276 @@
+/* lapsharp_template.c
+
+   Copyright (c) 2003-2024 HandBrake Team
+   This file is part of the HandBrake source code
+   Homepage: <http://handbrake.fr/>.
+   It may be used under the terms of the GNU General Public License v2.
+   For full terms see the file COPYING file or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+// The kernels are symmetric, so each output pixel is computed as
+// sum(taps[j][k] * (sum of the pixels at rows +-j and columns +-k)).
+// The rows above and below are added first, then a short symmetric
+// filter runs along the line.  This does the same integer sum as the
+// full 2D convolution, so the output is unchanged.
+
+#if BIT_DEPTH > 8
+#   define pixel  uint16_t
+#   define spixel int32_t
+#   define FUNC(name) name##_##16
+#   define LOAD_X4(p) _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i *)(p)))
+#   define LOAD_X8(p) _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(p)))
+#else
+#   define pixel  uint8_t
+#   define spixel int16_t
+#   define FUNC(name) name##_##8
+#   define LOAD_X4(p) _mm_cvtepu8_epi32(_mm_cvtsi32_si128(load_u32(p)))
+#   define LOAD_X8(p) _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(p)))
+#endif
+
+static inline pixel FUNC(lapsharp_pixel)(const pixel *src, int stride,
+                                         const lapsharp_plane_context_t *ctx)
+{
+    const int r = ctx->radius;
+    int       sum = 0;
+
+    for (int j = 0; j <= r; j++)
+    {
+        const pixel *a = src - j * stride;
+        const pixel *b = src + j * stride;
+
+        if (j == 0)
+        {
+            sum += ctx->taps[0][0] * a[0];
+            for (int k = 1; k <= r; k++)
+            {
+                sum += ctx->taps[0][k] * (a[-k] + a[k]);
+            }
+        }
+        else
+        {
+            sum += ctx->taps[j][0] * (a[0] + b[0]);
+            for (int k = 1; k <= r; k++)
+            {
+                sum += ctx->taps[j][k] * (a[-k] + a[k] + b[-k] + b[k]);
+            }
+        }
+    }
+
+    spixel value = sum;
+    value = (spixel)(((value * ctx->coef) - src[0]) * ctx->strength) + src[0];
+    value = value < 0 ? 0 : value;
+    value = value > ctx->max_value ? ctx->max_value : value;
+    return value;
+}
+
+static void FUNC(lapsharp)(const uint8_t *frame_src,
+                                 uint8_t *frame_dst,
+                           const int width,
+                           const int height,
+                           const int y0,
+                           const int y1,
+                           int stride_src,
+                           int stride_dst,
+                           lapsharp_plane_context_t *ctx)
+{
+    const pixel *src = (const pixel *)frame_src;
+    pixel       *dst = (pixel *)frame_dst;
+
+    stride_src /= ctx->bps;
+    stride_dst /= ctx->bps;
+
+    // Pixels closer to the edges than the kernel radius are copied.
+    // The horizontal limits are offset by the stride padding, which is
+    // mirrored from the picture, as they have always been.
+    const int offset_max    = ctx->radius + 1;
+    const int stride_border = (stride_src - width) / 2;
+    const int x_lo = MIN(MAX(stride_border + offset_max, 0), width);
+    const int x_hi = MIN(MAX(width + stride_border - offset_max + 1, x_lo), width);
+
+    for (int y = y0; y < y1; y++)
+    {
+        const pixel *s = src + stride_src * y;
+        pixel       *d = dst + stride_dst * y;
+
+        if (y < offset_max || y > height - offset_max)
+        {
+            memcpy(d, s, width * sizeof(pixel));
+            continue;
+        }
+
+        memcpy(d, s, x_lo * sizeof(pixel));
+        int x = x_lo;
+        if (ctx->line != NULL)
+        {
+            x = ctx->line(s, d, stride_src, x_lo, x_hi, ctx);
+        }
+        for (; x < x_hi; x++)
+        {
+            d[x] = FUNC(lapsharp_pixel)(s + x, stride_src, ctx);
+        }
+        memcpy(d + x_hi, s + x_hi, (width - x_hi) * sizeof(pixel));
+    }
+}
+
+#if defined(HAVE_LAPSHARP_SIMD)
+LAPSHARP_TARGET_SSE41
+static int FUNC(lapsharp_line_sse41)(const void *in_src, void *in_dst,
+                                     int stride, int x0, int x1,
+                                     const lapsharp_plane_context_t *ctx)
+{
+    const pixel *src = in_src;
+    pixel       *dst = in_dst;
+    const int    r   = ctx->radius;
+
+    __m128i taps[3][3];
+    for (int j = 0; j <= r; j++)
+    {
+        for (int k = 0; k <= r; k++)
+        {
+            taps[j][k] = _mm_set1_epi32(ctx->taps[j][k]);
+        }
+    }
+    const __m128d coef     = _mm_set1_pd(ctx->coef);
+    const __m128d strength = _mm_set1_pd(ctx->strength);
+    const __m128i zero     = _mm_setzero_si128();
+    const __m128i max      = _mm_set1_epi32(ctx->max_value);
+
+    int x;
+    for (x = x0; x + 4 <= x1; x += 4)
+    {
+        const __m128i c = LOAD_X4(&src[x]);
+        __m128i sum = _mm_mullo_epi32(taps[0][0], c);
+
+        for (int k = 1; k <= r; k++)
+        {
+            sum = _mm_add_epi32(sum, _mm_mullo_epi32(taps[0][k],
+                    _mm_add_epi32(LOAD_X4(&src[x - k]), LOAD_X4(&src[x + k]))));
+        }
+        for (int j = 1; j <= r; j++)
+        {
+            const pixel *a = &src[x - j * stride];
+            const pixel *b = &src[x + j * stride];
+
+            sum = _mm_add_epi32(sum, _mm_mullo_epi32(taps[j][0],
+                    _mm_add_epi32(LOAD_X4(a), LOAD_X4(b))));
+            for (int k = 1; k <= r; k++)
+            {
+                if (ctx->taps[j][k] == 0)
+                {
+                    continue;
+                }
+                sum = _mm_add_epi32(sum, _mm_mullo_epi32(taps[j][k],
+                        _mm_add_epi32(
+                            _mm_add_epi32(LOAD_X4(a - k), LOAD_X4(a + k)),
+                            _mm_add_epi32(LOAD_X4(b - k), LOAD_X4(b + k)))));
+            }
+        }
+
+        // Same double precision operations as the scalar code
+        __m128d lo = _mm_cvtepi32_pd(sum);
+        __m128d hi = _mm_cvtepi32_pd(_mm_unpackhi_epi64(sum, sum));
+        lo = _mm_mul_pd(_mm_sub_pd(_mm_mul_pd(lo, coef), _mm_cvtepi32_pd(c)),
+                        strength);
+        hi = _mm_mul_pd(_mm_sub_pd(_mm_mul_pd(hi, coef),
+                                   _mm_cvtepi32_pd(_mm_unpackhi_epi64(c, c))),
+                        strength);
+        __m128i res = _mm_unpacklo_epi64(_mm_cvttpd_epi32(lo),
+                                         _mm_cvttpd_epi32(hi));
+        res = _mm_min_epi32(_mm_max_epi32(_mm_add_epi32(res, c), zero), max);
+        res = _mm_packus_epi32(res, res);
+#if BIT_DEPTH > 8
+        _mm_storel_epi64((__m128i *)&dst[x], res);
+#else
+        const int32_t v = _mm_cvtsi128_si32(_mm_packus_epi16(res, res));
+        memcpy(&dst[x], &v, sizeof(v));
+#endif
+    }
+    return x;
+}
+#endif // HAVE_LAPSHARP_SIMD
+
+#if defined(ARCH_X86)
+__attribute__((target("avx2")))
+static int FUNC(lapsharp_line_avx2)(const void *in_src, void *in_dst,
+                                    int stride, int x0, int x1,
+                                    const lapsharp_plane_context_t *ctx)
+{
+    const pixel *src = in_src;
+    pixel       *dst = in_dst;
+    const int    r   = ctx->radius;
+
+    __m256i taps[3][3];
+    for (int j = 0; j <= r; j++)
+    {
+        for (int k = 0; k <= r; k++)
+        {
+            taps[j][k] = _mm256_set1_epi32(ctx->taps[j][k]);
+        }
+    }
+    const __m256d coef     = _mm256_set1_pd(ctx->coef);
+    const __m256d strength = _mm256_set1_pd(ctx->strength);
+    const __m256i zero     = _mm256_setzero_si256();
+    const __m256i max      = _mm256_set1_epi32(ctx->max_value);
+
+    int x;
+    for (x = x0; x + 8 <= x1; x += 8)
+    {
+        const __m256i c = LOAD_X8(&src[x]);
+        __m256i sum = _mm256_mullo_epi32(taps[0][0], c);
+
+        for (int k = 1; k <= r; k++)
+        {
+            sum = _mm256_add_epi32(sum, _mm256_mullo_epi32(taps[0][k],
+                    _mm256_add_epi32(LOAD_X8(&src[x - k]), LOAD_X8(&src[x + k]))));
+        }
+        for (int j = 1; j <= r; j++)
+        {
+            const pixel *a = &src[x - j * stride];
+            const pixel *b = &src[x + j * stride];
+
+            sum = _mm256_add_epi32(sum, _mm256_mullo_epi32(taps[j][0],
+                    _mm256_add_epi32(LOAD_X8(a), LOAD_X8(b))));
+            for (int k = 1; k <= r; k++)
+            {
+                if (ctx->taps[j][k] == 0)
+                {
+                    continue;
+                }
+                sum = _mm256_add_epi32(sum, _mm256_mullo_epi32(taps[j][k],
+                        _mm256_add_epi32(
+                            _mm256_add_epi32(LOAD_X8(a - k), LOAD_X8(a + k)),
+                            _mm256_add_epi32(LOAD_X8(b - k), LOAD_X8(b + k)))));
+            }
+        }
+
+        // Same double precision operations as the scalar code
+        const __m128i c_lo = _mm256_castsi256_si128(c);
+        const __m128i c_hi = _mm256_extracti128_si256(c, 1);
+        __m256d lo = _mm256_cvtepi32_pd(_mm256_castsi256_si128(sum));
+        __m256d hi = _mm256_cvtepi32_pd(_mm256_extracti128_si256(sum, 1));
+        lo = _mm256_mul_pd(_mm256_sub_pd(_mm256_mul_pd(lo, coef),
+                                         _mm256_cvtepi32_pd(c_lo)), strength);
+        hi = _mm256_mul_pd(_mm256_sub_pd(_mm256_mul_pd(hi, coef),
+                                         _mm256_cvtepi32_pd(c_hi)), strength);
+        __m256i res = _mm256_inserti128_si256(
+                        _mm256_castsi128_si256(_mm256_cvttpd_epi32(lo)),
+                        _mm256_cvttpd_epi32(hi), 1);
+        res = _mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(res, c), zero), max);
+
+        const __m128i w = _mm_packus_epi32(_mm256_castsi256_si128(res),
+                                           _mm256_extracti128_si256(res, 1));
+#if BIT_DEPTH > 8
+        _mm_storeu_si128((__m128i *)&dst[x], w);
+#else
+        _mm_storel_epi64((__m128i *)&dst[x], _mm_packus_epi16(w, w));
+#endif
+    }
+    return x;
+}
+#endif // ARCH_X86
+
+#undef pixel
+#undef spixel
+#undef FUNC
+#undef LOAD_X4
+#undef LOAD_X8
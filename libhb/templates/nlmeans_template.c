@@ -77,8 +77,19 @@ static void FUNC(nlmeans_alloc)(const void *in_src,
     const int bh = src_h + 2 * border;
 
     const pixel *src = in_src;
+    const size_t size = bw * bh * sizeof(pixel);
 
-    pixel *mem   = malloc(bw * bh * sizeof(pixel));
+    // Reuse the buffers of the frame slot, unless the plane grew
+    if (dst->alloc_size < size)
+    {
+        free(dst->mem_alloc);
+        free(dst->mem_pre_alloc);
+        dst->mem_alloc     = malloc(size);
+        dst->mem_pre_alloc = NULL;
+        dst->alloc_size    = dst->mem_alloc != NULL ? size : 0;
+    }
+
+    pixel *mem   = dst->mem_alloc;
     pixel *image = mem + border + bw * border;
 
     // Copy main image
@@ -453,7 +464,11 @@ static void FUNC(nlmeans_prefilter)(BorderedPlane *src,
         const int bh         = h + 2 * border;
 
         // Duplicate plane
-        pixel *mem_pre = malloc(bw * bh * sizeof(pixel));
+        if (src->mem_pre_alloc == NULL)
+        {
+            src->mem_pre_alloc = malloc(src->alloc_size);
+        }
+        pixel *mem_pre = src->mem_pre_alloc;
         pixel *image_pre = mem_pre + border + bw * border;
         memcpy(mem_pre, mem, bw * bh * sizeof(pixel));
 
@@ -590,49 +605,94 @@ static void FUNC(build_integral_scalar)(uint32_t *integral,
     }
 }
 
-static void FUNC(nlmeans_plane)(NLMeansFunctions *functions,
-                                Frame *frame,
-                                int prefilter,
-                                int plane,
-                                int nframes,
-                                void *in_dst,
-                                int dst_w,
-                                int dst_s,
-                                int dst_h,
-                                double h_param,
-                                double origin_tune,
-                                int n,
-                                int r,
-                          const float *exptable,
-                          const float  weight_fact_table,
-                          const int    diff_max)
+static void FUNC(accumulate_scalar)(struct PixelSum *tmp_data,
+                             const uint32_t *integral,
+                                   int       integral_stride,
+                             const void     *in_compare,
+                                   int       bw,
+                                   int       dst_w,
+                                   int       dst_h,
+                                   int       dx,
+                                   int       dy,
+                                   int       n,
+                             const float    *exptable,
+                             const float     weight_fact_table,
+                             const int       diff_max)
+{
+    const pixel *compare = (const pixel *)in_compare;
+
+    for (int y = 0; y < dst_h; y++)
+    {
+        const uint32_t *integral_ptr1 = integral + (y  -1)*integral_stride - 1;
+        const uint32_t *integral_ptr2 = integral + (y+n-1)*integral_stride - 1;
+
+        for (int x = 0; x < dst_w; x++)
+        {
+
+            // Difference between patches
+            const int diff = (uint32_t)(integral_ptr2[n] - integral_ptr2[0] - integral_ptr1[n] + integral_ptr1[0]);
+
+            // Sum pixel with weight
+            if (diff < diff_max)
+            {
+                const int diffidx = diff * weight_fact_table;
+
+                //float weight = exp(-diff*weightFact);
+                const float weight = exptable[diffidx];
+
+                tmp_data[y*dst_w + x].weight_sum += weight;
+                tmp_data[y*dst_w + x].pixel_sum  += weight * compare[(y+dy)*bw + x + dx];
+            }
+
+            integral_ptr1++;
+            integral_ptr2++;
+        }
+    }
+}
+
+static void FUNC(nlmeans_tile)(NLMeansFunctions *functions,
+                               NLMeansScratch *scratch,
+                               Frame **frame,
+                               int plane,
+                               int nframes,
+                               void *in_dst,
+                               int dst_s,
+                               int tile_x,
+                               int tile_y,
+                               int tile_w,
+                               int tile_h,
+                               double origin_tune,
+                               int n,
+                               int r,
+                         const float *exptable,
+                         const float  weight_fact_table,
+                         const int    diff_max)
 {
-    pixel *dst = in_dst;
     const int r_half = (r-1) /2;
 
     // Source image
-    const pixel *src     = frame[0].plane[plane].image;
-    const pixel *src_pre = frame[0].plane[plane].image_pre;
-    const int w      = frame[0].plane[plane].w;
-    const int border = frame[0].plane[plane].border;
+    const int w      = frame[0]->plane[plane].w;
+    const int border = frame[0]->plane[plane].border;
     const int bw     = w + 2 * border;
+    const int offset = tile_y * bw + tile_x;
+    const pixel *src     = (const pixel *)frame[0]->plane[plane].image + offset;
+    const pixel *src_pre = (const pixel *)frame[0]->plane[plane].image_pre + offset;
+    pixel *dst = (pixel *)in_dst + tile_y * dst_s + tile_x;
 
-    // Allocate temporary pixel sums
-    struct PixelSum *tmp_data = calloc(dst_w * dst_h, sizeof(struct PixelSum));
+    // Temporary pixel sums and integral image of the tile, the integral
+    // row and column before the tile are never written and stay zero
+    struct PixelSum *tmp_data        = scratch->tmp_data;
+    const int        integral_stride = scratch->integral_stride;
+    uint32_t* const  integral        = scratch->integral_mem + integral_stride + 16;
 
-    // Allocate integral image
-    const int integral_stride    = ((dst_w + n + 15) / 16 * 16) + 2 * 16;
-    uint32_t* const integral_mem = calloc(integral_stride * (dst_h + n + 1), sizeof(uint32_t));
-    uint32_t* const integral     = integral_mem + integral_stride + 16;
+    memset(tmp_data, 0, tile_w * tile_h * sizeof(struct PixelSum));
 
     // Iterate through available frames
     for (int f = 0; f < nframes; f++)
     {
-        FUNC(nlmeans_prefilter)(&frame[f].plane[plane], prefilter);
-
         // Compare image
-        const pixel *compare     = frame[f].plane[plane].image;
-        const pixel *compare_pre = frame[f].plane[plane].image_pre;
+        const pixel *compare     = (const pixel *)frame[f]->plane[plane].image + offset;
+        const pixel *compare_pre = (const pixel *)frame[f]->plane[plane].image_pre + offset;
 
         // Iterate through all displacements
         for (int dy = -r_half; dy <= r_half; dy++)
@@ -643,12 +703,12 @@ static void FUNC(nlmeans_plane)(NLMeansFunctions *functions,
                 // Apply special weight tuning to origin patch
                 if (dx == 0 && dy == 0 && f == 0)
                 {
-                    for (int y = 0; y < dst_h; y++)
+                    for (int y = 0; y < tile_h; y++)
                     {
-                        for (int x = 0; x < dst_w; x++)
+                        for (int x = 0; x < tile_w; x++)
                         {
-                            tmp_data[y*dst_w + x].weight_sum += origin_tune;
-                            tmp_data[y*dst_w + x].pixel_sum  += origin_tune * src[y*bw + x];
+                            tmp_data[y*tile_w + x].weight_sum += origin_tune;
+                            tmp_data[y*tile_w + x].pixel_sum  += origin_tune * src[y*bw + x];
                         }
                     }
                     continue;
@@ -663,57 +723,40 @@ static void FUNC(nlmeans_plane)(NLMeansFunctions *functions,
                                           compare_pre,
                                           w,
                                           border,
-                                          dst_w,
-                                          dst_h,
+                                          tile_w,
+                                          tile_h,
                                           dx,
                                           dy,
                                           n);
 
                 // Average displacement
-                for (int y = 0; y < dst_h; y++)
-                {
-                    const uint32_t *integral_ptr1 = integral + (y  -1)*integral_stride - 1;
-                    const uint32_t *integral_ptr2 = integral + (y+n-1)*integral_stride - 1;
-
-                    for (int x = 0; x < dst_w; x++)
-                    {
-
-                        // Difference between patches
-                        const int diff = (uint32_t)(integral_ptr2[n] - integral_ptr2[0] - integral_ptr1[n] + integral_ptr1[0]);
-
-                        // Sum pixel with weight
-                        if (diff < diff_max)
-                        {
-                            const int diffidx = diff * weight_fact_table;
-
-                            //float weight = exp(-diff*weightFact);
-                            const float weight = exptable[diffidx];
-
-                            tmp_data[y*dst_w + x].weight_sum += weight;
-                            tmp_data[y*dst_w + x].pixel_sum  += weight * compare[(y+dy)*bw + x + dx];
-                        }
-
-                        integral_ptr1++;
-                        integral_ptr2++;
-                    }
-                }
+                functions->accumulate(tmp_data,
+                                      integral,
+                                      integral_stride,
+                                      compare,
+                                      bw,
+                                      tile_w,
+                                      tile_h,
+                                      dx,
+                                      dy,
+                                      n,
+                                      exptable,
+                                      weight_fact_table,
+                                      diff_max);
             }
         }
     }
 
     // Copy image without border
     pixel result;
-    for (int y = 0; y < dst_h; y++)
+    for (int y = 0; y < tile_h; y++)
     {
-        for (int x = 0; x < dst_w; x++)
+        for (int x = 0; x < tile_w; x++)
         {
-            result = (pixel)(tmp_data[y*dst_w + x].pixel_sum / tmp_data[y*dst_w + x].weight_sum);
+            result = (pixel)(tmp_data[y*tile_w + x].pixel_sum / tmp_data[y*tile_w + x].weight_sum);
             *(dst + y*dst_s + x) = result ? result : *(src + y*bw + x);
         }
     }
-
-    free(tmp_data);
-    free(integral_mem);
 }
 
 #undef pixel_2
@@ -0,0 +1,175 @@
+/* nlmeans_x86_template.c
+
+   Copyright (c) 2013 Dirk Farin
+   Copyright (c) 2003-2024 HandBrake Team
+   This file is part of the HandBrake source code
+   Homepage: <http://handbrake.fr/>.
+   It may be used under the terms of the GNU General Public License v2.
+   For full terms see the file COPYING file or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+// AVX2 versions of build_integral_scalar and accumulate_scalar.
+// Pixels are widened to 32 bit lanes and every pixel sees the same
+// integer and single precision operations in the same order as the
+// scalar code, so the output is identical (the tolerance is zero).
+// No FMA is used, a fused multiply-add would round differently.
+
+#if BIT_DEPTH > 8
+#   define pixel  uint16_t
+#   define FUNC(name) name##_##16
+#   define LOAD_X8(p) _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(p)))
+#else
+#   define pixel  uint8_t
+#   define FUNC(name) name##_##8
+#   define LOAD_X8(p) _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(p)))
+#endif
+
+__attribute__((target("avx2")))
+static void FUNC(build_integral_avx2)(uint32_t *integral,
+                                      int       integral_stride,
+                                const void  *in_src,
+                                const void  *in_src_pre,
+                                const void  *in_compare,
+                                const void  *in_compare_pre,
+                                      int    w,
+                                      int    border,
+                                      int    dst_w,
+                                      int    dst_h,
+                                      int    dx,
+                                      int    dy,
+                                      int    n)
+{
+    const int bw = w + 2 * border;
+    const int n_half = (n-1) /2;
+    const int width  = dst_w + n;
+    const __m256i last = _mm256_set1_epi32(7);
+
+    const pixel *src_pre      = (const pixel *)in_src_pre;
+    const pixel *compare_pre  = (const pixel *)in_compare_pre;
+
+    for (int y = 0; y < dst_h + n; y++)
+    {
+        const pixel *p1 = src_pre     + (y-n_half   )*bw - n_half;
+        const pixel *p2 = compare_pre + (y-n_half+dy)*bw - n_half + dx;
+        uint32_t *out = integral + (y*integral_stride);
+        __m256i prevadd = _mm256_setzero_si256();
+
+        // Running sum of the squared differences, 8 at a time
+        int x;
+        for (x = 0; x + 8 <= width; x += 8)
+        {
+            __m256i diff = _mm256_sub_epi32(LOAD_X8(p1 + x), LOAD_X8(p2 + x));
+            __m256i sum  = _mm256_mullo_epi32(diff, diff);
+
+            sum = _mm256_add_epi32(sum, _mm256_slli_si256(sum, 4));
+            sum = _mm256_add_epi32(sum, _mm256_slli_si256(sum, 8));
+            // Carry the total of the low half into the high half
+            const __m256i carry = _mm256_shuffle_epi32(sum, 0xff);
+            sum = _mm256_add_epi32(sum, _mm256_permute2x128_si256(carry, carry, 0x08));
+            sum = _mm256_add_epi32(sum, prevadd);
+
+            _mm256_storeu_si256((__m256i *)(out + x), sum);
+            prevadd = _mm256_permutevar8x32_epi32(sum, last);
+        }
+        for (; x < width; x++)
+        {
+            int diff = p1[x] - p2[x];
+            out[x] = out[x-1] + diff * diff;
+        }
+
+        if (y > 0)
+        {
+            const uint32_t *above = out - integral_stride;
+
+            for (x = 0; x + 8 <= width; x += 8)
+            {
+                _mm256_storeu_si256((__m256i *)(out + x),
+                    _mm256_add_epi32(_mm256_loadu_si256((const __m256i *)(out + x)),
+                                     _mm256_loadu_si256((const __m256i *)(above + x))));
+            }
+            for (; x < width; x++)
+            {
+                out[x] += above[x];
+            }
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+static void FUNC(accumulate_avx2)(struct PixelSum *tmp_data,
+                            const uint32_t *integral,
+                                  int       integral_stride,
+                            const void     *in_compare,
+                                  int       bw,
+                                  int       dst_w,
+                                  int       dst_h,
+                                  int       dx,
+                                  int       dy,
+                                  int       n,
+                            const float    *exptable,
+                            const float     weight_fact_table,
+                            const int       diff_max)
+{
+    const pixel  *compare = in_compare;
+    const __m256i max     = _mm256_set1_epi32(diff_max);
+    const __m256  fact    = _mm256_set1_ps(weight_fact_table);
+    const __m256  zero    = _mm256_setzero_ps();
+
+    for (int y = 0; y < dst_h; y++)
+    {
+        const uint32_t *integral_ptr1 = integral + (y  -1)*integral_stride - 1;
+        const uint32_t *integral_ptr2 = integral + (y+n-1)*integral_stride - 1;
+        const pixel    *cmp = compare + (y+dy)*bw + dx;
+        struct PixelSum *sums = tmp_data + y*dst_w;
+
+        int x;
+        for (x = 0; x + 8 <= dst_w; x += 8)
+        {
+            const __m256i a  = _mm256_loadu_si256((const __m256i *)(integral_ptr2 + x + n));
+            const __m256i b  = _mm256_loadu_si256((const __m256i *)(integral_ptr2 + x));
+            const __m256i c  = _mm256_loadu_si256((const __m256i *)(integral_ptr1 + x + n));
+            const __m256i d  = _mm256_loadu_si256((const __m256i *)(integral_ptr1 + x));
+            const __m256i diff = _mm256_add_epi32(_mm256_sub_epi32(_mm256_sub_epi32(a, b), c), d);
+
+            // Lanes at or over diff_max keep a weight of 0, adding 0
+            // leaves their sums unchanged
+            const __m256i in_range = _mm256_cmpgt_epi32(max, diff);
+            if (_mm256_testz_si256(in_range, in_range))
+            {
+                continue;
+            }
+            const __m256i diffidx = _mm256_cvttps_epi32(
+                                        _mm256_mul_ps(_mm256_cvtepi32_ps(diff), fact));
+            const __m256 weight = _mm256_mask_i32gather_ps(zero, exptable, diffidx,
+                                                           _mm256_castsi256_ps(in_range), 4);
+            const __m256 pixel_weight = _mm256_mul_ps(weight,
+                                                      _mm256_cvtepi32_ps(LOAD_X8(cmp + x)));
+
+            // Interleave into weight_sum, pixel_sum pairs
+            const __m256 lo = _mm256_unpacklo_ps(weight, pixel_weight);
+            const __m256 hi = _mm256_unpackhi_ps(weight, pixel_weight);
+            float *s = &sums[x].weight_sum;
+            _mm256_storeu_ps(s,     _mm256_add_ps(_mm256_loadu_ps(s),
+                                        _mm256_permute2f128_ps(lo, hi, 0x20)));
+            _mm256_storeu_ps(s + 8, _mm256_add_ps(_mm256_loadu_ps(s + 8),
+                                        _mm256_permute2f128_ps(lo, hi, 0x31)));
+        }
+        for (; x < dst_w; x++)
+        {
+            const int diff = (uint32_t)(integral_ptr2[x+n] - integral_ptr2[x] - integral_ptr1[x+n] + integral_ptr1[x]);
+
+            if (diff < diff_max)
+            {
+                const int diffidx = diff * weight_fact_table;
+                const float weight = exptable[diffidx];
+
+                sums[x].weight_sum += weight;
+                sums[x].pixel_sum  += weight * cmp[x];
+            }
+        }
+    }
+}
+
+#undef pixel
+#undef FUNC
+#undef LOAD_X8
@@ -0,0 +1,436 @@
+/* threadpool.c
+
+   Copyright (c) 2003-2024 HandBrake Team
+   This file is part of the HandBrake source code
+   Homepage: <http://handbrake.fr/>.
+   It may be used under the terms of the GNU General Public License v2.
+   For full terms see the file COPYING file or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+#include "handbrake/handbrake.h"
+#include "handbrake/ports.h"
+#include "handbrake/threadpool.h"
+
+typedef struct
+{
+    hb_lock_t   * lock;
+    hb_task_t   * head;
+    hb_task_t   * tail;
+    hb_thread_t * thread;
+    int           index;
+
+    // Statistics, only written by the worker itself
+    uint64_t      tasks_run;
+    uint64_t      tasks_stolen;
+    uint64_t      busy_us;
+
+    // Keep workers on separate cache lines
+    uint8_t       pad[64];
+} hb_worker_t;
+
+static struct
+{
+    hb_lock_t    * lock;        // protects started, stop and sleeping
+    hb_cond_t    * cond;        // signaled when tasks are queued
+    int            started;
+    int            stop;
+    int            sleeping;
+    int            queued;      // tasks sitting in worker queues
+    unsigned       next;        // round robin for external submitters
+    int            count;
+    uint64_t       start_time;
+    uint64_t       tasks_helped;
+    hb_worker_t  * workers;
+} pool;
+
+// Index of the pool worker running on this thread, -1 for other threads
+static __thread int current_worker = -1;
+
+static void worker_func( void * _w );
+
+void hb_threadpool_init( void )
+{
+    if (pool.lock == NULL)
+    {
+        pool.lock = hb_lock_init();
+        pool.cond = hb_cond_init();
+    }
+}
+
+// Workers are started on first use so that processes that never
+// filter or encode don't pay for idle threads.
+static int threadpool_start( void )
+{
+    if (__atomic_load_n(&pool.started, __ATOMIC_ACQUIRE))
+    {
+        return 1;
+    }
+    if (pool.lock == NULL)
+    {
+        return 0;
+    }
+
+    hb_lock(pool.lock);
+    if (!pool.started)
+    {
+        int ii;
+
+        pool.count   = hb_get_cpu_count();
+        pool.workers = calloc(pool.count, sizeof(hb_worker_t));
+        if (pool.workers == NULL)
+        {
+            hb_unlock(pool.lock);
+            return 0;
+        }
+        pool.stop       = 0;
+        pool.start_time = hb_get_time_us();
+        for (ii = 0; ii < pool.count; ii++)
+        {
+            pool.workers[ii].lock  = hb_lock_init();
+            pool.workers[ii].index = ii;
+        }
+        for (ii = 0; ii < pool.count; ii++)
+        {
+            pool.workers[ii].thread = hb_thread_init("pool_worker", worker_func,
+                                                     &pool.workers[ii],
+                                                     HB_NORMAL_PRIORITY);
+        }
+        hb_deep_log(2, "threadpool: started %d workers", pool.count);
+        __atomic_store_n(&pool.started, 1, __ATOMIC_RELEASE);
+    }
+    hb_unlock(pool.lock);
+
+    return 1;
+}
+
+void hb_threadpool_close( void )
+{
+    int ii;
+
+    if (pool.lock == NULL)
+    {
+        return;
+    }
+    if (pool.started)
+    {
+        hb_lock(pool.lock);
+        pool.stop = 1;
+        hb_cond_broadcast(pool.cond);
+        hb_unlock(pool.lock);
+
+        for (ii = 0; ii < pool.count; ii++)
+        {
+            hb_thread_close(&pool.workers[ii].thread);
+            hb_lock_close(&pool.workers[ii].lock);
+        }
+        free(pool.workers);
+        pool.workers = NULL;
+        pool.started = 0;
+    }
+    hb_lock_close(&pool.lock);
+    hb_cond_close(&pool.cond);
+}
+
+int hb_threadpool_worker_count( void )
+{
+    if (threadpool_start())
+    {
+        return pool.count;
+    }
+    return hb_get_cpu_count();
+}
+
+void hb_threadpool_get_stats( hb_threadpool_stats_t * stats )
+{
+    int ii;
+
+    memset(stats, 0, sizeof(*stats));
+    if (!__atomic_load_n(&pool.started, __ATOMIC_ACQUIRE))
+    {
+        return;
+    }
+    stats->worker_count = pool.count;
+    for (ii = 0; ii < pool.count; ii++)
+    {
+        hb_worker_t * w = &pool.workers[ii];
+        stats->tasks_run    += __atomic_load_n(&w->tasks_run, __ATOMIC_RELAXED);
+        stats->tasks_stolen += __atomic_load_n(&w->tasks_stolen, __ATOMIC_RELAXED);
+        stats->busy_us      += __atomic_load_n(&w->busy_us, __ATOMIC_RELAXED);
+    }
+    stats->tasks_helped = __atomic_load_n(&pool.tasks_helped, __ATOMIC_RELAXED);
+    stats->uptime_us    = hb_get_time_us() - pool.start_time;
+}
+
+void hb_threadpool_log_stats( const char * prefix,
+                              const hb_threadpool_stats_t * since )
+{
+    hb_threadpool_stats_t stats;
+    double                utilization = 0.;
+
+    hb_threadpool_get_stats(&stats);
+    if (stats.worker_count == 0)
+    {
+        return;
+    }
+    if (since != NULL && since->worker_count == stats.worker_count)
+    {
+        stats.tasks_run    -= since->tasks_run;
+        stats.tasks_helped -= since->tasks_helped;
+        stats.tasks_stolen -= since->tasks_stolen;
+        stats.busy_us      -= since->busy_us;
+        stats.uptime_us    -= since->uptime_us;
+    }
+    if (stats.uptime_us > 0)
+    {
+        utilization = 100. * stats.busy_us /
+                      ((double)stats.uptime_us * stats.worker_count);
+    }
+    hb_log("%s: thread pool %d workers, %"PRIu64" tasks (%"PRIu64" stolen, "
+           "%"PRIu64" run by waiters), %.1f%% busy",
+           prefix, stats.worker_count, stats.tasks_run + stats.tasks_helped,
+           stats.tasks_stolen, stats.tasks_helped, utilization);
+}
+
+static void queue_push( hb_worker_t * w, hb_task_t * task )
+{
+    task->next = NULL;
+    hb_lock(w->lock);
+    if (w->tail == NULL)
+    {
+        __atomic_store_n(&w->head, task, __ATOMIC_RELAXED);
+    }
+    else
+    {
+        w->tail->next = task;
+    }
+    w->tail = task;
+    hb_unlock(w->lock);
+}
+
+static hb_task_t * queue_pop( hb_worker_t * w )
+{
+    hb_task_t * task;
+
+    // Unlocked peek, avoids taking the lock of every idle worker
+    // when looking for something to steal
+    if (__atomic_load_n(&w->head, __ATOMIC_RELAXED) == NULL)
+    {
+        return NULL;
+    }
+
+    hb_lock(w->lock);
+    task = w->head;
+    if (task != NULL)
+    {
+        __atomic_store_n(&w->head, task->next, __ATOMIC_RELAXED);
+        if (w->head == NULL)
+        {
+            w->tail = NULL;
+        }
+        task->next = NULL;
+    }
+    hb_unlock(w->lock);
+
+    if (task != NULL)
+    {
+        __atomic_sub_fetch(&pool.queued, 1, __ATOMIC_RELAXED);
+    }
+    return task;
+}
+
+// Take a task from our own queue first, then steal from the others
+static hb_task_t * take_task( int self, int * stolen )
+{
+    hb_task_t * task;
+    int         start, ii;
+
+    *stolen = 0;
+    if (self >= 0)
+    {
+        task = queue_pop(&pool.workers[self]);
+        if (task != NULL)
+        {
+            return task;
+        }
+        start = self + 1;
+    }
+    else
+    {
+        start = 0;
+    }
+    for (ii = 0; ii < pool.count; ii++)
+    {
+        int victim = (start + ii) % pool.count;
+        if (victim == self)
+        {
+            continue;
+        }
+        task = queue_pop(&pool.workers[victim]);
+        if (task != NULL)
+        {
+            *stolen = 1;
+            return task;
+        }
+    }
+    return NULL;
+}
+
+static void run_task( hb_task_t * task )
+{
+    hb_task_group_t * group = task->group;
+
+    task->func(task->arg);
+
+    // The group may be freed as soon as the waiter sees pending == 0,
+    // so the decrement must happen with the group lock held.
+    hb_lock(group->lock);
+    if (__atomic_sub_fetch(&group->pending, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        hb_cond_broadcast(group->cond);
+    }
+    hb_unlock(group->lock);
+}
+
+static void worker_func( void * _w )
+{
+    hb_worker_t * w = _w;
+    hb_task_t   * task;
+    int           stolen;
+
+    // Workers are shared by every job, the pool may have been started
+    // by a thread that is bound to the placement domain of a job
+    hb_thread_set_domain(-1);
+
+    current_worker = w->index;
+    while (1)
+    {
+        task = take_task(w->index, &stolen);
+        if (task != NULL)
+        {
+            uint64_t start = hb_get_time_us();
+            run_task(task);
+            __atomic_store_n(&w->busy_us,
+                             w->busy_us + hb_get_time_us() - start,
+                             __ATOMIC_RELAXED);
+            __atomic_store_n(&w->tasks_run, w->tasks_run + 1,
+                             __ATOMIC_RELAXED);
+            if (stolen)
+            {
+                __atomic_store_n(&w->tasks_stolen, w->tasks_stolen + 1,
+                                 __ATOMIC_RELAXED);
+            }
+            continue;
+        }
+
+        hb_lock(pool.lock);
+        while (__atomic_load_n(&pool.queued, __ATOMIC_RELAXED) == 0 &&
+               !pool.stop)
+        {
+            pool.sleeping++;
+            hb_cond_wait(pool.cond, pool.lock);
+            pool.sleeping--;
+        }
+        if (pool.stop)
+        {
+            hb_unlock(pool.lock);
+            break;
+        }
+        hb_unlock(pool.lock);
+    }
+    current_worker = -1;
+}
+
+int hb_task_group_init( hb_task_group_t * group )
+{
+    group->pending = 0;
+    group->lock    = hb_lock_init();
+    group->cond    = hb_cond_init();
+
+    return group->lock != NULL && group->cond != NULL;
+}
+
+void hb_task_group_close( hb_task_group_t * group )
+{
+    hb_lock_close(&group->lock);
+    hb_cond_close(&group->cond);
+}
+
+void hb_task_group_submit( hb_task_group_t * group, hb_task_t * task,
+                           thread_func_t * func, void * arg )
+{
+    hb_worker_t * w;
+
+    task->func  = func;
+    task->arg   = arg;
+    task->group = group;
+    task->next  = NULL;
+    __atomic_add_fetch(&group->pending, 1, __ATOMIC_ACQ_REL);
+
+    if (!threadpool_start())
+    {
+        // No pool, run synchronously
+        run_task(task);
+        return;
+    }
+
+    if (current_worker >= 0)
+    {
+        w = &pool.workers[current_worker];
+    }
+    else
+    {
+        w = &pool.workers[__atomic_fetch_add(&pool.next, 1,
+                                             __ATOMIC_RELAXED) % pool.count];
+    }
+    queue_push(w, task);
+
+    hb_lock(pool.lock);
+    __atomic_add_fetch(&pool.queued, 1, __ATOMIC_RELAXED);
+    if (pool.sleeping > 0)
+    {
+        hb_cond_signal(pool.cond);
+    }
+    hb_unlock(pool.lock);
+}
+
+void hb_task_group_wait( hb_task_group_t * group )
+{
+    hb_task_t * task;
+    int         stolen;
+
+    // Help with queued work rather than sleeping. This keeps nested
+    // groups from deadlocking and puts the waiting thread to use.
+    while (__atomic_load_n(&group->pending, __ATOMIC_ACQUIRE) > 0)
+    {
+        task = NULL;
+        if (__atomic_load_n(&pool.started, __ATOMIC_ACQUIRE))
+        {
+            task = take_task(current_worker, &stolen);
+        }
+        if (task == NULL)
+        {
+            break;
+        }
+        run_task(task);
+        if (current_worker < 0)
+        {
+            __atomic_add_fetch(&pool.tasks_helped, 1, __ATOMIC_RELAXED);
+        }
+        else
+        {
+            hb_worker_t * w = &pool.workers[current_worker];
+            __atomic_store_n(&w->tasks_run, w->tasks_run + 1,
+                             __ATOMIC_RELAXED);
+        }
+    }
+
+    // Nothing left to help with, sleep until the remaining tasks
+    // complete. Taking the lock also guarantees that the last task
+    // is done touching the group.
+    hb_lock(group->lock);
+    while (__atomic_load_n(&group->pending, __ATOMIC_ACQUIRE) > 0)
+    {
+        hb_cond_wait(group->cond, group->lock);
+    }
+    hb_unlock(group->lock);
+}
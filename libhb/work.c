@@ -15,6 +15,8 @@
 #include "handbrake/dovi_common.h"
 #include "handbrake/rpu.h"
 #include "handbrake/hwaccel.h"
+#include "handbrake/threadpool.h"
+#include "handbrake/telemetry.h"
 
 #if HB_PROJECT_FEATURE_QSV
 #include "handbrake/qsv_common.h"
@@ -26,16 +28,33 @@
 
 typedef struct
 {
-    hb_list_t * jobs;
-    hb_job_t  ** current_job;
+    hb_handle_t   * h;
+    hb_list_t     * jobs;
     hb_error_code * error;
-    volatile int * die;
+    volatile int  * die;
 
+    // Jobs that run at the same time, see hb_set_max_concurrent_jobs()
+    int             max_jobs;
+    hb_interjob_t ** interjob;      // one per job slot
+    hb_lock_t     * prepare_lock;   // serializes use of the title set
 } hb_work_t;
 
+typedef struct
+{
+    hb_work_t     * work;
+    hb_job_t      * job;
+    int             slot;
+    int             cpu_share;
+    int             done;
+    hb_thread_t   * thread;
+} hb_job_runner_t;
+
 static void work_func(void * _work);
 static void do_job( hb_job_t *);
 static void filter_loop( void * );
+static void interrupt_job_fifos( hb_job_t * );
+static hb_fifo_t * video_fifo_init( hb_job_t *, int, int, int, int );
+static void place_job_threads( hb_job_t * );
 
 #define FIFO_UNBOUNDED 65536
 #define FIFO_UNBOUNDED_WAKE 65535
@@ -46,20 +65,33 @@ static void filter_loop( void * );
 #define FIFO_MINI 4
 #define FIFO_MINI_WAKE 3
 
+// Bounds of the video fifos when job->fifo_memory_budget is set,
+// the maximum is a multiple of the default depth
+#define FIFO_ADAPT_MIN 2
+#define FIFO_ADAPT_MAX_FACTOR 4
+
 /**
  * Allocates work object and launches work thread with work_func.
+ * @param h Handle to hb_handle_t.
  * @param jobs Handle to hb_list_t.
  * @param die Handle to user initiated exit indicator.
  * @param error Handle to error indicator.
  */
-hb_thread_t * hb_work_init( hb_list_t * jobs, volatile int * die, hb_error_code * error, hb_job_t ** job )
+hb_thread_t * hb_work_init( hb_handle_t * h, hb_list_t * jobs, volatile int * die, hb_error_code * error )
 {
     hb_work_t * work = calloc( sizeof( hb_work_t ), 1 );
 
+    work->h         = h;
     work->jobs      = jobs;
-    work->current_job = job;
     work->die       = die;
     work->error     = error;
+    work->max_jobs  = hb_get_max_concurrent_jobs(h);
+    work->interjob  = calloc(work->max_jobs, sizeof(hb_interjob_t *));
+    work->prepare_lock = hb_lock_init();
+
+    // The first slot uses the handle's interjob, so that sequential
+    // processing behaves as it always did
+    work->interjob[0] = hb_interjob_get(h);
 
     return hb_thread_init( "work", work_func, work, HB_LOW_PRIORITY );
 }
@@ -84,7 +116,7 @@ static void InitWorkState(hb_job_t * job, int pass, int pass_count)
     p.seconds         = -1;
 #undef p
 
-    hb_set_state( job->h, &state );
+    hb_set_job_state( job, &state );
 }
 
 static void SetWorkStateInfo(hb_job_t *job)
@@ -95,95 +127,248 @@ static void SetWorkStateInfo(hb_job_t *job)
     {
         return;
     }
-    hb_get_state2(job->h, &state);
+    hb_get_job_state(job, &state);
     state.param.working.error        = *job->done_error;
-    hb_set_state( job->h, &state );
+    hb_set_job_state( job, &state );
 }
 
 /**
- * Iterates through job list and calls do_job for each job.
- * @param _work Handle work object.
+ * Performs the title scan of a queued job and runs its passes.
+ * @param work Handle work object.
+ * @param job Queued job, closed before returning.
+ * @param interjob Persistent data between the passes of the job.
+ * @param cpu_share Logical processors the job may use, 0 for all.
+ * @returns 0 on success, -1 if the job could not be set up.
  */
-static void work_func( void * _work )
+static int run_job( hb_work_t * work, hb_job_t * job,
+                    hb_interjob_t * interjob, int cpu_share )
 {
-    hb_work_t  * work = _work;
-    hb_job_t   * job;
+    hb_handle_t * h = job->h;
+    hb_title_t  * title = NULL;
+    int           sequence_id = job->sequence_id;
 
-    time_t t = time(NULL);
-    hb_log("Starting work at: %s", asctime(localtime(&t)));
-    hb_log( "%d job(s) to process", hb_list_count( work->jobs ) );
+    hb_list_t * passes = hb_list_init();
+    hb_running_job_add(h, sequence_id);
 
-    while( !*work->die && ( job = hb_list_item( work->jobs, 0 ) ) )
+    // JSON jobs get special treatment.  We want to perform the title
+    // scan for the JSON job automatically.  This requires that we delay
+    // filling the job struct till we have performed the title scan
+    // because the default values for the job come from the title.
+    if (job->json != NULL)
     {
-        hb_handle_t * h = job->h;
+        hb_deep_log(1, "json job:\n%s", job->json);
 
-        hb_list_rem( work->jobs, job );
-        hb_list_t * passes = hb_list_init();
+        // Initialize state sequence_id
+        InitWorkState(job, 0, 0);
 
-        // JSON jobs get special treatment.  We want to perform the title
-        // scan for the JSON job automatically.  This requires that we delay
-        // filling the job struct till we have performed the title scan
-        // because the default values for the job come from the title.
-        if (job->json != NULL)
+        // The title set of the handle is shared by all jobs,
+        // scan and expand one json job at a time
+        hb_lock(work->prepare_lock);
+        // Perform title scan for json job
+        hb_json_job_scan(job->h, job->json);
+
+        // Expand json string to full job struct
+        hb_job_t *new_job = hb_json_to_job(job->h, job->json);
+        if (new_job != NULL && work->max_jobs > 1)
+        {
+            // The scan of the next job would close the title
+            // while this one still uses it
+            title = new_job->title;
+            hb_list_rem(hb_get_titles(h), title);
+        }
+        hb_unlock(work->prepare_lock);
+
+        if (new_job == NULL)
         {
-            hb_deep_log(1, "json job:\n%s", job->json);
+            hb_job_close(&job);
+            hb_list_close(&passes);
+            hb_running_job_remove(h, sequence_id);
+            *work->error = HB_ERROR_INIT;
+            *work->die = 1;
+            return -1;
+        }
+        new_job->h = job->h;
+        new_job->sequence_id = job->sequence_id;
+        hb_job_close(&job);
+        job = new_job;
+    }
+#if HB_PROJECT_FEATURE_QSV
+    if (hb_qsv_available())
+    {
+        hb_qsv_setup_job(job);
+    }
+#endif
 
-            // Initialize state sequence_id
-            InitWorkState(job, 0, 0);
-            // Perform title scan for json job
-            hb_json_job_scan(job->h, job->json);
+    hb_job_setup_passes(job->h, job, passes);
 
-            // Expand json string to full job struct
-            hb_job_t *new_job = hb_json_to_job(job->h, job->json);
-            if (new_job == NULL)
+    // The frame pool is held across the passes so that
+    // frames allocated by one pass are reused by the next
+    int64_t frame_pool_limit = job->frame_pool_limit;
+    int     huge_pages       = job->huge_pages;
+    hb_frame_pool_acquire(frame_pool_limit, huge_pages);
+    hb_job_close(&job);
+
+    int pass_count, pass;
+    pass_count = hb_list_count(passes);
+    for (pass = 0; pass < pass_count && !*work->die; pass++)
+    {
+        job = hb_list_item(passes, pass);
+        job->die = work->die;
+        job->done_error = work->error;
+        job->interjob = interjob;
+        job->cpu_share = cpu_share;
+        hb_running_job_set_pass(h, job);
+        InitWorkState(job, pass + 1, pass_count);
+        do_job( job );
+    }
+    SetWorkStateInfo(job);
+    hb_running_job_remove(h, sequence_id);
+    hb_frame_pool_release(frame_pool_limit, huge_pages);
+
+    // Clean job passes
+    for (pass = 0; pass < pass_count; pass++)
+    {
+        job = hb_list_item(passes, pass);
+        hb_job_close(&job);
+    }
+    hb_list_close(&passes);
+    if (title != NULL)
+    {
+        hb_title_close(&title);
+    }
+
+    // Force rescan of next source processed by this hb_handle_t
+    // TODO: Fix this ugly hack!
+    hb_lock(work->prepare_lock);
+    hb_force_rescan(h);
+    hb_unlock(work->prepare_lock);
+
+    return 0;
+}
+
+static void job_runner( void * _runner )
+{
+    hb_job_runner_t * runner = _runner;
+    hb_work_t       * work   = runner->work;
+
+    run_job(work, runner->job, work->interjob[runner->slot],
+            runner->cpu_share);
+
+    __atomic_store_n(&runner->done, 1, __ATOMIC_RELEASE);
+    hb_work_signal(work->h);
+}
+
+/**
+ * Runs up to work->max_jobs queued jobs at the same time, each with
+ * its own pipeline.  A job starts as soon as a slot is free, and gets
+ * an equal share of the logical processors among the jobs expected
+ * to run alongside it.
+ * @param work Handle work object.
+ */
+static void run_concurrent_jobs( hb_work_t * work )
+{
+    hb_job_runner_t ** runners = calloc(work->max_jobs, sizeof(hb_job_runner_t *));
+    hb_job_t         * job;
+    int                running = 0;
+    int                slot;
+
+    hb_log("work: running up to %d jobs concurrently", work->max_jobs);
+
+    for (;;)
+    {
+        uint64_t seen = hb_work_event_count(work->h);
+
+        for (slot = 0; slot < work->max_jobs; slot++)
+        {
+            hb_job_runner_t * runner = runners[slot];
+            if (runner != NULL &&
+                __atomic_load_n(&runner->done, __ATOMIC_ACQUIRE))
             {
-                hb_job_close(&job);
-                hb_list_close(&passes);
-                *work->error = HB_ERROR_INIT;
-                *work->die = 1;
-                break;
+                hb_thread_close(&runner->thread);
+                free(runner);
+                runners[slot] = NULL;
+                running--;
             }
-            new_job->h = job->h;
-            new_job->sequence_id = job->sequence_id;
-            hb_job_close(&job);
-            job = new_job;
         }
-#if HB_PROJECT_FEATURE_QSV
-        if (hb_qsv_available())
+
+        while (!*work->die && running < work->max_jobs &&
+               (job = hb_list_item(work->jobs, 0)) != NULL)
         {
-            hb_qsv_setup_job(job);
-        }
-#endif
+            hb_job_runner_t * runner = calloc(1, sizeof(hb_job_runner_t));
+            int               sharing;
 
-        hb_job_setup_passes(job->h, job, passes);
-        hb_job_close(&job);
+            sharing = MIN(work->max_jobs, running + hb_list_count(work->jobs));
+            hb_list_rem(work->jobs, job);
+
+            for (slot = 0; runners[slot] != NULL; slot++);
+            if (work->interjob[slot] == NULL)
+            {
+                work->interjob[slot] = calloc(1, sizeof(hb_interjob_t));
+            }
 
-        int pass_count, pass;
-        pass_count = hb_list_count(passes);
-        for (pass = 0; pass < pass_count && !*work->die; pass++)
+            runner->work      = work;
+            runner->job       = job;
+            runner->slot      = slot;
+            runner->cpu_share = MAX(1, hb_get_cpu_count() / sharing);
+            hb_log("work: starting job %d in slot %d, %d logical processor(s)",
+                   job->sequence_id, slot, runner->cpu_share);
+
+            runners[slot] = runner;
+            running++;
+            runner->thread = hb_thread_init("work job", job_runner, runner,
+                                            HB_LOW_PRIORITY);
+        }
+
+        if (running == 0)
         {
-            job = hb_list_item(passes, pass);
-            job->die = work->die;
-            job->done_error = work->error;
-            *(work->current_job) = job;
-            InitWorkState(job, pass + 1, pass_count);
-            do_job( job );
+            break;
         }
-        SetWorkStateInfo(job);
-        *(work->current_job) = NULL;
+        hb_work_wait(work->h, seen);
+    }
+    free(runners);
+}
+
+/**
+ * Iterates through job list and calls do_job for each job.
+ * @param _work Handle work object.
+ */
+static void work_func( void * _work )
+{
+    hb_work_t  * work = _work;
+    hb_job_t   * job;
+    int          slot;
 
-        // Clean job passes
-        for (pass = 0; pass < pass_count; pass++)
+    time_t t = time(NULL);
+    hb_log("Starting work at: %s", asctime(localtime(&t)));
+    hb_log( "%d job(s) to process", hb_list_count( work->jobs ) );
+
+    if (work->max_jobs > 1)
+    {
+        run_concurrent_jobs(work);
+    }
+    else
+    {
+        while( !*work->die && ( job = hb_list_item( work->jobs, 0 ) ) )
         {
-            job = hb_list_item(passes, pass);
-            hb_job_close(&job);
+            hb_list_rem( work->jobs, job );
+            if (run_job(work, job, work->interjob[0], 0) < 0)
+            {
+                break;
+            }
         }
-        hb_list_close(&passes);
+    }
 
-        // Force rescan of next source processed by this hb_handle_t
-        // TODO: Fix this ugly hack!
-        hb_force_rescan(h);
+    // The first slot is the handle's interjob
+    for (slot = 1; slot < work->max_jobs; slot++)
+    {
+        if (work->interjob[slot] != NULL)
+        {
+            hb_subtitle_close(&work->interjob[slot]->select_subtitle);
+            free(work->interjob[slot]);
+        }
     }
+    free(work->interjob);
+    hb_lock_close(&work->prepare_lock);
 
     t = time(NULL);
     hb_log("Finished work at: %s", asctime(localtime(&t)));
@@ -967,7 +1152,7 @@ static void analyze_subtitle_scan( hb_job_t * job )
         subtitle = hb_list_item( job->list_subtitle, i );
         if (subtitle->id == subtitle_hit)
         {
-            hb_interjob_t *interjob = hb_interjob_get(job->h);
+            hb_interjob_t *interjob = hb_job_interjob_get(job);
 
             subtitle->config = job->select_subtitle_config;
             // Remove from list since we are taking ownership
@@ -983,7 +1168,7 @@ static int sanitize_subtitles( hb_job_t * job )
 {
     int             i;
     uint8_t         one_burned = 0;
-    hb_interjob_t * interjob = hb_interjob_get(job->h);
+    hb_interjob_t * interjob = hb_job_interjob_get(job);
     hb_subtitle_t * subtitle;
 
     if (job->indepth_scan)
@@ -1641,15 +1826,21 @@ static void sanitize_dynamic_hdr_metadata_passthru(hb_job_t *job)
 static void do_job(hb_job_t *job)
 {
     int                i, result;
+    int                frame_depth = 0;
     hb_title_t       * title;
     hb_interjob_t    * interjob;
     hb_work_object_t * w;
     hb_audio_t       * audio;
     hb_subtitle_t    * subtitle;
+    hb_threadpool_stats_t pool_stats;
+    hb_buffer_pool_stats_t buffer_stats;
 
     title = job->title;
+    hb_threadpool_get_stats(&pool_stats);
+    hb_buffer_pool_get_stats(&buffer_stats);
+    place_job_threads(job);
 
-    interjob = hb_interjob_get(job->h);
+    interjob = hb_job_interjob_get(job);
     if (job->sequence_id != interjob->sequence_id)
     {
         // New job sequence, clear interjob
@@ -1747,6 +1938,14 @@ static void do_job(hb_job_t *job)
         init.cfr = 0;
         init.grayscale = 0;
 
+        // Filters that can run over stripes of a frame are merged into
+        // a single filter so each stripe goes through all of them while
+        // still in cache
+        if (job->filter_fusion)
+        {
+            hb_filter_fuse(job->list_filter);
+        }
+
         for( i = 0; i < hb_list_count( job->list_filter ); )
         {
             hb_filter_object_t * filter = hb_list_item( job->list_filter, i );
@@ -1831,14 +2030,50 @@ static void do_job(hb_job_t *job)
         update_dolby_vision_level(job);
     }
 
-    job->fifo_mpeg2  = hb_fifo_init( FIFO_SMALL, FIFO_SMALL_WAKE );
-    job->fifo_raw    = hb_fifo_init( FIFO_SMALL, FIFO_SMALL_WAKE );
+    if (job->fifo_memory_budget > 0)
+    {
+        int64_t frame_size, links = 2;
+
+        // Split the budget evenly between the fifos that hold
+        // uncompressed frames (raw, sync and filter outputs) to
+        // set their initial depth
+        frame_size = MAX(av_image_get_buffer_size(job->input_pix_fmt,
+                                                  title->geometry.width,
+                                                  title->geometry.height, 1),
+                         av_image_get_buffer_size(job->output_pix_fmt,
+                                                  job->width, job->height, 1));
+        if (frame_size <= 0)
+        {
+            frame_size = (int64_t)job->width * job->height * 3 / 2;
+        }
+        for (i = 0; job->list_filter != NULL &&
+                    i < hb_list_count(job->list_filter); i++)
+        {
+            hb_filter_object_t * filter = hb_list_item(job->list_filter, i);
+            links += !filter->skip;
+        }
+        frame_depth = MIN(job->fifo_memory_budget / (frame_size * links),
+                          FIFO_LARGE * FIFO_ADAPT_MAX_FACTOR);
+        frame_depth = MAX(frame_depth, FIFO_ADAPT_MIN);
+
+        job->fifo_budget = hb_fifo_budget_init(job->fifo_memory_budget);
+        hb_log("work: fifo memory budget %.1f MiB, %.1f MiB per frame, "
+               "initial frame fifo depth %d",
+               job->fifo_memory_budget / 1048576., frame_size / 1048576.,
+               frame_depth);
+    }
+
+    job->fifo_mpeg2  = video_fifo_init(job, FIFO_SMALL, FIFO_SMALL_WAKE, 0, 0);
+    job->fifo_raw    = video_fifo_init(job, FIFO_SMALL, FIFO_SMALL_WAKE,
+                                       frame_depth, 0);
     if (!job->indepth_scan)
     {
         // When doing subtitle indepth scan, the pipeline ends at sync
-        job->fifo_sync   = hb_fifo_init( FIFO_SMALL, FIFO_SMALL_WAKE );
+        job->fifo_sync   = video_fifo_init(job, FIFO_SMALL, FIFO_SMALL_WAKE,
+                                           frame_depth, 0);
         job->fifo_render = NULL; // Attached to filter chain
-        job->fifo_mpeg4  = hb_fifo_init( FIFO_LARGE, FIFO_LARGE_WAKE );
+        job->fifo_mpeg4  = video_fifo_init(job, FIFO_LARGE, FIFO_LARGE_WAKE,
+                                           0, 0);
     }
 
     result = sanitize_audio(job);
@@ -1979,8 +2214,14 @@ static void do_job(hb_job_t *job)
                 hb_filter_object_t * filter = hb_list_item(job->list_filter, i);
                 if (!filter->skip)
                 {
+                    // Each filter output has exactly one producer (this
+                    // filter's thread) and one consumer (the next filter
+                    // or the video encoder), so it can use a lock-free fifo.
+                    // fifo_sync is not, sync threads can push to it.
                     filter->fifo_in = fifo_in;
-                    filter->fifo_out = hb_fifo_init(FIFO_MINI, FIFO_MINI_WAKE);
+                    filter->fifo_out = video_fifo_init(job, FIFO_MINI,
+                                                       FIFO_MINI_WAKE,
+                                                       frame_depth, 1);
                     fifo_in = filter->fifo_out;
                 }
             }
@@ -2041,6 +2282,7 @@ static void do_job(hb_job_t *job)
     {
         w = hb_list_item( job->list_work, i );
         w->done = &job->done;
+        w->die  = job->die;
         if (w->init( w, job ))
         {
             hb_error( "Failure to initialise thread '%s'", w->name );
@@ -2050,6 +2292,27 @@ static void do_job(hb_job_t *job)
         }
     }
 
+    if (job->pipeline_telemetry)
+    {
+        job->telemetry = hb_telemetry_init();
+        for (i = 0; i < hb_list_count(job->list_work); i++)
+        {
+            w = hb_list_item(job->list_work, i);
+            w->stats = hb_telemetry_add_stage(job->telemetry, "work", w->name);
+        }
+        for (i = 0; job->list_filter != NULL && !job->indepth_scan &&
+                    i < hb_list_count(job->list_filter); i++)
+        {
+            hb_filter_object_t * filter = hb_list_item(job->list_filter, i);
+            if (!filter->skip)
+            {
+                filter->stats = hb_telemetry_add_stage(job->telemetry,
+                                                       "filter", filter->name);
+            }
+        }
+        hb_set_job_telemetry(job, job->telemetry);
+    }
+
     /* Launch processing threads */
     for (i = 0; i < hb_list_count( job->list_work ); i++)
     {
@@ -2076,19 +2339,41 @@ static void do_job(hb_job_t *job)
     // Note that other threads may still be running even though the
     // last thread has exited. So we must be careful with the sequence
     // of closing threads below.
+    //
+    // Work objects call hb_work_signal() when they exit or notice that
+    // the job has been stopped, hb_stop() does the same.
     w = hb_list_item(job->list_work, hb_list_count(job->list_work) - 1);
-    w->die = job->die;
+    for (;;)
+    {
+        uint64_t seen = hb_work_event_count(job->h);
+
+        if (*job->die || job->done || w->status == HB_WORK_DONE)
+        {
+            break;
+        }
+        hb_work_wait(job->h, seen);
+    }
+    // Fifo waits don't time out, release every thread that is blocked
+    // so that it notices the job is over. This includes the last work
+    // object, which drains its input fifo until job->done is set, and
+    // the muxer when another mux track thread ended the job.
+    job->done = 1;
+    interrupt_job_fifos(job);
     hb_thread_close(&w->thread);
 
-    hb_handle_t * h = job->h;
     hb_state_t state;
-    hb_get_state2( h, &state );
+    hb_get_job_state( job, &state );
 
     hb_log("work: average encoding speed for job is %f fps",
            state.param.working.rate_avg);
+    hb_threadpool_log_stats("work", &pool_stats);
+    hb_buffer_pool_log_stats("work", &buffer_stats);
+    hb_frame_pool_log("work");
+    hb_fifo_budget_log(job->fifo_budget, "work");
 
 cleanup:
     job->done = 1;
+    interrupt_job_fifos(job);
 
     // Close render filter pipeline
     if (job->list_filter)
@@ -2115,6 +2400,14 @@ cleanup:
             hb_thread_close(&w->thread);
         }
     }
+    if (job->telemetry != NULL)
+    {
+        // Every pipeline thread has exited, the counters are final
+        hb_telemetry_log(job->telemetry, "work");
+        hb_set_job_telemetry(job, NULL);
+        hb_telemetry_close(&job->telemetry);
+    }
+
     while ((w = hb_list_item(job->list_work, 0)))
     {
         hb_list_rem(job->list_work, w);
@@ -2165,12 +2458,14 @@ cleanup:
         }
     }
 
+    hb_fifo_budget_close(&job->fifo_budget);
+
     if (job->indepth_scan)
     {
         analyze_subtitle_scan(job);
     }
 
-    hb_buffer_pool_free();
+    hb_running_job_pool_free(job->h);
     hb_hwaccel_hw_ctx_close(&job->hw_device_ctx);
 
 #if HB_PROJECT_FEATURE_QSV
@@ -2181,6 +2476,90 @@ cleanup:
         hb_qsv_context_uninit(job);
     }
 #endif
+
+    if (job->cpu_domain >= 0)
+    {
+        hb_thread_set_domain(-1);
+        hb_cpu_domain_release(job->cpu_domain);
+        job->cpu_domain = -1;
+    }
+}
+
+/**
+ * Creates a fifo of the video pipeline.
+ * When the job has a fifo memory budget, the fifo adapts its depth
+ * within the budget, starting at 'depth' (or the default capacity
+ * if 0) and growing up to FIFO_ADAPT_MAX_FACTOR times the default.
+ * @param job Handle to hb_job_t.
+ * @param capacity Default capacity.
+ * @param thresh Default wake up threshold.
+ * @param depth Initial depth of a frame fifo, 0 for compressed data.
+ * @param spsc Create a single producer single consumer fifo.
+ */
+static hb_fifo_t * video_fifo_init( hb_job_t * job, int capacity, int thresh,
+                                    int depth, int spsc )
+{
+    hb_fifo_t * fifo;
+
+    if (spsc)
+    {
+        fifo = hb_fifo_init_spsc(capacity, thresh);
+    }
+    else
+    {
+        fifo = hb_fifo_init(capacity, thresh);
+    }
+    if (job->fifo_budget != NULL)
+    {
+        hb_fifo_set_adaptive(fifo, job->fifo_budget,
+                             depth > 0 ? MIN(depth, capacity) : capacity,
+                             FIFO_ADAPT_MIN, capacity * FIFO_ADAPT_MAX_FACTOR);
+    }
+    return fifo;
+}
+
+/**
+ * Wakes up every pipeline thread blocked on one of the job's fifos.
+ * Must be called after setting job->done so that woken threads exit.
+ * @param job Handle to hb_job_t.
+ */
+static void interrupt_job_fifos( hb_job_t * job )
+{
+    hb_audio_t    * audio;
+    hb_subtitle_t * subtitle;
+    int             i;
+
+    hb_fifo_interrupt(job->fifo_mpeg2);
+    hb_fifo_interrupt(job->fifo_raw);
+    hb_fifo_interrupt(job->fifo_sync);
+    hb_fifo_interrupt(job->fifo_mpeg4);
+
+    for (i = 0; i < hb_list_count(job->list_audio); i++)
+    {
+        audio = hb_list_item(job->list_audio, i);
+        hb_fifo_interrupt(audio->priv.fifo_in);
+        hb_fifo_interrupt(audio->priv.fifo_raw);
+        hb_fifo_interrupt(audio->priv.fifo_sync);
+        hb_fifo_interrupt(audio->priv.fifo_out);
+    }
+    for (i = 0; i < hb_list_count(job->list_subtitle); i++)
+    {
+        subtitle = hb_list_item(job->list_subtitle, i);
+        hb_fifo_interrupt(subtitle->fifo_in);
+        hb_fifo_interrupt(subtitle->fifo_raw);
+        hb_fifo_interrupt(subtitle->fifo_out);
+    }
+    if (job->list_filter != NULL)
+    {
+        for (i = 0; i < hb_list_count(job->list_filter); i++)
+        {
+            hb_filter_object_t * filter = hb_list_item(job->list_filter, i);
+            if (!filter->skip)
+            {
+                hb_fifo_interrupt(filter->fifo_out);
+            }
+        }
+    }
 }
 
 static inline void copy_chapter( hb_buffer_t * dst, hb_buffer_t * src )
@@ -2208,14 +2587,33 @@ void hb_work_loop( void * _w )
 {
     hb_work_object_t * w = _w;
     hb_buffer_t      * buf_in = NULL, * buf_out = NULL;
+    hb_stage_stats_t * stats = w->stats;
+    uint64_t           clock = 0, wait_out;
 
+    if (stats != NULL)
+    {
+        hb_stage_stats_start(stats);
+    }
     while ((w->die == NULL || !*w->die) && !*w->done &&
            w->status != HB_WORK_DONE)
     {
+        if (stats != NULL)
+        {
+            clock = hb_get_time_us();
+        }
         // fifo_in == NULL means this is a data source (e.g. reader)
         if (w->fifo_in != NULL)
         {
+            if (stats != NULL)
+            {
+                hb_stage_stats_occupancy(stats, w->fifo_in);
+            }
             buf_in = hb_fifo_get_wait( w->fifo_in );
+            if (stats != NULL)
+            {
+                hb_stage_stats_add(&stats->wait_in_us,
+                                   hb_stage_stats_lap(&clock));
+            }
             if ( buf_in == NULL )
                 continue;
             if ( *w->done )
@@ -2226,11 +2624,31 @@ void hb_work_loop( void * _w )
                 }
                 break;
             }
+            if (stats != NULL)
+            {
+                hb_stage_stats_add(&stats->frames_in, 1);
+            }
         }
         // Invalidate buf_out so that if there is no output
         // we don't try to pass along junk.
         buf_out = NULL;
+        wait_out = stats != NULL ? stats->wait_out_us : 0;
         w->status = w->work( w, &buf_in, &buf_out );
+        if (stats != NULL)
+        {
+            // Generators count the time they block on their own
+            // output fifos in wait_out_us, it is not busy time
+            hb_stage_stats_add(&stats->busy_us, hb_stage_stats_lap(&clock) -
+                                                (stats->wait_out_us - wait_out));
+            hb_stage_stats_output(stats, buf_out);
+        }
+
+        if (w->die != NULL && *w->die && w->h != NULL)
+        {
+            // The work function failed and stopped the job,
+            // let do_job() know right away.
+            hb_work_signal(w->h);
+        }
 
         copy_chapter( buf_out, buf_in );
 
@@ -2253,19 +2671,28 @@ void hb_work_loop( void * _w )
                     break;
                 }
             }
+            if (stats != NULL)
+            {
+                hb_stage_stats_add(&stats->wait_out_us,
+                                   hb_stage_stats_lap(&clock));
+            }
         }
-        else if (w->fifo_in == NULL)
-        {
-            // If this work object is a generator (no input fifo) and it
-            // generated no output, it may be waiting for status from
-            // another thread. Yield so that we don't spin doing nothing.
-            hb_yield();
-        }
+        // Generators (no input fifo, e.g. reader) deliver their output
+        // themselves and block on full output fifos, nothing to do here.
     }
     if ( buf_out )
     {
         hb_buffer_close( &buf_out );
     }
+    if (stats != NULL)
+    {
+        hb_stage_stats_stop(stats);
+    }
+    if (w->h != NULL)
+    {
+        // Let do_job() know that this work object is finished
+        hb_work_signal(w->h);
+    }
 
     // Consume data in incoming fifo till job completes so that
     // residual data does not stall the pipeline. There can be
@@ -2292,10 +2719,25 @@ static void filter_loop( void * _f )
 {
     hb_filter_object_t * f = _f;
     hb_buffer_t      * buf_in, * buf_out = NULL;
+    hb_stage_stats_t * stats = f->stats;
+    uint64_t           clock = 0;
 
+    if (stats != NULL)
+    {
+        hb_stage_stats_start(stats);
+    }
     while( !*f->done && f->status != HB_FILTER_DONE )
     {
+        if (stats != NULL)
+        {
+            clock = hb_get_time_us();
+            hb_stage_stats_occupancy(stats, f->fifo_in);
+        }
         buf_in = hb_fifo_get_wait( f->fifo_in );
+        if (stats != NULL)
+        {
+            hb_stage_stats_add(&stats->wait_in_us, hb_stage_stats_lap(&clock));
+        }
         if ( buf_in == NULL )
             continue;
 
@@ -2320,6 +2762,12 @@ static void filter_loop( void * _f )
         buf_out = NULL;
 
         f->status = f->work( f, &buf_in, &buf_out );
+        if (stats != NULL)
+        {
+            hb_stage_stats_add(&stats->frames_in, 1);
+            hb_stage_stats_add(&stats->busy_us, hb_stage_stats_lap(&clock));
+            hb_stage_stats_output(stats, buf_out);
+        }
 
         if ( buf_out && f->chapter_val && f->chapter_time <= buf_out->s.start )
         {
@@ -2346,12 +2794,21 @@ static void filter_loop( void * _f )
                     break;
                 }
             }
+            if (stats != NULL)
+            {
+                hb_stage_stats_add(&stats->wait_out_us,
+                                   hb_stage_stats_lap(&clock));
+            }
         }
     }
     if ( buf_out )
     {
         hb_buffer_close( &buf_out );
     }
+    if (stats != NULL)
+    {
+        hb_stage_stats_stop(stats);
+    }
 
     // Consume data in incoming fifo till job complete so that
     // residual data does not stall the pipeline
@@ -2363,3 +2820,38 @@ static void filter_loop( void * _f )
     }
 }
 
+/**
+ * Binds the thread running the job to a L3 cache or NUMA node domain
+ * large enough for the processors the job uses, or to a NUMA node
+ * when none is.  The pipeline threads, and the threads of the
+ * codecs, are started from this thread and inherit the placement.
+ * Frame buffers allocated by these threads come from the pools of the
+ * node, see hb_thread_get_node().
+ */
+static void place_job_threads( hb_job_t * job )
+{
+    int cpu_count = hb_job_cpu_count(job);
+
+    job->cpu_domain = -1;
+    if (!job->cpu_placement)
+    {
+        return;
+    }
+
+    job->cpu_domain = hb_cpu_domain_acquire(cpu_count);
+    if (job->cpu_domain < 0)
+    {
+        hb_log("work: placement, no cache or NUMA domain for %d logical"
+               " processor(s), threads are not bound", cpu_count);
+        return;
+    }
+    if (hb_cpu_domain_cpu_count(job->cpu_domain) < cpu_count)
+    {
+        // Size the codec thread counts for the domain
+        job->cpu_share = hb_cpu_domain_cpu_count(job->cpu_domain);
+    }
+    hb_thread_set_domain(job->cpu_domain);
+    hb_log("work: placement, %d logical processor(s) on %s, NUMA node %d",
+           hb_job_cpu_count(job), hb_cpu_domain_name(job->cpu_domain),
+           hb_cpu_domain_node(job->cpu_domain));
+}
@@ -0,0 +1,485 @@
+/* comb_detect.c
+
+   Copyright (c) 2003-2024 HandBrake Team
+   This file is part of the HandBrake source code
+   Homepage: <http://handbrake.fr/>.
+   It may be used under the terms of the GNU General Public License v2.
+   For full terms see the file COPYING file or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*
+ * Checks the x86 kernels of comb detection against the scalar code.
+ *
+ * The combing metric kernels run through the scalar template of the
+ * filter, once without kernels and once with the kernels of each level
+ * the cpu supports (SSE4.1, AVX2), and the masks are compared byte for
+ * byte.  The mask filter, erode, dilate and block score kernels are
+ * compared with the scalar loops of comb_detect.c.  Plane widths are
+ * odd so that the scalar code finishes every line.
+ *
+ * Usage: comb_detect [seed]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "handbrake/handbrake.h"
+#include "handbrake/comb_detect.h"
+#include "libavutil/cpu.h"
+
+#if defined(ARCH_X86)
+
+// Same as comb_detect.c
+#define MODE_GAMMA        1 // Scale gamma when decombing
+#define MODE_FILTER       2 // Filter combing mask
+#define MODE_MASK         4 // Output combing masks instead of pictures
+#define MODE_COMPOSITE    8 // Overlay combing mask onto picture
+
+#define HEIGHT 24
+
+// The fields of the filter's private data the template uses
+struct hb_filter_private_s
+{
+    int                depth;
+    int                bps;
+    int                max_value;
+    int                half_value;
+
+    int                mode;
+    int                spatial_metric;
+    int                motion_threshold;
+    int                spatial_threshold;
+    int                block_width;
+    int                block_height;
+
+    float              gamma_motion_threshold;
+    float              gamma_spatial_threshold;
+    float              gamma_spatial_threshold6;
+    int                spatial_threshold_squared;
+    int                spatial_threshold6;
+    int                comb32detect_min;
+    int                comb32detect_max;
+    float             *gamma_lut;
+
+    int                force_exaustive_check;
+
+    hb_buffer_t       *ref[3];
+    hb_buffer_t       *mask;
+    hb_buffer_t       *mask_filtered;
+    int                mask_box_x;
+    int                mask_box_y;
+
+    CombDetectFunctions functions;
+};
+
+#define BIT_DEPTH 8
+#include "templates/comb_detect_template.c"
+#undef BIT_DEPTH
+
+#define BIT_DEPTH 16
+#include "templates/comb_detect_template.c"
+#undef BIT_DEPTH
+
+typedef struct
+{
+    const char * name;
+    int          flags;     // forced cpu flags, -1 for the detected ones
+} level_t;
+
+static const int widths[] = { 333, 101, 37, 17, 9, 3 };
+
+// Motion thresholds, 0 turns the motion check off
+static const int motion_thresholds[] = { 0, 2, 9 };
+
+static uint32_t rnd_state = 0x6b8b4567;
+static int      failures;
+
+static uint32_t rnd( void )
+{
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 17;
+    rnd_state ^= rnd_state << 5;
+    return rnd_state;
+}
+
+/***********************************************************************
+ * Planes
+ **********************************************************************/
+static hb_buffer_t * plane_init( int width, int height, int bps )
+{
+    hb_buffer_t *b = calloc(1, sizeof(hb_buffer_t));
+
+    // Padding like the frame buffers, the kernels may read past the width
+    b->plane[0].width  = width;
+    b->plane[0].height = height;
+    b->plane[0].stride = ((width + 16 + 15) & ~15) * bps;
+    b->plane[0].size   = b->plane[0].stride * height;
+    b->plane[0].data   = malloc(b->plane[0].size);
+    return b;
+}
+
+static void plane_close( hb_buffer_t **_b )
+{
+    free((*_b)->plane[0].data);
+    free(*_b);
+    *_b = NULL;
+}
+
+// Interlaced looking frame: a smooth picture whose odd lines are
+// offset by a varying amount, plus noise
+static void fill_frame( hb_buffer_t *b, int depth )
+{
+    const int max    = (1 << depth) - 1;
+    const int shift  = depth - 8;
+    const int stride = b->plane[0].stride / (depth > 8 ? 2 : 1);
+    int       comb   = 0;
+
+    for (int y = 0; y < b->plane[0].height; y++)
+    {
+        for (int x = 0; x < stride; x++)
+        {
+            if (x % 8 == 0)
+            {
+                static const int combs[] = { 0, 2, 5, 12, 40, 90 };
+                comb = combs[rnd() % 6];
+            }
+            int v = ((x * 3 + y * 2) & 0xff) + (int)(rnd() % 7) - 3;
+            if (y & 1)
+            {
+                v += rnd() & 1 ? comb : -comb;
+            }
+            v = v < 0 ? 0 : v > 255 ? 255 : v;
+            v = (v << shift) | (rnd() & ((1 << shift) - 1));
+            v = v > max ? max : v;
+            if (depth > 8)
+            {
+                ((uint16_t *)b->plane[0].data)[y * stride + x] = v;
+            }
+            else
+            {
+                b->plane[0].data[y * stride + x] = v;
+            }
+        }
+    }
+}
+
+// Mask values, mostly 0 and 1, with the 128 of the drawn boxes
+static void fill_mask( hb_buffer_t *b )
+{
+    for (int ii = 0; ii < b->plane[0].size; ii++)
+    {
+        const int r = rnd() % 10;
+        b->plane[0].data[ii] = r < 5 ? 1 : r < 9 ? 0 : 128;
+    }
+}
+
+/***********************************************************************
+ * Combing metric
+ **********************************************************************/
+static void setup_thresholds( hb_filter_private_t *pv, int depth,
+                              int spatial_metric, int motion_threshold,
+                              int force )
+{
+    pv->depth      = depth;
+    pv->bps        = depth > 8 ? 2 : 1;
+    pv->max_value  = (1 << depth) - 1;
+    pv->half_value = (1 << depth) / 2;
+
+    pv->spatial_metric    = spatial_metric;
+    pv->motion_threshold  = motion_threshold << (depth - 8);
+    pv->spatial_threshold = 3 << (depth - 8);
+
+    pv->gamma_motion_threshold    = (float)pv->motion_threshold / (float)pv->max_value;
+    pv->gamma_spatial_threshold   = (float)pv->spatial_threshold / (float)pv->max_value;
+    pv->gamma_spatial_threshold6  = 6 * pv->gamma_spatial_threshold;
+    pv->spatial_threshold_squared = pv->spatial_threshold * pv->spatial_threshold;
+    pv->spatial_threshold6        = 6 * pv->spatial_threshold;
+    pv->comb32detect_min = 10 << (depth - 8);
+    pv->comb32detect_max = 15 << (depth - 8);
+
+    pv->force_exaustive_check = force;
+}
+
+static void check_detect( const level_t *level, const CombDetectFunctions *kernels,
+                          int depth, int width )
+{
+    hb_filter_private_t pv = {0};
+    uint8_t           * initial, * expected;
+    int                 size;
+
+    pv.gamma_lut = malloc(sizeof(float) * ((1 << depth)));
+    for (int ii = 0; ii < (1 << depth); ii++)
+    {
+        pv.gamma_lut[ii] = pow(((float)ii / (float)((1 << depth) - 1)), 2.2f);
+    }
+    for (int ii = 0; ii < 3; ii++)
+    {
+        pv.ref[ii] = plane_init(width, HEIGHT, depth > 8 ? 2 : 1);
+        fill_frame(pv.ref[ii], depth);
+    }
+    pv.mask  = plane_init(width, HEIGHT, 1);
+    size     = pv.mask->plane[0].size;
+    initial  = malloc(size);
+    expected = malloc(size);
+
+    // Lines the detection skips keep their content, start both runs
+    // from the same mask
+    fill_mask(pv.mask);
+    memcpy(initial, pv.mask->plane[0].data, size);
+
+    for (int gamma = 0; gamma < 2; gamma++)
+    for (int metric = 0; metric < 3; metric++)
+    for (int motion = 0; motion < 3; motion++)
+    for (int force = 0; force < 2; force++)
+    {
+        void (*detect)(hb_filter_private_t *, int, int);
+
+        if (gamma && metric != 2)
+        {
+            // The gamma version only has one metric
+            continue;
+        }
+        if (depth > 8)
+        {
+            detect = gamma ? detect_gamma_combed_segment_16 : detect_combed_segment_16;
+        }
+        else
+        {
+            detect = gamma ? detect_gamma_combed_segment_8 : detect_combed_segment_8;
+        }
+        setup_thresholds(&pv, depth, metric, motion_thresholds[motion], force);
+
+        memset(&pv.functions, 0, sizeof(pv.functions));
+        memcpy(pv.mask->plane[0].data, initial, size);
+        detect(&pv, 0, HEIGHT);
+        memcpy(expected, pv.mask->plane[0].data, size);
+
+        pv.functions = *kernels;
+        memcpy(pv.mask->plane[0].data, initial, size);
+        detect(&pv, 0, HEIGHT);
+
+        if (memcmp(expected, pv.mask->plane[0].data, size))
+        {
+            fprintf(stderr, "%s: %s combed line, %d bit, width %d, metric %d,"
+                    " motion threshold %d, exhaustive %d: masks differ\n",
+                    level->name, gamma ? "gamma" : "integer", depth, width,
+                    metric, pv.motion_threshold, force);
+            failures++;
+        }
+    }
+
+    free(initial);
+    free(expected);
+    plane_close(&pv.mask);
+    for (int ii = 0; ii < 3; ii++)
+    {
+        plane_close(&pv.ref[ii]);
+    }
+    free(pv.gamma_lut);
+}
+
+/***********************************************************************
+ * Mask filters and block scores
+ **********************************************************************/
+enum { MASK_CLASSIC, MASK_FILTER, MASK_ERODE, MASK_DILATE, MASK_COUNT };
+static const char * const mask_names[] = { "classic filter", "filter",
+                                           "erode", "dilate" };
+
+// The scalar loops of comb_detect.c, from 'xx' to 'width' - 1
+static void mask_line_c( int op, uint8_t *dst, const uint8_t *curp,
+                         const uint8_t *cur, const uint8_t *curn,
+                         int xx, int width )
+{
+    for (; xx < width - 1; xx++)
+    {
+        const int h_count = cur[xx-1] & cur[xx] & cur[xx+1];
+        const int v_count = curp[xx] & cur[xx] & curn[xx];
+        const int count = curp[xx-1] + curp[xx] + curp[xx+1] +
+                          cur [xx-1] +            cur [xx+1] +
+                          curn[xx-1] + curn[xx] + curn[xx+1];
+
+        switch (op)
+        {
+            case MASK_CLASSIC:
+                dst[xx] = h_count;
+                break;
+            case MASK_FILTER:
+                dst[xx] = h_count & v_count;
+                break;
+            case MASK_ERODE:
+                dst[xx] = cur[xx] == 0 ? 0 : count >= 2;
+                break;
+            case MASK_DILATE:
+                dst[xx] = cur[xx] ? 1 : count >= 4;
+                break;
+        }
+    }
+}
+
+static int mask_line_kernel( const CombDetectFunctions *kernels, int op,
+                             uint8_t *dst, const uint8_t *curp,
+                             const uint8_t *cur, const uint8_t *curn, int width )
+{
+    switch (op)
+    {
+        case MASK_CLASSIC:
+        case MASK_FILTER:
+            return kernels->mask_filter_line(dst, curp, cur, curn, width,
+                                             op == MASK_CLASSIC);
+        case MASK_ERODE:
+            return kernels->mask_erode_line(dst, curp, cur, curn, width);
+        default:
+            return kernels->mask_dilate_line(dst, curp, cur, curn, width);
+    }
+}
+
+static void check_masks( const level_t *level, const CombDetectFunctions *kernels,
+                         int width )
+{
+    hb_buffer_t *src      = plane_init(width, HEIGHT, 1);
+    hb_buffer_t *expected = plane_init(width, HEIGHT, 1);
+    hb_buffer_t *result   = plane_init(width, HEIGHT, 1);
+    const int    stride   = src->plane[0].stride;
+    const int    size     = src->plane[0].size;
+
+    fill_mask(src);
+    for (int op = 0; op < MASK_COUNT; op++)
+    {
+        memset(expected->plane[0].data, 0, size);
+        memset(result->plane[0].data, 0, size);
+
+        // Pointers start at x = 1, as in comb_detect.c
+        for (int y = 1; y < HEIGHT - 1; y++)
+        {
+            const uint8_t *cur  = src->plane[0].data + y * stride + 1;
+            uint8_t       *dst  = result->plane[0].data + y * stride + 1;
+            int            xx;
+
+            mask_line_c(op, expected->plane[0].data + y * stride + 1,
+                        cur - stride, cur, cur + stride, 1, width);
+            xx = mask_line_kernel(kernels, op, dst, cur - stride, cur,
+                                  cur + stride, width);
+            mask_line_c(op, dst, cur - stride, cur, cur + stride, xx, width);
+        }
+        if (memcmp(expected->plane[0].data, result->plane[0].data, size))
+        {
+            fprintf(stderr, "%s: mask %s, width %d: masks differ\n",
+                    level->name, mask_names[op], width);
+            failures++;
+        }
+    }
+
+    // Blocks at every position of a line, the adjacent score only for
+    // blocks that don't start at x = 0, like comb_detect.c
+    for (int x = 0; x < width; x++)
+    {
+        for (int block_width = 1; x + block_width < width && block_width <= 40;
+             block_width += block_width < 16 ? 1 : 7)
+        {
+            const uint8_t *mask = src->plane[0].data + 2 * stride + x;
+            const int      block_height = 1 + x % 16;
+            int            score = 0, adjacent = 0;
+
+            for (int by = 0; by < block_height; by++)
+            {
+                for (int bx = 0; bx < block_width; bx++)
+                {
+                    const uint8_t *p = mask + by * stride + bx;
+
+                    score += p[0];
+                    if (x + bx == width - 1)
+                    {
+                        adjacent += p[-1] & p[0];
+                    }
+                    else if (x + bx > 0)
+                    {
+                        adjacent += p[-1] & p[0] & p[1];
+                    }
+                }
+            }
+            if (kernels->block_score(mask, stride, block_width,
+                                     block_height) != score ||
+                (x > 0 && kernels->block_score_adjacent(mask, stride,
+                                                        block_width,
+                                                        block_height) != adjacent))
+            {
+                fprintf(stderr, "%s: block score at %d, %dx%d, width %d:"
+                        " scores differ\n", level->name, x, block_width,
+                        block_height, width);
+                failures++;
+                x = width;
+                break;
+            }
+        }
+    }
+
+    plane_close(&src);
+    plane_close(&expected);
+    plane_close(&result);
+}
+
+static void run_level( const level_t *level )
+{
+    CombDetectFunctions kernels = {0};
+
+    av_force_cpu_flags(level->flags);
+    comb_detect_init_x86(&kernels);
+    av_force_cpu_flags(-1);
+
+    for (int ii = 0; ii < (int)(sizeof(widths) / sizeof(widths[0])); ii++)
+    {
+        check_detect(level, &kernels, 8, widths[ii]);
+        check_detect(level, &kernels, 10, widths[ii]);
+        check_detect(level, &kernels, 16, widths[ii]);
+        check_masks(level, &kernels, widths[ii]);
+    }
+}
+
+int main( int argc, char **argv )
+{
+    const int detected = av_get_cpu_flags();
+    level_t   levels[2];
+    int       count = 0;
+
+    if (argc > 1)
+    {
+        rnd_state = strtoul(argv[1], NULL, 0) | 1;
+    }
+    // Only the detection of the template is checked
+    (void)apply_mask_8;
+    (void)apply_mask_16;
+
+    if (detected & AV_CPU_FLAG_SSE4)
+    {
+        levels[count++] = (level_t){ "sse4.1",
+                                     detected & (AV_CPU_FLAG_MMX | AV_CPU_FLAG_MMXEXT |
+                                                 AV_CPU_FLAG_SSE | AV_CPU_FLAG_SSE2 |
+                                                 AV_CPU_FLAG_SSE3 | AV_CPU_FLAG_SSSE3 |
+                                                 AV_CPU_FLAG_SSE4) };
+    }
+    if (detected & AV_CPU_FLAG_AVX2)
+    {
+        levels[count++] = (level_t){ "avx2", -1 };
+    }
+
+    for (int ii = 0; ii < count; ii++)
+    {
+        run_level(&levels[ii]);
+    }
+
+    printf("comb_detect: %d level(s), %s\n", count,
+           failures ? "FAILED" : "passed");
+    return failures != 0;
+}
+
+#else // ARCH_X86
+
+int main( void )
+{
+    printf("comb_detect: no x86 kernels on this system, skipped\n");
+    return 0;
+}
+
+#endif // ARCH_X86
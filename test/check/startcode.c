@@ -0,0 +1,341 @@
+/* startcode.c
+
+   Copyright (c) 2003-2024 HandBrake Team
+   This file is part of the HandBrake source code
+   Homepage: <http://handbrake.fr/>.
+   It may be used under the terms of the GNU General Public License v2.
+   For full terms see the file COPYING file or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*
+ * Checks hb_find_start_code_prefix() and hb_find_ts_sync() against
+ * plain byte loops, for each version of the scanners the cpu supports,
+ * and reports their throughput.
+ *
+ * Usage: startcode [seed]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "handbrake/handbrake.h"
+#include "handbrake/startcode.h"
+#include "libavutil/cpu.h"
+
+#define BUF_SIZE    (16 * 1024)
+#define BENCH_SIZE  (4 * 1024 * 1024)
+#define BENCH_LOOPS 64
+
+typedef struct
+{
+    const char * name;
+    int          flags;     // forced cpu flags, -1 for the detected ones
+} level_t;
+
+static uint32_t rnd_state = 0x2545f491;
+static int      failures;
+
+static uint32_t rnd( void )
+{
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 17;
+    rnd_state ^= rnd_state << 5;
+    return rnd_state;
+}
+
+/***********************************************************************
+ * References
+ **********************************************************************/
+static const uint8_t * ref_find_prefix( const uint8_t *p, const uint8_t *end,
+                                        uint8_t mask, uint8_t value )
+{
+    for (; p + 3 < end; p++)
+    {
+        if (p[0] == 0 && p[1] == 0 && (p[2] & mask) == value)
+        {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static int ref_find_ts_sync( const uint8_t *buf, int len, int psize, int count )
+{
+    for (int offset = 0; offset < len; offset++)
+    {
+        int ii;
+        for (ii = 0; ii < count; ii++)
+        {
+            const uint8_t *p = buf + offset + ii * psize;
+            if (p[0] != 0x47 || (p[3] & 0x30) == 0)
+            {
+                break;
+            }
+        }
+        if (ii == count)
+        {
+            return offset;
+        }
+    }
+    return -1;
+}
+
+/***********************************************************************
+ * Buffers
+ **********************************************************************/
+// Random bytes, 'zeros' in 256 of them are 0
+static void fill_random( uint8_t *buf, int size, int zeros )
+{
+    for (int ii = 0; ii < size; ii++)
+    {
+        buf[ii] = (int)(rnd() & 0xff) < zeros ? 0 : rnd() | 1;
+    }
+}
+
+// Start codes every few bytes, some of them cut short
+static void fill_start_codes( uint8_t *buf, int size )
+{
+    int ii = 0;
+    while (ii < size)
+    {
+        int gap = rnd() % 8;
+        for (; gap > 0 && ii < size; gap--)
+        {
+            buf[ii++] = rnd();
+        }
+        if (ii < size) buf[ii++] = 0;
+        if (ii < size) buf[ii++] = rnd() % 4 ? 0 : 1;
+        if (ii < size) buf[ii++] = rnd() % 2 ? 1 : rnd();
+    }
+}
+
+// TS packets of 'psize' bytes with damaged sync bytes and adaptation
+// field controls, and 0x47 bytes in the payload
+static void fill_ts( uint8_t *buf, int size, int psize )
+{
+    int start = rnd() % psize;
+
+    for (int ii = 0; ii < size; ii++)
+    {
+        int pos = (ii + psize - start) % psize;
+
+        if (pos == 0)
+        {
+            buf[ii] = rnd() % 16 ? 0x47 : rnd();
+        }
+        else if (pos == 3)
+        {
+            buf[ii] = rnd() % 16 ? 0x10 | (rnd() & 0xef) : rnd() & 0xcf;
+        }
+        else
+        {
+            buf[ii] = rnd() % 8 ? rnd() : 0x47;
+        }
+    }
+}
+
+/***********************************************************************
+ * Checks
+ **********************************************************************/
+static void check_prefix( const char *level, const uint8_t *buf, int size )
+{
+    static const uint8_t masks[][2] = { {0xff, 0x01}, {0xfe, 0x00},
+                                        {0x00, 0x00}, {0xe0, 0xe0} };
+
+    for (int mm = 0; mm < 4; mm++)
+    {
+        const uint8_t mask  = masks[mm][0];
+        const uint8_t value = masks[mm][1];
+
+        // Every start position near the beginning of the buffer, and
+        // every length up to the end of the buffer
+        for (int ii = 0; ii < 400; ii++)
+        {
+            const uint8_t *start = buf + (ii < 64 ? ii : (int)(rnd() % size));
+            const uint8_t *end   = buf + size - (ii < 128 ? ii % 64 : 0);
+
+            if (start > end)
+            {
+                start = end;
+            }
+            if (ii >= 128 && ii < 256)
+            {
+                // Short ranges ending at the end of the buffer
+                start = end - (ii - 128) % 70;
+            }
+            for (const uint8_t *p = start; p < end; )
+            {
+                const uint8_t *expected = ref_find_prefix(p, end, mask, value);
+                const uint8_t *result   = hb_find_start_code_prefix(p, end,
+                                                                    mask, value);
+                if (result != expected)
+                {
+                    fprintf(stderr, "%s: start code %02x/%02x from %td to %td:"
+                            " found %td, expected %td\n", level, mask, value,
+                            p - buf, end - buf,
+                            result   ? result   - buf : (ptrdiff_t)-1,
+                            expected ? expected - buf : (ptrdiff_t)-1);
+                    failures++;
+                    return;
+                }
+                if (expected == NULL)
+                {
+                    break;
+                }
+                p = expected + 1;
+            }
+        }
+    }
+}
+
+static void check_ts_sync( const char *level, const uint8_t *buf, int size,
+                           int psize )
+{
+    for (int count = 1; count <= 8; count++)
+    {
+        const int room = size - (count - 1) * psize - 3;
+
+        for (int ii = 0; ii < 200; ii++)
+        {
+            int offset = ii < 64 ? ii : (int)(rnd() % room);
+            int len    = ii < 128 ? room - offset - ii % 70 :
+                                    (int)(rnd() % (room - offset + 1));
+
+            if (len < 0)
+            {
+                len = 0;
+            }
+            int expected = ref_find_ts_sync(buf + offset, len, psize, count);
+            int result   = hb_find_ts_sync(buf + offset, len, psize, count);
+            if (result != expected)
+            {
+                fprintf(stderr, "%s: ts sync, packet %d, count %d, offset %d,"
+                        " length %d: found %d, expected %d\n", level, psize,
+                        count, offset, len, result, expected);
+                failures++;
+                return;
+            }
+        }
+    }
+}
+
+/***********************************************************************
+ * Throughput
+ **********************************************************************/
+static void bench( const char *level, uint8_t *buf )
+{
+    uint64_t start;
+    double   prefix_us, sync_us;
+    int      found = 0;
+
+    // No 00 00 01 and no 0x47, the scanners go through the whole buffer
+    for (int ii = 0; ii < BENCH_SIZE; ii++)
+    {
+        buf[ii] = rnd() | 0x80;
+    }
+
+    start = hb_get_time_us();
+    for (int ii = 0; ii < BENCH_LOOPS; ii++)
+    {
+        found += hb_find_start_code(buf, buf + BENCH_SIZE) != NULL;
+    }
+    prefix_us = hb_get_time_us() - start;
+
+    start = hb_get_time_us();
+    for (int ii = 0; ii < BENCH_LOOPS; ii++)
+    {
+        found += hb_find_ts_sync(buf, BENCH_SIZE - 4 * 188 - 3, 188, 5) >= 0;
+    }
+    sync_us = hb_get_time_us() - start;
+
+    if (found)
+    {
+        fprintf(stderr, "%s: throughput buffer has matches\n", level);
+        failures++;
+    }
+    printf("%-8s start code %7.2f GB/s, ts sync %7.2f GB/s\n", level,
+           (double)BENCH_SIZE * BENCH_LOOPS / (prefix_us * 1000.),
+           (double)BENCH_SIZE * BENCH_LOOPS / (sync_us * 1000.));
+}
+
+static void run_level( const level_t *level, uint8_t *buf, uint8_t *bench_buf )
+{
+    static const int psizes[] = { 188, 192, 204, 208 };
+
+    av_force_cpu_flags(level->flags);
+    hb_startcode_init();
+
+    for (int ii = 0; ii < 8; ii++)
+    {
+        fill_random(buf, BUF_SIZE, ii * 32);
+        check_prefix(level->name, buf, BUF_SIZE);
+        fill_start_codes(buf, BUF_SIZE);
+        check_prefix(level->name, buf, BUF_SIZE);
+    }
+    for (int ii = 0; ii < 4; ii++)
+    {
+        fill_ts(buf, BUF_SIZE, psizes[ii]);
+        check_ts_sync(level->name, buf, BUF_SIZE, psizes[ii]);
+        for (int jj = 0; jj < BUF_SIZE; jj++)
+        {
+            // Dense 0x47 bytes and adaptation field controls
+            buf[jj] = rnd() % 3 ? 0x47 : rnd();
+        }
+        check_ts_sync(level->name, buf, BUF_SIZE, psizes[ii]);
+    }
+    bench(level->name, bench_buf);
+}
+
+int main( int argc, char **argv )
+{
+    const int detected = av_get_cpu_flags();
+    level_t   levels[3];
+    int       count = 0;
+    uint8_t * buf, * bench_buf;
+
+    if (argc > 1)
+    {
+        rnd_state = strtoul(argv[1], NULL, 0) | 1;
+    }
+
+    levels[count++] = (level_t){ "scalar", 0 };
+#if defined(ARCH_X86)
+    if (detected & AV_CPU_FLAG_SSE2)
+    {
+        levels[count++] = (level_t){ "sse2", AV_CPU_FLAG_MMX | AV_CPU_FLAG_MMXEXT |
+                                             AV_CPU_FLAG_SSE | AV_CPU_FLAG_SSE2 };
+    }
+    if (detected & AV_CPU_FLAG_AVX2)
+    {
+        levels[count++] = (level_t){ "avx2", -1 };
+    }
+#elif defined(__aarch64__)
+    levels[count++] = (level_t){ "neon", -1 };
+#endif
+
+    // The buffers end at the end of their allocation so that reads
+    // past the end show up with sanitizers and valgrind
+    buf       = malloc(BUF_SIZE);
+    bench_buf = malloc(BENCH_SIZE);
+    if (buf == NULL || bench_buf == NULL)
+    {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    for (int ii = 0; ii < count; ii++)
+    {
+        run_level(&levels[ii], buf, bench_buf);
+    }
+    av_force_cpu_flags(-1);
+    hb_startcode_init();
+
+    free(buf);
+    free(bench_buf);
+
+    printf("startcode: %d level(s), %s\n", count,
+           failures ? "FAILED" : "passed");
+    return failures != 0;
+}
@@ -64,6 +64,20 @@
 static int     debug               = HB_DEBUG_ALL;
 static int     json                = 0;
 static int     inline_parameter_sets = -1;
+static int     filter_fusion       = -1;
+static int     fifo_memory_budget  = -1;
+static int     pipeline_telemetry  = -1;
+static int     max_concurrent_jobs = 1;
+static int     cpu_placement       = -1;
+static int     frame_pool_size     = -1;
+static int     huge_pages          = -1;
+static int     read_ahead_size     = -1;
+static int     stream_index        = 0;
+static int     scan_threads        = 0;
+static int     scan_cache          = 0;
+static int     fast_scan           = 0;
+static int     scan_preview_threads = 0;
+static int     preview_memory      = -1;
 static int     align_av_start      = -1;
 static int     dvdnav              = 1;
 static char *  input               = NULL;
@@ -430,7 +444,7 @@ void EventLoop(hb_handle_t *h, hb_dict_t *preset_dict)
     job_running = 0;
 }
 
-int RunQueueJob(hb_handle_t *h, hb_dict_t *job_dict)
+static int AddQueueJob(hb_handle_t *h, hb_dict_t *job_dict)
 {
     if (job_dict == NULL)
     {
@@ -448,6 +462,16 @@ int RunQueueJob(hb_handle_t *h, hb_dict_t *job_dict)
 
     hb_add_json(h, json_job);
     free(json_job);
+
+    return 0;
+}
+
+int RunQueueJob(hb_handle_t *h, hb_dict_t *job_dict)
+{
+    if (AddQueueJob(h, job_dict) < 0)
+    {
+        return -1;
+    }
     job_running = 1;
     hb_start( h );
 
@@ -469,6 +493,26 @@ int RunQueue(hb_handle_t *h, const char *queue_import_name)
         int ii, count, result = 0;
 
         count = hb_value_array_len(queue);
+        if (max_concurrent_jobs > 1)
+        {
+            // Queue every job, libhb runs them concurrently
+            hb_set_max_concurrent_jobs(h, max_concurrent_jobs);
+            for (ii = 0; ii < count; ii++)
+            {
+                hb_dict_t * entry = hb_value_array_get(queue, ii);
+                if (AddQueueJob(h, hb_dict_get(entry, "Job")) < 0)
+                {
+                    result = -1;
+                }
+            }
+            if (hb_count(h) > 0)
+            {
+                job_running = 1;
+                hb_start( h );
+                EventLoop(h, NULL);
+            }
+            return result;
+        }
         for (ii = 0; ii < count; ii++)
         {
             hb_dict_t * entry = hb_value_array_get(queue, ii);
@@ -522,6 +566,15 @@ int main( int argc, char ** argv )
     hb_register_error_handler(&hb_cli_error_handler);
 
     hb_dvd_set_dvdnav( dvdnav );
+    hb_stream_index_enable( stream_index );
+    hb_scan_set_file_threads( scan_threads );
+    hb_scan_cache_enable( scan_cache );
+    hb_scan_set_fast( fast_scan );
+    hb_scan_set_preview_threads( scan_preview_threads );
+    if (preview_memory >= 0)
+    {
+        hb_preview_store_set_budget( (int64_t)preview_memory * 1024 * 1024 );
+    }
 
     /* Show version */
     fprintf( stderr, "%s - %s - %s\n",
@@ -700,6 +753,11 @@ static void PrintTitleInfo( hb_title_t * title, int feature )
              (float)title->vrate.num / title->vrate.den );
     fprintf( stderr, "  + autocrop: %d/%d/%d/%d\n", title->crop[0],
              title->crop[1], title->crop[2], title->crop[3] );
+    if (title->flags & HBTF_FAST_SCAN)
+    {
+        fprintf( stderr, "  + fast scan: %s confidence\n",
+                 title->flags & HBTF_LOW_CONFIDENCE ? "low" : "normal" );
+    }
 
     fprintf( stderr, "  + chapters:\n" );
     for( i = 0; i < hb_list_count( title->list_chapter ); i++ )
@@ -853,12 +911,12 @@ static void lang_list_remove(hb_value_array_t *list, const char *lang)
     }
 }
 
-static void show_progress_json(hb_state_t * state)
+static void show_progress_json(hb_handle_t * h, hb_state_t * state)
 {
     hb_dict_t * state_dict;
     char      * state_json;
 
-    state_dict = hb_state_to_dict(state);
+    state_dict = hb_handle_state_to_dict(h, state);
     state_json = hb_value_get_json(state_dict);
     hb_value_free(&state_dict);
     fprintf(stdout, "Progress: %s\n", state_json);
@@ -882,7 +940,7 @@ static int HandleEvents(hb_handle_t * h, hb_dict_t *preset_dict)
             /* Show what title is currently being scanned */
             if (json)
             {
-                show_progress_json(&s);
+                show_progress_json(h, &s);
                 break;
             }
             if (p.preview_cur)
@@ -1008,7 +1066,7 @@ static int HandleEvents(hb_handle_t * h, hb_dict_t *preset_dict)
         case HB_STATE_SEARCHING:
             if (json)
             {
-                show_progress_json(&s);
+                show_progress_json(h, &s);
                 break;
             }
             fprintf( stdout, "%sEncoding: task %d of %d, Searching for start time, %.2f %%",
@@ -1024,7 +1082,7 @@ static int HandleEvents(hb_handle_t * h, hb_dict_t *preset_dict)
         case HB_STATE_WORKING:
             if (json)
             {
-                show_progress_json(&s);
+                show_progress_json(h, &s);
                 break;
             }
             fprintf( stdout, "%sEncoding: task %d of %d, %.2f %%",
@@ -1044,7 +1102,7 @@ static int HandleEvents(hb_handle_t * h, hb_dict_t *preset_dict)
         {
             if (json)
             {
-                show_progress_json(&s);
+                show_progress_json(h, &s);
                 break;
             }
             if (show_mux_warning)
@@ -1062,7 +1120,7 @@ static int HandleEvents(hb_handle_t * h, hb_dict_t *preset_dict)
             /* Print error if any, then exit */
             if (json)
             {
-                show_progress_json(&s);
+                show_progress_json(h, &s);
             }
             switch( p.error )
             {
@@ -1347,6 +1405,57 @@ static void ShowHelp(void)
 "                           '--preset-export'\n"
 "   --queue-import-file <filename>\n"
 "                           Import an encode queue file created by the GUI\n"
+"   --fifo-memory-budget <number>\n"
+"                           Limit the memory used by frames queued between\n"
+"                           pipeline stages to <number> MiB. Queue depths\n"
+"                           then adapt to the job within that budget.\n"
+"                           0 keeps the fixed default depths.\n"
+"   --pipeline-telemetry    Collect per stage frame counts, busy and wait\n"
+"                           times. They are reported in the JSON progress\n"
+"                           and summarized in the log at the end of a job.\n"
+"   --max-concurrent-jobs <number>\n"
+"                           Encode up to <number> jobs of the queue imported\n"
+"                           with '--queue-import-file' at the same time.\n"
+"                           The logical processors are split between the\n"
+"                           running jobs. (default: 1)\n"
+"   --cpu-placement         Bind the threads of each job to the processors\n"
+"                           of one L3 cache or NUMA node (Linux only), and\n"
+"                           allocate its frames from that node's memory.\n"
+"   --frame-pool <number>   Keep up to <number> MiB of idle video frames for\n"
+"                           reuse by the following frames and passes of a\n"
+"                           job. 0 disables the frame pool. (default: 256)\n"
+"   --huge-pages            Back large video frames with reserved huge pages\n"
+"                           (Linux only, see vm.nr_hugepages), transparent\n"
+"                           huge pages are used otherwise.\n"
+"   --read-ahead <number>   Read up to <number> MiB of the source ahead of the\n"
+"                           demuxer on a separate I/O thread. Hides storage\n"
+"                           latency, e.g. of network file systems.\n"
+"                           0 reads on the reader thread. (default: 32)\n"
+"   --stream-index          Index the video keyframes of transport and program\n"
+"                           stream sources while scanning, and keep the index\n"
+"                           in the user cache directory. Gives exact durations\n"
+"                           and seeks, and is reused by later runs on the same\n"
+"                           unmodified file.\n"
+"   --scan-threads <number> Scan up to <number> files of a folder or list of\n"
+"                           input files at the same time.\n"
+"                           (default: auto, up to 8)\n"
+"   --scan-cache            Keep the scan results of input files in the user\n"
+"                           cache directory, and reuse them when the same\n"
+"                           unmodified file is scanned again with the same\n"
+"                           settings.\n"
+"   --fast-scan             Decode only the keyframes of input files for the\n"
+"                           previews. Much faster on long GOP and high\n"
+"                           resolution sources, but the frame rate and\n"
+"                           interlacing may be less accurate (reported as\n"
+"                           low confidence in the scan results).\n"
+"   --scan-preview-threads <number>\n"
+"                           Decode the previews of an input file on up to\n"
+"                           <number> threads.\n"
+"                           (default: auto, up to 8)\n"
+"   --preview-memory <MB>   Keep up to <MB> megabytes of scan previews in\n"
+"                           memory, the others are written to the temporary\n"
+"                           directory. 0 keeps them all on disk.\n"
+"                           (default: 256)\n"
 "       --no-dvdnav         Do not use dvdnav for reading DVDs\n"
 "\n"
 "\n"
@@ -1854,6 +1963,10 @@ static void ShowHelp(void)
     fprintf( out,
 "   -g, --grayscale         Grayscale encoding\n"
 "   --no-grayscale          Disable preset 'grayscale'\n"
+"   --filter-fusion         Run adjacent sharpen and chroma smooth filters\n"
+"                           together over stripes of each frame. Uses less\n"
+"                           memory bandwidth, the output is unchanged.\n"
+"   --no-filter-fusion      Run each filter over whole frames (default)\n"
 "\n"
 "\n"
 "Subtitles Options ------------------------------------------------------------\n"
@@ -2233,6 +2346,13 @@ static int ParseOptions( int argc, char ** argv )
     #define CROP_MODE                     330
     #define HW_DECODE                     331
     #define KEEP_DUPLICATE_TITLES         332
+    #define FIFO_MEMORY_BUDGET            333
+    #define MAX_CONCURRENT_JOBS           334
+    #define FRAME_POOL                    335
+    #define READ_AHEAD                    336
+    #define SCAN_THREADS                  337
+    #define SCAN_PREVIEW_THREADS          338
+    #define PREVIEW_MEMORY                339
     
     for( ;; )
     {
@@ -2254,6 +2374,19 @@ static int ParseOptions( int argc, char ** argv )
             { "disable-hw-decoding", no_argument,        &hw_decode,  0, },
             { "enable-hw-decoding",  required_argument,  NULL,  HW_DECODE, },
             { "keep-duplicate-titles", no_argument,      NULL, KEEP_DUPLICATE_TITLES },
+            { "fifo-memory-budget", required_argument,   NULL, FIFO_MEMORY_BUDGET },
+            { "pipeline-telemetry", no_argument,   &pipeline_telemetry, 1 },
+            { "max-concurrent-jobs", required_argument, NULL, MAX_CONCURRENT_JOBS },
+            { "cpu-placement", no_argument,   &cpu_placement, 1 },
+            { "frame-pool",  required_argument, NULL,    FRAME_POOL },
+            { "huge-pages",  no_argument,       &huge_pages, 1 },
+            { "read-ahead",  required_argument, NULL,    READ_AHEAD },
+            { "stream-index", no_argument,      &stream_index, 1 },
+            { "scan-threads", required_argument, NULL,   SCAN_THREADS },
+            { "scan-cache",   no_argument,      &scan_cache, 1 },
+            { "fast-scan",    no_argument,      &fast_scan, 1 },
+            { "scan-preview-threads", required_argument, NULL, SCAN_PREVIEW_THREADS },
+            { "preview-memory", required_argument, NULL, PREVIEW_MEMORY },
 
             { "format",      required_argument, NULL,    'f' },
             { "input",       required_argument, NULL,    'i' },
@@ -2338,6 +2471,8 @@ static int ParseOptions( int argc, char ** argv )
             { "no-decomb",   no_argument,       &decomb_disable,      1 },
             { "grayscale",   no_argument,       NULL,        'g' },
             { "no-grayscale",no_argument,       &grayscale,    0 },
+            { "filter-fusion",    no_argument,  &filter_fusion, 1 },
+            { "no-filter-fusion", no_argument,  &filter_fusion, 0 },
             { "rotate",      optional_argument, NULL,   ROTATE_FILTER },
             { "non-anamorphic",  no_argument, &anamorphic_mode, HB_ANAMORPHIC_NONE },
             { "auto-anamorphic",  no_argument, &anamorphic_mode, HB_ANAMORPHIC_AUTO },
@@ -3231,6 +3366,69 @@ static int ParseOptions( int argc, char ** argv )
             case KEEP_DUPLICATE_TITLES:
                 keep_duplicate_titles = 1;
                 break;
+            case FIFO_MEMORY_BUDGET:
+                fifo_memory_budget = strtol(optarg, NULL, 0);
+                if (fifo_memory_budget < 0)
+                {
+                    fprintf(stderr, "invalid fifo memory budget (%s)\n",
+                            optarg);
+                    return -1;
+                }
+                break;
+            case MAX_CONCURRENT_JOBS:
+                max_concurrent_jobs = strtol(optarg, NULL, 0);
+                if (max_concurrent_jobs < 1)
+                {
+                    fprintf(stderr, "invalid max concurrent jobs (%s)\n",
+                            optarg);
+                    return -1;
+                }
+                break;
+            case FRAME_POOL:
+                frame_pool_size = strtol(optarg, NULL, 0);
+                if (frame_pool_size < 0)
+                {
+                    fprintf(stderr, "invalid frame pool size (%s)\n",
+                            optarg);
+                    return -1;
+                }
+                break;
+            case READ_AHEAD:
+                read_ahead_size = strtol(optarg, NULL, 0);
+                if (read_ahead_size < 0)
+                {
+                    fprintf(stderr, "invalid read ahead size (%s)\n",
+                            optarg);
+                    return -1;
+                }
+                break;
+            case SCAN_THREADS:
+                scan_threads = strtol(optarg, NULL, 0);
+                if (scan_threads < 1)
+                {
+                    fprintf(stderr, "invalid scan thread count (%s)\n",
+                            optarg);
+                    return -1;
+                }
+                break;
+            case SCAN_PREVIEW_THREADS:
+                scan_preview_threads = strtol(optarg, NULL, 0);
+                if (scan_preview_threads < 1)
+                {
+                    fprintf(stderr, "invalid scan preview thread count (%s)\n",
+                            optarg);
+                    return -1;
+                }
+                break;
+            case PREVIEW_MEMORY:
+                preview_memory = strtol(optarg, NULL, 0);
+                if (preview_memory < 0)
+                {
+                    fprintf(stderr, "invalid preview memory size (%s)\n",
+                            optarg);
+                    return -1;
+                }
+                break;
             case ':':
                 fprintf( stderr, "missing parameter (%s)\n", argv[cur_optind] );
                 return -1;
@@ -4953,6 +5151,47 @@ PrepareJob(hb_handle_t *h, hb_title_t *title, hb_dict_t *preset_dict)
 
     hb_dict_t *source_dict = hb_dict_get(job_dict, "Source");
 
+    if (filter_fusion != -1)
+    {
+        hb_dict_t *filters_dict = hb_dict_get(job_dict, "Filters");
+        hb_dict_set(filters_dict, "Fusion", hb_value_bool(filter_fusion));
+    }
+
+    hb_dict_t *pipeline_dict = hb_dict_get(job_dict, "Pipeline");
+    if (fifo_memory_budget != -1)
+    {
+        hb_dict_set(pipeline_dict, "FifoMemoryBudget",
+                    hb_value_int((int64_t)fifo_memory_budget * 1024 * 1024));
+    }
+    if (pipeline_telemetry != -1)
+    {
+        hb_dict_set(pipeline_dict, "Telemetry",
+                    hb_value_bool(pipeline_telemetry));
+    }
+    if (cpu_placement != -1)
+    {
+        hb_dict_set(pipeline_dict, "CpuPlacement",
+                    hb_value_bool(cpu_placement));
+    }
+    if (frame_pool_size != -1)
+    {
+        // 0 disables the pool, which the job expresses as -1
+        hb_dict_set(pipeline_dict, "FramePoolLimit",
+                    hb_value_int(frame_pool_size > 0 ?
+                                 (int64_t)frame_pool_size * 1024 * 1024 : -1));
+    }
+    if (huge_pages != -1)
+    {
+        hb_dict_set(pipeline_dict, "HugePages", hb_value_bool(huge_pages));
+    }
+    if (read_ahead_size != -1)
+    {
+        // 0 reads synchronously, which the job expresses as -1
+        hb_dict_set(pipeline_dict, "ReadAhead",
+                    hb_value_int(read_ahead_size > 0 ?
+                                 (int64_t)read_ahead_size * 1024 * 1024 : -1));
+    }
+
     if (angle)
     {
         hb_dict_set(source_dict, "Angle", hb_value_int(angle));
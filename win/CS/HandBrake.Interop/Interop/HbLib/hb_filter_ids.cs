@@ -52,6 +52,8 @@ namespace HandBrake.Interop.Interop.HbLib
 
         HB_FILTER_LAST,
         // wrapper filter for frame based multi-threading of simple filters
-        HB_FILTER_MT_FRAME
+        HB_FILTER_MT_FRAME,
+        // wrapper filter for stripe based processing of adjacent filters
+        HB_FILTER_FUSED
     }
 }